@@ -18,6 +18,10 @@ struct Configure
     QString remoteAddress;
     quint16 localPort;
     quint16 remotePort;
+    int dataShards;
+    int parityShards;
+    int paths;
+    bool compression;
 };
 
 
@@ -59,15 +63,18 @@ bool KcptunClient::start()
 void KcptunClient::handleRequest(QSharedPointer<Socket> request)
 {
     QSharedPointer<KcpSocket> forward(new KcpSocket);
+    forward->setFecShards(configure.dataShards, configure.parityShards);  // used if the server agrees.
+    forward->setCompressionEnabled(configure.compression);
+    forward->setMultiPathCount(configure.paths);
     if (!forward->connect(configure.remoteAddress, configure.remotePort)) {
         QString errorMessage = QCoreApplication::translate("main", "can not connect to remote host %1:%2");
         printf("%s", qPrintable(errorMessage.arg(configure.remoteAddress).arg(configure.remotePort)));
         request->close();
         return;
     }
-    QSharedPointer<Cipher> cipher(new Cipher(Cipher::AES256, Cipher::CFB, Cipher::Encrypt));
-    cipher->setPassword(configure.password.toUtf8(), "3.1415926535");
-    QSharedPointer<SocketLike> encryptedForward = encrypted(cipher, SocketLike::kcpSocket(forward));
+    Cipher cipher(Cipher::AES256, Cipher::CFB, Cipher::Encrypt);
+    cipher.setPassword(configure.password.toUtf8(), "3.1415926535");  // derive the key by PBKDF2.
+    QSharedPointer<SocketLike> encryptedForward = encrypted(Cipher::AES256, cipher.key(), SocketLike::kcpSocket(forward));
     Exchanger exchanger(asStream(request), encryptedForward);
     exchanger.exchange();
 }
@@ -100,7 +107,21 @@ ParserResult parseArguments(Configure *configure, QString *errorMessage)
                                         QCoreApplication::translate("main", "remote port which runs the kcptun server. default to `8000`."),
                                         "target_port");
     parser.addOption(remotePortOption);
-
+    QCommandLineOption dataShardOption(QStringList() << "datashard",
+                                       QCoreApplication::translate("main", "reed-solomon erasure coding, the number of data shards. default to `10`."),
+                                       "data_shards");
+    parser.addOption(dataShardOption);
+    QCommandLineOption parityShardOption(QStringList() << "parityshard",
+                                         QCoreApplication::translate("main", "reed-solomon erasure coding, the number of parity shards. `0` disables it. default to `0`."),
+                                         "parity_shards");
+    parser.addOption(parityShardOption);
+    QCommandLineOption noCompressionOption(QStringList() << "nocomp",
+                                           QCoreApplication::translate("main", "disable compression."));
+    parser.addOption(noCompressionOption);
+    QCommandLineOption pathsOption(QStringList() << "paths",
+                                   QCoreApplication::translate("main", "the number of udp sockets to the server, from `1` to `8`. default to `1`."),
+                                   "paths");
+    parser.addOption(pathsOption);
 
     if (!parser.parse(QCoreApplication::arguments())) {
         *errorMessage = parser.errorText();
@@ -164,6 +185,23 @@ ParserResult parseArguments(Configure *configure, QString *errorMessage)
         }
     }
 
+    configure->dataShards = parser.isSet(dataShardOption) ? parser.value(dataShardOption).toInt() : 10;
+    configure->parityShards = parser.isSet(parityShardOption) ? parser.value(parityShardOption).toInt() : 0;
+    if (configure->parityShards == 0) {
+        configure->dataShards = 0;
+    } else if (configure->dataShards <= 0 || configure->parityShards < 0
+               || configure->dataShards + configure->parityShards > 256) {
+        *errorMessage = QCoreApplication::translate("main", "the data shards and parity shards are invalid.");
+        return Failed;
+    }
+
+    configure->compression = !parser.isSet(noCompressionOption);
+    configure->paths = parser.isSet(pathsOption) ? parser.value(pathsOption).toInt() : 1;
+    if (configure->paths < 1 || configure->paths > 8) {
+        *errorMessage = QCoreApplication::translate("main", "the number of paths should be between 1 and 8.");
+        return Failed;
+    }
+
     return Success;
 }
 
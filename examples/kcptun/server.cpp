@@ -66,9 +66,9 @@ void KcptunServer::handleRequest(QSharedPointer<KcpSocket> request)
         return;
     }
 
-    QSharedPointer<Cipher> cipher(new Cipher(Cipher::AES256, Cipher::CFB, Cipher::Encrypt));
-    cipher->setPassword(configure.password.toUtf8(), "3.1415926535");
-    QSharedPointer<SocketLike> encryptedRequest = encrypted(cipher, SocketLike::kcpSocket(request));
+    Cipher cipher(Cipher::AES256, Cipher::CFB, Cipher::Encrypt);
+    cipher.setPassword(configure.password.toUtf8(), "3.1415926535");  // derive the key by PBKDF2.
+    QSharedPointer<SocketLike> encryptedRequest = encrypted(Cipher::AES256, cipher.key(), SocketLike::kcpSocket(request));
 
     Exchanger exchanger(encryptedRequest, asStream(forward));
     exchanger.exchange();
@@ -2,6 +2,7 @@
 #define QTNG_CIPHER_H
 
 #include <QtCore/qpair.h>
+#include <QtCore/qlist.h>
 #include "md.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
@@ -67,6 +68,14 @@ public:
     QByteArray addData(const QByteArray &data) { return addData(data.constData(), data.size()); }
     QByteArray addData(const char *data, int len);
     QByteArray finalData();
+    // write to `out` which must have `len + blockSize()` bytes. `out` may overlap `data`, which is copied then.
+    // return the number of bytes written, or -1 on error.
+    int addData(const char *data, int len, char *out);
+    int finalData(char *out);  // `out` must have blockSize() bytes.
+    // start a new message with the same key, which reuses the context. the current iv is used if `iv` is empty.
+    bool reset(const QByteArray &iv = QByteArray());
+    // encrypt or decrypt every message with one context, which starts with the same iv, or `ivs[i]` if given.
+    QList<QByteArray> batch(const QList<QByteArray> &messages, const QList<QByteArray> &ivs = QList<QByteArray>());
 public:
     QByteArray update(const QByteArray &data) { return addData(data.constData(), data.size()); }
     QByteArray update(const char *data, int len) { return addData(data, len); }
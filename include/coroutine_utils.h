@@ -502,6 +502,10 @@ QList<T> ThreadPool::map(std::function<T(S)> func, const QList<S> &l)
 {
     QList<QSharedPointer<Coroutine>> coroutines;
     QSharedPointer<QList<T>> result(new QList<T>());
+    result->reserve(l.size());
+    for (int i = 0; i < l.size(); ++i) {
+        result->append(T());
+    }
     std::function<T(S)> f = makeResult<T, S>(func);
     for (int i = 0; i < l.size(); ++i) {
         S s = l.at(i);
@@ -549,7 +553,14 @@ T ThreadPool::apply(std::function<T(S)> func, S s)
     } else {
         thread = threads.takeFirst();
     }
-    const T &t = thread->apply<T, S>(func, s);
+    T t;
+    try {
+        t = thread->apply<T, S>(func, s);
+    } catch (...) {
+        // the thread is still running the function, keep it so it is not destroyed while running.
+        threads.append(thread);
+        throw;
+    }
     threads.append(thread);
     return t;
 }
@@ -570,7 +581,12 @@ void ThreadPool::apply(std::function<void(S)> func, S s)
     } else {
         thread = threads.takeFirst();
     }
-    thread->apply<S>(func, s);
+    try {
+        thread->apply<S>(func, s);
+    } catch (...) {
+        threads.append(thread);
+        throw;
+    }
     threads.append(thread);
 }
 
@@ -589,7 +605,14 @@ T ThreadPool::call(std::function<T()> func)
     } else {
         thread = threads.takeFirst();
     }
-    const T &t = thread->call<T>(func);
+    T t;
+    try {
+        t = thread->call<T>(func);
+    } catch (...) {
+        // the thread is still running the function, keep it so it is not destroyed while running.
+        threads.append(thread);
+        throw;
+    }
     threads.append(thread);
     return t;
 }
@@ -608,7 +631,12 @@ void ThreadPool::call(std::function<void()> func)
     } else {
         thread = threads.takeFirst();
     }
-    thread->call(func);
+    try {
+        thread->call(func);
+    } catch (...) {
+        threads.append(thread);
+        throw;
+    }
     threads.append(thread);
 }
 
@@ -33,8 +33,12 @@ public:
     quint32 maxPacketSize() const;                      // packet with size > maxPacketSize is an error.
     void setPayloadSizeHint(quint32 payloadSizeHint);   // usually set to tcp/udp mtu.
     quint32 payloadSizeHint() const;                    // should be <= maxPacketSize - headerSize
-    void setCapacity(quint32 packets);                  // channel blocked if there are n packets not read.
+    void setCapacity(quint32 packets);                  // the peer is blocked if there are 3/4 n packets not read.
     quint32 capacity() const;                           // so, a data channel may consume `maxPacketSize * capacity` bytes of receiving buffer memory.
+    void setReceivingWindow(quint32 bytes);             // the peer is blocked if there are so many bytes not read, which
+    quint32 receivingWindow() const;                    // is ignored by the old versions of peer. defaults to 1M.
+    void setPriority(int priority);                     // the share of sending bandwidth among the channels of the same
+    int priority() const;                               // SocketChannel, from 1 to 64. defaults to 1.
     DataChannelPole pole() const;
     void setName(const QString &name);
     QString name() const;
@@ -47,6 +51,13 @@ public:
     QSharedPointer<VirtualChannel> makeChannel();
     QSharedPointer<VirtualChannel> takeChannel();
     QSharedPointer<VirtualChannel> takeChannel(quint32 channelNumber);
+    // sends a message of any size by the fragments of a new virtual channel, which are interleaved with the other
+    // packets and flow-controlled separately. blocks until the whole message is sent. returns false if the peer is
+    // an old version without streams.
+    bool sendStream(QSharedPointer<FileLike> stream);
+    bool sendStream(const QByteArray &data);
+    // returns the next message sent by sendStream(), which can be read while it is being received.
+    QSharedPointer<FileLike> takeStream();
 protected:
     DataChannelPrivate * const d_ptr;
     Q_DECLARE_PRIVATE(DataChannel)
@@ -66,6 +77,10 @@ public:
 public:
     void setKeepaliveTimeout(float timeout);
     float keepaliveTimeout() const;
+    // the packets queued together are sent by one write. if `msecs` > 0, a small batch waits that long for more
+    // packets before it is sent, which trades latency for fewer writes.
+    void setFlushDelay(int msecs);
+    int flushDelay() const;
 private:
     Q_DECLARE_PRIVATE(SocketChannel)
 };
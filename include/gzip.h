@@ -11,6 +11,26 @@ bool qGzipCompress(QSharedPointer<FileLike> input, QSharedPointer<FileLike> outp
 bool qGzipDecompress(QSharedPointer<FileLike> input, QSharedPointer<FileLike> output);
 
 
+// incremental decompressor for gzip, zlib and raw deflate streams.
+// feed compressed bytes with addData(), then call decompress() until it returns 0.
+class GzipDecompressorPrivate;
+class GzipDecompressor
+{
+public:
+    GzipDecompressor();
+    ~GzipDecompressor();
+public:
+    void addData(const char *data, qint32 size);
+    void addData(const QByteArray &data) { addData(data.constData(), data.size()); }
+    qint32 decompress(char *data, qint32 size);  // returns -1 if error occured.
+    bool needsInput() const;
+    bool isFinished() const;
+private:
+    GzipDecompressorPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(GzipDecompressor)
+};
+
+
 inline QByteArray qGzipCompress(const QByteArray &input, int level = -1)
 {
     QSharedPointer<BytesIO> output(new BytesIO());
@@ -0,0 +1,40 @@
+#ifndef QTNG_HASH_SERVICE_H
+#define QTNG_HASH_SERVICE_H
+
+#include <QtCore/qstringlist.h>
+#include "md.h"
+#include "io_utils.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// hashes large files and streams in worker threads, and only the current coroutine is blocked.
+// if `hmacKey` is not empty, the results are HMAC instead of digests.
+class HashServicePrivate;
+class HashService
+{
+public:
+    explicit HashService(int threads = 0);             // default to the number of cpu cores.
+    ~HashService();
+public:
+    // the file is mapped into memory if possible.
+    QByteArray hash(const QString &filePath, MessageDigest::Algorithm algo, const QByteArray &hmacKey = QByteArray());
+    // the stream is read in the current coroutine, while the last chunk is hashed in worker thread.
+    QByteArray hash(QSharedPointer<FileLike> file, MessageDigest::Algorithm algo, const QByteArray &hmacKey = QByteArray());
+    // the files are hashed in parallel.
+    QList<QByteArray> hash(const QStringList &filePaths, MessageDigest::Algorithm algo,
+                           const QByteArray &hmacKey = QByteArray());
+    // split the file into leaves of `leafSize` bytes, which are hashed in parallel. the result is
+    // H(0x01 || H(0x00 || leaf0) || H(0x00 || leaf1) || ...), where H is the HMAC if `hmacKey` is given.
+    QByteArray treeHash(const QString &filePath, MessageDigest::Algorithm algo, qint64 leafSize = 1024 * 1024 * 16,
+                        const QByteArray &hmacKey = QByteArray());
+    int chunkSize() const;                              // default to 8M bytes.
+    void setChunkSize(int chunkSize);
+private:
+    HashServicePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(HashService)
+    Q_DISABLE_COPY(HashService)
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif // QTNG_HASH_SERVICE_H
@@ -170,9 +170,13 @@ public:
     void setVersion(HttpVersion version);
 
     QSharedPointer<SocketLike> takeStream(QByteArray *readBytes);
+    qint32 readInto(char *data, qint32 size);
+    QByteArray readChunk(qint32 maxSize = 1024 * 16);
+    bool saveTo(QSharedPointer<FileLike> file);
     QByteArray body() const;
     QByteArray body();
     void setBody(const QByteArray &body);
+    void setBody(QSharedPointer<FileLike> body);
     QString text();
     QJsonDocument json();
     QString html();
@@ -194,6 +198,7 @@ class Socks5Proxy;
 class HttpProxy;
 class HttpSessionPrivate;
 class HttpCacheManager;
+class SslSessionCache;
 class HttpSession
 {
 public:
@@ -359,6 +364,8 @@ public:
     void setHttpProxy(QSharedPointer<HttpProxy> proxy);
     QSharedPointer<HttpCacheManager> cacheManager() const;
     void setCacheManager(QSharedPointer<HttpCacheManager> cacheManager);
+    QSharedPointer<SslSessionCache> sslSessionCache() const;
+    void setSslSessionCache(QSharedPointer<SslSessionCache> sslSessionCache);
 private:
     HttpSessionPrivate *d_ptr;
     Q_DECLARE_PRIVATE(HttpSession)
@@ -373,12 +380,22 @@ public:
 public:
     virtual bool addResponse(const HttpResponse &response);
     virtual bool getResponse(HttpResponse *response);
+    virtual bool updateResponse(const HttpResponse &response);  // refresh headers after revalidation.
+public:
+    static bool isCacheable(const HttpRequest &request, const HttpResponse &response);
+    static bool isFresh(const HttpResponse &response);
+    static qint64 freshnessLifetime(const HttpResponse &response);
+    static qint64 currentAge(const HttpResponse &response);
+    static bool addValidators(const HttpResponse &cachedResponse, QList<HttpHeader> *headers);
+    static void mergeNotModified(HttpResponse *cachedResponse, const HttpResponse &notModified);
 protected:
+    static QList<HttpHeader> varyingHeaders(const HttpResponse &response, const HttpRequest &request);
     virtual bool store(const QString &url, const QByteArray &data);
     virtual QByteArray load(const QString &url);
 };
 
 
+// keeps the responses in memory without serialization, so store() and load() are not used.
 class HttpMemoryCacheManagerPrivate;
 class HttpMemoryCacheManager: public HttpCacheManager
 {
@@ -386,30 +403,44 @@ public:
     HttpMemoryCacheManager();
     virtual ~HttpMemoryCacheManager() override;
 public:
+    virtual bool addResponse(const HttpResponse &response) override;
+    virtual bool getResponse(HttpResponse *response) override;
     float expireTime() const;
     void setExpireTime(float expireTime);
-protected:
-    QMap<QString, QByteArray> &cache();
-    virtual bool store(const QString &url, const QByteArray &data) override;
-    virtual QByteArray load(const QString &url) override;
+    int maxCacheSize() const;
+    void setMaxCacheSize(int maxCacheSize);
+    int cacheSize() const;
+    void clear();
 private:
     HttpMemoryCacheManagerPrivate * const d_ptr;
     Q_DECLARE_PRIVATE(HttpMemoryCacheManager)
 };
 
 
+// all file operations run in a thread pool, so the event loop is never blocked by disk io.
+class HttpDiskCacheManagerPrivate;
 class HttpDiskCacheManager: public HttpCacheManager
 {
 public:
-    HttpDiskCacheManager(const QDir &cacheDir)
-        :cacheDir(cacheDir) {}
-    HttpDiskCacheManager(const QString &cacheDir)
-        :cacheDir(cacheDir) {}
+    HttpDiskCacheManager(const QDir &cacheDir);
+    HttpDiskCacheManager(const QString &cacheDir);
+    virtual ~HttpDiskCacheManager() override;
+public:
+    virtual bool addResponse(const HttpResponse &response) override;
+    virtual bool getResponse(HttpResponse *response) override;
+    virtual bool updateResponse(const HttpResponse &response) override;
+    qint64 maxCacheSize() const;
+    void setMaxCacheSize(qint64 maxCacheSize);
+    qint64 cacheSize() const;
+    void clear();
 protected:
-    virtual bool store(const QString &url, const QByteArray &data);
-    virtual QByteArray load(const QString &url);
+    virtual bool store(const QString &url, const QByteArray &data) override;
+    virtual QByteArray load(const QString &url) override;
 protected:
     QDir cacheDir;
+private:
+    HttpDiskCacheManagerPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(HttpDiskCacheManager)
 };
 
 
@@ -7,6 +7,7 @@
 #include <QtCore/qlist.h>
 #include <QtCore/qurl.h>
 #include <QtCore/qmap.h>
+#include <QtCore/qvarlengtharray.h>
 #include "socket_utils.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
@@ -129,7 +130,16 @@ public:
         MIMEVersionHeader,
         ConnectionHeader,
         UpgradeHeader,
+        HostHeader,
+        ETagHeader,
+        ExpiresHeader,
+        AgeHeader,
+        IfModifiedSinceHeader,
+        IfNoneMatchHeader,
+        AuthorizationHeader,
+        KeepAliveHeader,
     };
+    enum { KnownHeaderCount = KeepAliveHeader + 1 };
 
     void setContentType(const QString &contentType);
     QString getContentType() const;
@@ -163,6 +173,9 @@ public:
     static QDateTime fromHttpDate(const QByteArray &value);
     static QByteArray toHttpDate(const QDateTime &dt);
     static QString toString(KnownHeader knownHeader);
+    static bool lookupKnownHeader(const char *name, int size, KnownHeader *knownHeader);
+protected:
+    int indexOfHeader(const QString &name, int from = 0) const;
 protected:
     QList<HttpHeader> headers;
 };
@@ -196,6 +209,63 @@ public:
 };
 
 
+struct HttpHeaderView
+{
+    int nameOffset;
+    int nameLength;
+    int valueOffset;
+    int valueLength;
+    int knownHeader;  // -1 if the name is not a HeaderOperationMixin::KnownHeader
+};
+
+
+// parse the first line and headers of a http/1.x message incrementally. the parser keeps the offsets of
+// lines in the receiving buffer instead of copying them, and the buffer is never rescanned from the start
+// after more data arrived.
+class HttpHeaderParser
+{
+public:
+    enum Result {
+        Finished,
+        NeedMoreData,
+        InvalidHeader,
+        TooManyHeaders,
+        HeadersTooLarge,
+        ConnectionError,
+    };
+public:
+    HttpHeaderParser(int maxHeaders = 64, int maxHeaderSize = 1024 * 64);
+    Result parse(const char *data, int size);
+    Result parse(const QByteArray &buf) { return parse(buf.constData(), buf.size()); }
+    // read from connection into the spare capacity of buf until the headers are finished.
+    Result read(QSharedPointer<SocketLike> connection, QByteArray *buf);
+    void reset();
+public:
+    bool isFinished() const { return finished; }
+    // the size of the first line and headers including the empty line. the body starts from here.
+    int headerSize() const { return pos; }
+    int firstLineOffset() const { return lineOffset; }
+    int firstLineLength() const { return lineLength; }
+    int headerCount() const { return views.size(); }
+    const HttpHeaderView &headerAt(int i) const { return views.at(i); }
+    QList<HttpHeader> headers(const char *data) const;
+
+    static bool parseStatusLine(const char *line, int size, HttpVersion *version, int *statusCode,
+                                QByteArray *statusText);
+    static bool parseRequestLine(const char *line, int size, QByteArray *method, QByteArray *path,
+                                 HttpVersion *version);
+    static HttpVersion parseVersion(const char *s, int size);
+private:
+    QVarLengthArray<HttpHeaderView, 32> views;
+    int maxHeaders;
+    int maxHeaderSize;
+    int pos;
+    int lineOffset;
+    int lineLength;
+    bool finished;
+};
+
+
 class ChunkedBlockReader
 {
 public:
@@ -79,9 +79,23 @@ protected:
 
 
 // static http(s) server serving current directory.
-class SimpleHttpServer: public TcpServer<SimpleHttpRequestHandler>{};
+class SimpleHttpServer: public TcpServer<SimpleHttpRequestHandler>
+{
+public:
+    SimpleHttpServer(const QHostAddress &serverAddress, quint16 serverPort)
+        :TcpServer<SimpleHttpRequestHandler>(serverAddress, serverPort) {}
+};
+
+
 #ifndef QTNG_NO_CRYPTO
-class SimpleHttpsServer: public SslServer<SimpleHttpRequestHandler> {};
+class SimpleHttpsServer: public SslServer<SimpleHttpRequestHandler>
+{
+public:
+    SimpleHttpsServer(const QHostAddress &serverAddress, quint16 serverPort)
+        :SslServer<SimpleHttpRequestHandler>(serverAddress, serverPort) {}
+    SimpleHttpsServer(const QHostAddress &serverAddress, quint16 serverPort, const SslConfiguration &configuration)
+        :SslServer<SimpleHttpRequestHandler>(serverAddress, serverPort, configuration) {}
+};
 #endif
 
 QTNETWORKNG_NAMESPACE_END
@@ -6,6 +6,25 @@
 QTNETWORKNG_NAMESPACE_BEGIN
 
 
+// the live metrics of kcp. the times are in msecs, the windows are in segments.
+struct KcpStats
+{
+    quint32 srtt;
+    quint32 rttVariance;
+    quint32 rto;
+    quint32 congestionWindow;
+    quint32 sendWindow;
+    quint32 remoteWindow;
+    quint32 mtu;
+    quint32 interval;
+    quint32 waitSend;          // the segments not acknowledged yet.
+    quint64 sentSegments;
+    quint64 retransmittedSegments;
+    float lossRate;            // the ratio of retransmitted segments, smoothed every second.
+    int paths;
+};
+
+
 class KcpSocketPrivate;
 class KcpSocket
 {
@@ -16,6 +35,7 @@ public:
         FastInternet,
         Ethernet,
         Loopback,
+        Adaptive,  // tunes the window, interval, resend threshold and mtu by the measured rtt and loss.
     };
 public:
     explicit KcpSocket(Socket::NetworkLayerProtocol protocol = Socket::AnyIPProtocol);
@@ -30,6 +50,32 @@ public:
     quint32 payloadSizeHint() const;
     void setUdpPacketSize(quint32 udpPacketSize);
     quint32 udpPacketSize() const;
+    // reed-solomon forward error correction. every group of `dataShards` packets is followed by `parityShards`
+    // packets, or earlier if the group is not full after `fecGroupTimeout()` msecs. (0, 0) disables it, which
+    // is the default. the client side asks the server for it, and sends parity only after the server agrees,
+    // so that old servers keep working. the server side answers with the shards of client unless they are set
+    // in the listening socket.
+    bool setFecShards(int dataShards, int parityShards);
+    int fecDataShards() const;
+    int fecParityShards() const;
+    void setFecGroupTimeout(quint32 msecs);
+    quint32 fecGroupTimeout() const;
+    // compress the datagrams with deflate if they shrink. returns false if zlib is not available.
+    // the client side asks the server for it, and compresses only after the server agrees, so that old
+    // servers keep working. the server side agrees if zlib is available, and then compresses as well.
+    bool setCompressionEnabled(bool enabled);
+    bool isCompressionEnabled() const;
+    // the client side opens `count - 1` more udp sockets to the server, and spreads the packets over them by
+    // their rtt and loss, which are probed every second. a path missing two probes in a row is not used until it
+    // answers again. the server side accepts a new path only if it proves the session token, so the builds
+    // without crypto keep one path. at most 8 paths.
+    void setMultiPathCount(int count);
+    int multiPathCount() const;
+    int activePathCount() const;
+    // spread the datagrams over the round-trip time instead of sending a whole window at once.
+    void setPacingEnabled(bool enabled);
+    bool isPacingEnabled() const;
+    KcpStats stats() const;
     Event busy;
     Event notBusy;
 public:
@@ -64,6 +110,11 @@ public:
     QByteArray recvall(qint32 size);
     qint32 send(const QByteArray &data);
     qint32 sendall(const QByteArray &data);
+    // keep the message boundaries of kcp. a packet is at most 127 * payloadSizeHint() bytes. recvPacket()
+    // returns the rest of a message first if it is partially read by recv().
+    qint32 sendPacket(const char *data, qint32 size);
+    qint32 sendPacket(const QByteArray &packet);
+    QByteArray recvPacket();
 
     void setDnsCache(QSharedPointer<SocketDnsCache> dnsCache);
 private:
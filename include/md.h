@@ -2,6 +2,7 @@
 #define QTNG_MD_H
 
 #include <QtCore/qbytearray.h>
+#include <QtCore/qlist.h>
 #include "crypto.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
@@ -29,6 +30,11 @@ public:
     inline void addData(const QByteArray &data) { addData(data.constData(), data.size()); }
     void addData(const char *data, int len);
     QByteArray result();
+    // write the digest to `out` which must have digestSize() bytes. return the size of digest, or -1 on error.
+    int result(char *out);
+    int digestSize() const;
+    // start a new message, which reuses the context.
+    void reset();
 public:
     inline void update(const QByteArray &data) { addData(data.constData(), data.size()); }
     inline void update(const char *data, int len) { addData(data, len); }
@@ -37,6 +43,8 @@ public:
 public:
     static QByteArray hash(const QByteArray &data, Algorithm algo);
     static QByteArray digest(const QByteArray &data, Algorithm algo);
+    // digest every message with one context.
+    static QList<QByteArray> digest(const QList<QByteArray> &messages, Algorithm algo);
 private:
     MessageDigestPrivate * const d_ptr;
     Q_DECLARE_PRIVATE(MessageDigest)
@@ -58,6 +66,9 @@ inline QByteArray MessageDigest::digest(const QByteArray &data, Algorithm algo)
     return m.result();
 }
 
+QByteArray hmac(const QByteArray &key, const QByteArray &data,
+                const MessageDigest::Algorithm hashAlgo = MessageDigest::Sha256);
+
 QByteArray PBKDF2_HMAC(int keylen, const QByteArray &password, const QByteArray &salt,
                        const MessageDigest::Algorithm hashAlgo = MessageDigest::Sha256,
                        int i = 10000);
@@ -12,6 +12,7 @@ QTNETWORKNG_NAMESPACE_BEGIN
 
 class HttpProxy;
 class Socks5Proxy;
+class SslSessionCache;
 class ConnectionPoolItem
 {
 public:
@@ -23,6 +24,19 @@ public:
 };
 
 
+class ConnectionPool;
+// streamed responses hold this handle to return their connections after draining the body.
+// the pool clears it on destruction, so responses may outlive the session.
+class ConnectionPoolHandle
+{
+public:
+    ConnectionPoolHandle(ConnectionPool *pool)
+        :pool(pool) {}
+public:
+    ConnectionPool *pool;
+};
+
+
 class ConnectionPool
 {
 public:
@@ -47,6 +61,8 @@ public:
     QSharedPointer<SocketDnsCache> dnsCache;
     CoroutineGroup *operations;
     QSharedPointer<BaseProxySwitcher> proxySwitcher;
+    QSharedPointer<SslSessionCache> sslSessionCache;
+    QSharedPointer<ConnectionPoolHandle> handle;
 };
 
 
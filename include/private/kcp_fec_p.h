@@ -0,0 +1,87 @@
+#ifndef QTNG_KCP_FEC_P_H
+#define QTNG_KCP_FEC_P_H
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qvector.h>
+#include <QtCore/qhash.h>
+#include "../config.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+// a systematic reed-solomon erasure code over GF(2^8). the parity shards are built from a cauchy matrix, so
+// any `dataShards` of the shards can recover the others. requires dataShards + parityShards <= 256.
+class ReedSolomon
+{
+public:
+    // dst ^= c * src
+    static void mulAdd(quint8 c, const char *src, char *dst, int size);
+    static quint8 coefficient(int parityIndex, int dataIndex);
+    // every data shard is `shardSize` bytes. the parity shards are overwritten.
+    static void encode(const QVector<const char *> &dataShards, const QVector<char *> &parityShards, int shardSize);
+    // `shards` holds the data shards and then the parity shards. the empty ones are missing and recovered
+    // in place if there are enough parity shards. the data shards shorter than `shardSize` are padded by zero.
+    static bool reconstruct(QVector<QByteArray> &shards, int dataShards, int shardSize);
+};
+
+
+// the fec packet: type(1) + connection id(4) + group id(4) + shard index(1) + data shards(1) + parity shards(1)
+// the data shard carries a data packet without connection id, which is the packet type(1) + kcp segment. its
+// parity is computed from the length(2) + data packet, padded by zero.
+// data shards contain the configured number of data shards, and parity shards contain the number of the group.
+const int KcpFecHeaderSize = 12;
+
+
+class KcpFecEncoder
+{
+public:
+    KcpFecEncoder();
+public:
+    bool setShards(int dataShards, int parityShards);
+    bool isEnabled() const { return dataShards > 0; }
+    bool isEmpty() const { return count == 0; }
+    // returns the index of the shard in group.
+    int addData(char packetType, const char *data, int size, quint64 now);
+    bool isFull() const { return count >= dataShards; }
+    bool isExpired(quint64 now) const { return count > 0 && now - timestamp >= groupTimeout; }
+    // build the parity of the current group, and start a new group. returns the data shards of the group.
+    int finish();
+public:
+    QVector<QByteArray> shards;
+    QVector<QByteArray> parity;
+    quint64 timestamp;
+    quint32 groupId;
+    quint32 groupTimeout;
+    int dataShards;
+    int parityShards;
+    int count;
+    int shardSize;
+};
+
+
+class KcpFecDecoder
+{
+public:
+    KcpFecDecoder();
+public:
+    // returns the data packets recovered by the new shard, which are not received yet.
+    QList<QByteArray> addShard(const char *packet, int size, quint64 now);
+    void expire(quint64 now);
+private:
+    struct Group
+    {
+        Group() : timestamp(0), dataShards(0), shardSize(0), received(0), finished(false) {}
+        QVector<QByteArray> shards;
+        quint64 timestamp;
+        int dataShards;
+        int shardSize;
+        int received;
+        bool finished;
+    };
+    QHash<quint32, Group> groups;
+public:
+    quint32 groupTimeout;
+};
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif // QTNG_KCP_FEC_P_H
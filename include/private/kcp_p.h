@@ -0,0 +1,300 @@
+#ifndef QTNG_KCP_P_H
+#define QTNG_KCP_P_H
+
+#include <QtCore/qhash.h>
+#include <QtCore/qsharedpointer.h>
+#include <QtCore/qvector.h>
+#include <QtNetwork/qhostaddress.h>
+#include "../config.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+class Socket;
+
+// the address of kcp peer in binary form, so that the server can find the receiver of datagram without
+// formatting the address. ipv4 addresses are mapped to ipv6.
+struct KcpPeerKey
+{
+    KcpPeerKey()
+        : port(0) { memset(address, 0, sizeof(address)); }
+    KcpPeerKey(const QHostAddress &addr, quint16 port)
+        : port(port)
+    {
+        const Q_IPV6ADDR &ipv6 = addr.toIPv6Address();
+        memcpy(address, ipv6.c, sizeof(address));
+    }
+    quint8 address[16];
+    quint16 port;
+};
+
+
+inline bool operator==(const KcpPeerKey &a, const KcpPeerKey &b)
+{
+    return a.port == b.port && memcmp(a.address, b.address, sizeof(a.address)) == 0;
+}
+
+
+inline uint qHash(const KcpPeerKey &key, uint seed = 0)
+{
+    return qHashBits(key.address, sizeof(key.address), seed) ^ (static_cast<uint>(key.port) * 2654435761U);
+}
+
+
+// a two-level timer wheel with 1ms ticks. the items are linked into the slots by their own members wheelPrev,
+// wheelNext, wheelDue and wheelSlot, so scheduling never allocates. the ticks come from a monotonic clock.
+template<typename T>
+class KcpTimerWheel
+{
+public:
+    enum {
+        NearBits = 8,
+        NearSlots = 1 << NearBits,
+        FarSlots = 64,
+        ReadySlot = NearSlots + FarSlots,
+        SlotCount = ReadySlot + 1,
+        NoSlot = -1,
+        DueSlot = -2,
+    };
+    explicit KcpTimerWheel(quint64 now);
+public:
+    void link(T *item, int slot);
+    void unlink(T *item);
+    void schedule(T *item, quint64 due);
+    // moves the items due at now into due, and marks them by DueSlot.
+    void advance(quint64 now);
+    quint64 nextTick() const;
+public:
+    QVector<T *> due;
+    quint64 currentTick;
+private:
+    void collect(int slot);
+    void cascade(int slot);
+private:
+    T *slots[SlotCount];
+};
+
+
+template<typename T>
+KcpTimerWheel<T>::KcpTimerWheel(quint64 now)
+    : currentTick(now)
+{
+    for (int slot = 0; slot < SlotCount; ++slot) {
+        slots[slot] = nullptr;
+    }
+}
+
+
+template<typename T>
+void KcpTimerWheel<T>::link(T *item, int slot)
+{
+    item->wheelSlot = slot;
+    item->wheelPrev = nullptr;
+    item->wheelNext = slots[slot];
+    if (slots[slot]) {
+        slots[slot]->wheelPrev = item;
+    }
+    slots[slot] = item;
+}
+
+
+template<typename T>
+void KcpTimerWheel<T>::unlink(T *item)
+{
+    if (item->wheelSlot < 0) {
+        return;
+    }
+    if (item->wheelPrev) {
+        item->wheelPrev->wheelNext = item->wheelNext;
+    } else {
+        slots[item->wheelSlot] = item->wheelNext;
+    }
+    if (item->wheelNext) {
+        item->wheelNext->wheelPrev = item->wheelPrev;
+    }
+    item->wheelPrev = nullptr;
+    item->wheelNext = nullptr;
+    item->wheelSlot = NoSlot;
+}
+
+
+template<typename T>
+void KcpTimerWheel<T>::schedule(T *item, quint64 due)
+{
+    item->wheelDue = due;
+    if (due <= currentTick) {
+        link(item, ReadySlot);
+    } else if (due - currentTick < NearSlots) {
+        link(item, static_cast<int>(due % NearSlots));
+    } else {
+        // an item far beyond the wheel is cascaded earlier, and then scheduled again.
+        quint64 block = qMin<quint64>(due >> NearBits, (currentTick >> NearBits) + FarSlots);
+        link(item, NearSlots + static_cast<int>(block % FarSlots));
+    }
+}
+
+
+template<typename T>
+void KcpTimerWheel<T>::collect(int slot)
+{
+    T *item = slots[slot];
+    slots[slot] = nullptr;
+    while (item) {
+        T *next = item->wheelNext;
+        item->wheelPrev = nullptr;
+        item->wheelNext = nullptr;
+        item->wheelSlot = DueSlot;
+        due.append(item);
+        item = next;
+    }
+}
+
+
+template<typename T>
+void KcpTimerWheel<T>::cascade(int slot)
+{
+    T *item = slots[slot];
+    slots[slot] = nullptr;
+    while (item) {
+        T *next = item->wheelNext;
+        schedule(item, item->wheelDue);
+        item = next;
+    }
+}
+
+
+template<typename T>
+void KcpTimerWheel<T>::advance(quint64 now)
+{
+    if (now > currentTick + NearSlots * FarSlots) {
+        // the thread was blocked for a long time, every item is due.
+        for (int slot = 0; slot < ReadySlot; ++slot) {
+            collect(slot);
+        }
+        currentTick = now;
+    }
+    while (currentTick < now) {
+        ++currentTick;
+        if (currentTick % NearSlots == 0) {
+            cascade(NearSlots + static_cast<int>((currentTick >> NearBits) % FarSlots));
+        }
+        collect(static_cast<int>(currentTick % NearSlots));
+    }
+    collect(ReadySlot);
+}
+
+
+template<typename T>
+quint64 KcpTimerWheel<T>::nextTick() const
+{
+    if (slots[ReadySlot]) {
+        return currentTick;
+    }
+    for (quint64 tick = currentTick + 1; tick <= currentTick + NearSlots; ++tick) {
+        if (slots[tick % NearSlots]) {
+            return tick;
+        }
+        if (tick % NearSlots == 0 && slots[NearSlots + (tick >> NearBits) % FarSlots]) {
+            return tick;
+        }
+    }
+    return currentTick + NearSlots;
+}
+
+
+// one of the udp 4-tuples carrying a session. the paths are probed every second if there are more than one,
+// and the packets are spread over them by smooth weighted round-robin.
+struct KcpPath
+{
+    enum {
+        // the path missing so many probes in a row is taken as broken, and is not chosen until it answers.
+        MaxLostProbes = 2,
+    };
+    KcpPath()
+        : port(0), lastReceivedTimestamp(0), lastProbeTimestamp(0), probeSequence(0), ackSequence(0), challengeNonce(0)
+        , srtt(0), loss(0.0f), weight(10), currentWeight(0), lostProbes(0), probeAcked(true), ackPending(false)
+        , resumePending(false) {}
+    void updateWeight();
+    void probeAnswered(quint32 rtt);
+    void probeLost();
+    bool isBroken() const { return lostProbes >= MaxLostProbes; }
+
+    QSharedPointer<Socket> socket;  // the client side only. the server side sends by the listening socket.
+    KcpPeerKey key;                 // the server side only.
+    QHostAddress address;
+    quint16 port;
+    quint64 lastReceivedTimestamp;
+    quint64 lastProbeTimestamp;
+    quint32 probeSequence;
+    quint32 ackSequence;
+    quint64 challengeNonce;     // the client side only.
+    quint32 srtt;
+    float loss;
+    int weight;
+    int currentWeight;
+    int lostProbes;
+    bool probeAcked;
+    bool ackPending;
+    bool resumePending;
+};
+
+
+inline void KcpPath::updateWeight()
+{
+    // prefer the path of lower rtt, and punish the lossy path harder.
+    const float delivery = 1.0f - loss;
+    weight = qMax(1, static_cast<int>(1000.0f * delivery * delivery / (srtt + 5)));
+}
+
+
+inline void KcpPath::probeAnswered(quint32 rtt)
+{
+    srtt = srtt == 0 ? rtt : (srtt * 7 + rtt) / 8;
+    loss = loss * 7 / 8;
+    lostProbes = 0;
+    probeAcked = true;
+    updateWeight();
+}
+
+
+inline void KcpPath::probeLost()
+{
+    loss = loss * 7 / 8 + 1.0f / 8;
+    ++lostProbes;
+    updateWeight();
+}
+
+
+// smooth weighted round-robin, which interleaves the paths instead of sending bursts to the heaviest one. the
+// broken paths are skipped unless all of them are broken.
+inline int chooseKcpPath(QVector<KcpPath> &paths)
+{
+    if (paths.size() <= 1) {
+        return 0;
+    }
+    bool allBroken = true;
+    for (const KcpPath &path: paths) {
+        if (!path.isBroken()) {
+            allBroken = false;
+            break;
+        }
+    }
+    int total = 0;
+    int best = -1;
+    for (int i = 0; i < paths.size(); ++i) {
+        KcpPath &path = paths[i];
+        if (!allBroken && path.isBroken()) {
+            continue;
+        }
+        path.currentWeight += path.weight;
+        total += path.weight;
+        if (best < 0 || path.currentWeight > paths.at(best).currentWeight) {
+            best = i;
+        }
+    }
+    paths[best].currentWeight -= total;
+    return best;
+}
+
+QTNETWORKNG_NAMESPACE_END
+
+#endif // QTNG_KCP_P_H
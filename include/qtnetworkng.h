@@ -23,6 +23,7 @@
 #include "cipher.h"
 #include "pkey.h"
 #include "certificate.h"
+#include "hash_service.h"
 #endif
 
 #ifdef QTNG_HAVE_ZLIB
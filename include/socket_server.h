@@ -45,6 +45,8 @@ protected:
     virtual bool serviceActions();                      // default to nothing, called before accept next request.
     virtual QSharedPointer<SocketLike> getRequest();    // accept();
     virtual bool verifyRequest(QSharedPointer<SocketLike> request);
+    // called in the coroutine of request before processRequest(). return null to drop the request.
+    virtual QSharedPointer<SocketLike> prepareRequest(QSharedPointer<SocketLike> request);
     virtual void handleError(QSharedPointer<SocketLike> request);
     virtual void shutdownRequest(QSharedPointer<SocketLike> request);
     virtual void closeRequest(QSharedPointer<SocketLike> request);
@@ -125,9 +127,21 @@ public:
 public:
     void setSslConfiguration(const SslConfiguration &configuration);
     SslConfiguration sslConfiguratino() const;
+    float handshakeTimeout() const;                    // default to 10 seconds.
+    void setHandshakeTimeout(float handshakeTimeout);
+    int maxConcurrentHandshakes() const;               // default to 64.
+    void setMaxConcurrentHandshakes(int maxConcurrentHandshakes);
+    QSharedPointer<SslServerSessionCache> sessionCache() const;
+    QSharedPointer<SslCertificateStore> certificateStore() const;
+    void setCertificateStore(QSharedPointer<SslCertificateStore> certificateStore);
+    QSharedPointer<SslCryptoWorkerPool> cryptoWorkerPool() const;
+    void setCryptoWorkerPool(QSharedPointer<SslCryptoWorkerPool> cryptoWorkerPool);
     virtual bool isSecure() const override;
 protected:
     virtual QSharedPointer<SocketLike> serverCreate() override;
+    // the handshake runs here, in the coroutine of request. so verifyRequest() is given the plain tcp socket, and
+    // the subclasses checking the ssl socket should override this function and check the returned one.
+    virtual QSharedPointer<SocketLike> prepareRequest(QSharedPointer<SocketLike> request) override;
 private:
     Q_DECLARE_PRIVATE(BaseSslServer)
 };
@@ -3,6 +3,7 @@
 
 #include "socket.h"
 #include "certificate.h"
+#include "cipher.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
 
@@ -37,6 +38,9 @@ private:
 };
 
 
+class SslServerSessionCache;
+class SslCertificateStore;
+class SslCryptoWorkerPool;
 class SslConfigurationPrivate;
 class SslConfiguration
 {
@@ -57,6 +61,9 @@ public:
     PrivateKey privateKey() const;
     bool onlySecureProtocol() const;
     bool supportCompression() const;
+    QSharedPointer<SslServerSessionCache> serverSessionCache() const;
+    QSharedPointer<SslCertificateStore> certificateStore() const;
+    QSharedPointer<SslCryptoWorkerPool> cryptoWorkerPool() const;
 
     void addCaCertificate(const Certificate &certificate);
     void addCaCertificates(const QList<Certificate> &certificates);
@@ -72,6 +79,9 @@ public:
     void setAllowedNextProtocols(const QList<QByteArray> &protocols);
     void setOnlySecureProtocol(bool onlySecureProtocol);
     void setSupportCompression(bool supportCompression);
+    void setServerSessionCache(QSharedPointer<SslServerSessionCache> serverSessionCache);
+    void setCertificateStore(QSharedPointer<SslCertificateStore> certificateStore);
+    void setCryptoWorkerPool(QSharedPointer<SslCryptoWorkerPool> cryptoWorkerPool);
 public:
     static QList<SslCipher> supportedCiphers();
     static SslConfiguration testPurpose(const QString &commonName, const QString &countryCode, const QString &organization);
@@ -142,6 +152,136 @@ QDebug &operator<<(QDebug &debug, const SslError &error);
 QDebug &operator<<(QDebug &debug, const SslError::Error &error);
 
 
+// keeps tls sessions of client connections by host:port, so that reconnecting to the same server
+// takes an abbreviated handshake instead of a full one.
+class SslSessionCachePrivate;
+class SslSessionCache
+{
+public:
+    explicit SslSessionCache(int maxSessions = 256);
+    ~SslSessionCache();
+public:
+    int maxSessions() const;
+    void setMaxSessions(int maxSessions);
+    int size() const;
+    void remove(const QString &key);
+    void clear();
+    quint64 hits() const;
+    quint64 misses() const;
+private:
+    SslSessionCachePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(SslSessionCache)
+    Q_DISABLE_COPY(SslSessionCache)
+};
+
+
+// an external store of server sessions, so that servers in other threads or processes can resume them.
+// the functions are called by openssl while it handshakes. if the server configuration has a
+// SslCryptoWorkerPool, that is in the threads of the pool, concurrently for many connections; otherwise it is
+// in the coroutine doing handshake. so the implementations must be thread-safe if a pool is used, and must
+// not use coroutine primitives such as Socket, Event or Coroutine::sleep(), which would block the whole worker thread.
+class SslSessionStore
+{
+public:
+    virtual ~SslSessionStore();
+public:
+    virtual bool store(const QByteArray &sessionId, const QByteArray &session) = 0;
+    virtual QByteArray load(const QByteArray &sessionId) = 0;
+    virtual void remove(const QByteArray &sessionId) = 0;
+};
+
+
+// resumes server sessions by session id and by session ticket. the keys of tickets are rotated periodically,
+// and the previous key is still accepted for one more period.
+// all settings may be changed while serving, and take effect for new connections. changing maxSessions,
+// sessionTimeout or ticketsEnabled rebuilds the SSL contexts of the configurations using this cache, so the
+// sessions kept in memory by the old contexts can not be resumed by id any more. tickets and the sessions in
+// the external store are still accepted.
+class SslServerSessionCachePrivate;
+class SslServerSessionCache
+{
+public:
+    explicit SslServerSessionCache(int maxSessions = 1024 * 20);
+    ~SslServerSessionCache();
+public:
+    int maxSessions() const;
+    void setMaxSessions(int maxSessions);
+    float sessionTimeout() const;                       // default to 300 seconds.
+    void setSessionTimeout(float sessionTimeout);
+    bool ticketsEnabled() const;                        // default to true.
+    void setTicketsEnabled(bool ticketsEnabled);
+    float ticketKeyLifetime() const;                    // default to 3600 seconds.
+    void setTicketKeyLifetime(float ticketKeyLifetime);
+    void rotateTicketKey();
+    // every key has 48 bytes, and the current key comes first. share them to accept tickets issued by other servers.
+    QList<QByteArray> ticketKeys() const;
+    void setTicketKeys(const QList<QByteArray> &ticketKeys);
+    QSharedPointer<SslSessionStore> externalStore() const;
+    void setExternalStore(QSharedPointer<SslSessionStore> externalStore);
+public:
+    quint64 hits() const;                               // resumed handshakes.
+    quint64 misses() const;                             // full handshakes.
+    float hitRate() const;
+    void resetCounters();
+private:
+    SslServerSessionCachePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(SslServerSessionCache)
+    Q_DISABLE_COPY(SslServerSessionCache)
+};
+
+
+// selects the configuration of server by the name which clients indicate (SNI). exact names are preferred to
+// wildcard names such as *.example.com, and the configuration of server is used if no name matches.
+// only the local certificate and private key are taken from the configuration of name; all other settings,
+// such as ciphers, session cache and ca certificates, come from the configuration of server.
+// the store may be changed while serving, which takes effect for new connections.
+class SslCertificateStorePrivate;
+class SslCertificateStore
+{
+public:
+    SslCertificateStore();
+    ~SslCertificateStore();
+public:
+    // the names default to the dns names of local certificate, or the common name if there is none.
+    void addConfiguration(const SslConfiguration &configuration, const QStringList &hostNames = QStringList());
+    bool addCertificateFiles(const QString &certificatePath, const QString &privateKeyPath,
+                             const QStringList &hostNames = QStringList(), Ssl::EncodingFormat format = Ssl::Pem);
+    // read the files added by addCertificateFiles() again if they are modified. returns the number of reloaded.
+    int reload();
+    bool removeHostName(const QString &hostName);
+    void clear();
+    QStringList hostNames() const;
+    SslConfiguration find(const QString &hostName, bool *found = nullptr) const;
+private:
+    SslCertificateStorePrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(SslCertificateStore)
+    Q_DISABLE_COPY(SslCertificateStore)
+};
+
+
+// runs the server handshakes in worker threads, so that the private key operations and the verification of
+// certificates do not block other coroutines. the pool belongs to the thread which creates it.
+class SslCryptoWorkerPoolPrivate;
+class SslCryptoWorkerPool
+{
+public:
+    explicit SslCryptoWorkerPool(int threads = 0);      // default to the number of cpu cores.
+    ~SslCryptoWorkerPool();
+public:
+    int threads() const;
+    int queueDepth() const;                             // handshake steps waiting for or running in workers.
+    int maxQueueDepth() const;
+    quint64 operations() const;
+    float averageLatency() const;                       // in seconds, including the time waiting for a worker.
+    float maxLatency() const;
+    void resetCounters();
+private:
+    SslCryptoWorkerPoolPrivate * const d_ptr;
+    Q_DECLARE_PRIVATE(SslCryptoWorkerPool)
+    Q_DISABLE_COPY(SslCryptoWorkerPool)
+};
+
+
 class Socket;
 class SslSocketPrivate;
 class SocketLike;
@@ -187,6 +327,10 @@ public:
     SslConfiguration sslConfiguration() const;
     QList<SslError> sslErrors() const;
     void setSslConfiguration(const SslConfiguration &configuration);
+    // the key defaults to host:port of the peer.
+    void setSessionCache(QSharedPointer<SslSessionCache> cache, const QString &key = QString());
+    QSharedPointer<SslSessionCache> sessionCache() const;
+    bool isSessionReused() const;
 public:
     Socket::SocketError error() const;
     QString errorString() const;
@@ -240,6 +384,14 @@ QSharedPointer<SslSocket> convertSocketLikeToSslSocket(QSharedPointer<SocketLike
 QSharedPointer<SocketLike> encrypted(QSharedPointer<Cipher> cipher, QSharedPointer<SocketLike> socket);
 
 
+// sends authenticated records. the algorithm is one of Cipher::AES128, Cipher::AES256 (both GCM mode) and
+// Cipher::ChaCha20Poly1305. the key should be random or derived from password, such as by PBKDF2. every
+// direction uses its own key derived from the key and a random salt, and the key is renewed after
+// `rekeyBytes` bytes. the receiving side closes the connection if any record is modified.
+QSharedPointer<SocketLike> encrypted(Cipher::Algorithm algorithm, const QByteArray &key, QSharedPointer<SocketLike> socket,
+                                     qint64 rekeyBytes = Q_INT64_C(1024) * 1024 * 1024);
+
+
 QTNETWORKNG_NAMESPACE_END
 
 Q_DECLARE_METATYPE(QList<QTNETWORKNG_NAMESPACE::SslError>)
@@ -23,6 +23,7 @@ SOURCES += \
     $$PWD/src/eventloop_qt.cpp \
     $$PWD/src/msgpack.cpp \
     $$PWD/src/kcp.cpp \
+    $$PWD/src/kcp_fec.cpp \
     $$PWD/src/kcp/ikcp.c \
     $$PWD/src/socket_server.cpp \
     $$PWD/src/httpd.cpp \
@@ -33,6 +34,8 @@ SOURCES += \
 PRIVATE_HEADERS += \
     $$PWD/include/private/coroutine_p.h \
     $$PWD/include/private/http_p.h \
+    $$PWD/include/private/kcp_p.h \
+    $$PWD/include/private/kcp_fec_p.h \
     $$PWD/include/private/socket_p.h
     $$PWD/src/kcp/ikcp.h
 
@@ -85,6 +88,7 @@ qtng_crypto {
         $$PWD/include/cipher.h \
         $$PWD/include/pkey.h \
         $$PWD/include/certificate.h \
+        $$PWD/include/hash_service.h \
         $$PWD/include/qtcrypto.h
 
     SOURCES += $$PWD/src/ssl.cpp \
@@ -93,7 +97,8 @@ qtng_crypto {
         $$PWD/src/pkey.cpp \
         $$PWD/src/cipher.cpp \
         $$PWD/src/certificate.cpp \
-        $$PWD/src/qasn1element.cpp
+        $$PWD/src/qasn1element.cpp \
+        $$PWD/src/hash_service.cpp
 
     LIBS += -lssl -lcrypto
 } else {
@@ -1,3 +1,4 @@
+#include <QtCore/qvarlengtharray.h>
 #include "../include/cipher.h"
 #include "../include/private/crypto_p.h"
 #include "../include/random.h"
@@ -190,6 +191,9 @@ public:
     ~CipherPrivate();
     QByteArray addData(const char *data, int len);
     QByteArray finalData();
+    int addData(const char *data, int len, char *out);
+    int finalData(char *out);
+    bool reset(const QByteArray &iv);
     QPair<QByteArray, QByteArray> bytesToKey(const QByteArray &password,MessageDigest::Algorithm hashAlgo,
                                              const QByteArray &salt, int i);
     QPair<QByteArray, QByteArray> PBKDF2_HMAC(const QByteArray &password, const QByteArray &salt,
@@ -317,15 +321,12 @@ QByteArray CipherPrivate::addData(const char *data, int len)
         return QByteArray();
     }
     QByteArray out;
-    out.resize(len + EVP_MAX_BLOCK_LENGTH);
-    int outl = 0;
-    int rvalue = EVP_CipherUpdate(context, reinterpret_cast<unsigned char *>(out.data()), &outl,
-                                             reinterpret_cast<const unsigned char *>(data), len);
-    if(rvalue) {
+    out.resize(len + EVP_CIPHER_block_size(cipher));
+    int outl = addData(data, len, out.data());
+    if(outl >= 0) {
         out.resize(outl);
         return out;
     } else {
-        hasError = true;
         return QByteArray();
     }
 }
@@ -335,19 +336,67 @@ QByteArray CipherPrivate::finalData()
     if(!context || !inited || hasError) {
         return QByteArray();
     }
-    QByteArray out;
-    out.resize(1024 + EVP_MAX_BLOCK_LENGTH);
+    char buf[EVP_MAX_BLOCK_LENGTH];
+    int outl = finalData(buf);
+    if(outl > 0) {
+        return QByteArray(buf, outl);
+    } else {
+        return QByteArray();
+    }
+}
+
+int CipherPrivate::addData(const char *data, int len, char *out)
+{
+    if(!context || !inited || hasError || len < 0) {
+        return -1;
+    }
     int outl = 0;
-    int rvalue = EVP_CipherFinal_ex(context, reinterpret_cast<unsigned char *>(out.data()), &outl);
+    int rvalue = EVP_CipherUpdate(context, reinterpret_cast<unsigned char *>(out), &outl,
+                                  reinterpret_cast<const unsigned char *>(data), len);
     if(rvalue) {
-        out.resize(outl);
-        return out;
+        return outl;
     } else {
         hasError = true;
-        return QByteArray();
+        return -1;
     }
 }
 
+int CipherPrivate::finalData(char *out)
+{
+    if(!context || !inited || hasError) {
+        return -1;
+    }
+    int outl = 0;
+    int rvalue = EVP_CipherFinal_ex(context, reinterpret_cast<unsigned char *>(out), &outl);
+    if(rvalue) {
+        return outl;
+    } else {
+        hasError = true;
+        return -1;
+    }
+}
+
+bool CipherPrivate::reset(const QByteArray &iv)
+{
+    if(!context || !cipher) {
+        return false;
+    }
+    if(!iv.isEmpty()) {
+        if(iv.size() != EVP_CIPHER_iv_length(cipher)) {
+            return false;
+        }
+        this->iv = iv;
+    }
+    if(!inited) {
+        return init();
+    }
+    // keep the cipher and the key schedule, only the iv and the state are changed.
+    int rvalue = EVP_CipherInit_ex(context, nullptr, nullptr, nullptr,
+                                   reinterpret_cast<const unsigned char*>(this->iv.constData()), -1);
+    hasError = !rvalue;
+    return rvalue;
+}
+
 bool CipherPrivate::setPassword(const QByteArray &password, const QByteArray &salt, const MessageDigest::Algorithm hashAlgo, int i)
 {
     QByteArray s;
@@ -450,6 +499,59 @@ QByteArray Cipher::finalData()
 }
 
 
+int Cipher::addData(const char *data, int len, char *out)
+{
+    Q_D(Cipher);
+    // openssl writes the buffered block or the held back block of decryption to `out` before reading `data`,
+    // so overlapped input is copied first.
+    if (d->cipher && len > 0 && out < data + len && data < out + len + EVP_CIPHER_block_size(d->cipher)) {
+        QVarLengthArray<char, 1024 * 4> copy(len);
+        memcpy(copy.data(), data, static_cast<size_t>(len));
+        return d->addData(copy.constData(), len, out);
+    }
+    return d->addData(data, len, out);
+}
+
+
+int Cipher::finalData(char *out)
+{
+    Q_D(Cipher);
+    return d->finalData(out);
+}
+
+
+bool Cipher::reset(const QByteArray &iv)
+{
+    Q_D(Cipher);
+    return d->reset(iv);
+}
+
+
+QList<QByteArray> Cipher::batch(const QList<QByteArray> &messages, const QList<QByteArray> &ivs)
+{
+    Q_D(Cipher);
+    QList<QByteArray> results;
+    results.reserve(messages.size());
+    const int blockSize = EVP_CIPHER_block_size(d->cipher);
+    for (int i = 0; i < messages.size(); ++i) {
+        const QByteArray &message = messages.at(i);
+        QByteArray out;
+        if (d->reset(i < ivs.size() ? ivs.at(i) : QByteArray())) {
+            out.resize(message.size() + blockSize);
+            int len = d->addData(message.constData(), message.size(), out.data());
+            int finalLen = len < 0 ? -1 : d->finalData(out.data() + len);
+            if (finalLen < 0) {
+                out.clear();
+            } else {
+                out.resize(len + finalLen);
+            }
+        }
+        results.append(out);
+    }
+    return results;
+}
+
+
 bool Cipher::setInitialVector(const QByteArray &iv)
 {
     Q_D(Cipher);
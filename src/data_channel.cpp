@@ -3,6 +3,7 @@
 #include <QtCore/qsharedpointer.h>
 #include <QtCore/qendian.h>
 #include <QtCore/qdatetime.h>
+#include <QtCore/qqueue.h>
 #include "../include/locks.h"
 #include "../include/coroutine_utils.h"
 #include "../include/data_channel.h"
@@ -21,6 +22,16 @@ const quint8 DESTROY_CHANNEL_REQUEST = 3;
 const quint8 SLOW_DOWN_REQUEST = 4;
 const quint8 GO_THROUGH_REQUEST = 5;
 const quint8 KEEPALIVE_REQUEST = 6;
+const quint8 WINDOW_UPDATE_REQUEST = 7;
+const quint8 MAKE_STREAM_REQUEST = 8;
+
+// both sides assume the receiving window of peer is this large before any window update.
+const quint32 DefaultReceivingWindow = 1024 * 1024;
+
+// the fragments of stream.
+const qint32 StreamFragmentSize = 1024 * 16;
+const char StreamContinued = 0;
+const char StreamFinished = 1;
 
 
 static QByteArray packMakeChannelRequest(quint32 channelNumber)
@@ -32,6 +43,15 @@ static QByteArray packMakeChannelRequest(quint32 channelNumber)
 }
 
 
+static QByteArray packMakeStreamRequest(quint32 channelNumber)
+{
+    uchar buf[sizeof(quint8) + sizeof(quint32)];
+    qToBigEndian(MAKE_STREAM_REQUEST, buf);
+    qToBigEndian(channelNumber, buf + sizeof(quint8));
+    return QByteArray(reinterpret_cast<char*>(buf), sizeof(buf));
+}
+
+
 static QByteArray packChannelMadeRequest(quint32 channelNumber)
 {
     uchar buf[sizeof(quint8) + sizeof(quint32)];
@@ -66,6 +86,14 @@ static QByteArray packGoThroughRequest()
 }
 
 
+// the first packet of SocketChannel tells the peer that window updates and streams are supported. it is a
+// request to destroy the command channel, which the old versions accept and ignore.
+static QByteArray packHelloRequest()
+{
+    return packDestoryChannelRequest(CommandChannelNumber);
+}
+
+
 static QByteArray packKeepaliveRequest()
 {
     uchar buf[sizeof(quint8)];
@@ -74,6 +102,15 @@ static QByteArray packKeepaliveRequest()
 }
 
 
+static QByteArray packWindowUpdateRequest(quint32 bytes)
+{
+    uchar buf[sizeof(quint8) + sizeof(quint32)];
+    qToBigEndian(WINDOW_UPDATE_REQUEST, buf);
+    qToBigEndian(bytes, buf + sizeof(quint8));
+    return QByteArray(reinterpret_cast<char*>(buf), sizeof(buf));
+}
+
+
 static bool unpackCommand(QByteArray data, quint8 *command, quint32 *channelNumber)
 {
     if (data.size() == (sizeof(quint8) + sizeof(quint32))) {
@@ -82,7 +119,9 @@ static bool unpackCommand(QByteArray data, quint8 *command, quint32 *channelNumb
 #else
         *command = qFromBigEndian<quint8>(reinterpret_cast<const uchar*>(data.constData()));
 #endif
-        if (*command != MAKE_CHANNEL_REQUEST && *command != CHANNEL_MADE_REQUEST && *command != DESTROY_CHANNEL_REQUEST) {
+        // the channel number of WINDOW_UPDATE_REQUEST is the bytes of credit.
+        if (*command != MAKE_CHANNEL_REQUEST && *command != CHANNEL_MADE_REQUEST && *command != DESTROY_CHANNEL_REQUEST
+                && *command != WINDOW_UPDATE_REQUEST && *command != MAKE_STREAM_REQUEST) {
             return false;
         }
 #if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
@@ -107,6 +146,86 @@ static bool unpackCommand(QByteArray data, quint8 *command, quint32 *channelNumb
 }
 
 
+// a packet to send. the headers of nested channels are written into the headroom in front of the payload, so
+// the payload is shared with the caller and not copied until SocketChannel frames it into the sending buffer.
+class PacketBuffer
+{
+public:
+    PacketBuffer()
+        : offset(MaxHeadroom) {}
+    PacketBuffer(const QByteArray &payload)
+        : payload(payload), offset(MaxHeadroom) {}
+public:
+    bool prependHeader(quint32 channelNumber);  // returns false if the channels are nested too deep.
+    const char *headers() const { return headroom + offset; }
+    int headersSize() const { return MaxHeadroom - offset; }
+    int size() const { return headersSize() + payload.size(); }
+    bool isNull() const { return payload.isNull() && offset == MaxHeadroom; }
+public:
+    QByteArray payload;
+private:
+    static const int MaxHeadroom = sizeof(quint32) * 16;
+    char headroom[MaxHeadroom];
+    int offset;
+};
+
+
+bool PacketBuffer::prependHeader(quint32 channelNumber)
+{
+    if (offset < static_cast<int>(sizeof(quint32))) {
+        return false;
+    }
+    offset -= static_cast<int>(sizeof(quint32));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint32>(channelNumber, headroom + offset);
+#else
+    qToBigEndian<quint32>(channelNumber, reinterpret_cast<uchar*>(headroom + offset));
+#endif
+    return true;
+}
+
+
+// a received packet. every level of nested channels skips its header by moving the offset, instead of copying
+// the rest of packet. the view is queued as is, and the payload is read through it.
+class PacketView
+{
+public:
+    PacketView()
+        : offset(0) {}
+    explicit PacketView(const QByteArray &data)
+        : data(data), offset(0) {}
+public:
+    bool takeHeader(quint32 *channelNumber);
+    bool isNull() const { return data.isNull(); }
+    const char *constData() const { return data.constData() + offset; }
+    int size() const { return data.size() - offset; }
+    // QByteArray can not share a part of another one, so the payload is copied if any header is skipped.
+    QByteArray toByteArray() const { return offset == 0 ? data : data.mid(offset); }
+private:
+    QByteArray data;
+    int offset;
+};
+
+
+bool PacketView::takeHeader(quint32 *channelNumber)
+{
+    if (data.size() - offset < static_cast<int>(sizeof(quint32))) {
+        return false;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    *channelNumber = qFromBigEndian<quint32>(data.constData() + offset);
+#else
+    *channelNumber = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(data.constData() + offset));
+#endif
+    offset += static_cast<int>(sizeof(quint32));
+    return true;
+}
+
+
+// checks the headers of a queued packet, which start with the channel number of the next level.
+typedef std::function<bool(const char *headers, int size)> PacketChecker;
+
+
 class DataChannelPrivate
 {
 public:
@@ -114,29 +233,38 @@ public:
     virtual ~DataChannelPrivate();
 
     // called by the public class DataChannel
-    QSharedPointer<VirtualChannel> makeChannel();
+    QSharedPointer<VirtualChannel> makeChannel(bool stream = false);
     QSharedPointer<VirtualChannel> takeChannel();
     QSharedPointer<VirtualChannel> takeChannel(quint32 channelNumber);
+    QSharedPointer<VirtualChannel> takeStream();
     bool removeChannel(VirtualChannel *channel);
     QByteArray recvPacket();
+    PacketView recvView();  // used by the readers which copy the payload anyway.
     bool sendPacket(const QByteArray &packet);
     bool sendPacketAsync(const QByteArray &packet);
+    bool sendStream(QSharedPointer<FileLike> stream);
     QString toString();
 
     // must be implemented by subclasses
     virtual void abort();
     virtual bool isBroken() const = 0;
-    virtual bool sendPacketRaw(quint32 channelNumber, const QByteArray &packet) = 0;
-    virtual bool sendPacketRawAsync(quint32 channelNumber, const QByteArray &packet) = 0;
+    virtual bool sendPacketRaw(quint32 channelNumber, const PacketBuffer &packet) = 0;
+    virtual bool sendPacketRawAsync(quint32 channelNumber, const PacketBuffer &packet) = 0;
     virtual void cleanChannel(quint32 channelNumber, bool sendDestroyPacket) = 0;
-    virtual void cleanSendingPacket(quint32 subChannelNumber, std::function<bool(const QByteArray&)> subCheckPacket) = 0;
+    virtual void cleanSendingPacket(quint32 subChannelNumber, PacketChecker subCheckPacket) = 0;
     virtual quint32 headerSize() const = 0;
     virtual QSharedPointer<SocketLike> getBackend() const = 0;
+    virtual bool isPeerExtended() const = 0;  // the peer knows window updates and streams.
+    virtual bool waitForPeer() = 0;           // blocks until isPeerExtended() is known.
 
     // called by the subclasses.
     bool handleCommand(const QByteArray &packet);
     bool handleRawPacket(const QByteArray &packet);
     void notifyChannelClose(quint32 channelNumber);
+    void consumeCredit(int bytes);
+    void returnCredit(bool force);
+    void updateGate();
+    void setReceivingWindow(quint32 bytes);
     QByteArray packPacket(quint32 channelNumber, const QByteArray &packet);
 
     QString name;
@@ -145,9 +273,18 @@ public:
     quint32 maxPacketSize;
     quint32 payloadSizeHint;
     Queue<QSharedPointer<VirtualChannel>> pendingChannels;
+    Queue<QSharedPointer<VirtualChannel>> pendingStreams;
     QMap<quint32, QWeakPointer<VirtualChannel>> subChannels;
-    Queue<QByteArray> receivingQueue;
+    Queue<PacketView> receivingQueue;
     Gate goThrough;
+    // credit-based flow control of data packets. the sender stops if the credit is used up, and the receiver
+    // returns the credit as the packets are read. it is enforced only if the peer is extended, while the peer
+    // may still ask to slow down if too many packets are not read.
+    bool slowDown;
+    qint64 sendingCredit;
+    qint64 consumedBytes;
+    quint32 receivingWindow;
+    int priority;
 
     Q_DECLARE_PUBLIC(DataChannel)
     DataChannel * const q_ptr;
@@ -163,19 +300,157 @@ class WritingPacket
 public:
     WritingPacket()
         :channelNumber(0) {}
-    WritingPacket(quint32 channelNumber, const QByteArray &packet, QSharedPointer<ValueEvent<bool>> done)
+    WritingPacket(quint32 channelNumber, const PacketBuffer &packet, QSharedPointer<ValueEvent<bool>> done)
         :packet(packet), done(done), channelNumber(channelNumber) {}
 
-    QByteArray packet;
+    PacketBuffer packet;
     QSharedPointer<ValueEvent<bool>> done;
     quint32 channelNumber;
-    bool isValid()
+    bool isValid() const
     {
         return !(channelNumber == 0 && packet.isNull() && done.isNull());
     }
 };
 
 
+// the sending queue of SocketChannel, which is a deficit round-robin over the queues of virtual channels, so
+// that a bulk channel does not starve the others. a channel takes `priority` quantums in every round. the
+// command packets go first.
+class SendingQueue
+{
+public:
+    SendingQueue(quint32 capacity)
+        : count(0), capacity(capacity) { notFull.set(); }
+public:
+    void put(const WritingPacket &packet, int priority);
+    void putForcedly(const WritingPacket &packet, int priority);
+    WritingPacket get();   // blocks until a packet is queued.
+    WritingPacket take();  // returns an invalid packet if empty.
+    bool isEmpty() const { return count == 0; }
+    void clean(quint32 channelNumber, PacketChecker check);
+private:
+    struct ChannelQueue
+    {
+        ChannelQueue() : priority(1), deficit(0) {}
+        QQueue<WritingPacket> packets;
+        int priority;
+        qint64 deficit;
+    };
+    QQueue<WritingPacket> commands;
+    QMap<quint32, ChannelQueue> queues;
+    QQueue<quint32> active;
+    Event notEmpty;
+    Event notFull;
+    quint32 count;
+    quint32 capacity;
+    static const int Quantum = 1024 * 4;
+};
+
+
+void SendingQueue::put(const WritingPacket &packet, int priority)
+{
+    while (count >= capacity) {
+        notFull.clear();
+        if (!notFull.wait()) {
+            break;
+        }
+    }
+    putForcedly(packet, priority);
+}
+
+
+void SendingQueue::putForcedly(const WritingPacket &packet, int priority)
+{
+    if (packet.channelNumber == CommandChannelNumber) {
+        commands.enqueue(packet);
+    } else {
+        ChannelQueue &queue = queues[packet.channelNumber];
+        if (queue.packets.isEmpty()) {
+            active.enqueue(packet.channelNumber);
+        }
+        queue.priority = priority;
+        queue.packets.enqueue(packet);
+    }
+    ++count;
+    notEmpty.set();
+}
+
+
+WritingPacket SendingQueue::get()
+{
+    while (count == 0) {
+        notEmpty.clear();
+        if (!notEmpty.wait()) {
+            return WritingPacket();
+        }
+    }
+    return take();
+}
+
+
+WritingPacket SendingQueue::take()
+{
+    WritingPacket packet;
+    if (!commands.isEmpty()) {
+        packet = commands.dequeue();
+    } else {
+        while (!active.isEmpty()) {
+            const quint32 channelNumber = active.head();
+            ChannelQueue &queue = queues[channelNumber];
+            const int size = queue.packets.head().packet.size();
+            if (queue.deficit >= size) {
+                queue.deficit -= size;
+                packet = queue.packets.dequeue();
+                if (queue.packets.isEmpty()) {
+                    active.dequeue();
+                    queues.remove(channelNumber);
+                }
+                break;
+            }
+            // the turn of this channel is over, and the quantum is for the next round.
+            queue.deficit += static_cast<qint64>(queue.priority) * Quantum;
+            active.enqueue(active.dequeue());
+        }
+    }
+    if (packet.isValid()) {
+        --count;
+        if (count < capacity) {
+            notFull.set();
+        }
+    }
+    return packet;
+}
+
+
+void SendingQueue::clean(quint32 channelNumber, PacketChecker check)
+{
+    QMap<quint32, ChannelQueue>::iterator itor = queues.find(channelNumber);
+    if (itor == queues.end()) {
+        return;
+    }
+    QQueue<WritingPacket> reserved;
+    for (const WritingPacket &writingPacket: itor->packets) {
+        if (check(writingPacket.packet.headers(), writingPacket.packet.headersSize())) {
+            if (!writingPacket.done.isNull()) {
+                writingPacket.done->send(false);
+            }
+            --count;
+        } else {
+            reserved.enqueue(writingPacket);
+        }
+    }
+    if (reserved.isEmpty()) {
+        queues.erase(itor);
+        active.removeAll(channelNumber);
+    } else {
+        itor->packets = reserved;
+    }
+    if (count < capacity) {
+        notFull.set();
+    }
+}
+
+
 class SocketChannelPrivate: public DataChannelPrivate
 {
 public:
@@ -183,24 +458,32 @@ public:
     virtual ~SocketChannelPrivate() override;
     virtual bool isBroken() const override;
     virtual void abort() override;
-    virtual bool sendPacketRaw(quint32 channelNumber, const QByteArray &packet) override;
-    virtual bool sendPacketRawAsync(quint32 channelNumber, const QByteArray &packet) override;
+    virtual bool sendPacketRaw(quint32 channelNumber, const PacketBuffer &packet) override;
+    virtual bool sendPacketRawAsync(quint32 channelNumber, const PacketBuffer &packet) override;
     virtual void cleanChannel(quint32 channelNumber, bool sendDestroyPacket) override;
-    virtual void cleanSendingPacket(quint32 subChannelNumber, std::function<bool(const QByteArray&)> subCheckPacket) override;
+    virtual void cleanSendingPacket(quint32 subChannelNumber, PacketChecker subCheckPacket) override;
     virtual quint32 headerSize() const override;
     virtual QSharedPointer<SocketLike> getBackend() const override;
+    virtual bool isPeerExtended() const override;
+    virtual bool waitForPeer() override;
+    int priorityOf(quint32 channelNumber) const;
     void doSend();
+    void finishBatch(QList<WritingPacket> *batch, bool success);
     void doReceive();
     void doKeepalive();
     QHostAddress getPeerAddress();
 
     const QSharedPointer<SocketLike> connection;
-    Queue<WritingPacket> sendingQueue;
+    SendingQueue sendingQueue;
     CoroutineGroup *operations;
     qint64 lastActiveTimestamp;
     qint64 lastKeepaliveTimestamp;
     qint64 keepaliveTimeout;
     qint64 keepaliveInterval;
+    quint32 sendingBudget;  // the max bytes of packets sent together.
+    int flushDelay;
+    Event peerKnown;  // set by the first packet of peer.
+    bool peerExtended;
 
     Q_DECLARE_PUBLIC(SocketChannel)
 };
@@ -213,14 +496,16 @@ public:
     virtual ~VirtualChannelPrivate() override;
     virtual bool isBroken() const override;
     virtual void abort() override;
-    virtual bool sendPacketRaw(quint32 channelNumber, const QByteArray &packet) override;
-    virtual bool sendPacketRawAsync(quint32 channelNumber, const QByteArray &packet) override;
+    virtual bool sendPacketRaw(quint32 channelNumber, const PacketBuffer &packet) override;
+    virtual bool sendPacketRawAsync(quint32 channelNumber, const PacketBuffer &packet) override;
     virtual void cleanChannel(quint32 channelNumber, bool sendDestroyPacket) override;
-    virtual void cleanSendingPacket(quint32 subChannelNumber, std::function<bool(const QByteArray&)> subCheckPacket) override;
+    virtual void cleanSendingPacket(quint32 subChannelNumber, PacketChecker subCheckPacket) override;
     virtual quint32 headerSize() const override;
     virtual QSharedPointer<SocketLike> getBackend() const override;
+    virtual bool isPeerExtended() const override;
+    virtual bool waitForPeer() override;
 
-    bool handleIncomingPacket(const QByteArray &packet);
+    bool handleIncomingPacket(PacketView &packet);
 
     QPointer<DataChannel> parentChannel;
     quint32 channelNumber;
@@ -233,6 +518,7 @@ DataChannelPrivate::DataChannelPrivate(DataChannelPole pole, DataChannel *parent
     : pole(pole)
     , maxPacketSize(1024 * 64), payloadSizeHint(1400)
     , receivingQueue(1024)  // may consume 1024 * 1024 * 64 bytes.
+    , slowDown(false), sendingCredit(DefaultReceivingWindow), consumedBytes(0), receivingWindow(DefaultReceivingWindow), priority(1)
     , q_ptr(parent)
     , broken(false)
 {
@@ -277,11 +563,14 @@ void DataChannelPrivate::abort()
     Q_ASSERT(broken); // must be called by subclasses's close method.
     // FIXME if close() is called by doReceive(), may cause the queue reports deleting not empty.
     for (quint32 i = 0; i < receivingQueue.getting(); ++i) {
-        receivingQueue.put(QByteArray());
+        receivingQueue.put(PacketView());
     }
     for (quint32 i = 0;i < pendingChannels.getting(); ++i) {
         pendingChannels.put(QSharedPointer<VirtualChannel>());
     }
+    for (quint32 i = 0;i < pendingStreams.getting(); ++i) {
+        pendingStreams.put(QSharedPointer<VirtualChannel>());
+    }
     goThrough.open();
     for (QMapIterator<quint32, QWeakPointer<VirtualChannel>> itor(subChannels); itor.hasNext();) {
         const QWeakPointer<VirtualChannel> &subChannel = itor.next().value();
@@ -293,7 +582,7 @@ void DataChannelPrivate::abort()
 }
 
 
-QSharedPointer<VirtualChannel> DataChannelPrivate::makeChannel()
+QSharedPointer<VirtualChannel> DataChannelPrivate::makeChannel(bool stream)
 {
     Q_Q(DataChannel);
     if (isBroken()) {
@@ -308,7 +597,11 @@ QSharedPointer<VirtualChannel> DataChannelPrivate::makeChannel()
     } else {
         ++nextChannelNumber;
     }
-    sendPacketRawAsync(CommandChannelNumber, packMakeChannelRequest(channelNumber));
+    if (stream) {
+        sendPacketRawAsync(CommandChannelNumber, packMakeStreamRequest(channelNumber));
+    } else {
+        sendPacketRawAsync(CommandChannelNumber, packMakeChannelRequest(channelNumber));
+    }
     QSharedPointer<VirtualChannel> channel(new VirtualChannel(q, DataChannelPole::PositivePole, channelNumber));
     channel->setMaxPacketSize(maxPacketSize - sizeof(quint32));
     channel->setPayloadSizeHint(payloadSizeHint - sizeof(quint32));
@@ -327,38 +620,103 @@ QSharedPointer<VirtualChannel> DataChannelPrivate::takeChannel()
 }
 
 
+QSharedPointer<VirtualChannel> DataChannelPrivate::takeStream()
+{
+    // the streams received before the channel is broken are still readable.
+    if (isBroken() && pendingStreams.isEmpty()) {
+        return QSharedPointer<VirtualChannel>();
+    }
+    return pendingStreams.get();
+}
+
+
 QSharedPointer<VirtualChannel> DataChannelPrivate::takeChannel(quint32 channelNumber)
 {
     if (isBroken()) {
         return QSharedPointer<VirtualChannel>();
     }
     QList<QSharedPointer<VirtualChannel>> tmp;
+    QSharedPointer<VirtualChannel> found;
     while (!pendingChannels.isEmpty()) {
         QSharedPointer<VirtualChannel> channel = pendingChannels.get();
         if (channel->channelNumber() == channelNumber) {
-            return channel;
+            found = channel;
+        } else {
+            tmp.append(channel);
         }
     }
-    return QSharedPointer<VirtualChannel>();
+    // the other channels are still pending.
+    for (const QSharedPointer<VirtualChannel> &channel: tmp) {
+        pendingChannels.putForcedly(channel);
+    }
+    return found;
 }
 
 
 QByteArray DataChannelPrivate::recvPacket()
+{
+    return recvView().toByteArray();
+}
+
+
+PacketView DataChannelPrivate::recvView()
 {
     if (receivingQueue.isEmpty() && broken) {
-        return QByteArray();
+        return PacketView();
     }
-    QByteArray packet = receivingQueue.get();
+    const PacketView packet = receivingQueue.get();
     if (packet.isNull()) {
-        return QByteArray();
+        return PacketView();
     }
-    if (receivingQueue.size() == (receivingQueue.capacity() / 2)){
+    if (receivingQueue.size() == (receivingQueue.capacity() / 2) && !broken) {
         sendPacketRawAsync(CommandChannelNumber, packGoThroughRequest());
     }
+    consumedBytes += packet.size();
+    returnCredit(false);
     return packet;
 }
 
 
+void DataChannelPrivate::consumeCredit(int bytes)
+{
+    // counted even if the peer is not known yet, so both sides agree on the credit.
+    sendingCredit -= bytes;
+    if (sendingCredit <= 0) {
+        updateGate();
+    }
+}
+
+
+void DataChannelPrivate::returnCredit(bool force)
+{
+    // return the credit in large pieces.
+    if (broken || consumedBytes <= 0 || (!force && consumedBytes < receivingWindow / 4) || !isPeerExtended()) {
+        return;
+    }
+    sendPacketRawAsync(CommandChannelNumber, packWindowUpdateRequest(static_cast<quint32>(consumedBytes)));
+    consumedBytes = 0;
+}
+
+
+void DataChannelPrivate::updateGate()
+{
+    if (slowDown || (sendingCredit <= 0 && isPeerExtended())) {
+        goThrough.close();
+    } else {
+        goThrough.open();
+    }
+}
+
+
+void DataChannelPrivate::setReceivingWindow(quint32 bytes)
+{
+    // the credit given to peer can not be taken back, so a smaller window holds the next updates.
+    consumedBytes += static_cast<qint64>(bytes) - receivingWindow;
+    receivingWindow = bytes;
+    returnCredit(true);
+}
+
+
 bool DataChannelPrivate::sendPacket(const QByteArray &packet)
 {
     if (static_cast<quint32>(packet.size()) > maxPacketSize) {
@@ -367,6 +725,7 @@ bool DataChannelPrivate::sendPacket(const QByteArray &packet)
     if (!goThrough.wait()) {
         return false;
     }
+    consumeCredit(packet.size());
     return sendPacketRaw(DataChannelNumber, packet);
 }
 
@@ -376,10 +735,57 @@ bool DataChannelPrivate::sendPacketAsync(const QByteArray &packet)
     if (static_cast<quint32>(packet.size()) > maxPacketSize) {
         return false;
     }
+    consumeCredit(packet.size());
     return sendPacketRawAsync(DataChannelNumber, packet);
 }
 
 
+// a stream is sent by a new virtual channel, so its fragments are interleaved with the other packets by the
+// sending queue, and flow-controlled by the window of that channel. the first packet is the size of stream (-1
+// if unknown), and then every fragment starts with a flag, which is StreamFinished for the last one.
+bool DataChannelPrivate::sendStream(QSharedPointer<FileLike> stream)
+{
+    if (stream.isNull()) {
+        return false;
+    }
+    // the old versions close the connection if they receive MAKE_STREAM_REQUEST.
+    if (!waitForPeer()) {
+        return false;
+    }
+    QSharedPointer<VirtualChannel> channel = makeChannel(true);
+    if (channel.isNull()) {
+        return false;
+    }
+    channel->setPriority(priority);
+    uchar header[sizeof(qint64)];
+    qToBigEndian<qint64>(stream->size(), header);
+    if (!channel->sendPacket(QByteArray(reinterpret_cast<char*>(header), sizeof(header)))) {
+        return false;
+    }
+    const qint32 fragmentSize = qMin<qint32>(StreamFragmentSize, static_cast<qint32>(channel->maxPacketSize()) - 1);
+    // the fragment is written to the socket before sendPacket() returns, so the buffer is reused mostly.
+    QByteArray fragment;
+    while (true) {
+        fragment.resize(1 + fragmentSize);
+        qint32 len = stream->read(fragment.data() + 1, fragmentSize);
+        if (len < 0) {
+            channel->abort();
+            return false;
+        } else if (len == 0) {
+            break;
+        }
+        fragment[0] = StreamContinued;
+        fragment.resize(1 + len);
+        if (!channel->sendPacket(fragment)) {
+            return false;
+        }
+    }
+    bool ok = channel->sendPacket(QByteArray(1, StreamFinished));
+    channel->abort();
+    return ok;
+}
+
+
 bool DataChannelPrivate::handleCommand(const QByteArray &packet)
 {
     Q_Q(DataChannel);
@@ -390,14 +796,18 @@ bool DataChannelPrivate::handleCommand(const QByteArray &packet)
         qWarning() << "invalid command.";
         return false;
     }
-    if (command == MAKE_CHANNEL_REQUEST) {
+    if (command == MAKE_CHANNEL_REQUEST || command == MAKE_STREAM_REQUEST) {
         QSharedPointer<VirtualChannel> channel(new VirtualChannel(q, DataChannelPole::NegativePole, channelNumber));
         channel->setMaxPacketSize(maxPacketSize - sizeof(quint32));
         channel->setPayloadSizeHint(payloadSizeHint - sizeof(quint32));
         channel->setCapacity(receivingQueue.capacity());
         subChannels.insert(channelNumber, channel);
         sendPacketRawAsync(CommandChannelNumber, packChannelMadeRequest(channelNumber));
-        pendingChannels.put(channel);
+        if (command == MAKE_STREAM_REQUEST) {
+            pendingStreams.put(channel);
+        } else {
+            pendingChannels.put(channel);
+        }
         return true;
     } else if (command == CHANNEL_MADE_REQUEST) {
         if (subChannels.contains(channelNumber)) {
@@ -425,11 +835,17 @@ bool DataChannelPrivate::handleCommand(const QByteArray &packet)
             }
         }
         return true;
+    } else if (command == WINDOW_UPDATE_REQUEST) {
+        sendingCredit += channelNumber;
+        updateGate();
+        return true;
     } else if (command == SLOW_DOWN_REQUEST) {
-        goThrough.close();
+        slowDown = true;
+        updateGate();
         return true;
     } else if (command == GO_THROUGH_REQUEST) {
-        goThrough.open();
+        slowDown = false;
+        updateGate();
         return true;
     } else if (command == KEEPALIVE_REQUEST) {
         return true;
@@ -458,8 +874,12 @@ SocketChannelPrivate::SocketChannelPrivate(QSharedPointer<SocketLike> connection
     , lastKeepaliveTimestamp(lastActiveTimestamp)
     , keepaliveTimeout(1000 * 10)
     , keepaliveInterval(1000 * 2)
+    , sendingBudget(1024 * 64)
+    , flushDelay(0)
+    , peerExtended(false)
 {
     connection->setOption(Socket::LowDelayOption, true);
+    sendPacketRawAsync(CommandChannelNumber, packHelloRequest());
     operations->spawnWithName(QStringLiteral("receiving"), [this] {
         this->doReceive();
     });
@@ -479,31 +899,49 @@ SocketChannelPrivate::~SocketChannelPrivate()
 }
 
 
-bool SocketChannelPrivate::sendPacketRaw(quint32 channelNumber, const QByteArray &packet)
+bool SocketChannelPrivate::sendPacketRaw(quint32 channelNumber, const PacketBuffer &packet)
 {
     if (broken) {
         return false;
     }
     QSharedPointer<ValueEvent<bool>> done(new ValueEvent<bool>());
-    sendingQueue.put(WritingPacket(channelNumber, packet, done));
+    sendingQueue.put(WritingPacket(channelNumber, packet, done), priorityOf(channelNumber));
+    if (broken) {  // aborted while the queue is full.
+        return false;
+    }
     bool success = done->wait();
     return success;
 }
 
 
-bool SocketChannelPrivate::sendPacketRawAsync(quint32 channelNumber, const QByteArray &packet)
+bool SocketChannelPrivate::sendPacketRawAsync(quint32 channelNumber, const PacketBuffer &packet)
 {
     if (broken) {
         return false;
     }
     QSharedPointer<ValueEvent<bool>> done;
-    sendingQueue.putForcedly(WritingPacket(channelNumber, packet, done));
+    sendingQueue.putForcedly(WritingPacket(channelNumber, packet, done), priorityOf(channelNumber));
     return true;
 }
 
 
+int SocketChannelPrivate::priorityOf(quint32 channelNumber) const
+{
+    const QWeakPointer<VirtualChannel> &channel = subChannels.value(channelNumber);
+    if (channel.isNull()) {
+        return priority;
+    }
+    return channel.toStrongRef()->d_func()->priority;
+}
+
+
 void SocketChannelPrivate::doSend()
 {
+    // the packets queued at the same time are framed into one buffer, and sent by one sendall(), which is
+    // one syscall of tcp, or one record of ssl.
+    QList<WritingPacket> batch;
+    QByteArray data;
+    data.reserve(static_cast<int>(sendingBudget));  // keeps the capacity across batches.
     while (true) {
         WritingPacket writingPacket;
         try {
@@ -523,21 +961,47 @@ void SocketChannelPrivate::doSend()
             return abort();
         }
 
-        uchar header[sizeof(quint32) + sizeof(quint32)];
-        qToBigEndian<quint32>(static_cast<quint32>(writingPacket.packet.size()), header);
-        qToBigEndian<quint32>(writingPacket.channelNumber, header + sizeof(quint32));
-        QByteArray data;
-        data.reserve(static_cast<int>(sizeof(header)) + writingPacket.packet.size());
-        data.append(reinterpret_cast<char*>(header), sizeof(header));
-        data.append(writingPacket.packet);
+        batch.append(writingPacket);
+        quint32 batchSize = headerSize() + static_cast<quint32>(writingPacket.packet.size());
+        bool delayed = flushDelay <= 0;
+        while (batchSize < sendingBudget) {
+            if (sendingQueue.isEmpty()) {
+                if (delayed) {
+                    break;
+                }
+                // wait a little for more packets, like the nagle algorithm.
+                delayed = true;
+                try {
+                    Coroutine::msleep(static_cast<quint32>(flushDelay));
+                } catch (CoroutineExitException) {
+                    finishBatch(&batch, false);
+                    return abort();
+                }
+                continue;
+            }
+            const WritingPacket &nextPacket = sendingQueue.take();
+            if (!nextPacket.isValid()) {
+                break;
+            }
+            batch.append(nextPacket);
+            batchSize += headerSize() + static_cast<quint32>(nextPacket.packet.size());
+        }
+
+        data.resize(0);
+        for (const WritingPacket &packet: batch) {
+            uchar header[sizeof(quint32) + sizeof(quint32)];
+            qToBigEndian<quint32>(static_cast<quint32>(packet.packet.size()), header);
+            qToBigEndian<quint32>(packet.channelNumber, header + sizeof(quint32));
+            data.append(reinterpret_cast<char*>(header), sizeof(header));
+            data.append(packet.packet.headers(), packet.packet.headersSize());
+            data.append(packet.packet.payload);
+        }
 
         int sentBytes;
         try {
             sentBytes = connection->sendall(data);
         } catch (CoroutineExitException) {
-            if (!writingPacket.done.isNull()) {
-                writingPacket.done->send(false);
-            }
+            finishBatch(&batch, false);
 #ifdef DEBUG_PROTOCOL
             qDebug() << "coroutine is killed while sending packet.";
 #endif
@@ -546,26 +1010,32 @@ void SocketChannelPrivate::doSend()
 #ifdef DEBUG_PROTOCOL
             qDebug() << "unhandled exception while sending packet.";
 #endif
+            finishBatch(&batch, false);
             return abort();
         }
 
         if (sentBytes == data.size()) {
-            if (!writingPacket.done.isNull()) {
-                writingPacket.done->send(true);
-            }
+            finishBatch(&batch, true);
             lastKeepaliveTimestamp = QDateTime::currentMSecsSinceEpoch();
         } else {
-            if (writingPacket.done.isNull()) {
-//                continue; // why do this?
-            } else {
-                writingPacket.done->send(false);
-            }
+            finishBatch(&batch, false);
             return abort();
         }
     }
 }
 
 
+void SocketChannelPrivate::finishBatch(QList<WritingPacket> *batch, bool success)
+{
+    for (const WritingPacket &writingPacket: *batch) {
+        if (!writingPacket.done.isNull()) {
+            writingPacket.done->send(success);
+        }
+    }
+    batch->clear();
+}
+
+
 void SocketChannelPrivate::doReceive()
 {
     const size_t headerSize = sizeof(quint32) + sizeof(quint32);
@@ -604,11 +1074,20 @@ void SocketChannelPrivate::doReceive()
         } catch (...) {
             return abort();
         }
+        if (!peerKnown.isSet()) {
+            // the old versions do not send the hello packet.
+            peerExtended = channelNumber == CommandChannelNumber && packet == packHelloRequest();
+            peerKnown.set();
+            if (peerExtended) {
+                returnCredit(true);
+                continue;
+            }
+        }
         if (channelNumber == DataChannelNumber) {
             if (receivingQueue.size() == (receivingQueue.capacity() * 3 / 4)) {
                 sendPacketRawAsync(CommandChannelNumber, packSlowDownRequest());
             }
-            receivingQueue.putForcedly(packet);
+            receivingQueue.putForcedly(PacketView(packet));
         } else if (channelNumber == CommandChannelNumber) {
             if (!handleCommand(packet)) {
                 return abort();
@@ -621,7 +1100,8 @@ void SocketChannelPrivate::doReceive()
 #endif
                 subChannels.remove(channelNumber);
             } else {
-                channel.toStrongRef()->d_func()->handleIncomingPacket(packet);
+                PacketView view(packet);
+                channel.toStrongRef()->d_func()->handleIncomingPacket(view);
             }
         } else {
 #ifdef DEBUG_PROTOCOL
@@ -655,9 +1135,10 @@ void SocketChannelPrivate::abort()
         return;
     }
     broken = true;
+    peerKnown.set();
     connection->abort();
     while (!sendingQueue.isEmpty()) {
-        const WritingPacket &writingPacket = sendingQueue.get();
+        const WritingPacket &writingPacket = sendingQueue.take();
         if (!writingPacket.done.isNull()) {
             writingPacket.done->send(false);
         }
@@ -682,7 +1163,7 @@ bool SocketChannelPrivate::isBroken() const
 }
 
 
-static inline bool alwayTrue(const QByteArray &) {
+static inline bool alwayTrue(const char *, int) {
     return true;
 }
 
@@ -700,22 +1181,9 @@ void SocketChannelPrivate::cleanChannel(quint32 channelNumber, bool sendDestroyP
 }
 
 
-void SocketChannelPrivate::cleanSendingPacket(quint32 subChannelNumber, std::function<bool (const QByteArray &)> subCheckPacket)
+void SocketChannelPrivate::cleanSendingPacket(quint32 subChannelNumber, PacketChecker subCheckPacket)
 {
-    QList<WritingPacket> reserved;
-    while (!sendingQueue.isEmpty()) {
-        const WritingPacket &writingPacket = sendingQueue.get();
-        if (writingPacket.channelNumber == subChannelNumber && subCheckPacket(writingPacket.packet)) {
-            if (!writingPacket.done.isNull()) {
-                writingPacket.done.data()->send(false);
-            }
-        } else {
-            reserved.append(writingPacket);
-        }
-    }
-    for (const WritingPacket &writingPacket: reserved) {
-        sendingQueue.putForcedly(writingPacket);
-    }
+    sendingQueue.clean(subChannelNumber, subCheckPacket);
 }
 
 
@@ -731,6 +1199,20 @@ QSharedPointer<SocketLike> SocketChannelPrivate::getBackend() const
 }
 
 
+bool SocketChannelPrivate::isPeerExtended() const
+{
+    return peerExtended;
+}
+
+
+bool SocketChannelPrivate::waitForPeer()
+{
+    // the old versions send keepalive packets at least, so it does not wait forever.
+    peerKnown.wait();
+    return peerExtended && !broken;
+}
+
+
 VirtualChannelPrivate::VirtualChannelPrivate(DataChannel *parentChannel, DataChannelPole pole, quint32 channelNumber, VirtualChannel *parent)
     :DataChannelPrivate(pole, parent), parentChannel(parentChannel), channelNumber(channelNumber)
 {
@@ -743,41 +1225,34 @@ VirtualChannelPrivate::~VirtualChannelPrivate()
 }
 
 
-bool VirtualChannelPrivate::sendPacketRaw(quint32 channelNumber, const QByteArray &packet)
+bool VirtualChannelPrivate::sendPacketRaw(quint32 channelNumber, const PacketBuffer &packet)
 {
     if (broken || parentChannel.isNull()) {
         return false;
     }
-    uchar header[sizeof(quint32)];
-    qToBigEndian(channelNumber, header);
-    QByteArray data;
-    data.reserve(packet.size() + static_cast<int>(sizeof(quint32)));
-    data.append(reinterpret_cast<char*>(header), sizeof(quint32));
-    data.append(packet);
-    return getPrivateHelper(parentChannel)->sendPacketRaw(this->channelNumber, data);
+    PacketBuffer buffer(packet);
+    if (!buffer.prependHeader(channelNumber)) {
+        qWarning() << "virtual channels are nested too deep.";
+        return false;
+    }
+    return getPrivateHelper(parentChannel)->sendPacketRaw(this->channelNumber, buffer);
 }
 
 
-bool VirtualChannelPrivate::handleIncomingPacket(const QByteArray &packet)
+bool VirtualChannelPrivate::handleIncomingPacket(PacketView &packet)
 {
-    const int headerSize = sizeof(quint32);
-    if (packet.size() < headerSize) {
+    quint32 channelNumber;
+    if (!packet.takeHeader(&channelNumber)) {
         return false;
     }
-#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-    quint32 channelNumber = qFromBigEndian<quint32>(packet.constData());
-#else
-    quint32 channelNumber = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(packet.constData()));
-#endif
-    const QByteArray &payload = packet.mid(headerSize);
     if (channelNumber == DataChannelNumber) {
-        receivingQueue.putForcedly(payload);
-        if(receivingQueue.size() == (receivingQueue.capacity() * 3 / 4)) {
+        if (receivingQueue.size() == (receivingQueue.capacity() * 3 / 4)) {
             sendPacketRawAsync(CommandChannelNumber, packSlowDownRequest());
         }
+        receivingQueue.putForcedly(packet);
         return true;
     } else if (channelNumber == CommandChannelNumber) {
-        return handleCommand(payload);
+        return handleCommand(packet.toByteArray());
     } else if (subChannels.contains(channelNumber)) {
         QWeakPointer<VirtualChannel> channel = subChannels.value(channelNumber);
         if (channel.isNull()) {
@@ -787,7 +1262,7 @@ bool VirtualChannelPrivate::handleIncomingPacket(const QByteArray &packet)
             subChannels.remove(channelNumber);
             return false;
         }
-        channel.toStrongRef()->d_func()->handleIncomingPacket(payload);
+        channel.toStrongRef()->d_func()->handleIncomingPacket(packet);
         return true;
     } else {
 #ifdef DEBUG_PROTOCOL
@@ -820,39 +1295,39 @@ void VirtualChannelPrivate::cleanChannel(quint32 channelNumber, bool sendDestroy
     if (sendDestroyPacket) {
         notifyChannelClose(channelNumber);
     }
-    getPrivateHelper(parentChannel)->cleanSendingPacket(this->channelNumber, [channelNumber](const QByteArray &packet) -> bool{
+    getPrivateHelper(parentChannel)->cleanSendingPacket(this->channelNumber, [channelNumber](const char *headers, int size) -> bool{
         const int headerSize = sizeof(quint32);
-        if (packet.size() < headerSize) {
+        if (size < headerSize) {
             return false;
         }
 #if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-        quint32 channelNumberInPacket = qFromBigEndian<quint32>(packet.constData());
+        quint32 channelNumberInPacket = qFromBigEndian<quint32>(headers);
 #else
-        quint32 channelNumberInPacket = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(packet.constData()));
+        quint32 channelNumberInPacket = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(headers));
 #endif
         return channelNumberInPacket == channelNumber;
     });
 }
 
 
-void VirtualChannelPrivate::cleanSendingPacket(quint32 subChannelNumber, std::function<bool(const QByteArray &packet)> subCheckPacket)
+void VirtualChannelPrivate::cleanSendingPacket(quint32 subChannelNumber, PacketChecker subCheckPacket)
 {
     if (broken || parentChannel.isNull())
         return;
-    getPrivateHelper(parentChannel)->cleanSendingPacket(this->channelNumber, [subChannelNumber, subCheckPacket](const QByteArray &packet) {
+    getPrivateHelper(parentChannel)->cleanSendingPacket(this->channelNumber, [subChannelNumber, subCheckPacket](const char *headers, int size) {
         const int headerSize = sizeof(quint32);
-        if (packet.size() < headerSize) {
+        if (size < headerSize) {
             return false;
         }
 #if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-        quint32 channelNumberInPacket = qFromBigEndian<quint32>(packet.constData());
+        quint32 channelNumberInPacket = qFromBigEndian<quint32>(headers);
 #else
-        quint32 channelNumberInPacket = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(packet.constData()));
+        quint32 channelNumberInPacket = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(headers));
 #endif
         if (channelNumberInPacket != subChannelNumber) {
             return false;
         }
-        return subCheckPacket(packet.mid(headerSize));
+        return subCheckPacket(headers + headerSize, size - headerSize);
     });
 }
 
@@ -863,18 +1338,16 @@ bool VirtualChannelPrivate::isBroken() const
 }
 
 
-bool VirtualChannelPrivate::sendPacketRawAsync(quint32 channelNumber, const QByteArray &packet)
+bool VirtualChannelPrivate::sendPacketRawAsync(quint32 channelNumber, const PacketBuffer &packet)
 {
     if (broken || parentChannel.isNull())
         return false;
-    uchar header[sizeof(quint32)];
-    qToBigEndian(channelNumber, header);
-
-    QByteArray data;
-    data.reserve(packet.size() + static_cast<int>(sizeof(quint32)));
-    data.append(reinterpret_cast<char*>(header), sizeof(header));
-    data.append(packet);
-    return getPrivateHelper(parentChannel)->sendPacketRawAsync(this->channelNumber, data);
+    PacketBuffer buffer(packet);
+    if (!buffer.prependHeader(channelNumber)) {
+        qWarning() << "virtual channels are nested too deep.";
+        return false;
+    }
+    return getPrivateHelper(parentChannel)->sendPacketRawAsync(this->channelNumber, buffer);
 }
 
 
@@ -893,6 +1366,24 @@ QSharedPointer<SocketLike> VirtualChannelPrivate::getBackend() const
 }
 
 
+bool VirtualChannelPrivate::isPeerExtended() const
+{
+    if (broken || parentChannel.isNull()) {
+        return false;
+    }
+    return getPrivateHelper(parentChannel)->isPeerExtended();
+}
+
+
+bool VirtualChannelPrivate::waitForPeer()
+{
+    if (broken || parentChannel.isNull()) {
+        return false;
+    }
+    return getPrivateHelper(parentChannel)->waitForPeer();
+}
+
+
 SocketChannel::SocketChannel(QSharedPointer<Socket> connection, DataChannelPole pole)
     :DataChannel(new SocketChannelPrivate(asSocketLike(connection), pole, this))
 {
@@ -933,6 +1424,20 @@ float SocketChannel::keepaliveTimeout() const
 }
 
 
+void SocketChannel::setFlushDelay(int msecs)
+{
+    Q_D(SocketChannel);
+    d->flushDelay = qMax(0, msecs);
+}
+
+
+int SocketChannel::flushDelay() const
+{
+    Q_D(const SocketChannel);
+    return d->flushDelay;
+}
+
+
 VirtualChannel::VirtualChannel(DataChannel *parentChannel, DataChannelPole pole, quint32 channelNumber)
     :DataChannel(new VirtualChannelPrivate(parentChannel, pole, channelNumber, this))
 {
@@ -940,6 +1445,105 @@ VirtualChannel::VirtualChannel(DataChannel *parentChannel, DataChannelPole pole,
 }
 
 
+namespace {
+
+// reads a stream sent by DataChannel::sendStream() while it is being received.
+class StreamImpl: public FileLike
+{
+public:
+    StreamImpl(QSharedPointer<VirtualChannel> channel)
+        : channel(channel), offset(0), streamSize(-1), headerReceived(false), finished(false) {}
+    virtual ~StreamImpl() override;
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(char *data, qint32 size) override;
+    virtual void close() override;
+    virtual qint64 size() override;
+private:
+    bool receiveHeader();
+private:
+    QSharedPointer<VirtualChannel> channel;
+    PacketView fragment;
+    qint32 offset;
+    qint64 streamSize;
+    bool headerReceived;
+    bool finished;
+};
+
+
+StreamImpl::~StreamImpl()
+{
+    // the sender stops if the stream is not read completely.
+    channel->abort();
+}
+
+
+bool StreamImpl::receiveHeader()
+{
+    if (headerReceived) {
+        return true;
+    }
+    const QByteArray &header = channel->recvPacket();
+    if (header.size() != static_cast<int>(sizeof(qint64))) {
+        return false;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    streamSize = qFromBigEndian<qint64>(header.constData());
+#else
+    streamSize = qFromBigEndian<qint64>(reinterpret_cast<const uchar*>(header.constData()));
+#endif
+    headerReceived = true;
+    return true;
+}
+
+
+qint32 StreamImpl::read(char *data, qint32 size)
+{
+    if (size <= 0 || !receiveHeader()) {
+        return -1;
+    }
+    while (offset >= fragment.size()) {
+        if (finished) {
+            return 0;
+        }
+        // read the payload in place, without copying it to a new QByteArray.
+        fragment = DataChannelPrivate::getPrivateHelper(channel)->recvView();
+        if (fragment.size() <= 0) {
+            // the channel is closed before the last fragment.
+            return -1;
+        }
+        finished = fragment.constData()[0] == StreamFinished;
+        offset = 1;
+    }
+    qint32 len = qMin(size, fragment.size() - offset);
+    memcpy(data, fragment.constData() + offset, static_cast<size_t>(len));
+    offset += len;
+    return len;
+}
+
+
+qint32 StreamImpl::write(char *, qint32)
+{
+    return -1;
+}
+
+
+void StreamImpl::close()
+{
+    channel->abort();
+}
+
+
+qint64 StreamImpl::size()
+{
+    if (!receiveHeader()) {
+        return -1;
+    }
+    return streamSize;
+}
+
+}
+
+
 DataChannel::DataChannel(DataChannelPrivate *d)
     :d_ptr(d)
 {
@@ -994,6 +1598,31 @@ QSharedPointer<VirtualChannel> DataChannel::makeChannel()
 }
 
 
+bool DataChannel::sendStream(QSharedPointer<FileLike> stream)
+{
+    Q_D(DataChannel);
+    return d->sendStream(stream);
+}
+
+
+bool DataChannel::sendStream(const QByteArray &data)
+{
+    Q_D(DataChannel);
+    return d->sendStream(FileLike::bytes(data));
+}
+
+
+QSharedPointer<FileLike> DataChannel::takeStream()
+{
+    Q_D(DataChannel);
+    const QSharedPointer<VirtualChannel> &channel = d->takeStream();
+    if (channel.isNull()) {
+        return QSharedPointer<FileLike>();
+    }
+    return QSharedPointer<StreamImpl>::create(channel).dynamicCast<FileLike>();
+}
+
+
 QSharedPointer<VirtualChannel> DataChannel::takeChannel()
 {
     Q_D(DataChannel);
@@ -1058,6 +1687,34 @@ quint32 DataChannel::capacity() const
 }
 
 
+void DataChannel::setReceivingWindow(quint32 bytes)
+{
+    Q_D(DataChannel);
+    d->setReceivingWindow(bytes);
+}
+
+
+quint32 DataChannel::receivingWindow() const
+{
+    Q_D(const DataChannel);
+    return d->receivingWindow;
+}
+
+
+void DataChannel::setPriority(int priority)
+{
+    Q_D(DataChannel);
+    d->priority = qBound(1, priority, 64);
+}
+
+
+int DataChannel::priority() const
+{
+    Q_D(const DataChannel);
+    return d->priority;
+}
+
+
 DataChannelPole DataChannel::pole() const
 {
     Q_D(const DataChannel);
@@ -1129,13 +1786,14 @@ public:
 public:
     QSharedPointer<SocketLike> getBackend() const;
 public:
-    QByteArray buf;
+    PacketView buf;
+    qint32 offset;
     QSharedPointer<DataChannel> channel;
 };
 
 
 SocketLikeImpl::SocketLikeImpl(QSharedPointer<DataChannel> channel)
-    :channel(channel)
+    :offset(0), channel(channel)
 {}
 
 
@@ -1347,15 +2005,16 @@ qint32 SocketLikeImpl::recv(char *data, qint32 size)
     if (size <= 0) {
         return -1;
     }
-    if (buf.isEmpty()) {
-        buf = channel->recvPacket();
-        if (buf.isEmpty()) {
+    if (offset >= buf.size()) {
+        buf = DataChannelPrivate::getPrivateHelper(channel)->recvView();
+        offset = 0;
+        if (buf.size() <= 0) {
             return 0;
         }
     }
-    qint32 len = qMin(size, static_cast<qint32>(buf.size()));
-    memcpy(data, buf.data(), static_cast<size_t>(len));
-    buf.remove(0, len);
+    qint32 len = qMin(size, buf.size() - offset);
+    memcpy(data, buf.constData() + offset, static_cast<size_t>(len));
+    offset += len;
     return len;
 }
 
@@ -1365,19 +2024,15 @@ qint32 SocketLikeImpl::recvall(char *data, qint32 size)
     if (size <= 0) {
         return -1;
     }
-    while (buf.size() < size) {
-        const QByteArray &packet = channel->recvPacket();
-        if (packet.isEmpty()) {
+    qint32 total = 0;
+    while (total < size) {
+        qint32 len = recv(data + total, size - total);
+        if (len <= 0) {
             break;
         }
-        buf.append(packet);
+        total += len;
     }
-    qint32 len = qMin(size, static_cast<qint32>(buf.size()));
-    if (len > 0) {
-        memcpy(data, buf.data(), static_cast<size_t>(len));
-        buf.remove(0, len);
-    }
-    return len;
+    return total;
 }
 
 
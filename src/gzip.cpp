@@ -126,4 +126,136 @@ bool qGzipDecompress(QSharedPointer<FileLike> input, QSharedPointer<FileLike> ou
 }
 
 
+class GzipDecompressorPrivate
+{
+public:
+    GzipDecompressorPrivate();
+    ~GzipDecompressorPrivate();
+    bool init(int windowBits);
+public:
+    z_stream zstream;
+    QByteArray input;
+    bool initialized;
+    bool finished;
+    bool triedRawDeflate;
+    bool hasOutput;
+    bool pendingOutput;
+};
+
+
+GzipDecompressorPrivate::GzipDecompressorPrivate()
+    : initialized(false), finished(false), triedRawDeflate(false), hasOutput(false), pendingOutput(false)
+{
+    initialized = init(GZIP_WINDOWS_BIT);
+}
+
+
+GzipDecompressorPrivate::~GzipDecompressorPrivate()
+{
+    if (initialized) {
+        inflateEnd(&zstream);
+    }
+}
+
+
+bool GzipDecompressorPrivate::init(int windowBits)
+{
+    zstream.zalloc = nullptr;
+    zstream.zfree = nullptr;
+    zstream.opaque = nullptr;
+    zstream.avail_in = 0;
+    zstream.next_in = nullptr;
+    return inflateInit2(&zstream, windowBits) == Z_OK;
+}
+
+
+GzipDecompressor::GzipDecompressor()
+    : d_ptr(new GzipDecompressorPrivate())
+{
+}
+
+
+GzipDecompressor::~GzipDecompressor()
+{
+    delete d_ptr;
+}
+
+
+void GzipDecompressor::addData(const char *data, qint32 size)
+{
+    Q_D(GzipDecompressor);
+    if (size <= 0) {
+        return;
+    }
+    // zlib points into `input` directly. the consumed bytes are kept until the stream format is detected,
+    // so we can restart as raw deflate stream.
+    int consumed = d->input.size() - static_cast<int>(d->zstream.avail_in);
+    if (d->triedRawDeflate && consumed > 0) {
+        d->input.remove(0, consumed);
+        consumed = 0;
+    }
+    d->input.append(data, size);
+    d->zstream.next_in = reinterpret_cast<Bytef*>(d->input.data()) + consumed;
+    d->zstream.avail_in = static_cast<uint>(d->input.size() - consumed);
+}
+
+
+qint32 GzipDecompressor::decompress(char *data, qint32 size)
+{
+    Q_D(GzipDecompressor);
+    if (!d->initialized) {
+        return -1;
+    }
+    if (d->finished || size <= 0 || (d->zstream.avail_in == 0 && !d->pendingOutput)) {
+        return 0;
+    }
+    d->zstream.next_out = reinterpret_cast<Bytef*>(data);
+    d->zstream.avail_out = static_cast<uint>(size);
+    int ret = inflate(&d->zstream, Z_SYNC_FLUSH);
+    if (ret == Z_DATA_ERROR && !d->triedRawDeflate && !d->hasOutput) {
+        // some servers send raw deflate stream as `Content-Encoding: deflate`.
+        d->triedRawDeflate = true;
+        inflateEnd(&d->zstream);
+        d->initialized = d->init(-MAX_WBITS);
+        if (!d->initialized) {
+            return -1;
+        }
+        d->zstream.next_in = reinterpret_cast<Bytef*>(d->input.data());
+        d->zstream.avail_in = static_cast<uint>(d->input.size());
+        return decompress(data, size);
+    } else if (ret < 0 && ret != Z_BUF_ERROR) {
+        return -1;
+    } else if (ret == Z_NEED_DICT) {
+        return -1;
+    }
+    if (d->zstream.total_in >= 2) {
+        // the magic header is checked.
+        d->triedRawDeflate = true;
+    }
+    d->pendingOutput = (d->zstream.avail_out == 0);
+    if (ret == Z_STREAM_END) {
+        d->finished = true;
+    }
+    qint32 have = size - static_cast<qint32>(d->zstream.avail_out);
+    if (have > 0) {
+        d->hasOutput = true;
+    }
+    return have;
+}
+
+
+bool GzipDecompressor::needsInput() const
+{
+    Q_D(const GzipDecompressor);
+    return !d->finished && d->zstream.avail_in == 0 && !d->pendingOutput;
+}
+
+
+bool GzipDecompressor::isFinished() const
+{
+    Q_D(const GzipDecompressor);
+    return d->finished;
+}
+
+
 QTNETWORKNG_NAMESPACE_END
@@ -0,0 +1,289 @@
+#include <QtCore/qfile.h>
+#include <QtCore/qfileinfo.h>
+#include <openssl/hmac.h>
+#include "../include/hash_service.h"
+#include "../include/coroutine_utils.h"
+#include "../include/private/crypto_p.h"
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+namespace {
+
+// a digest or HMAC context, which may be used in any thread, but one thread at a time.
+class Hasher
+{
+public:
+    Hasher(MessageDigest::Algorithm algo, const QByteArray &key);
+    ~Hasher();
+    bool update(const char *data, qint64 size);
+    QByteArray final();
+    bool isValid() const { return valid; }
+private:
+    EVP_MD_CTX *mdContext;
+    HMAC_CTX *hmacContext;
+    bool valid;
+};
+
+
+Hasher::Hasher(MessageDigest::Algorithm algo, const QByteArray &key)
+    : mdContext(nullptr), hmacContext(nullptr), valid(false)
+{
+    initOpenSSL();
+    const EVP_MD *md = getOpenSSL_MD(algo);
+    if (!md) {
+        return;
+    }
+    if (key.isEmpty()) {
+        mdContext = EVP_MD_CTX_new();
+        valid = mdContext && EVP_DigestInit_ex(mdContext, md, nullptr);
+    } else {
+        hmacContext = HMAC_CTX_new();
+        valid = hmacContext && HMAC_Init_ex(hmacContext, key.constData(), key.size(), md, nullptr);
+    }
+}
+
+
+Hasher::~Hasher()
+{
+    if (mdContext) {
+        EVP_MD_CTX_free(mdContext);
+    }
+    if (hmacContext) {
+        HMAC_CTX_free(hmacContext);
+    }
+}
+
+
+bool Hasher::update(const char *data, qint64 size)
+{
+    if (!valid || size < 0) {
+        return false;
+    }
+    if (mdContext) {
+        valid = EVP_DigestUpdate(mdContext, data, static_cast<size_t>(size));
+    } else {
+        valid = HMAC_Update(hmacContext, reinterpret_cast<const unsigned char *>(data), static_cast<size_t>(size));
+    }
+    return valid;
+}
+
+
+QByteArray Hasher::final()
+{
+    if (!valid) {
+        return QByteArray();
+    }
+    unsigned char result[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if (mdContext) {
+        valid = EVP_DigestFinal_ex(mdContext, result, &len);
+    } else {
+        valid = HMAC_Final(hmacContext, result, &len);
+    }
+    if (!valid) {
+        return QByteArray();
+    }
+    return QByteArray(reinterpret_cast<const char *>(result), static_cast<int>(len));
+}
+
+}  // anonymous namespace
+
+
+class HashServicePrivate
+{
+public:
+    HashServicePrivate(int threads)
+        : pool(new ThreadPool(threads)), chunkSize(1024 * 1024 * 8) {}
+    // runs in worker threads.
+    static QByteArray hashFile(const QString &filePath, qint64 offset, qint64 size, MessageDigest::Algorithm algo,
+                               const QByteArray &key, int chunkSize, const QByteArray &prefix);
+public:
+    QSharedPointer<ThreadPool> pool;
+    int chunkSize;
+};
+
+
+QByteArray HashServicePrivate::hashFile(const QString &filePath, qint64 offset, qint64 size,
+                                        MessageDigest::Algorithm algo, const QByteArray &key, int chunkSize,
+                                        const QByteArray &prefix)
+{
+    QFile f(filePath);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    Hasher hasher(algo, key);
+    if (!hasher.update(prefix.constData(), prefix.size())) {
+        return QByteArray();
+    }
+    const qint64 end = size < 0 ? f.size() : qMin(f.size(), offset + size);
+    QByteArray buf;
+    qint64 pos = offset;
+    while (pos < end) {
+        qint64 len = qMin<qint64>(chunkSize, end - pos);
+        uchar *mapped = f.map(pos, len);
+        if (mapped) {
+            bool ok = hasher.update(reinterpret_cast<const char *>(mapped), len);
+            f.unmap(mapped);
+            if (!ok) {
+                return QByteArray();
+            }
+        } else {
+            // some file systems do not support mapping.
+            if (buf.size() < len) {
+                buf.resize(static_cast<int>(len));
+            }
+            if (!f.seek(pos)) {
+                return QByteArray();
+            }
+            len = f.read(buf.data(), len);
+            if (len <= 0 || !hasher.update(buf.constData(), len)) {
+                return QByteArray();
+            }
+        }
+        pos += len;
+    }
+    return hasher.final();
+}
+
+
+HashService::HashService(int threads)
+    : d_ptr(new HashServicePrivate(threads))
+{
+}
+
+
+HashService::~HashService()
+{
+    delete d_ptr;
+}
+
+
+QByteArray HashService::hash(const QString &filePath, MessageDigest::Algorithm algo, const QByteArray &hmacKey)
+{
+    Q_D(HashService);
+    int chunkSize = d->chunkSize;
+    return d->pool->call<QByteArray>([filePath, algo, hmacKey, chunkSize] {
+        return HashServicePrivate::hashFile(filePath, 0, -1, algo, hmacKey, chunkSize, QByteArray());
+    });
+}
+
+
+QByteArray HashService::hash(QSharedPointer<FileLike> file, MessageDigest::Algorithm algo, const QByteArray &hmacKey)
+{
+    Q_D(HashService);
+    if (file.isNull()) {
+        return QByteArray();
+    }
+    QSharedPointer<Hasher> hasher(new Hasher(algo, hmacKey));
+    if (!hasher->isValid()) {
+        return QByteArray();
+    }
+    QSharedPointer<ThreadPool> pool = d->pool;
+    QSharedPointer<bool> ok(new bool(true));
+    QSharedPointer<Coroutine> hashing;
+    // read the next chunk while the last one is hashed.
+    QByteArray buffers[2] = {QByteArray(d->chunkSize, Qt::Uninitialized), QByteArray(d->chunkSize, Qt::Uninitialized)};
+    bool eof = false;
+    bool readError = false;
+    for (int i = 0; !eof; ++i) {
+        QByteArray &buf = buffers[i % 2];
+        qint32 total = 0;
+        while (total < buf.size()) {
+            qint32 n = file->read(buf.data() + total, buf.size() - total);
+            if (n < 0) {
+                readError = true;
+            }
+            if (n <= 0) {
+                eof = true;
+                break;
+            }
+            total += n;
+        }
+        if (!hashing.isNull()) {
+            hashing->join();
+        }
+        if (readError || !*ok) {
+            return QByteArray();
+        }
+        if (total > 0) {
+            // the worker may outlive this function if the caller is killed, so it shares the buffer instead of
+            // pointing into it. reading into a buffer still shared detaches it, the worker keeps its data.
+            const QByteArray chunk = buf;
+            hashing.reset(Coroutine::spawn([pool, hasher, ok, chunk, total] {
+                *ok = pool->call<bool>([hasher, chunk, total] {
+                    return hasher->update(chunk.constData(), total);
+                });
+            }));
+        } else {
+            hashing.clear();
+        }
+    }
+    if (!hashing.isNull()) {
+        hashing->join();
+    }
+    if (!*ok) {
+        return QByteArray();
+    }
+    return pool->call<QByteArray>([hasher] {
+        return hasher->final();
+    });
+}
+
+
+QList<QByteArray> HashService::hash(const QStringList &filePaths, MessageDigest::Algorithm algo, const QByteArray &hmacKey)
+{
+    Q_D(HashService);
+    int chunkSize = d->chunkSize;
+    std::function<QByteArray(QString)> func = [algo, hmacKey, chunkSize] (QString filePath) {
+        return HashServicePrivate::hashFile(filePath, 0, -1, algo, hmacKey, chunkSize, QByteArray());
+    };
+    return d->pool->map<QByteArray, QString>(func, filePaths);
+}
+
+
+QByteArray HashService::treeHash(const QString &filePath, MessageDigest::Algorithm algo, qint64 leafSize,
+                                 const QByteArray &hmacKey)
+{
+    Q_D(HashService);
+    QFileInfo fileInfo(filePath);
+    if (leafSize <= 0 || !fileInfo.isFile()) {
+        return QByteArray();
+    }
+    QList<qint64> offsets;
+    for (qint64 offset = 0; offset < fileInfo.size(); offset += leafSize) {
+        offsets.append(offset);
+    }
+    int chunkSize = d->chunkSize;
+    std::function<QByteArray(qint64)> func = [filePath, leafSize, algo, hmacKey, chunkSize] (qint64 offset) {
+        return HashServicePrivate::hashFile(filePath, offset, leafSize, algo, hmacKey, chunkSize, QByteArray(1, '\x00'));
+    };
+    const QList<QByteArray> &leaves = d->pool->map<QByteArray, qint64>(func, offsets);
+    Hasher root(algo, hmacKey);
+    root.update("\x01", 1);
+    for (const QByteArray &leaf: leaves) {
+        if (leaf.isEmpty()) {
+            return QByteArray();
+        }
+        root.update(leaf.constData(), leaf.size());
+    }
+    return root.final();
+}
+
+
+int HashService::chunkSize() const
+{
+    Q_D(const HashService);
+    return d->chunkSize;
+}
+
+
+void HashService::setChunkSize(int chunkSize)
+{
+    Q_D(HashService);
+    if (chunkSize > 0) {
+        d->chunkSize = chunkSize;
+    }
+}
+
+
+QTNETWORKNG_NAMESPACE_END
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <QtCore/qurl.h>
 #include <QtCore/qurlquery.h>
 #include <QtCore/qjsondocument.h>
@@ -6,6 +7,9 @@
 #include <QtCore/qendian.h>
 #include <QtCore/qdatastream.h>
 #include <QtCore/qcryptographichash.h>
+#include <QtCore/qcache.h>
+#include <QtCore/qsavefile.h>
+#include <QtCore/qdiriterator.h>
 #include "../include/private/http_p.h"
 #include "../include/socks5_proxy.h"
 #ifdef QTNG_HAVE_ZLIB
@@ -392,6 +396,252 @@ void HttpRequest::setBody(const QUrlQuery &form)
     d->body = form.toString(QUrl::FullyEncoded).toUtf8();
 }
 
+class HttpBodyReader
+{
+public:
+    enum State {
+        ReadingContent,
+        ReadingChunkSize,
+        ReadingChunkData,
+        ReadingChunkEnd,
+        ReadingTrailers,
+        Finished,
+        Failed,
+    };
+    HttpBodyReader(QSharedPointer<SocketLike> stream, const QByteArray &buf)
+        : stream(stream)
+#ifdef QTNG_HAVE_ZLIB
+        , compressedBytes(0)
+#endif
+        , buf(buf), left(-1), total(0), maxBodySize(0), pos(0), state(ReadingContent) {}
+public:
+    qint32 read(char *data, qint32 size);
+    bool atEnd() const { return state == Finished; }
+    QByteArray leftBytes() const { return buf.mid(pos); }
+private:
+    qint32 readDecoded(char *data, qint32 size);
+    qint32 readRaw(char *data, qint32 size);
+    qint32 readData(char *data, qint32 size);
+    bool readLine(QByteArray *line);
+    qint32 fail(RequestError *error);
+public:
+    QSharedPointer<SocketLike> stream;
+    QSharedPointer<RequestError> error;
+#ifdef QTNG_HAVE_ZLIB
+    QSharedPointer<GzipDecompressor> decompressor;
+    QByteArray compressed;
+    qint64 compressedBytes;
+#endif
+    QByteArray buf;
+    qint64 left;  // -1 means reading until the connection is closed.
+    qint64 total;
+    qint64 maxBodySize;
+    int pos;
+    State state;
+};
+
+
+qint32 HttpBodyReader::fail(RequestError *error)
+{
+    if (error) {
+        this->error.reset(error);
+    }
+    state = Failed;
+    return -1;
+}
+
+
+bool HttpBodyReader::readLine(QByteArray *line)
+{
+    const int MaxLineLength = 1024 * 4;
+    while (true) {
+        int i = buf.indexOf('\n', pos);
+        if (i >= 0) {
+            int end = i;
+            if (end > pos && buf.at(end - 1) == '\r') {
+                --end;
+            }
+            *line = buf.mid(pos, end - pos);
+            pos = i + 1;
+            return true;
+        }
+        if (buf.size() - pos > MaxLineLength) {
+            error.reset(new ChunkedEncodingError());
+            return false;
+        }
+        if (stream.isNull()) {
+            error.reset(new UnrewindableBodyError());
+            return false;
+        }
+        buf.remove(0, pos);
+        pos = 0;
+        const QByteArray &t = stream->recv(1024 * 8);
+        if (t.isEmpty()) {
+            error.reset(new ConnectionError());
+            return false;
+        }
+        buf.append(t);
+    }
+}
+
+
+// read the buffered bytes first, then read from the connection straight into `data`.
+qint32 HttpBodyReader::readData(char *data, qint32 size)
+{
+    qint32 toRead = left < 0 ? size : static_cast<qint32>(qMin<qint64>(size, left));
+    qint32 got;
+    if (pos < buf.size()) {
+        got = qMin(toRead, buf.size() - pos);
+        memcpy(data, buf.constData() + pos, static_cast<size_t>(got));
+        pos += got;
+        if (pos >= buf.size()) {
+            buf.clear();
+            pos = 0;
+        }
+    } else if (stream.isNull()) {
+        return -1;
+    } else {
+        got = stream->recv(data, toRead);
+    }
+    if (got > 0 && left > 0) {
+        left -= got;
+    }
+    return got;
+}
+
+
+qint32 HttpBodyReader::readRaw(char *data, qint32 size)
+{
+    while (true) {
+        switch (state) {
+        case ReadingContent: {
+            if (left == 0) {
+                state = Finished;
+                return 0;
+            }
+            qint32 got = readData(data, size);
+            if (got <= 0) {
+                if (left < 0) {
+                    state = Finished;
+                    return 0;
+                }
+                return fail(stream.isNull() ? static_cast<RequestError*>(new UnrewindableBodyError()) : new ConnectionError());
+            }
+            if (left == 0) {
+                state = Finished;
+            }
+            return got;
+        }
+        case ReadingChunkSize: {
+            QByteArray line;
+            if (!readLine(&line)) {
+                return fail(nullptr);
+            }
+            int semicolon = line.indexOf(';');  // ignore chunk extensions.
+            if (semicolon >= 0) {
+                line.truncate(semicolon);
+            }
+            bool ok;
+            left = line.trimmed().toLongLong(&ok, 16);
+            if (!ok || left < 0) {
+                return fail(new ChunkedEncodingError());
+            }
+            state = left == 0 ? ReadingTrailers : ReadingChunkData;
+            break;
+        }
+        case ReadingChunkData: {
+            qint32 got = readData(data, size);
+            if (got <= 0) {
+                return fail(new ConnectionError());
+            }
+            if (left == 0) {
+                state = ReadingChunkEnd;
+            }
+            return got;
+        }
+        case ReadingChunkEnd: {
+            QByteArray line;
+            if (!readLine(&line)) {
+                return fail(nullptr);
+            }
+            if (!line.isEmpty()) {
+                return fail(new ChunkedEncodingError());
+            }
+            state = ReadingChunkSize;
+            break;
+        }
+        case ReadingTrailers: {
+            QByteArray line;
+            if (!readLine(&line)) {
+                return fail(nullptr);
+            }
+            if (line.isEmpty()) {
+                state = Finished;
+                return 0;
+            }
+            break;
+        }
+        case Finished:
+            return 0;
+        case Failed:
+        default:
+            return -1;
+        }
+    }
+}
+
+
+qint32 HttpBodyReader::read(char *data, qint32 size)
+{
+    qint32 got = readDecoded(data, size);
+    if (got > 0) {
+        total += got;
+        if (maxBodySize > 0 && total > maxBodySize) {
+            return fail(new UnrewindableBodyError());
+        }
+    }
+    return got;
+}
+
+
+qint32 HttpBodyReader::readDecoded(char *data, qint32 size)
+{
+#ifdef QTNG_HAVE_ZLIB
+    if (!decompressor.isNull()) {
+        while (true) {
+            qint32 got = decompressor->decompress(data, size);
+            if (got < 0) {
+                return fail(new ContentDecodingError());
+            } else if (got > 0) {
+                return got;
+            }
+            if (decompressor->isFinished()) {
+                // drain the left bytes, such as the last chunk, to make the connection reusable.
+                while (true) {
+                    qint32 raw = readRaw(compressed.data(), compressed.size());
+                    if (raw <= 0) {
+                        return raw;
+                    }
+                }
+            }
+            qint32 raw = readRaw(compressed.data(), compressed.size());
+            if (raw < 0) {
+                return -1;
+            } else if (raw == 0) {
+                if (compressedBytes > 0) {  // the compressed stream is truncated.
+                    return fail(new ContentDecodingError());
+                }
+                return 0;  // empty document.
+            }
+            compressedBytes += raw;
+            decompressor->addData(compressed.constData(), raw);
+        }
+    }
+#endif
+    return readRaw(data, size);
+}
+
+
 
 class HttpResponsePrivate: public QSharedData
 {
@@ -408,15 +658,21 @@ public:
     QList<HttpResponse> history;
     QSharedPointer<RequestError> error;
     QSharedPointer<SocketLike> stream;
+    QSharedPointer<HttpBodyReader> reader;
+    QSharedPointer<FileLike> bodyFile;
+    QSharedPointer<ConnectionPoolHandle> pool;
     qint64 elapsed;
     int statusCode;
+    int bodyPos;
     HttpVersion version;
     bool consumed;
+public:
+    void recycleConnection();
 };
 
 
 HttpResponsePrivate::HttpResponsePrivate()
-    : elapsed(0), statusCode(0), version(Http1_1), consumed(false)
+    : elapsed(0), statusCode(0), bodyPos(0), version(Http1_1), consumed(false)
 {}
 
 
@@ -431,13 +687,29 @@ HttpResponsePrivate::HttpResponsePrivate(const HttpResponsePrivate &other)
     , request(other.request)
     , body(other.body)
     , history(other.history)
+    , reader(other.reader)
+    , bodyFile(other.bodyFile)
+    , pool(other.pool)
     , elapsed(other.elapsed)
     , statusCode(other.statusCode)
+    , bodyPos(other.bodyPos)
     , version(other.version)
     , consumed(other.consumed)
 {}
 
 
+// called after the body is drained. the connection is returned to the pool if the server keeps it alive.
+void HttpResponsePrivate::recycleConnection()
+{
+    if (!pool.isNull() && pool->pool && !stream.isNull() && stream->isValid()) {
+        pool->pool->recycle(url, stream);
+    }
+    pool.clear();
+    reader.clear();
+    stream.clear();
+}
+
+
 HttpResponse::HttpResponse()
     :d(new HttpResponsePrivate())
 {}
@@ -533,6 +805,11 @@ QSharedPointer<SocketLike> HttpResponse::takeStream(QByteArray *readBytes)
     if (d->consumed) {
 //        qWarning() << "the stream is consumed. do you remember to set the streamResponse property of request to true?";
     }
+    if (!d->reader.isNull()) {
+        d->body = d->reader->leftBytes();
+        d->reader.clear();
+    }
+    d->pool.clear();
     if (readBytes) {
         *readBytes = d->body;
     } else {
@@ -542,20 +819,76 @@ QSharedPointer<SocketLike> HttpResponse::takeStream(QByteArray *readBytes)
     return d->stream;
 }
 
-RequestError *toRequestError(ChunkedBlockReader::Error error)
+
+qint32 HttpResponse::readInto(char *data, qint32 size)
 {
-    switch (error) {
-    case ChunkedBlockReader::ChunkedEncodingError:
-        return new ChunkedEncodingError();
-    case ChunkedBlockReader::UnrewindableBodyError:
-        return new UnrewindableBodyError();
-    case ChunkedBlockReader::ConnectionError:
-        return new ConnectionError();
-    default:
-        return nullptr;
+    if (size <= 0) {
+        return 0;
+    }
+    if (d->reader.isNull() && !d->bodyFile.isNull()) {
+        // the body is stored in a file, such as the disk cache.
+        qint32 readBytes = d->bodyFile->read(data, size);
+        if (readBytes <= 0) {
+            d->bodyFile.clear();
+            d->consumed = true;
+            return qMax(readBytes, 0);
+        }
+        return readBytes;
+    }
+    if (d->reader.isNull()) {
+        // the body is read already, or it is loaded from cache.
+        qint32 readBytes = qMin(size, qMax(d->body.size() - d->bodyPos, 0));
+        memcpy(data, d->body.constData() + d->bodyPos, static_cast<size_t>(readBytes));
+        d->bodyPos += readBytes;
+        return readBytes;
+    }
+    qint32 readBytes = d->reader->read(data, size);
+    if (readBytes < 0) {
+        setError(d->reader->error);
+        d->reader.clear();
+        d->pool.clear();
+        d->stream.clear();
+        d->consumed = true;
+        return -1;
+    }
+    if (d->reader->atEnd()) {
+        d->recycleConnection();
+        d->consumed = true;
+    }
+    return readBytes;
+}
+
+
+QByteArray HttpResponse::readChunk(qint32 maxSize)
+{
+    QByteArray chunk(maxSize, Qt::Uninitialized);
+    qint32 readBytes = readInto(chunk.data(), maxSize);
+    if (readBytes <= 0) {
+        return QByteArray();
+    }
+    chunk.resize(readBytes);
+    return chunk;
+}
+
+
+bool HttpResponse::saveTo(QSharedPointer<FileLike> file)
+{
+    const qint32 BufferSize = 1024 * 64;
+    QByteArray buf(BufferSize, Qt::Uninitialized);
+    while (true) {
+        qint32 readBytes = readInto(buf.data(), BufferSize);
+        if (readBytes < 0) {
+            return false;
+        } else if (readBytes == 0) {
+            return true;
+        }
+        if (file->write(buf.data(), readBytes) != readBytes) {
+            return false;
+        }
     }
 }
 
+
 QByteArray HttpResponse::body() const
 {
     return d->body;
@@ -564,100 +897,45 @@ QByteArray HttpResponse::body() const
 
 QByteArray HttpResponse::body()
 {
-    // special cases.
-    if (d->consumed) {
+    if (d->consumed || (d->reader.isNull() && d->bodyFile.isNull())) {
+        d->consumed = true;
         return d->body;
     }
-    // XXX if not consumed and body is not empty, it must be the from the header splitter.
-    // read it from stream
-    qint32 contentLength = getContentLength();
-    if (contentLength > 0) {
-        if (d->request.maxBodySize() > 0 && contentLength > d->request.maxBodySize()) {
-            setError(new UnrewindableBodyError());
-            d->consumed = true;
-            return QByteArray();
-        } else {
-            if (d->body.size() > contentLength) {
-                qWarning() << "got too much bytes.";
-            } else if (d->body.size() < contentLength){
-                if (d->stream.isNull()) {
-                    setError(new UnrewindableBodyError());
-                    d->consumed = true;
-                    return QByteArray();
-                }
-                qint32 leftBytes = contentLength - d->body.size();
-                const QByteArray &t = d->stream->recvall(leftBytes);
-                if (t.size() != leftBytes) {
-                    setError(new ConnectionError());
-                    d->consumed = true;
-                    return QByteArray();
-                }
-                d->body.append(t);
-            }
-        }
-    } else if (contentLength < 0) { // without `Content-Length` header.
-        if (d->stream.isNull()) {
-            setError(new UnrewindableBodyError());
-            d->consumed = true;
-            return QByteArray();
-        }
-        const QByteArray &transferEncodingHeader = header(QStringLiteral("Transfer-Encoding"));
-        bool readTrunked = (transferEncodingHeader.toLower() == QByteArray("chunked"));
-        if (readTrunked) {
-            ChunkedBlockReader reader(d->stream, d->body);
-            ChunkedBlockReader::Error readerError;
-//            reader.debugLevel = debugLevel;
-            d->body.clear();
-            RequestError *error = nullptr;
-            while (true) {
-                qint64 leftBytes;
-                if (d->request.maxBodySize() > 0) {
-                    leftBytes = d->request.maxBodySize() - d->body.size();
-                } else {
-                    leftBytes = INT_MAX;
-                }
-                const QByteArray &block = reader.nextBlock(leftBytes, &readerError);
-                error = toRequestError(readerError);
-                if (error != nullptr) {
-                    setError(error);
-                    d->consumed = true;
-                    return QByteArray();
-                }
-                if (block.isEmpty()) {
-                    break;
-                }
-                d->body.append(block);
-            }
-        } else {
-            while (d->request.maxBodySize() < 0 || d->body.size() < d->request.maxBodySize()) {
-                const QByteArray &t = d->stream->recv(1024 * 8);
-                if (t.isEmpty()) {
-                    break;
-                }
-                d->body.append(t);
-            }
-        }
-    } else { // nothing to read. empty document.
-        if(!d->body.isEmpty()) {
-            // warning!
-            qWarning() << "the body is not empty but content length is set to 0.";
+    QByteArray result;
+    qint64 expectedSize = -1;
+    if (!d->reader.isNull()) {
+        bool decoding = false;
+#ifdef QTNG_HAVE_ZLIB
+        decoding = !d->reader->decompressor.isNull();
+#endif
+        if (!decoding) {
+            expectedSize = d->reader->left;
         }
+    } else {
+        expectedSize = d->bodyFile->size();
     }
-#ifdef QTNG_HAVE_ZLIB
-    const QByteArray &contentEncodingHeader = header("Content-Encoding");
-    if ((contentEncodingHeader.toLower() == QByteArray("gzip") ||
-         contentEncodingHeader.toLower() == "deflate") && !d->body.isEmpty()) {
-        QSharedPointer<BytesIO> output(new BytesIO());
-        if (!qGzipDecompress(FileLike::bytes(d->body), output)) {
-            setError(new ContentDecodingError());
-            d->consumed = true;
+    if (expectedSize > 0 && expectedSize < INT32_MAX) {
+        result.reserve(static_cast<int>(expectedSize));
+    }
+    const int BlockSize = 1024 * 64;
+    while (!d->reader.isNull() || !d->bodyFile.isNull()) {
+        int oldSize = result.size();
+        if (result.capacity() - oldSize <= 0) {
+            result.reserve(qMax(oldSize * 2, oldSize + BlockSize));
+        }
+        int space = qMin(result.capacity() - oldSize, BlockSize);
+        result.resize(oldSize + space);
+        qint32 readBytes = readInto(result.data() + oldSize, space);
+        if (readBytes < 0) {
             return QByteArray();
         }
-        d->body = output->data();
-    } else if (!contentEncodingHeader.isEmpty()){
-        qWarning() << "unsupported content encoding." << contentEncodingHeader;
+        result.resize(oldSize + readBytes);
+        if (readBytes == 0) {
+            break;
+        }
     }
-#endif
+    d->body = result;
+    d->bodyPos = 0;
     d->consumed = true;
     return d->body;
 }
@@ -666,10 +944,21 @@ QByteArray HttpResponse::body()
 void HttpResponse::setBody(const QByteArray &body)
 {
     d->body = body;
+    d->bodyFile.clear();
+    d->bodyPos = 0;
     d->consumed = true;
 }
 
 
+void HttpResponse::setBody(QSharedPointer<FileLike> body)
+{
+    d->body.clear();
+    d->bodyFile = body;
+    d->bodyPos = 0;
+    d->consumed = false;
+}
+
+
 qint64 HttpResponse::elapsed() const
 {
     return d->elapsed;
@@ -794,13 +1083,18 @@ ConnectionPool::ConnectionPool()
     , defaultConnectionTimeout(10.0)
     , operations(new CoroutineGroup)
     , proxySwitcher(new SimpleProxySwitcher)
+    , handle(new ConnectionPoolHandle(this))
 {
+#ifndef QTNG_NO_CRYPTO
+    sslSessionCache.reset(new SslSessionCache());
+#endif
     operations->spawnWithName("removeUnusedConnections", [this] {removeUnusedConnections();});
 }
 
 
 ConnectionPool::~ConnectionPool()
 {
+    handle->pool = nullptr;
     delete operations;
 }
 
@@ -898,7 +1192,13 @@ QSharedPointer<SocketLike> ConnectionPool::newConnectionForUrl(const QUrl &url,
     } else {
 #ifndef QTNG_NO_CRYPTO
         QSharedPointer<SslSocket> ssl(new SslSocket(rawSocket));
-        ssl->handshake(false);
+        if (!sslSessionCache.isNull()) {
+            ssl->setSessionCache(sslSessionCache, url.host() + QLatin1Char(':') + QString::number(port));
+        }
+        if (!ssl->handshake(false, url.host())) {
+            *error = new ConnectionError();
+            return QSharedPointer<SocketLike>();
+        }
         connection = asSocketLike(ssl);
 #else
         *error = new ConnectionError();
@@ -979,22 +1279,57 @@ void ConnectionPool::setHttpProxy(QSharedPointer<HttpProxy> proxy)
 }
 
 
-RequestError *toRequestError(HeaderSplitter::Error error)
+RequestError *toRequestError(HttpHeaderParser::Result result)
 {
-    switch (error) {
-    case HeaderSplitter::ConnectionError:
+    switch (result) {
+    case HttpHeaderParser::ConnectionError:
         return new ConnectionError();
-    case HeaderSplitter::EncodingError:
-        return new InvalidHeader();
-    case HeaderSplitter::ExhausedMaxLine:
-        return new InvalidHeader();
-    case HeaderSplitter::LineTooLong:
+    case HttpHeaderParser::InvalidHeader:
+    case HttpHeaderParser::TooManyHeaders:
+    case HttpHeaderParser::HeadersTooLarge:
+    case HttpHeaderParser::NeedMoreData:
         return new InvalidHeader();
     default:
         return nullptr;
     }
 }
 
+static QSharedPointer<HttpBodyReader> makeBodyReader(HttpResponse &response, const HttpRequest &request,
+                                                    QSharedPointer<SocketLike> connection, const QByteArray &buf)
+{
+    QSharedPointer<HttpBodyReader> reader(new HttpBodyReader(connection, buf));
+    reader->maxBodySize = request.maxBodySize();
+    int statusCode = response.statusCode();
+    if (request.method().toUpper() == QStringLiteral("HEAD") || (statusCode >= 100 && statusCode < 200)
+            || statusCode == NoContent || statusCode == NotModified) {
+        reader->left = 0;
+        return reader;
+    }
+    const QByteArray &transferEncodingHeader = response.header(HttpResponse::TransferEncodingHeader);
+    if (transferEncodingHeader.toLower().contains("chunked")) {
+        reader->state = HttpBodyReader::ReadingChunkSize;
+    } else {
+        qint32 contentLength = response.getContentLength();
+        if (contentLength >= 0) {
+            if (reader->maxBodySize > 0 && contentLength > reader->maxBodySize) {
+                response.setError(new UnrewindableBodyError());
+                return QSharedPointer<HttpBodyReader>();
+            }
+            reader->left = contentLength;
+        }
+    }
+#ifdef QTNG_HAVE_ZLIB
+    const QByteArray &contentEncodingHeader = response.header(HttpResponse::ContentEncodingHeader).toLower();
+    if (contentEncodingHeader == QByteArray("gzip") || contentEncodingHeader == QByteArray("deflate")) {
+        reader->decompressor.reset(new GzipDecompressor());
+        reader->compressed.resize(1024 * 16);
+    } else if (!contentEncodingHeader.isEmpty() && contentEncodingHeader != QByteArray("identity")) {
+        qWarning() << "unsupported content encoding." << contentEncodingHeader;
+    }
+#endif
+    return reader;
+}
+
 // for old qt
 #if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
     #define QBYTEARRAYLIST QByteArrayList
@@ -1011,8 +1346,6 @@ RequestError *toRequestError(HeaderSplitter::Error error)
         return buf;
     }
 #endif
-inline static QString join(QChar c, const QStringList &l) { return l.join(c); }
-inline static QString join(QChar c, const QList<QString> &l) { return QStringList(l).join(c); }
 
 
 HttpResponse HttpSessionPrivate::send(HttpRequest &request)
@@ -1039,19 +1372,36 @@ HttpResponse HttpSessionPrivate::send(HttpRequest &request)
         response.d->url = url;
     }
 
-    if (!cacheManager.isNull() && (request.d->method == "GET"
-                                   || request.d->method == "HEAD"
-                                   || request.d->method == "OPTION")) {
-        const QByteArray &cacheControlHeader = request.header(HttpRequest::CacheControlHeader);
-        if (!cacheControlHeader.contains("no-cache")) {
-            if (cacheManager->getResponse(&response)) {
-                return response;
+    // only GET responses are cached, because a HEAD response has no body.
+    bool usingCache = !cacheManager.isNull() && request.d->method.toUpper() == QStringLiteral("GET")
+            && !request.streamResponse()
+            && !request.hasHeader(QStringLiteral("If-None-Match"))
+            && !request.hasHeader(QStringLiteral("If-Modified-Since"));
+    HttpResponse cachedResponse;
+    bool revalidating = false;
+    if (usingCache) {
+        const QByteArray &cacheControlHeader = request.header(HttpRequest::CacheControlHeader).toLower();
+        if (!cacheControlHeader.contains("no-cache") && !cacheControlHeader.contains("no-store")) {
+            cachedResponse.d->url = url;
+            cachedResponse.d->request = request;
+            if (cacheManager->getResponse(&cachedResponse)) {
+                if (HttpCacheManager::isFresh(cachedResponse)) {
+                    if (debugLevel > 0) {
+                        qDebug() << "got fresh response from cache:" << url;
+                    }
+                    return cachedResponse;
+                }
+                revalidating = true;
             }
         }
     }
 
     mergeCookies(request, url);
     QList<HttpHeader> allHeaders = makeHeaders(request, url);
+    if (revalidating) {
+        // the cached response is stale, ask the server whether it is still valid.
+        revalidating = HttpCacheManager::addValidators(cachedResponse, &allHeaders);
+    }
 
     if (request.d->version == HttpVersion::Unknown) {
         request.d->version = defaultVersion;
@@ -1138,49 +1488,32 @@ HttpResponse HttpSessionPrivate::send(HttpRequest &request)
         }
     }
 
-    HeaderSplitter headerSplitter(connection, debugLevel);
-    HeaderSplitter::Error headerSplitterError;
-
-    // parse first line.
-    QByteArray firstLine = headerSplitter.nextLine(&headerSplitterError);
-    error = toRequestError(headerSplitterError);
-    if (error != nullptr) {
-        response.setError(error);
-        return response;
-    }
-    QStringList commands = QString::fromLatin1(firstLine).split(QRegExp("\\s+"));
-    if (commands.size() < 3) {
-        response.setError(new InvalidHeader());
+    HttpHeaderParser headerParser;
+    QByteArray buf;
+    HttpHeaderParser::Result parseResult = headerParser.read(connection, &buf);
+    if (parseResult != HttpHeaderParser::Finished) {
+        response.setError(toRequestError(parseResult));
         return response;
     }
-    if (commands.at(0) == QStringLiteral("HTTP/1.0")) {
-        response.d->version = Http1_0;
-    } else if (commands.at(0) == QStringLiteral("HTTP/1.1")) {
-        response.d->version = Http1_1;
-    } else {
-        response.setError(new InvalidHeader());
-        return response;
+    if (debugLevel > 2) {
+        qDebug() << "receiving data:" << buf.left(headerParser.headerSize());
     }
-    bool ok;
-    response.d->statusCode = commands.at(1).toInt(&ok);
-    if (!ok) {
+
+    // parse first line.
+    QByteArray statusText;
+    if (!HttpHeaderParser::parseStatusLine(buf.constData() + headerParser.firstLineOffset(),
+                                           headerParser.firstLineLength(), &response.d->version,
+                                           &response.d->statusCode, &statusText)) {
         response.setError(new InvalidHeader());
         return response;
     }
-    response.d->statusText = join(' ', commands.mid(2));
+    response.d->statusText = QString::fromLatin1(statusText);
 
     // parse headers.
-    const int MaxHeaders = 64;
-    QList<HttpHeader> headers = headerSplitter.headers(MaxHeaders, &headerSplitterError);
-    if (headerSplitterError != HeaderSplitter::NoError) {
-        response.setError(toRequestError(headerSplitterError));
-        return response;
-    } else {
-        response.setHeaders(headers);
-        if(debugLevel > 0)  {
-            for (const HttpHeader &header: headers) {
-                qDebug() << "receiving header: " << header.name << header.value;
-            }
+    response.setHeaders(headerParser.headers(buf.constData()));
+    if(debugLevel > 0)  {
+        for (const HttpHeader &header: response.allHeaders()) {
+            qDebug() << "receiving header: " << header.name << header.value;
         }
     }
 
@@ -1197,9 +1530,19 @@ HttpResponse HttpSessionPrivate::send(HttpRequest &request)
     }
 
     // read body.
-    response.d->body = headerSplitter.buf;
     response.d->stream = connection;
+    response.d->reader = makeBodyReader(response, request, connection, buf.mid(headerParser.headerSize()));
+    if (!response.d->error.isNull()) {
+        return response;
+    }
+    if (!ptrLock.isNull()
+            && (response.d->statusCode == OK || response.d->statusCode == NotModified)
+            && response.header(HttpResponse::ConnectionHeader).toLower() == "keep-alive"
+            && keepAlive) {
+        response.d->pool = handle;
+    }
     if (!request.streamResponse()) {
+        // the connection is recycled after the body is drained.
         const QByteArray &body = response.body();
         if (!response.d->error.isNull()) {
             return response;
@@ -1207,42 +1550,25 @@ HttpResponse HttpSessionPrivate::send(HttpRequest &request)
         if(debugLevel > 1 && !body.isEmpty()) {
             qDebug() << "receiving body:" << body;
         }
-        if (!ptrLock.isNull()
-                && connection->isValid()
-                && response.d->statusCode == 200
-                && response.header(HttpResponse::ConnectionHeader).toLower() == "keep-alive"
-                && keepAlive) {
-            recycle(response.d->url, connection);
-        }
         response.d->stream.clear();
     }
 
+    // the stale response is still valid. refresh it and use the cached body.
+    if (revalidating && response.d->statusCode == NotModified) {
+        if (debugLevel > 0) {
+            qDebug() << "cached response is not modified:" << url;
+        }
+        HttpCacheManager::mergeNotModified(&cachedResponse, response);
+        cacheManager->updateResponse(cachedResponse);
+        cachedResponse.d->cookies = response.d->cookies;
+        return cachedResponse;
+    }
+
     // response.d->statusCode < 200 is not error.
     if (response.d->statusCode >= 400) {
         response.setError(new HTTPError(response.d->statusCode));
-    } else {
-        if ((request.method() == "GET" || request.method() == "HEAD" || request.method() == "OPTION")
-                && !cacheManager.isNull()
-                && !request.streamResponse()
-                ) {
-            bool doCache = true;
-            const QByteArray &requestHeader = request.header(HttpResponse::CacheControlHeader).toLower();
-            if (requestHeader.contains("no-cache") || requestHeader.contains("no-store")) {
-                doCache = false;
-            } else {
-                const QByteArray &responseHeader = response.header(HttpResponse::CacheControlHeader).toLower();
-                if (responseHeader.contains("public") || responseHeader.contains("private")) {
-                    doCache = true;
-                } else if (responseHeader.contains("no-cache") || responseHeader.contains("no-store")) {
-                    doCache = false;
-                } else {
-                    doCache = false;
-                }
-            }
-            if (doCache) {
-                cacheManager->addResponse(response);
-            }
-        }
+    } else if (usingCache && HttpCacheManager::isCacheable(request, response)) {
+        cacheManager->addResponse(response);
     }
     return response;
 }
@@ -2858,6 +3184,20 @@ void HttpSession::setCacheManager(QSharedPointer<HttpCacheManager> cacheManager)
 }
 
 
+QSharedPointer<SslSessionCache> HttpSession::sslSessionCache() const
+{
+    Q_D(const HttpSession);
+    return d->sslSessionCache;
+}
+
+
+void HttpSession::setSslSessionCache(QSharedPointer<SslSessionCache> sslSessionCache)
+{
+    Q_D(HttpSession);
+    d->sslSessionCache = sslSessionCache;
+}
+
+
 HttpCacheManager::HttpCacheManager()
 {
 }
@@ -2868,70 +3208,262 @@ HttpCacheManager::~HttpCacheManager()
 }
 
 
-bool HttpCacheManager::addResponse(const HttpResponse &response)
+// find a directive such as `max-age=60` in the `Cache-Control` header.
+static bool cacheControlDirective(const QByteArray &cacheControl, const QByteArray &name, QByteArray *value = nullptr)
 {
-    const QString &url = response.url().toString();
-    int statusCode = response.statusCode();
-    const QString &statusText = response.statusText();
-    const QList<HttpHeader> headers = response.allHeaders();
-    const QByteArray &body = response.body();
-    QByteArray bs;
-    QDataStream ds(&bs, QIODevice::WriteOnly);
-    ds << statusCode << statusText << headers << body;
-    if (ds.status() != QDataStream::Ok) {
-        return false;
+    for (const QByteArray &part: cacheControl.split(',')) {
+        const QByteArray &directive = part.trimmed();
+        int eq = directive.indexOf('=');
+        const QByteArray &key = (eq < 0 ? directive : directive.left(eq)).trimmed().toLower();
+        if (key == name) {
+            if (value) {
+                *value = eq < 0 ? QByteArray() : directive.mid(eq + 1).trimmed();
+                if (value->startsWith('"') && value->endsWith('"') && value->size() >= 2) {
+                    *value = value->mid(1, value->size() - 2);
+                }
+            }
+            return true;
+        }
     }
-    return store(url, bs);
+    return false;
 }
 
 
-bool HttpCacheManager::getResponse(HttpResponse *response)
+bool HttpCacheManager::isCacheable(const HttpRequest &request, const HttpResponse &response)
 {
-    const QString &url = response->url().toString();
-    if (url.isEmpty()) {
+    const QByteArray &requestCacheControl = request.header(HttpRequest::CacheControlHeader).toLower();
+    if (cacheControlDirective(requestCacheControl, "no-store")) {
         return false;
     }
-    const QByteArray &bs = load(url);
-    if (bs.isEmpty()) {
+    int statusCode = response.statusCode();
+    if (statusCode != OK && statusCode != NonAuthoritative && statusCode != MultipleChoices
+            && statusCode != MovedPermanently) {
         return false;
     }
-    QDataStream ds(bs);
-    int statusCode;
-    QString statusText;
-    QList<HttpHeader> headers;
-    QByteArray body;
-    ds >> statusCode >> statusText >> headers >> body;
-    if (ds.status() != QDataStream::Ok) {
+    const QByteArray &cacheControl = response.header(HttpResponse::CacheControlHeader).toLower();
+    if (cacheControlDirective(cacheControl, "no-store")) {
         return false;
     }
-    response->setStatusCode(statusCode);
-    response->setStatusText(statusText);
-    response->setHeaders(headers);
-    response->setBody(body);
-    return true;
+    if (response.header(HttpResponse::VaryHeader).trimmed() == "*") {
+        return false;
+    }
+    if (request.hasHeader(QStringLiteral("Authorization")) && !cacheControlDirective(cacheControl, "public")) {
+        return false;
+    }
+    // a response without freshness information and validators can not be used anymore.
+    return cacheControlDirective(cacheControl, "public") || cacheControlDirective(cacheControl, "private")
+            || cacheControlDirective(cacheControl, "max-age") || response.hasHeader(QStringLiteral("Expires"))
+            || response.hasHeader(QStringLiteral("ETag")) || response.hasHeader(QStringLiteral("Last-Modified"));
 }
 
 
-bool HttpCacheManager::store(const QString &, const QByteArray &)
+// the freshness lifetime in seconds, see RFC 7234 section 4.2.1
+qint64 HttpCacheManager::freshnessLifetime(const HttpResponse &response)
 {
-    return false;
+    const QByteArray &cacheControl = response.header(HttpResponse::CacheControlHeader).toLower();
+    if (cacheControlDirective(cacheControl, "no-cache")) {
+        return 0;
+    }
+    QByteArray value;
+    if (cacheControlDirective(cacheControl, "max-age", &value)) {
+        bool ok;
+        qint64 maxAge = value.toLongLong(&ok);
+        return ok ? qMax<qint64>(maxAge, 0) : 0;
+    }
+    const QDateTime &date = HttpResponse::fromHttpDate(response.header(HttpResponse::DateHeader));
+    if (!date.isValid()) {
+        return 0;
+    }
+    const QByteArray &expiresHeader = response.header(QStringLiteral("Expires"));
+    if (!expiresHeader.isEmpty()) {
+        const QDateTime &expires = HttpResponse::fromHttpDate(expiresHeader);
+        return expires.isValid() ? qMax<qint64>(date.secsTo(expires), 0) : 0;  // invalid date means expired.
+    }
+    // heuristic freshness: 10% of the time since last modification.
+    const QDateTime &lastModified = response.getLastModified();
+    if (lastModified.isValid() && lastModified < date) {
+        return lastModified.secsTo(date) / 10;
+    }
+    return 0;
 }
 
 
-QByteArray HttpCacheManager::load(const QString &)
+qint64 HttpCacheManager::currentAge(const HttpResponse &response)
 {
-    return QByteArray();
+    const QDateTime &date = HttpResponse::fromHttpDate(response.header(HttpResponse::DateHeader));
+    if (!date.isValid()) {
+        return -1;
+    }
+    qint64 age = qMax<qint64>(date.secsTo(QDateTime::currentDateTimeUtc()), 0);
+    bool ok;
+    qint64 ageHeader = response.header(QStringLiteral("Age")).toLongLong(&ok);
+    if (ok && ageHeader > 0) {
+        age += ageHeader;
+    }
+    return age;
 }
 
 
-class HttpMemoryCacheManagerPrivate
+bool HttpCacheManager::isFresh(const HttpResponse &response)
 {
-public:
+    qint64 age = currentAge(response);
+    return age >= 0 && age < freshnessLifetime(response);
+}
+
+
+// make a conditional request for stale response.
+bool HttpCacheManager::addValidators(const HttpResponse &cachedResponse, QList<HttpHeader> *headers)
+{
+    bool added = false;
+    const QByteArray &etag = cachedResponse.header(QStringLiteral("ETag"));
+    if (!etag.isEmpty()) {
+        headers->append(HttpHeader(QStringLiteral("If-None-Match"), etag));
+        added = true;
+    }
+    const QByteArray &lastModified = cachedResponse.header(HttpResponse::LastModifiedHeader);
+    if (!lastModified.isEmpty()) {
+        headers->append(HttpHeader(QStringLiteral("If-Modified-Since"), lastModified));
+        added = true;
+    }
+    return added;
+}
+
+
+// the headers of 304 response replace the stored ones, see RFC 7234 section 4.3.4
+void HttpCacheManager::mergeNotModified(HttpResponse *cachedResponse, const HttpResponse &notModified)
+{
+    for (const HttpHeader &header: notModified.allHeaders()) {
+        if (header.name.compare(QStringLiteral("Content-Length"), Qt::CaseInsensitive) == 0
+                || header.name.compare(QStringLiteral("Transfer-Encoding"), Qt::CaseInsensitive) == 0
+                || header.name.compare(QStringLiteral("Connection"), Qt::CaseInsensitive) == 0) {
+            continue;
+        }
+        cachedResponse->setHeader(header.name, header.value);
+    }
+    if (!notModified.hasHeader(QStringLiteral("Date"))) {
+        cachedResponse->setHeader(QStringLiteral("Date"), HttpResponse::toHttpDate(QDateTime::currentDateTimeUtc()));
+    }
+    cachedResponse->removeHeader(QStringLiteral("Age"));
+}
+
+
+QList<HttpHeader> HttpCacheManager::varyingHeaders(const HttpResponse &response, const HttpRequest &request)
+{
+    QList<HttpHeader> headers;
+    for (const QByteArray &vary: response.multiHeader(HttpResponse::VaryHeader)) {
+        for (const QByteArray &name: vary.split(',')) {
+            const QString &headerName = QString::fromLatin1(name.trimmed()).toLower();
+            if (!headerName.isEmpty()) {
+                headers.append(HttpHeader(headerName, request.header(headerName)));
+            }
+        }
+    }
+    return headers;
+}
+
+
+static inline bool sameHeaders(const QList<HttpHeader> &l, const QList<HttpHeader> &r)
+{
+    if (l.size() != r.size()) {
+        return false;
+    }
+    for (int i = 0; i < l.size(); ++i) {
+        if (l.at(i).name != r.at(i).name || l.at(i).value != r.at(i).value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool HttpCacheManager::addResponse(const HttpResponse &response)
+{
+    const QString &url = response.url().toString();
+    int statusCode = response.statusCode();
+    const QString &statusText = response.statusText();
+    QList<HttpHeader> headers = response.allHeaders();
+    if (!response.hasHeader(QStringLiteral("Date"))) {
+        headers.append(HttpHeader(QStringLiteral("Date"), HttpResponse::toHttpDate(QDateTime::currentDateTimeUtc())));
+    }
+    const QList<HttpHeader> &vary = varyingHeaders(response, response.request());
+    const QByteArray &body = response.body();
+    QByteArray bs;
+    QDataStream ds(&bs, QIODevice::WriteOnly);
+    ds << statusCode << statusText << headers << body << vary;
+    if (ds.status() != QDataStream::Ok) {
+        return false;
+    }
+    return store(url, bs);
+}
+
+
+bool HttpCacheManager::getResponse(HttpResponse *response)
+{
+    const QString &url = response->url().toString();
+    if (url.isEmpty()) {
+        return false;
+    }
+    const QByteArray &bs = load(url);
+    if (bs.isEmpty()) {
+        return false;
+    }
+    QDataStream ds(bs);
+    int statusCode;
+    QString statusText;
+    QList<HttpHeader> headers;
+    QByteArray body;
+    QList<HttpHeader> vary;
+    ds >> statusCode >> statusText >> headers >> body >> vary;
+    if (ds.status() != QDataStream::Ok) {
+        return false;
+    }
+    response->setStatusCode(statusCode);
+    response->setStatusText(statusText);
+    response->setHeaders(headers);
+    if (!sameHeaders(vary, varyingHeaders(*response, response->request()))) {
+        return false;
+    }
+    response->setBody(body);
+    return true;
+}
+
+
+bool HttpCacheManager::updateResponse(const HttpResponse &response)
+{
+    return addResponse(response);
+}
+
+
+bool HttpCacheManager::store(const QString &, const QByteArray &)
+{
+    return false;
+}
+
+
+QByteArray HttpCacheManager::load(const QString &)
+{
+    return QByteArray();
+}
+
+
+struct HttpCacheEntry
+{
+    HttpResponse response;
+    QList<HttpHeader> vary;
+    QDateTime storedAt;
+};
+
+
+class HttpMemoryCacheManagerPrivate
+{
+public:
     HttpMemoryCacheManagerPrivate()
-        :expireTime(60 * 60 * 24) // one day
-    {}
+        : expireTime(60 * 60 * 24) // one day
+    {
+        cache.setMaxCost(1024 * 1024 * 64);
+    }
 public:
-    QMap<QString, QByteArray> cache;
+    QCache<QString, HttpCacheEntry> cache;
     float expireTime;
 };
 
@@ -2963,50 +3495,617 @@ void HttpMemoryCacheManager::setExpireTime(float expireTime)
 }
 
 
-bool HttpMemoryCacheManager::store(const QString &url, const QByteArray &data)
+int HttpMemoryCacheManager::maxCacheSize() const
+{
+    Q_D(const HttpMemoryCacheManager);
+    return d->cache.maxCost();
+}
+
+
+void HttpMemoryCacheManager::setMaxCacheSize(int maxCacheSize)
 {
     Q_D(HttpMemoryCacheManager);
-    d->cache.insert(url, data);
-    return true;
+    d->cache.setMaxCost(maxCacheSize);
+}
+
+
+int HttpMemoryCacheManager::cacheSize() const
+{
+    Q_D(const HttpMemoryCacheManager);
+    return d->cache.totalCost();
 }
 
 
-QByteArray HttpMemoryCacheManager::load(const QString &url)
+void HttpMemoryCacheManager::clear()
 {
     Q_D(HttpMemoryCacheManager);
-    return d->cache.value(url);
+    d->cache.clear();
 }
 
 
-bool HttpDiskCacheManager::store(const QString &url, const QByteArray &data)
+// the response is stored as is. the body is implicitly shared, so there is no serialization nor copy.
+bool HttpMemoryCacheManager::addResponse(const HttpResponse &response)
+{
+    Q_D(HttpMemoryCacheManager);
+    const QString &url = response.url().toString();
+    if (url.isEmpty()) {
+        return false;
+    }
+    HttpCacheEntry *entry = new HttpCacheEntry();
+    entry->response = response;
+    if (!response.hasHeader(QStringLiteral("Date"))) {
+        entry->response.setHeader(QStringLiteral("Date"), HttpResponse::toHttpDate(QDateTime::currentDateTimeUtc()));
+    }
+    entry->vary = varyingHeaders(response, response.request());
+    entry->storedAt = QDateTime::currentDateTimeUtc();
+    int cost = response.body().size() + url.size() * 2;
+    for (const HttpHeader &header: response.allHeaders()) {
+        cost += header.name.size() * 2 + header.value.size();
+    }
+    // QCache removes the least recently used entries if the total size exceeds the limit.
+    return d->cache.insert(url, entry, cost);
+}
+
+
+bool HttpMemoryCacheManager::getResponse(HttpResponse *response)
+{
+    Q_D(HttpMemoryCacheManager);
+    const QString &url = response->url().toString();
+    HttpCacheEntry *entry = d->cache.object(url);
+    if (!entry) {
+        return false;
+    }
+    if (d->expireTime > 0 && entry->storedAt.msecsTo(QDateTime::currentDateTimeUtc()) > static_cast<qint64>(d->expireTime * 1000)) {
+        d->cache.remove(url);
+        return false;
+    }
+    if (!sameHeaders(entry->vary, varyingHeaders(entry->response, response->request()))) {
+        return false;
+    }
+    response->setStatusCode(entry->response.statusCode());
+    response->setStatusText(entry->response.statusText());
+    response->setVersion(entry->response.version());
+    response->setHeaders(entry->response.allHeaders());
+    response->setBody(entry->response.body());
+    return true;
+}
+
+
+struct HttpDiskCacheIndexEntry
+{
+    HttpDiskCacheIndexEntry()
+        : size(0), lastUsed(0) {}
+    qint64 size;
+    qint64 lastUsed;
+};
+typedef QHash<QByteArray, HttpDiskCacheIndexEntry> HttpDiskCacheIndex;
+
+
+struct HttpDiskCacheLoadResult
+{
+    HttpDiskCacheLoadResult()
+        : ok(false) {}
+    QByteArray meta;
+    QByteArray body;
+    QSharedPointer<QFile> bodyFile;
+    bool ok;
+};
+
+
+// reads the large body of cached response in the thread pool.
+class HttpDiskCacheBody: public FileLike
+{
+public:
+    HttpDiskCacheBody(QSharedPointer<QFile> f, QSharedPointer<ThreadPool> threadPool)
+        : f(f), threadPool(threadPool) {}
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(char *data, qint32 size) override;
+    virtual void close() override;
+    virtual qint64 size() override;
+private:
+    QSharedPointer<QFile> f;
+    QSharedPointer<ThreadPool> threadPool;
+};
+
+
+qint32 HttpDiskCacheBody::read(char *data, qint32 size)
+{
+    if (size <= 0) {
+        return 0;
+    }
+    // the worker may still be reading after the caller is killed, so it reads into its own buffer.
+    QSharedPointer<QFile> f = this->f;
+    QSharedPointer<QByteArray> buf(new QByteArray(size, Qt::Uninitialized));
+    qint32 bs = threadPool->call<qint32>([f, buf, size] () -> qint32 {
+        return static_cast<qint32>(f->read(buf->data(), size));
+    });
+    if (bs > 0) {
+        memcpy(data, buf->constData(), static_cast<size_t>(bs));
+    }
+    return bs;
+}
+
+
+qint32 HttpDiskCacheBody::write(char *, qint32)
 {
-    const QString &filename = QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha256).toHex();
-    const QString &fullpath = cacheDir.filePath(filename);
-    QFile f(fullpath);
+    return -1;
+}
+
+
+void HttpDiskCacheBody::close()
+{
+    f->close();
+}
+
+
+qint64 HttpDiskCacheBody::size()
+{
+    return f->size();
+}
+
+
+class HttpDiskCacheManagerPrivate
+{
+public:
+    HttpDiskCacheManagerPrivate(const QDir &cacheDir);
+    ~HttpDiskCacheManagerPrivate();
+public:
+    static QByteArray keyOf(const QString &url);
+    static QString pathOf(const QString &root, const QByteArray &key, const QString &suffix);
+    static bool writeFile(const QString &path, const QByteArray &data);
+    static HttpDiskCacheIndex scan(const QString &root);
+    QSharedPointer<ThreadPool> pool();
+    bool ensureIndex();
+    void touch(const QByteArray &key, qint64 size);
+    void remove(const QList<QByteArray> &keys);
+    void evict();
+public:
+    QString root;
+    HttpDiskCacheIndex index;
+    QSharedPointer<ThreadPool> threadPool;
+    QSharedPointer<Lock> indexLock;
+    qint64 cacheSize;
+    qint64 maxCacheSize;
+    bool indexLoaded;
+};
+
+
+// the bodies larger than this size are streamed from disk instead of being loaded into memory.
+const qint64 InlineBodySize = 1024 * 256;
+
+
+HttpDiskCacheManagerPrivate::HttpDiskCacheManagerPrivate(const QDir &cacheDir)
+    : root(cacheDir.absolutePath())
+    , indexLock(new Lock())
+    , cacheSize(0)
+    , maxCacheSize(1024 * 1024 * 256)
+    , indexLoaded(false)
+{
+}
+
+
+HttpDiskCacheManagerPrivate::~HttpDiskCacheManagerPrivate()
+{
+}
+
+
+QByteArray HttpDiskCacheManagerPrivate::keyOf(const QString &url)
+{
+    return QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha256).toHex();
+}
+
+
+// shard the files into 256 * 256 directories, such as `ab/cd/abcd...ef.meta`
+QString HttpDiskCacheManagerPrivate::pathOf(const QString &root, const QByteArray &key, const QString &suffix)
+{
+    return root + QLatin1Char('/') + QString::fromLatin1(key.left(2)) + QLatin1Char('/')
+            + QString::fromLatin1(key.mid(2, 2)) + QLatin1Char('/') + QString::fromLatin1(key) + suffix;
+}
+
+
+// QSaveFile writes to a temporary file and renames it, so the readers never see a partial file.
+bool HttpDiskCacheManagerPrivate::writeFile(const QString &path, const QByteArray &data)
+{
+    if (!QDir().mkpath(QFileInfo(path).absolutePath())) {
+        return false;
+    }
+    QSaveFile f(path);
     if (!f.open(QIODevice::WriteOnly)) {
         return false;
     }
-    qint64 bs = f.write(data);
-    if (bs != data.size()) {
+    if (f.write(data) != data.size()) {
+        f.cancelWriting();
+        return false;
+    }
+    return f.commit();
+}
+
+
+static bool isHexName(const QString &name, int size)
+{
+    if (name.size() < size) {
+        return false;
+    }
+    for (int i = 0; i < size; ++i) {
+        const QChar c = name.at(i);
+        if (!((c >= QLatin1Char('0') && c <= QLatin1Char('9')) || (c >= QLatin1Char('a') && c <= QLatin1Char('f')))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// the temporary files of QSaveFile are named like `abcd...ef.meta.XyZ123`. the ones not modified for this
+// time are left by crashed writers, the others may be written by another process sharing the directory.
+const qint64 StaleTemporaryFileAge = 1000 * 60 * 60;
+
+
+// only the shard directories and the files named by pathOf() are touched, the other files in the cache
+// directory are not ours.
+HttpDiskCacheIndex HttpDiskCacheManagerPrivate::scan(const QString &root)
+{
+    HttpDiskCacheIndex index;
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const QDir::Filters dirFilters = QDir::Dirs | QDir::NoDotAndDotDot;
+    for (const QString &first: QDir(root).entryList(dirFilters)) {
+        if (first.size() != 2 || !isHexName(first, 2)) {
+            continue;
+        }
+        const QString &firstPath = root + QLatin1Char('/') + first;
+        for (const QString &second: QDir(firstPath).entryList(dirFilters)) {
+            if (second.size() != 2 || !isHexName(second, 2)) {
+                continue;
+            }
+            const QString &shard = first + second;
+            QDirIterator itor(firstPath + QLatin1Char('/') + second, QDir::Files);
+            while (itor.hasNext()) {
+                itor.next();
+                const QFileInfo &info = itor.fileInfo();
+                const QString &fileName = info.fileName();
+                if (fileName.size() <= 64 || !isHexName(fileName, 64) || !fileName.startsWith(shard)) {
+                    continue;
+                }
+                const QByteArray &key = fileName.left(64).toLatin1();
+                const QString &suffix = fileName.mid(64);
+                if (suffix == QStringLiteral(".meta") || suffix == QStringLiteral(".body") || suffix == QStringLiteral(".data")) {
+                    HttpDiskCacheIndexEntry &entry = index[key];
+                    entry.size += info.size();
+                    entry.lastUsed = qMax(entry.lastUsed, info.lastModified().toMSecsSinceEpoch());
+                } else if ((suffix.startsWith(QStringLiteral(".meta.")) || suffix.startsWith(QStringLiteral(".body.")))
+                           && now - info.lastModified().toMSecsSinceEpoch() > StaleTemporaryFileAge) {
+                    QFile::remove(info.absoluteFilePath());
+                }
+            }
+        }
+    }
+    return index;
+}
+
+
+QSharedPointer<ThreadPool> HttpDiskCacheManagerPrivate::pool()
+{
+    if (threadPool.isNull()) {
+        threadPool.reset(new ThreadPool(2));
+    }
+    return threadPool;
+}
+
+
+bool HttpDiskCacheManagerPrivate::ensureIndex()
+{
+    if (indexLoaded) {
+        return true;
+    }
+    ScopedLock<Lock> lock(indexLock);
+    if (!lock.isSuccess()) {
         return false;
     }
+    if (indexLoaded) {
+        return true;
+    }
+    const QString root = this->root;
+    index = pool()->call<HttpDiskCacheIndex>([root] {
+        return scan(root);
+    });
+    cacheSize = 0;
+    for (HttpDiskCacheIndex::const_iterator itor = index.constBegin(); itor != index.constEnd(); ++itor) {
+        cacheSize += itor.value().size;
+    }
+    indexLoaded = true;
+    evict();
+    return true;
+}
+
+
+void HttpDiskCacheManagerPrivate::touch(const QByteArray &key, qint64 size)
+{
+    HttpDiskCacheIndexEntry &entry = index[key];
+    if (size >= 0) {
+        cacheSize += size - entry.size;
+        entry.size = size;
+    }
+    entry.lastUsed = QDateTime::currentMSecsSinceEpoch();
+}
+
+
+void HttpDiskCacheManagerPrivate::remove(const QList<QByteArray> &keys)
+{
+    if (keys.isEmpty()) {
+        return;
+    }
+    for (const QByteArray &key: keys) {
+        cacheSize -= index.value(key).size;
+        index.remove(key);
+    }
+    const QString root = this->root;
+    pool()->call([root, keys] {
+        for (const QByteArray &key: keys) {
+            QFile::remove(pathOf(root, key, QStringLiteral(".meta")));
+            QFile::remove(pathOf(root, key, QStringLiteral(".body")));
+            QFile::remove(pathOf(root, key, QStringLiteral(".data")));
+        }
+    });
+}
+
+
+// remove the least recently used entries until the cache size drops to 90% of the limit.
+void HttpDiskCacheManagerPrivate::evict()
+{
+    if (maxCacheSize <= 0 || cacheSize <= maxCacheSize) {
+        return;
+    }
+    QList<QPair<qint64, QByteArray>> entries;
+    entries.reserve(index.size());
+    for (HttpDiskCacheIndex::const_iterator itor = index.constBegin(); itor != index.constEnd(); ++itor) {
+        entries.append(qMakePair(itor.value().lastUsed, itor.key()));
+    }
+    std::sort(entries.begin(), entries.end());
+    QList<QByteArray> keys;
+    qint64 target = maxCacheSize / 10 * 9;
+    qint64 size = cacheSize;
+    for (const QPair<qint64, QByteArray> &entry: entries) {
+        if (size <= target) {
+            break;
+        }
+        size -= index.value(entry.second).size;
+        keys.append(entry.second);
+    }
+    remove(keys);
+}
+
+
+HttpDiskCacheManager::HttpDiskCacheManager(const QDir &cacheDir)
+    : cacheDir(cacheDir)
+    , d_ptr(new HttpDiskCacheManagerPrivate(cacheDir))
+{
+}
+
+
+HttpDiskCacheManager::HttpDiskCacheManager(const QString &cacheDir)
+    : cacheDir(cacheDir)
+    , d_ptr(new HttpDiskCacheManagerPrivate(QDir(cacheDir)))
+{
+}
+
+
+HttpDiskCacheManager::~HttpDiskCacheManager()
+{
+    delete d_ptr;
+}
+
+
+qint64 HttpDiskCacheManager::maxCacheSize() const
+{
+    Q_D(const HttpDiskCacheManager);
+    return d->maxCacheSize;
+}
+
+
+void HttpDiskCacheManager::setMaxCacheSize(qint64 maxCacheSize)
+{
+    Q_D(HttpDiskCacheManager);
+    d->maxCacheSize = maxCacheSize;
+    if (d->indexLoaded) {
+        d->evict();
+    }
+}
+
+
+qint64 HttpDiskCacheManager::cacheSize() const
+{
+    Q_D(const HttpDiskCacheManager);
+    return d->cacheSize;
+}
+
+
+void HttpDiskCacheManager::clear()
+{
+    Q_D(HttpDiskCacheManager);
+    if (!d->ensureIndex()) {
+        return;
+    }
+    d->remove(d->index.keys());
+}
+
+
+static QByteArray makeMeta(const HttpResponse &response)
+{
+    QList<HttpHeader> headers = response.allHeaders();
+    if (!response.hasHeader(QStringLiteral("Date"))) {
+        headers.append(HttpHeader(QStringLiteral("Date"), HttpResponse::toHttpDate(QDateTime::currentDateTimeUtc())));
+    }
+    QByteArray meta;
+    QDataStream ds(&meta, QIODevice::WriteOnly);
+    ds << response.statusCode() << response.statusText() << static_cast<int>(response.version()) << headers;
+    return meta;
+}
+
+
+bool HttpDiskCacheManager::addResponse(const HttpResponse &response)
+{
+    Q_D(HttpDiskCacheManager);
+    const QString &url = response.url().toString();
+    if (url.isEmpty() || !d->ensureIndex()) {
+        return false;
+    }
+    const QByteArray &key = d->keyOf(url);
+    QByteArray meta = makeMeta(response);
+    QDataStream ds(&meta, QIODevice::Append);
+    ds << varyingHeaders(response, response.request());
+    // the body is implicitly shared with the worker thread, no copy here.
+    const QByteArray &body = response.body();
+    const QString root = d->root;
+    qint64 size = d->pool()->call<qint64>([root, key, meta, body] () -> qint64 {
+        // write body first, so a meta file always has its body.
+        if (!HttpDiskCacheManagerPrivate::writeFile(HttpDiskCacheManagerPrivate::pathOf(root, key, QStringLiteral(".body")), body)) {
+            return -1;
+        }
+        if (!HttpDiskCacheManagerPrivate::writeFile(HttpDiskCacheManagerPrivate::pathOf(root, key, QStringLiteral(".meta")), meta)) {
+            return -1;
+        }
+        return meta.size() + body.size();
+    });
+    if (size < 0) {
+        return false;
+    }
+    d->touch(key, size);
+    d->evict();
+    return true;
+}
+
+
+bool HttpDiskCacheManager::updateResponse(const HttpResponse &response)
+{
+    Q_D(HttpDiskCacheManager);
+    const QString &url = response.url().toString();
+    if (url.isEmpty() || !d->ensureIndex()) {
+        return false;
+    }
+    const QByteArray &key = d->keyOf(url);
+    if (!d->index.contains(key)) {  // evicted.
+        return false;
+    }
+    QByteArray meta = makeMeta(response);
+    QDataStream ds(&meta, QIODevice::Append);
+    ds << varyingHeaders(response, response.request());
+    const QString root = d->root;
+    bool ok = d->pool()->call<bool>([root, key, meta] {
+        return HttpDiskCacheManagerPrivate::writeFile(HttpDiskCacheManagerPrivate::pathOf(root, key, QStringLiteral(".meta")), meta);
+    });
+    if (ok) {
+        d->touch(key, -1);
+    }
+    return ok;
+}
+
+
+bool HttpDiskCacheManager::getResponse(HttpResponse *response)
+{
+    Q_D(HttpDiskCacheManager);
+    const QString &url = response->url().toString();
+    if (url.isEmpty() || !d->ensureIndex()) {
+        return false;
+    }
+    const QByteArray &key = d->keyOf(url);
+    if (!d->index.contains(key)) {  // no disk io for cache missing.
+        return false;
+    }
+    const QString root = d->root;
+    const HttpDiskCacheLoadResult &result = d->pool()->call<HttpDiskCacheLoadResult>([root, key] {
+        HttpDiskCacheLoadResult result;
+        QFile metaFile(HttpDiskCacheManagerPrivate::pathOf(root, key, QStringLiteral(".meta")));
+        if (!metaFile.open(QIODevice::ReadOnly)) {
+            return result;
+        }
+        result.meta = metaFile.readAll();
+        QSharedPointer<QFile> bodyFile(new QFile(HttpDiskCacheManagerPrivate::pathOf(root, key, QStringLiteral(".body"))));
+        if (!bodyFile->open(QIODevice::ReadOnly)) {
+            return result;
+        }
+        if (bodyFile->size() <= InlineBodySize) {
+            result.body = bodyFile->readAll();
+        } else {
+            result.bodyFile = bodyFile;
+        }
+        result.ok = true;
+        return result;
+    });
+    if (!result.ok) {
+        d->remove(QList<QByteArray>() << key);
+        return false;
+    }
+    QDataStream ds(result.meta);
+    int statusCode;
+    QString statusText;
+    int version;
+    QList<HttpHeader> headers;
+    QList<HttpHeader> vary;
+    ds >> statusCode >> statusText >> version >> headers >> vary;
+    if (ds.status() != QDataStream::Ok) {
+        d->remove(QList<QByteArray>() << key);
+        return false;
+    }
+    response->setStatusCode(statusCode);
+    response->setStatusText(statusText);
+    response->setVersion(static_cast<HttpVersion>(version));
+    response->setHeaders(headers);
+    if (!sameHeaders(vary, varyingHeaders(*response, response->request()))) {
+        return false;
+    }
+    if (result.bodyFile.isNull()) {
+        response->setBody(result.body);
+    } else {
+        response->setBody(QSharedPointer<FileLike>(new HttpDiskCacheBody(result.bodyFile, d->pool())));
+    }
+    d->touch(key, -1);
+    return true;
+}
+
+
+bool HttpDiskCacheManager::store(const QString &url, const QByteArray &data)
+{
+    Q_D(HttpDiskCacheManager);
+    if (!d->ensureIndex()) {
+        return false;
+    }
+    const QByteArray &key = d->keyOf(url);
+    const QString root = d->root;
+    bool ok = d->pool()->call<bool>([root, key, data] {
+        return HttpDiskCacheManagerPrivate::writeFile(HttpDiskCacheManagerPrivate::pathOf(root, key, QStringLiteral(".data")), data);
+    });
+    if (!ok) {
+        return false;
+    }
+    d->touch(key, data.size());
+    d->evict();
     return true;
 }
 
 
 QByteArray HttpDiskCacheManager::load(const QString &url)
 {
-    const QString &filename = QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha256).toHex();
-    const QString &fullpath = cacheDir.filePath(filename);
-    QFile f(fullpath);
-    if (!f.open(QIODevice::ReadOnly)) {
+    Q_D(HttpDiskCacheManager);
+    if (!d->ensureIndex()) {
         return QByteArray();
     }
-    return f.readAll();
+    const QByteArray &key = d->keyOf(url);
+    if (!d->index.contains(key)) {
+        return QByteArray();
+    }
+    const QString root = d->root;
+    const QByteArray &data = d->pool()->call<QByteArray>([root, key] {
+        QFile f(HttpDiskCacheManagerPrivate::pathOf(root, key, QStringLiteral(".data")));
+        if (!f.open(QIODevice::ReadOnly)) {
+            return QByteArray();
+        }
+        return f.readAll();
+    });
+    d->touch(key, -1);
+    return data;
 }
 
 
-
 RequestError::~RequestError()
 {}
 
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <QtCore/qlocale.h>
 #include "../include/http_utils.h"
 
@@ -465,9 +466,67 @@ static QStringList knownHeaders = {
 };
 
 
+// the canonical names of HeaderOperationMixin::KnownHeader, indexed by the enum.
+static const char * const knownHeaderNames[HeaderOperationMixin::KnownHeaderCount] = {
+    "Content-Type",
+    "Content-Length",
+    "Content-Encoding",
+    "Transfer-Encoding",
+    "Location",
+    "Last-Modified",
+    "Cookie",
+    "Set-Cookie",
+    "Content-Disposition",
+    "Server",
+    "User-Agent",
+    "Accept",
+    "Accept-Language",
+    "Accept-Encoding",
+    "Pragma",
+    "Cache-Control",
+    "Date",
+    "Allow",
+    "Vary",
+    "X-Frame-Options",
+    "MIME-Version",
+    "Connection",
+    "Upgrade",
+    "Host",
+    "ETag",
+    "Expires",
+    "Age",
+    "If-Modified-Since",
+    "If-None-Match",
+    "Authorization",
+    "Keep-Alive",
+};
+
+
+struct KnownHeaderStrings
+{
+    KnownHeaderStrings()
+    {
+        for (int i = 0; i < HeaderOperationMixin::KnownHeaderCount; ++i) {
+            sizes[i] = static_cast<int>(qstrlen(knownHeaderNames[i]));
+            names[i] = QString::fromLatin1(knownHeaderNames[i], sizes[i]);
+        }
+    }
+    QString names[HeaderOperationMixin::KnownHeaderCount];
+    int sizes[HeaderOperationMixin::KnownHeaderCount];
+};
+
+
+// the strings are shared by all headers parsed from network, so the names of known headers are never allocated again.
+static const KnownHeaderStrings &knownHeaderStrings()
+{
+    static const KnownHeaderStrings strings;
+    return strings;
+}
+
+
 QString normalizeHeaderName(const QString &headerName) {
     for (const QString &goodName: knownHeaders) {
-        if(headerName.compare(goodName, Qt::CaseInsensitive) == 0) {
+        if (headerName.size() == goodName.size() && headerName.compare(goodName, Qt::CaseInsensitive) == 0) {
             return goodName;
         }
     }
@@ -475,28 +534,34 @@ QString normalizeHeaderName(const QString &headerName) {
 }
 
 
-bool HeaderOperationMixin::hasHeader(const QString &headerName) const
+int HeaderOperationMixin::indexOfHeader(const QString &headerName, int from) const
 {
-    for (int i = 0; i < headers.size(); ++i) {
-        const HttpHeader &header = headers.at(i);
-        if(header.name.compare(headerName, Qt::CaseInsensitive) == 0) {
-            return true;
+    // the names of parsed headers are the canonical strings, so the exact comparison usually hits.
+    for (int i = from; i < headers.size(); ++i) {
+        const QString &name = headers.at(i).name;
+        if (name.size() == headerName.size()
+                && (name == headerName || name.compare(headerName, Qt::CaseInsensitive) == 0)) {
+            return i;
         }
     }
-    return false;
+    return -1;
+}
+
+
+bool HeaderOperationMixin::hasHeader(const QString &headerName) const
+{
+    return indexOfHeader(headerName) >= 0;
 }
 
 
 bool HeaderOperationMixin::removeHeader(const QString &headerName)
 {
-    for (int i = 0; i < headers.size(); ++i) {
-        const HttpHeader &header = headers.at(i);
-        if(header.name.compare(headerName, Qt::CaseInsensitive) == 0) {
-            headers.removeAt(i);
-            return true;
-        }
+    int i = indexOfHeader(headerName);
+    if (i < 0) {
+        return false;
     }
-    return false;
+    headers.removeAt(i);
+    return true;
 }
 
 
@@ -521,67 +586,33 @@ void HeaderOperationMixin::addHeader(const HttpHeader &header)
 
 QByteArray HeaderOperationMixin::header(const QString &headerName, const QByteArray &defaultValue) const
 {
-    for (int i = 0; i < headers.size(); ++i) {
-        const HttpHeader &header = headers.at(i);
-        if(header.name.compare(headerName, Qt::CaseInsensitive) == 0) {
-            return header.value;
+    int i = indexOfHeader(headerName);
+    if (i < 0) {
+        return defaultValue;
+    }
+    return headers.at(i).value;
+}
+
+
+QString HeaderOperationMixin::toString(KnownHeader knownHeader)
+{
+    if (knownHeader < 0 || knownHeader >= KnownHeaderCount) {
+        return QString();
+    }
+    return knownHeaderStrings().names[knownHeader];
+}
+
+
+bool HeaderOperationMixin::lookupKnownHeader(const char *name, int size, KnownHeader *knownHeader)
+{
+    const KnownHeaderStrings &strings = knownHeaderStrings();
+    for (int i = 0; i < KnownHeaderCount; ++i) {
+        if (strings.sizes[i] == size && qstrnicmp(name, knownHeaderNames[i], static_cast<uint>(size)) == 0) {
+            *knownHeader = static_cast<KnownHeader>(i);
+            return true;
         }
     }
-    return defaultValue;
-}
-
-
-inline QString HeaderOperationMixin::toString(KnownHeader knownHeader)
-{
-    switch (knownHeader) {
-    case ContentTypeHeader:
-        return "Content-Type";
-    case ContentLengthHeader:
-        return "Content-Length";
-    case ContentEncodingHeader:
-        return "Content-Encoding";
-    case TransferEncodingHeader:
-        return "Transfer-Encoding";
-    case LocationHeader:
-        return "Location";
-    case LastModifiedHeader:
-        return "Last-Modified";
-    case CookieHeader:
-        return "Cookie";
-    case SetCookieHeader:
-        return "Set-Cookie";
-    case ContentDispositionHeader:
-        return "Content-Disposition";
-    case UserAgentHeader:
-        return "User-Agent";
-    case AcceptHeader:
-        return "Accept";
-    case AcceptLanguageHeader:
-        return "Accept-Language";
-    case AcceptEncodingHeader:
-        return "Accept-Encoding";
-    case PragmaHeader:
-        return "Pragma";
-    case CacheControlHeader:
-        return "Cache-Control";
-    case DateHeader:
-        return "Date";
-    case AllowHeader:
-        return "Allow";
-    case VaryHeader:
-        return "Vary";
-    case FrameOptionsHeader:
-        return "X-Frame-Options";
-    case MIMEVersionHeader:
-        return "MIME-Version";
-    case ServerHeader:
-        return "Server";
-    case ConnectionHeader:
-        return "Connection";
-    case UpgradeHeader:
-        return "Upgrade";
-    }
-    return QString();
+    return false;
 }
 
 
@@ -602,7 +633,7 @@ QBYTEARRAYLIST HeaderOperationMixin::multiHeader(const QString &headerName) cons
     QBYTEARRAYLIST l;
     for (int i = 0; i < headers.size(); ++i) {
         const HttpHeader &header = headers.at(i);
-        if(header.name.compare(headerName, Qt::CaseInsensitive) == 0) {
+        if (header.name.size() == headerName.size() && header.name.compare(headerName, Qt::CaseInsensitive) == 0) {
             l.append(header.value);
         }
     }
@@ -720,6 +751,236 @@ QList<HttpHeader> HeaderSplitter::headers(int maxHeaders, Error *error)
     return QList<HttpHeader>();
 }
 
+HttpHeaderParser::HttpHeaderParser(int maxHeaders, int maxHeaderSize)
+    : maxHeaders(maxHeaders)
+    , maxHeaderSize(maxHeaderSize)
+    , pos(0)
+    , lineOffset(0)
+    , lineLength(-1)
+    , finished(false)
+{
+}
+
+
+void HttpHeaderParser::reset()
+{
+    views.clear();
+    pos = 0;
+    lineOffset = 0;
+    lineLength = -1;
+    finished = false;
+}
+
+
+static inline bool isHttpSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+
+HttpHeaderParser::Result HttpHeaderParser::parse(const char *data, int size)
+{
+    if (finished) {
+        return Finished;
+    }
+    while (pos < size) {
+        // memchr() is vectorized by the c library, which is much faster than testing every byte.
+        const char *start = data + pos;
+        const char *lf = static_cast<const char *>(memchr(start, '\n', static_cast<size_t>(size - pos)));
+        if (!lf) {
+            break;
+        }
+        const int lineEnd = static_cast<int>(lf - data);
+        int length = lineEnd - pos;
+        if (length > 0 && start[length - 1] == '\r') {
+            --length;
+        }
+        if (memchr(start, '\r', static_cast<size_t>(length))) {
+            return InvalidHeader;
+        }
+        if (lineLength < 0) {
+            // rfc 7230 3.5: a server should ignore at least one empty line received prior to the request-line.
+            if (length > 0) {
+                lineOffset = pos;
+                lineLength = length;
+            }
+        } else if (length == 0) {
+            pos = lineEnd + 1;
+            finished = true;
+            return Finished;
+        } else {
+            // obsolete line folding is rejected as rfc 7230 3.2.4 permits.
+            if (isHttpSpace(start[0])) {
+                return InvalidHeader;
+            }
+            const char *colon = static_cast<const char *>(memchr(start, ':', static_cast<size_t>(length)));
+            if (!colon) {
+                return InvalidHeader;
+            }
+            int nameLength = static_cast<int>(colon - start);
+            while (nameLength > 0 && isHttpSpace(start[nameLength - 1])) {
+                --nameLength;
+            }
+            if (nameLength == 0) {
+                return InvalidHeader;
+            }
+            int valueOffset = static_cast<int>(colon - start) + 1;
+            int valueEnd = length;
+            while (valueOffset < valueEnd && isHttpSpace(start[valueOffset])) {
+                ++valueOffset;
+            }
+            while (valueEnd > valueOffset && isHttpSpace(start[valueEnd - 1])) {
+                --valueEnd;
+            }
+            if (views.size() >= maxHeaders) {
+                return TooManyHeaders;
+            }
+            HttpHeaderView view;
+            view.nameOffset = pos;
+            view.nameLength = nameLength;
+            view.valueOffset = pos + valueOffset;
+            view.valueLength = valueEnd - valueOffset;
+            HeaderOperationMixin::KnownHeader knownHeader;
+            if (HeaderOperationMixin::lookupKnownHeader(start, nameLength, &knownHeader)) {
+                view.knownHeader = knownHeader;
+            } else {
+                view.knownHeader = -1;
+            }
+            views.append(view);
+        }
+        pos = lineEnd + 1;
+        if (pos > maxHeaderSize) {
+            return HeadersTooLarge;
+        }
+    }
+    if (size > maxHeaderSize) {
+        return HeadersTooLarge;
+    }
+    return NeedMoreData;
+}
+
+
+HttpHeaderParser::Result HttpHeaderParser::read(QSharedPointer<SocketLike> connection, QByteArray *buf)
+{
+    const int MinimumSpace = 1024;
+    while (true) {
+        Result result = parse(*buf);
+        if (result != NeedMoreData) {
+            return result;
+        }
+        const int oldSize = buf->size();
+        if (buf->capacity() - oldSize < MinimumSpace) {
+            buf->reserve(qMax(oldSize * 2, 1024 * 4));
+        }
+        // most peers send the whole header in one tcp segment, so read straight into the buffer.
+        const int space = buf->capacity() - oldSize;
+        buf->resize(oldSize + space);
+        qint32 bs = connection->recv(buf->data() + oldSize, space);
+        if (bs <= 0) {
+            buf->resize(oldSize);
+            return ConnectionError;
+        }
+        buf->resize(oldSize + bs);
+    }
+}
+
+
+QList<HttpHeader> HttpHeaderParser::headers(const char *data) const
+{
+    QList<HttpHeader> headers;
+    headers.reserve(views.size());
+    for (const HttpHeaderView &view: views) {
+        QString name;
+        if (view.knownHeader >= 0) {
+            name = HeaderOperationMixin::toString(static_cast<HeaderOperationMixin::KnownHeader>(view.knownHeader));
+        } else {
+            name = QString::fromLatin1(data + view.nameOffset, view.nameLength);
+        }
+        headers.append(HttpHeader(name, QByteArray(data + view.valueOffset, view.valueLength)));
+    }
+    return headers;
+}
+
+
+HttpVersion HttpHeaderParser::parseVersion(const char *s, int size)
+{
+    if (size != 8 || memcmp(s, "HTTP/1.", 7) != 0) {
+        return Unknown;
+    }
+    if (s[7] == '1') {
+        return Http1_1;
+    } else if (s[7] == '0') {
+        return Http1_0;
+    }
+    return Unknown;
+}
+
+
+static inline int nextToken(const char *line, int size, int from, int *tokenLength)
+{
+    while (from < size && isHttpSpace(line[from])) {
+        ++from;
+    }
+    int end = from;
+    while (end < size && !isHttpSpace(line[end])) {
+        ++end;
+    }
+    *tokenLength = end - from;
+    return from;
+}
+
+
+bool HttpHeaderParser::parseStatusLine(const char *line, int size, HttpVersion *version, int *statusCode,
+                                       QByteArray *statusText)
+{
+    int versionLength, codeLength;
+    int versionOffset = nextToken(line, size, 0, &versionLength);
+    int codeOffset = nextToken(line, size, versionOffset + versionLength, &codeLength);
+    *version = parseVersion(line + versionOffset, versionLength);
+    if (*version == Unknown || codeLength != 3) {
+        return false;
+    }
+    int code = 0;
+    for (int i = 0; i < 3; ++i) {
+        char c = line[codeOffset + i];
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        code = code * 10 + (c - '0');
+    }
+    *statusCode = code;
+    int textOffset = codeOffset + codeLength;
+    while (textOffset < size && isHttpSpace(line[textOffset])) {
+        ++textOffset;
+    }
+    *statusText = QByteArray(line + textOffset, size - textOffset);
+    return true;
+}
+
+
+bool HttpHeaderParser::parseRequestLine(const char *line, int size, QByteArray *method, QByteArray *path,
+                                        HttpVersion *version)
+{
+    int methodLength, pathLength, versionLength, restLength;
+    int methodOffset = nextToken(line, size, 0, &methodLength);
+    int pathOffset = nextToken(line, size, methodOffset + methodLength, &pathLength);
+    int versionOffset = nextToken(line, size, pathOffset + pathLength, &versionLength);
+    nextToken(line, size, versionOffset + versionLength, &restLength);
+    if (methodLength == 0 || pathLength == 0 || restLength != 0) {
+        return false;
+    }
+    *method = QByteArray(line + methodOffset, methodLength);
+    *path = QByteArray(line + pathOffset, pathLength);
+    if (versionLength == 0) {
+        // http/0.9 style request line.
+        *version = Http1_0;
+    } else {
+        *version = parseVersion(line + versionOffset, versionLength);
+    }
+    return true;
+}
+
+
 QList<QByteArray> splitBytes(const QByteArray &bs, char sep, int maxSplit)
 {
     QList<QByteArray> tokens;
@@ -53,71 +53,54 @@ class HttpHeaders: public HeaderOperationMixin {};
 bool BaseHttpRequestHandler::parseRequest()
 {
     bool done = false;
-    const QByteArray &buf = tryToHandleMagicCode(&done);
+    QByteArray buf = tryToHandleMagicCode(&done);
     if (done) {
         return false;
     }
-    HeaderSplitter headerSplitter(request, buf);
-    HeaderSplitter::Error headerSpliiterError;
-    QByteArray firstLine = headerSplitter.nextLine(&headerSpliiterError);
-    if (firstLine.isEmpty() || headerSpliiterError != HeaderSplitter::NoError) {
-        return false;
-    }
-#ifdef DEBUG_HTTP_PROTOCOL
-    qDebug() << "first line is" << firstLine;
-#endif
-
-    const QString &commandLine = QString::fromLatin1(firstLine);
-    QStringList words = commandLine.split(QRegExp("\\s+"));
-    if (words.isEmpty()) {
-        return false;
-    }
-    if (words.size() == 3) {
-        method = words.at(0);
-        path = words.at(1);
-        const QString &versionStr = words.at(2);
-        if (versionStr == "HTTP/1.0") {
-            version = Http1_0;
-        } else if(versionStr == "HTTP/1.1") {
-            version = Http1_1;
-            if (serverVersion == Http1_1) {
-                closeConnection = false;
-            }
-        } else {
-            sendError(HttpStatus::BadRequest, QStringLiteral("Bad request version (%1").arg(versionStr));
-            return false;
-        }
-    } else if (words.size() == 2) {
-        method = words.at(0);
-        path = words.at(1);
-        version = Http1_0;
-    } else if (words.isEmpty()) {
-        return false;
-    } else {
-        sendError(HttpStatus::BadRequest, QStringLiteral("Bad request syntax (%1)").arg(commandLine));
-        return false;
-    }
 
     const int MaxHeaders = 64;
-    QList<HttpHeader> headers = headerSplitter.headers(MaxHeaders, &headerSpliiterError);
-    switch (headerSpliiterError) {
-    case HeaderSplitter::EncodingError:
+    HttpHeaderParser headerParser(MaxHeaders);
+    HttpHeaderParser::Result parseResult = headerParser.read(request, &buf);
+    switch (parseResult) {
+    case HttpHeaderParser::InvalidHeader:
         sendError(HttpStatus::BadRequest, QStringLiteral("Bad request invalid header"));
         return false;
-    case HeaderSplitter::ConnectionError:
+    case HttpHeaderParser::ConnectionError:
         return false;
-    case HeaderSplitter::ExhausedMaxLine:
+    case HttpHeaderParser::TooManyHeaders:
         sendError(HttpStatus::RequestHeaderFieldsTooLarge, QStringLiteral("Too much headers"));
         return false;
-    case HeaderSplitter::LineTooLong:
+    case HttpHeaderParser::HeadersTooLarge:
         sendError(HttpStatus::RequestHeaderFieldsTooLarge, QStringLiteral("Line too long"));
         return false;
     default:
         break;
     }
-    setHeaders(headers);
+
+    const char *firstLine = buf.constData() + headerParser.firstLineOffset();
+    const int firstLineLength = headerParser.firstLineLength();
+#ifdef DEBUG_HTTP_PROTOCOL
+    qDebug() << "first line is" << QByteArray(firstLine, firstLineLength);
+#endif
+    QByteArray methodBytes, pathBytes;
+    if (!HttpHeaderParser::parseRequestLine(firstLine, firstLineLength, &methodBytes, &pathBytes, &version)) {
+        const QString &commandLine = QString::fromLatin1(firstLine, firstLineLength);
+        sendError(HttpStatus::BadRequest, QStringLiteral("Bad request syntax (%1)").arg(commandLine));
+        return false;
+    }
+    method = QString::fromLatin1(methodBytes);
+    path = QString::fromLatin1(pathBytes);
+    if (version == Unknown) {
+        const QString &versionStr = QString::fromLatin1(firstLine, firstLineLength).section(QLatin1Char(' '), -1);
+        sendError(HttpStatus::BadRequest, QStringLiteral("Bad request version (%1)").arg(versionStr));
+        return false;
+    } else if (version == Http1_1 && serverVersion == Http1_1) {
+        closeConnection = false;
+    }
+
+    setHeaders(headerParser.headers(buf.constData()));
 #ifdef DEBUG_HTTP_PROTOCOL
-    for (const HttpHeader &header: headers) {
+    for (const HttpHeader &header: allHeaders()) {
         qDebug() << "header(" << header.name << ") = " << header.value;
     }
 #endif
@@ -127,7 +110,7 @@ bool BaseHttpRequestHandler::parseRequest()
     } else if (connectionType.toLower() == "keep-alive" && version == Http1_1 && serverVersion == Http1_1) {
         closeConnection = false;
     }
-    body = headerSplitter.buf;
+    body = buf.mid(headerParser.headerSize());
     return true;
 }
 
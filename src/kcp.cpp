@@ -1,24 +1,76 @@
-#include <QtCore/qdatetime.h>
 #include <QtCore/qelapsedtimer.h>
 #include <QtCore/qbytearray.h>
 #include <QtCore/qendian.h>
+#include <QtCore/qthreadstorage.h>
+#include <QtCore/qvarlengtharray.h>
 #include "../include/kcp.h"
 #include "../include/socket_utils.h"
 #include "../include/coroutine_utils.h"
 #include "../include/random.h"
+#ifndef QTNG_NO_CRYPTO
+#include <openssl/curve25519.h>
+#include "../include/md.h"
+#endif
+#include "../include/private/kcp_p.h"
+#include "../include/private/kcp_fec_p.h"
 #include "./kcp/ikcp.h"
+#ifdef QTNG_HAVE_ZLIB
+#include <zlib.h>
+#endif
 QTNETWORKNG_NAMESPACE_BEGIN
 
+// all timestamps of kcp are taken from a monotonic clock, so that changing the system time neither stalls the
+// timer wheel nor tears down the sessions.
+static inline quint64 kcpTimestamp()
+{
+    QElapsedTimer clock;
+    clock.start();
+    return static_cast<quint64>(clock.msecsSinceReference());
+}
+
+
 const char PACKET_TYPE_UNCOMPRESSED_DATA = 0x01;
 const char PACKET_TYPE_CREATE_MULTIPATH = 0x02;
 const char PACKET_TYPE_CLOSE= 0X03;
 const char PACKET_TYPE_KEEPALIVE = 0x04;
+const char PACKET_TYPE_FEC = 0x05;
+const char PACKET_TYPE_COMPRESSED_DATA = 0x06;
+const char PACKET_TYPE_PATH_PROBE = 0x07;
+const char PACKET_TYPE_PATH_PROBE_ACK = 0x08;
+const char PACKET_TYPE_SESSION_TOKEN = 0x09;
+const char PACKET_TYPE_RESUME_CHALLENGE = 0x0a;
+const char PACKET_TYPE_RESUME = 0x0b;
+const char PACKET_TYPE_FEATURES = 0x0c;
+
+// the client side asks for the optional features by a PACKET_TYPE_FEATURES packet, and the server side answers
+// with the features it agrees to. they are not used before the answer, so the old servers, which ignore the
+// unknown packet, keep working. the request is sent again every second for a few times if it is not answered.
+// type(1) + connection id(4) + features(1) + fec data shards(1) + fec parity shards(1)
+const quint8 KcpFeatureCompression = 0x01;
+const quint8 KcpFeatureFec = 0x02;
+const int KcpFeaturesPacketSize = 8;
+const int KcpMaxFeatureRequests = 10;
+
+// the session token is derived from an x25519 exchange. the client side sends its public key until the server
+// side answers with its own, and both sides hash the shared secret with the two public keys and the connection
+// id. the token itself is never sent, so the passive observers can not learn it. but the server is not
+// authenticated, so an active man in the middle of the exchange can; the token only stops the off-path and the
+// passive attackers from taking over the session. a new address of client proves the token by a hmac over the
+// challenge from server, which is truncated to 16 bytes.
+// type(1) + connection id(4) + x25519 public key(32)
+const int KcpTokenKeySize = 32;
+const int KcpTokenPacketSize = 37;
+const int KcpSessionTokenSize = 16;
+const int KcpResumeProofSize = 16;
+// type(1) + connection id(4) + nonce(8) + migrate flag(1) + proof(16)
+const int KcpResumePacketSize = 30;
 
 
 //#define DEBUG_PROTOCOL 1
 
 
 class SlaveKcpSocketPrivate;
+class KcpScheduler;
 class KcpSocketPrivate: public QObject
 {
 public:
@@ -49,13 +101,40 @@ public:
     void setMode(KcpSocket::Mode mode);
     qint32 send(const char *data, qint32 size, bool all);
     qint32 recv(char *data, qint32 size, bool all);
+    QByteArray recvPacket();
+    qint32 sendPacket(const char *data, qint32 size);
+    void consume(qint32 len);
+    void unread(const char *data, qint32 len);
     bool handleDatagram(const char *buf, quint32 len);
+    void inputPacket(const char *packet, int size);
+    void inputSegment(const char *data, int size);
+    void outputPacket(char packetType, const char *data, int size);
+    void countSegments(const char *buf, int len);
+    void updateStats(quint64 now);
+    void adapt();
+    void releasePacedPackets(quint64 now);
+    void sendFecData(char packetType, const char *data, int size);
+    void sendFecParity();
+    void writeFecHeader(char *packet, quint32 groupId, int index, int dataShards);
     void updateKcp();
-    void doUpdate();
-    virtual qint32 rawSend(const char *data, qint32 size) = 0;
+    quint64 updateStep(quint64 now);
+    qint32 rawSend(const char *data, qint32 size) { return sendToPath(choosePath(), data, size); }
+    virtual qint32 sendToPath(int path, const char *data, qint32 size) = 0;
+    virtual bool openPath(quint64 now);
+    virtual void closePath(int path);
+    int choosePath();
+    void maintainPaths(quint64 now);
+    void sendProbe(int path, char packetType, quint32 sequence);
+    void sendSessionToken(int path);
+    void generateTokenKeys();
+    bool deriveSessionToken();
+    quint8 wantedFeatures() const;
+    void sendFeatures(int path);
+    void warnUnknownPacket(char packetType);
+    void sendResume(int path);
+    QByteArray makeResumeProof(quint64 nonce, bool migrate) const;
     virtual void setDnsCache(QSharedPointer<SocketDnsCache> dnsCache) = 0;
 
-    QByteArray makeDataPacket(const char *data, qint32 size);
     QByteArray makeShutdownPacket();
     QByteArray makeKeepalivePacket();
     QByteArray makeMultiPathPacket(quint32 connectionId);
@@ -72,8 +151,9 @@ public:
     QSharedPointer<Event> sendingQueueEmpty;
     QSharedPointer<Event> receivingQueueNotEmpty;
     QSharedPointer<RLock> kcpLock;
-    QSharedPointer<Gate> forceToUpdate;
+    QSharedPointer<KcpScheduler> scheduler;
     QByteArray receivingBuffer;
+    qint32 receivingOffset;
 
     const quint64 zeroTimestamp;
     quint64 lastActiveTimestamp;
@@ -85,15 +165,128 @@ public:
 
     QHostAddress remoteAddress;
     quint16 remotePort;
+    QVector<KcpPath> paths;
+    int receivingPath;
+    int multiPathCount;
+    quint64 lastPathOpenedTimestamp;
+    // derived from the key exchange, which the client side starts again every second until it is answered.
+    QByteArray sessionToken;
+    QByteArray tokenPublicKey;
+    QByteArray tokenPrivateKey;
+    QByteArray peerTokenKey;
+    quint64 lastTokenRequestTimestamp;
+    bool tokenRequested;
 
     KcpSocket::Mode mode;
+
+    KcpFecEncoder fecEncoder;
+    KcpFecDecoder fecDecoder;
+    // set by user. the encoder is enabled by them after the peer agrees.
+    int fecDataShards;
+    int fecParityShards;
+    quint64 updatingTimestamp;
+    quint64 lastFecExpiredTimestamp;
+    bool negotiable;
+    bool compressionEnabled;
+    // the client side requests them, and the server side sets them by the request.
+    quint8 peerFeatures;
+    quint8 requestedFeatures;
+    int featureRequests;
+    quint64 lastFeatureRequestTimestamp;
+    bool featuresAnswered;
+    bool featuresRequested;
+    bool unknownPacketWarned;
+
+    // counted from the output of kcp, the retransmissions include the fast ones.
+    quint64 sentSegments;
+    quint64 retransmittedSegments;
+    quint32 nextSegmentNumber;
+    // sampled every second.
+    quint64 lastStatsTimestamp;
+    quint64 lastSentSegments;
+    quint64 lastRetransmittedSegments;
+    quint32 lastUna;
+    float lossRate;
+    float deliveryRate;  // segments per msec.
+
+    QList<QByteArray> pacedPackets;
+    quint64 lastPacedTimestamp;
+    qint64 pacingTokens;
+    bool pacingEnabled;
+
+    // maintained by KcpScheduler.
+    KcpSocketPrivate *wheelPrev;
+    KcpSocketPrivate *wheelNext;
+    quint64 wheelDue;
+    int wheelSlot;
 };
 
 
-static inline QString concat(const QHostAddress &addr, quint16 port)
+#ifdef QTNG_HAVE_ZLIB
+// compresses every datagram by itself, because datagrams may be lost or reordered. a preset dictionary of
+// common http and json tokens makes up for the missing history.
+class KcpCompressor
 {
-    return addr.toString() + QString::number(port);
-}
+public:
+    KcpCompressor();
+    ~KcpCompressor();
+public:
+    // returns the size of compressed data, or -1 if it does not shrink.
+    int compress(const char *data, int size, char *out);
+    int decompress(const char *data, int size, char *out, int outSize);
+private:
+    z_stream deflater;
+    z_stream inflater;
+    bool deflaterReady;
+    bool inflaterReady;
+};
+#endif
+
+
+// drives all kcp sessions of a thread from one coroutine. the sessions are kept in a two-level timer wheel
+// with 1ms ticks, so a wake-up only touches the sessions whose ikcp_check() is due. the packets produced by
+// a batch of ikcp_update() are sent back to back after the batch, and never block the other sessions' updates.
+class KcpScheduler
+{
+public:
+    KcpScheduler();
+    ~KcpScheduler();
+    static QSharedPointer<KcpScheduler> get();
+public:
+    void updateNow(KcpSocketPrivate *session);
+    void remove(KcpSocketPrivate *session);
+    // the packet is sent by the path, or a path chosen by session if it is negative.
+    char *reserve(KcpSocketPrivate *session, qint32 size, int path = -1);
+#ifdef QTNG_HAVE_ZLIB
+    // the buffers are shared by the sessions of thread, and only valid before the next call.
+    const char *compress(const char *segment, int size, int *compressedSize);
+    const char *decompress(const char *packet, int size, int *segmentSize);
+#endif
+private:
+    void flush();
+    void run();
+private:
+    typedef KcpTimerWheel<KcpSocketPrivate> Wheel;
+    struct OutgoingPacket
+    {
+        QPointer<KcpSocketPrivate> session;
+        int offset;
+        int size;
+        int path;
+    };
+    Wheel wheel;
+    QVector<OutgoingPacket> outgoingPackets;
+    QVarLengthArray<char, 1024 * 64> outgoingBuffer;
+#ifdef QTNG_HAVE_ZLIB
+    KcpCompressor compressor;
+    QByteArray compressBuffer;
+    QByteArray decompressBuffer;
+#endif
+    int sessions;
+    bool running;
+    Event wakeup;
+    CoroutineGroup *operations;
+};
 
 
 class MasterKcpSocketPrivate: public KcpSocketPrivate
@@ -121,18 +314,20 @@ public:
     virtual bool setOption(Socket::SocketOption option, const QVariant &value) override;
     virtual QVariant option(Socket::SocketOption option) const override;
 public:
-    virtual qint32 rawSend(const char *data, qint32 size) override;
+    virtual qint32 sendToPath(int path, const char *data, qint32 size) override;
+    virtual bool openPath(quint64 now) override;
+    virtual void closePath(int path) override;
     virtual void setDnsCache(QSharedPointer<SocketDnsCache> dnsCache) override;
 public:
-    void removeSlave(const QString &originalHostAndPort) { receiversByHostAndPort.remove(originalHostAndPort); }
+    void removeSlave(const KcpPeerKey &originalPeer) { receiversByHostAndPort.remove(originalPeer); }
     void removeSlave(quint32 connectionId) { receiversByConnectionId.remove(connectionId); }
     quint32 nextConnectionId();
-    void doReceive();
+    void doReceive(QSharedPointer<Socket> socket);
     void doAccept();
     bool startReceivingCoroutine();
 public:
-    QMap<QString, QPointer<class SlaveKcpSocketPrivate>> receiversByHostAndPort;
-    QMap<quint32, QPointer<class SlaveKcpSocketPrivate>> receiversByConnectionId;
+    QHash<KcpPeerKey, QPointer<class SlaveKcpSocketPrivate>> receiversByHostAndPort;
+    QHash<quint32, QPointer<class SlaveKcpSocketPrivate>> receiversByConnectionId;
     QSharedPointer<Socket> rawSocket;
     Queue<QSharedPointer<KcpSocket>> pendingSlaves;
 };
@@ -164,11 +359,21 @@ public:
     virtual bool setOption(Socket::SocketOption option, const QVariant &value) override;
     virtual QVariant option(Socket::SocketOption option) const override;
 public:
-    virtual qint32 rawSend(const char *data, qint32 size) override;
+    virtual qint32 sendToPath(int path, const char *data, qint32 size) override;
     virtual void setDnsCache(QSharedPointer<SocketDnsCache> dnsCache) override;
 public:
-    QString originalHostAndPort;
+    int touchPath(const KcpPeerKey &key, quint64 now);
+    int addPath(const KcpPeerKey &key, const QHostAddress &addr, quint16 port, quint64 now);
+    bool hasPath(const KcpPeerKey &key) const;
+    void challenge(const QHostAddress &addr, quint16 port, quint64 now);
+    bool resume(const char *packet, int len, const KcpPeerKey &key, const QHostAddress &addr, quint16 port,
+                quint64 now);
+public:
+    KcpPeerKey originalPeer;
     QPointer<MasterKcpSocketPrivate> parent;
+    quint64 resumeNonce;
+    quint64 resumeNonceTimestamp;
+    quint64 lastChallengeTimestamp;
 };
 
 
@@ -191,31 +396,321 @@ int kcp_callback(const char *buf, int len, ikcpcb *, void *user)
         qWarning() << "kcp_callback got invalid data.";
         return -1;
     }
-    const QByteArray &packet = p->makeDataPacket(buf, len);
-    qint32 sentBytes = -1;
-    for (int i = 0; i < 1; ++i) {
-        sentBytes = p->rawSend(packet.data(), packet.size());
-        if (sentBytes != packet.size()) {  // but why this happens?
-            p->error = Socket::SocketAccessError;
-            p->errorString = QStringLiteral("can not send udp packet");
+    p->countSegments(buf, len);
+    // the packet is sent by KcpScheduler::flush() after the current batch of updates.
+    char packetType = PACKET_TYPE_UNCOMPRESSED_DATA;
+    const char *data = buf;
+    int size = len;
+#ifdef QTNG_HAVE_ZLIB
+    if (p->compressionEnabled && (p->peerFeatures & KcpFeatureCompression)) {
+        int compressedSize;
+        const char *compressed = p->scheduler->compress(buf, len, &compressedSize);
+        if (compressed) {
+            packetType = PACKET_TYPE_COMPRESSED_DATA;
+            data = compressed;
+            size = compressedSize;
+        }
+    }
+#endif
+    if (p->pacingEnabled && (!p->pacedPackets.isEmpty() || p->pacingTokens <= 0)) {
+        // released by updateStep() as the tokens are refilled.
+        QByteArray packet(size + 1, Qt::Uninitialized);
+        packet.data()[0] = packetType;
+        memcpy(packet.data() + 1, data, static_cast<size_t>(size));
+        p->pacedPackets.append(packet);
+        return len;
+    }
+    p->pacingTokens -= size + 1;
+    p->outputPacket(packetType, data, size);
+    return len;
+}
+
+
+#ifdef QTNG_HAVE_ZLIB
+static const char kcpCompressionDictionary[] =
+        "HTTP/1.1 200 OK\r\nContent-Type: application/json; charset=utf-8\r\nContent-Length: "
+        "Content-Encoding: Transfer-Encoding: chunked\r\nConnection: keep-alive\r\nCache-Control: no-cache\r\n"
+        "Date: Server: Host: User-Agent: Mozilla/5.0 Accept: */*\r\nAccept-Encoding: Authorization: Bearer "
+        "Cookie: Set-Cookie: X-Request-Id: GET /api/ POST PUT DELETE HTTP/1.1\r\n\r\n"
+        "{\"id\":\"type\":\"name\":\"data\":{\"status\":\"code\":\"message\":\"error\":null,\"result\":"
+        "\"items\":[{\"value\":\"created_at\":\"updated_at\":\"timestamp\":\"user\":\"token\":"
+        "true,false,null},{\"\":\"\"}]}";
+
+
+KcpCompressor::KcpCompressor()
+    : deflaterReady(false), inflaterReady(false)
+{
+    memset(&deflater, 0, sizeof(deflater));
+    memset(&inflater, 0, sizeof(inflater));
+}
+
+
+KcpCompressor::~KcpCompressor()
+{
+    if (deflaterReady) {
+        deflateEnd(&deflater);
+    }
+    if (inflaterReady) {
+        inflateEnd(&inflater);
+    }
+}
+
+
+int KcpCompressor::compress(const char *data, int size, char *out)
+{
+    if (!deflaterReady) {
+        // raw deflate without header and checksum, kcp checks nothing but the udp checksum is there.
+        if (deflateInit2(&deflater, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return -1;
+        }
+        deflaterReady = true;
+    } else if (deflateReset(&deflater) != Z_OK) {
+        return -1;
+    }
+    deflateSetDictionary(&deflater, reinterpret_cast<const Bytef *>(kcpCompressionDictionary),
+                         sizeof(kcpCompressionDictionary) - 1);
+    deflater.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    deflater.avail_in = static_cast<uInt>(size);
+    deflater.next_out = reinterpret_cast<Bytef *>(out);
+    deflater.avail_out = static_cast<uInt>(size - 1);
+    if (deflate(&deflater, Z_FINISH) != Z_STREAM_END) {
+        return -1;  // the output is full, so it does not shrink.
+    }
+    return static_cast<int>(deflater.total_out);
+}
+
+
+int KcpCompressor::decompress(const char *data, int size, char *out, int outSize)
+{
+    if (!inflaterReady) {
+        if (inflateInit2(&inflater, -15) != Z_OK) {
+            return -1;
+        }
+        inflaterReady = true;
+    } else if (inflateReset(&inflater) != Z_OK) {
+        return -1;
+    }
+    inflateSetDictionary(&inflater, reinterpret_cast<const Bytef *>(kcpCompressionDictionary),
+                         sizeof(kcpCompressionDictionary) - 1);
+    inflater.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    inflater.avail_in = static_cast<uInt>(size);
+    inflater.next_out = reinterpret_cast<Bytef *>(out);
+    inflater.avail_out = static_cast<uInt>(outSize);
+    if (inflate(&inflater, Z_FINISH) != Z_STREAM_END) {
+        return -1;
+    }
+    return static_cast<int>(inflater.total_out);
+}
+#endif
+
+
+KcpScheduler::KcpScheduler()
+    : wheel(kcpTimestamp()), sessions(0), running(false)
+    , operations(new CoroutineGroup)
+{
+#ifdef QTNG_HAVE_ZLIB
+    compressBuffer.resize(1024 * 64);
+    decompressBuffer.resize(1024 * 64);
+#endif
+}
+
+
+KcpScheduler::~KcpScheduler()
+{
+    delete operations;
+}
+
+
+QSharedPointer<KcpScheduler> KcpScheduler::get()
+{
+    static QThreadStorage<QWeakPointer<KcpScheduler>> storage;
+    QSharedPointer<KcpScheduler> scheduler = storage.localData().toStrongRef();
+    if (scheduler.isNull()) {
+        scheduler.reset(new KcpScheduler());
+        storage.setLocalData(scheduler);
+    }
+    return scheduler;
+}
+
+
+void KcpScheduler::updateNow(KcpSocketPrivate *session)
+{
+    if (session->wheelSlot == Wheel::NoSlot) {
+        ++sessions;
+    } else if (session->wheelSlot == Wheel::DueSlot || session->wheelSlot == Wheel::ReadySlot) {
+        return;
+    } else {
+        wheel.unlink(session);
+    }
+    wheel.link(session, Wheel::ReadySlot);
+    if (!running) {
+        running = true;
+        operations->spawnWithName("kcp_scheduler", [this] { run(); });
+    } else {
+        wakeup.set();
+    }
+}
+
+
+void KcpScheduler::remove(KcpSocketPrivate *session)
+{
+    if (session->wheelSlot == Wheel::NoSlot) {
+        return;
+    } else if (session->wheelSlot == Wheel::DueSlot) {
+        int i = wheel.due.indexOf(session);
+        if (i >= 0) {
+            wheel.due[i] = nullptr;
+        }
+        session->wheelSlot = Wheel::NoSlot;
+    } else {
+        wheel.unlink(session);
+    }
+    --sessions;
+}
+
+
+char *KcpScheduler::reserve(KcpSocketPrivate *session, qint32 size, int path)
+{
+    OutgoingPacket packet;
+    packet.session = session;
+    packet.offset = outgoingBuffer.size();
+    packet.size = size;
+    packet.path = path;
+    outgoingPackets.append(packet);
+    outgoingBuffer.resize(packet.offset + size);
+    return outgoingBuffer.data() + packet.offset;
+}
+
+
+#ifdef QTNG_HAVE_ZLIB
+const char *KcpScheduler::compress(const char *segment, int size, int *compressedSize)
+{
+    // the conversation id is left uncompressed, the connection id is written over it.
+    // small segments are mostly acks, which never shrink.
+    if (size < 64 || size > compressBuffer.size()) {
+        return nullptr;
+    }
+    char *out = compressBuffer.data();
+    memset(out, 0, 4);
+    int len = compressor.compress(segment + 4, size - 4, out + 4);
+    if (len < 0) {
+        return nullptr;
+    }
+    *compressedSize = len + 4;
+    return out;
+}
+
+
+const char *KcpScheduler::decompress(const char *packet, int size, int *segmentSize)
+{
+    char *out = decompressBuffer.data();
+    memset(out, 0, 4);
+    int len = compressor.decompress(packet + 4, size - 4, out + 4, decompressBuffer.size() - 4);
+    if (len < 0) {
+        return nullptr;
+    }
+    *segmentSize = len + 4;
+    return out;
+}
+#endif
+
+
+void KcpScheduler::flush()
+{
+    // no packet is added while sending, only ikcp_update() in run() produces them.
+    for (int i = 0; i < outgoingPackets.size(); ++i) {
+        const OutgoingPacket &packet = outgoingPackets.at(i);
+        KcpSocketPrivate *session = packet.session.data();
+        if (!session || session->error != Socket::NoError) {
+            continue;
+        }
+        const char *data = outgoingBuffer.constData() + packet.offset;
+        qint32 sentBytes;
+        if (packet.path < 0) {
+            sentBytes = session->rawSend(data, packet.size);
+        } else if (packet.path < session->paths.size()) {
+            sentBytes = session->sendToPath(packet.path, data, packet.size);
+        } else {
+            continue;  // the path is closed.
+        }
+        if (sentBytes != packet.size) {  // but why this happens?
+            session->error = Socket::SocketAccessError;
+            session->errorString = QStringLiteral("can not send udp packet");
 #ifdef DEBUG_PROTOCOL
             qWarning() << "can not send packet.";
 #endif
-            p->close(true);
-            return -1;
+            session->close(true);
+        }
+    }
+    outgoingPackets.resize(0);
+    outgoingBuffer.resize(0);
+}
+
+
+void KcpScheduler::run()
+{
+    while (sessions > 0) {
+        quint64 now = kcpTimestamp();
+        wheel.advance(now);
+        // updateStep() may close the session, and the closing may switch coroutines which delete other due
+        // sessions. remove() nulls the due entries of them, so the entries are checked before each use.
+        for (int i = 0; i < wheel.due.size(); ++i) {
+            KcpSocketPrivate *session = wheel.due.at(i);
+            if (!session || session->wheelSlot != Wheel::DueSlot) {
+                continue;
+            }
+            quint64 next = session->updateStep(now);
+            if (wheel.due.at(i) != session || session->wheelSlot != Wheel::DueSlot) {  // removed or updated again.
+                continue;
+            }
+            if (next == 0) {
+                session->wheelSlot = Wheel::NoSlot;
+                --sessions;
+            } else {
+                wheel.schedule(session, next);
+            }
+        }
+        wheel.due.resize(0);
+        flush();
+
+        quint64 tick = wheel.nextTick();
+        now = kcpTimestamp();
+        if (tick <= now || sessions <= 0) {
+            continue;
+        }
+        wakeup.clear();
+        try {
+            Timeout timeout(static_cast<quint32>(tick - now), 0); Q_UNUSED(timeout);
+            bool ok = wakeup.wait();
+            if (!ok) {
+                break;
+            }
+        } catch (TimeoutException &) {
+            // continue
         }
     }
-    return sentBytes;
+    running = false;
 }
 
 
 KcpSocketPrivate::KcpSocketPrivate(KcpSocket *q)
     : q_ptr(q), operations(new CoroutineGroup), state(Socket::UnconnectedState), error(Socket::NoError)
     , sendingQueueNotFull(new Event()), sendingQueueEmpty(new Event()), receivingQueueNotEmpty(new Event())
-    , kcpLock(new RLock), forceToUpdate(new Gate)
-    , zeroTimestamp(static_cast<quint64>(QDateTime::currentMSecsSinceEpoch())), lastActiveTimestamp(zeroTimestamp)
+    , kcpLock(new RLock), scheduler(KcpScheduler::get()), receivingOffset(0)
+    , zeroTimestamp(kcpTimestamp()), lastActiveTimestamp(zeroTimestamp)
     , lastKeepaliveTimestamp(zeroTimestamp), tearDownTime(1000 * 30), waterLine(1024 * 16)
-    , connectionId(0), remotePort(0), mode(KcpSocket::Internet)
+    , connectionId(0), remotePort(0), receivingPath(0), multiPathCount(1), lastPathOpenedTimestamp(0)
+    , lastTokenRequestTimestamp(zeroTimestamp), tokenRequested(false)
+    , mode(KcpSocket::Internet)
+    , fecDataShards(0), fecParityShards(0)
+    , updatingTimestamp(zeroTimestamp), lastFecExpiredTimestamp(zeroTimestamp), negotiable(false)
+    , compressionEnabled(false), peerFeatures(0), requestedFeatures(0), featureRequests(0)
+    , lastFeatureRequestTimestamp(zeroTimestamp), featuresAnswered(false), featuresRequested(false)
+    , unknownPacketWarned(false)
+    , sentSegments(0), retransmittedSegments(0), nextSegmentNumber(0), lastStatsTimestamp(zeroTimestamp)
+    , lastSentSegments(0), lastRetransmittedSegments(0), lastUna(0), lossRate(0.0f), deliveryRate(0.0f)
+    , lastPacedTimestamp(zeroTimestamp), pacingTokens(0), pacingEnabled(false)
+    , wheelPrev(nullptr), wheelNext(nullptr), wheelDue(0), wheelSlot(KcpTimerWheel<KcpSocketPrivate>::NoSlot)
 {
     kcp = ikcp_create(0, this);
     ikcp_setoutput(kcp, kcp_callback);
@@ -230,6 +725,7 @@ KcpSocketPrivate::KcpSocketPrivate(KcpSocket *q)
 
 KcpSocketPrivate::~KcpSocketPrivate()
 {
+    scheduler->remove(this);
     delete operations;
     ikcp_release(kcp);
 }
@@ -292,6 +788,12 @@ void KcpSocketPrivate::setMode(KcpSocket::Mode mode)
         ikcp_setmtu(kcp, 32768);
         ikcp_wndsize(kcp, 32, 32);
         break;
+    case KcpSocket::Adaptive:
+        // starts as Internet with a small send window, which is tuned by adapt() every second.
+        ikcp_nodelay(kcp, 1, 20, 3, 1);
+        ikcp_setmtu(kcp, 1400);
+        ikcp_wndsize(kcp, 128, 2048);
+        break;
     }
 }
 
@@ -337,167 +839,849 @@ qint32 KcpSocketPrivate::send(const char *data, qint32 size, bool all)
 
 qint32 KcpSocketPrivate::recv(char *data, qint32 size, bool all)
 {
+    // the messages are received into the buffer of caller if they fit, only the rest of a larger message is
+    // kept in `receivingBuffer`.
+    qint32 total = 0;
     while (true) {
         if (state != Socket::ConnectedState) {
             error = Socket::SocketAccessError;
             errorString = QStringLiteral("KcpSocket is not connected.");
+            unread(data, total);
             return -1;
         }
-        int peeksize = ikcp_peeksize(kcp);
-        if (peeksize > 0) {
-            QByteArray buf(peeksize, Qt::Uninitialized);
+        const qint32 buffered = receivingBuffer.size() - receivingOffset;
+        if (buffered > 0) {
+            qint32 len = qMin(size - total, buffered);
+            memcpy(data + total, receivingBuffer.constData() + receivingOffset, static_cast<size_t>(len));
+            consume(len);
+            total += len;
+        }
+        while (total < size) {
+            int peeksize = ikcp_peeksize(kcp);
+            if (peeksize <= 0) {
+                break;
+            }
             ScopedLock<RLock> l(kcpLock); Q_UNUSED(l);
-            int readBytes = ikcp_recv(kcp, buf.data(), buf.size());
-            Q_ASSERT(readBytes == peeksize);
-            receivingBuffer.append(buf);
-        }
-        if (!receivingBuffer.isEmpty()) {
-            if (!all || receivingBuffer.size() >= size) {
-                qint32 len = qMin(size, receivingBuffer.size());
-                memcpy(data, receivingBuffer.data(), static_cast<size_t>(len));
-                receivingBuffer.remove(0, len);
-                return len;
+            if (peeksize <= size - total) {
+                int readBytes = ikcp_recv(kcp, data + total, peeksize);
+                Q_ASSERT(readBytes == peeksize);
+                total += readBytes;
+            } else {
+                Q_ASSERT(receivingOffset == receivingBuffer.size());
+                receivingBuffer.resize(peeksize);
+                receivingOffset = 0;
+                int readBytes = ikcp_recv(kcp, receivingBuffer.data(), peeksize);
+                Q_ASSERT(readBytes == peeksize);
+                qint32 len = size - total;
+                memcpy(data + total, receivingBuffer.constData(), static_cast<size_t>(len));
+                consume(len);
+                total += len;
             }
         }
+        if (total > 0 && (!all || total >= size)) {
+            return total;
+        }
         receivingQueueNotEmpty->clear();
         bool ok = receivingQueueNotEmpty->wait();
         if (!ok) {
             qDebug() << "not receivingQueueNotEmpty->wait()";
+            unread(data, total);
             return -1;
         }
     }
 }
 
 
-bool KcpSocketPrivate::handleDatagram(const char *buf, quint32 len)
+QByteArray KcpSocketPrivate::recvPacket()
+{
+    while (true) {
+        if (state != Socket::ConnectedState) {
+            error = Socket::SocketAccessError;
+            errorString = QStringLiteral("KcpSocket is not connected.");
+            return QByteArray();
+        }
+        if (receivingOffset < receivingBuffer.size()) {
+            // the rest of a message partially read by recv().
+            const QByteArray &packet = receivingBuffer.mid(receivingOffset);
+            consume(packet.size());
+            return packet;
+        }
+        int peeksize = ikcp_peeksize(kcp);
+        if (peeksize > 0) {
+            QByteArray packet(peeksize, Qt::Uninitialized);
+            ScopedLock<RLock> l(kcpLock); Q_UNUSED(l);
+            int readBytes = ikcp_recv(kcp, packet.data(), packet.size());
+            Q_ASSERT(readBytes == peeksize);
+            return packet;
+        }
+        receivingQueueNotEmpty->clear();
+        bool ok = receivingQueueNotEmpty->wait();
+        if (!ok) {
+            return QByteArray();
+        }
+    }
+}
+
+
+qint32 KcpSocketPrivate::sendPacket(const char *data, qint32 size)
+{
+    if (size <= 0 || !isValid()) {
+        return -1;
+    }
+    bool ok = sendingQueueNotFull->wait();
+    if (!ok) {
+        return -1;
+    }
+    if (state != Socket::ConnectedState) {
+        error = Socket::SocketAccessError;
+        errorString = QStringLiteral("KcpSocket is not connected.");
+        return -1;
+    }
+    int result;
+    {
+        ScopedLock<RLock> l(kcpLock); Q_UNUSED(l);
+        result = ikcp_send(kcp, data, size);
+    }
+    if (result < 0) {
+        error = Socket::DatagramTooLargeError;
+        errorString = QStringLiteral("the packet is too large.");
+        return -1;
+    }
+    updateKcp();
+    return size;
+}
+
+
+void KcpSocketPrivate::consume(qint32 len)
+{
+    receivingOffset += len;
+    if (receivingOffset >= receivingBuffer.size()) {
+        receivingBuffer.resize(0);
+        receivingOffset = 0;
+    }
+}
+
+
+void KcpSocketPrivate::unread(const char *data, qint32 len)
+{
+    // recvall() is interrupted, put the received bytes back for the next call.
+    if (len <= 0) {
+        return;
+    }
+    if (receivingOffset >= len) {
+        receivingOffset -= len;
+        memcpy(receivingBuffer.data() + receivingOffset, data, static_cast<size_t>(len));
+    } else {
+        receivingBuffer = QByteArray(data, len) + receivingBuffer.mid(receivingOffset);
+        receivingOffset = 0;
+    }
+}
+
+
+bool KcpSocketPrivate::handleDatagram(const char *buf, quint32 len)
+{
+    if (len < 5) {
+        return true;
+    }
+    switch(buf[0]) {
+    case PACKET_TYPE_UNCOMPRESSED_DATA:
+    case PACKET_TYPE_COMPRESSED_DATA:
+        inputPacket(buf, static_cast<int>(len));
+        break;
+    case PACKET_TYPE_FEC:
+        if (len > static_cast<quint32>(KcpFecHeaderSize)) {
+            const int index = static_cast<quint8>(buf[9]);
+            const int dataShards = static_cast<quint8>(buf[10]);
+            if (index < dataShards) {
+                inputPacket(buf + KcpFecHeaderSize, static_cast<int>(len) - KcpFecHeaderSize);
+            }
+            quint64 now = kcpTimestamp();
+            const QList<QByteArray> &recovered = fecDecoder.addShard(buf, static_cast<int>(len), now);
+            for (const QByteArray &packet: recovered) {
+                inputPacket(packet.constData(), packet.size());
+            }
+        }
+        break;
+    case PACKET_TYPE_CREATE_MULTIPATH:
+        lastActiveTimestamp = kcpTimestamp();
+        break;
+    case PACKET_TYPE_PATH_PROBE:
+        if (len >= 9 && receivingPath >= 0 && receivingPath < paths.size()) {
+            // echoed by the path it comes from in the next updateStep().
+            KcpPath &path = paths[receivingPath];
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+            path.ackSequence = qFromBigEndian<quint32>(buf + 5);
+#else
+            path.ackSequence = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(buf + 5));
+#endif
+            path.ackPending = true;
+            updateKcp();
+        }
+        break;
+    case PACKET_TYPE_PATH_PROBE_ACK:
+        if (len >= 9 && receivingPath >= 0 && receivingPath < paths.size()) {
+            KcpPath &path = paths[receivingPath];
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+            const quint32 sequence = qFromBigEndian<quint32>(buf + 5);
+#else
+            const quint32 sequence = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(buf + 5));
+#endif
+            if (sequence == path.probeSequence && !path.probeAcked) {
+                const quint64 now = kcpTimestamp();
+                path.probeAnswered(static_cast<quint32>(now - path.lastProbeTimestamp));
+            }
+        }
+        break;
+    case PACKET_TYPE_SESSION_TOKEN:
+#ifndef QTNG_NO_CRYPTO
+        if (len >= static_cast<quint32>(KcpTokenPacketSize)) {
+            const QByteArray peerKey(buf + 5, KcpTokenKeySize);
+            if (negotiable) {
+                // the first key of client is taken, and the answer is sent again for the lost ones.
+                if (peerTokenKey.isEmpty()) {
+                    peerTokenKey = peerKey;
+                    if (!deriveSessionToken()) {
+                        peerTokenKey.clear();
+                        break;
+                    }
+                }
+                if (peerKey == peerTokenKey) {
+                    tokenRequested = true;
+                    updateKcp();
+                }
+            } else if (sessionToken.isEmpty() && !tokenPrivateKey.isEmpty()) {
+                peerTokenKey = peerKey;
+                if (!deriveSessionToken()) {
+                    peerTokenKey.clear();
+                }
+            }
+        }
+#endif
+        break;
+    case PACKET_TYPE_RESUME_CHALLENGE:
+        // the server side sees a new address of the path, and asks for the session token.
+        if (!negotiable && len >= 13 && !sessionToken.isEmpty() && receivingPath >= 0 && receivingPath < paths.size()) {
+            KcpPath &path = paths[receivingPath];
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+            path.challengeNonce = qFromBigEndian<quint64>(buf + 5);
+#else
+            path.challengeNonce = qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(buf + 5));
+#endif
+            path.resumePending = true;
+            updateKcp();
+        }
+        break;
+    case PACKET_TYPE_FEATURES:
+        if (len >= 6) {
+            const quint8 flags = static_cast<quint8>(buf[5]);
+            const int dataShards = len >= static_cast<quint32>(KcpFeaturesPacketSize) ? static_cast<quint8>(buf[6]) : 0;
+            const int parityShards = len >= static_cast<quint32>(KcpFeaturesPacketSize) ? static_cast<quint8>(buf[7]) : 0;
+            if (negotiable) {
+                quint8 supported = KcpFeatureFec;
+#ifdef QTNG_HAVE_ZLIB
+                supported |= KcpFeatureCompression;
+#endif
+                peerFeatures = flags & supported;
+                compressionEnabled = (peerFeatures & KcpFeatureCompression) != 0;
+                // the shards set in the listening socket take precedence over the ones of client.
+                if (peerFeatures & KcpFeatureFec) {
+                    bool ok = fecDataShards > 0 ? fecEncoder.setShards(fecDataShards, fecParityShards)
+                                                : fecEncoder.setShards(dataShards, parityShards);
+                    if (!ok || !fecEncoder.isEnabled()) {
+                        peerFeatures &= ~KcpFeatureFec;
+                    }
+                }
+                if (!(peerFeatures & KcpFeatureFec)) {
+                    fecEncoder.setShards(0, 0);
+                }
+                featuresRequested = true;
+                updateKcp();
+            } else {
+                peerFeatures = flags & requestedFeatures;
+                featuresAnswered = true;
+                if (peerFeatures & KcpFeatureFec) {
+                    fecEncoder.setShards(fecDataShards, fecParityShards);
+                } else {
+                    fecEncoder.setShards(0, 0);
+                }
+            }
+        }
+        break;
+    case PACKET_TYPE_RESUME:
+        // handled by MasterKcpSocketPrivate::doAccept() before the path is known.
+        break;
+    case PACKET_TYPE_CLOSE:
+        close(true);
+        return false;
+    case PACKET_TYPE_KEEPALIVE:
+        lastActiveTimestamp = kcpTimestamp();
+        break;
+    default:
+        warnUnknownPacket(buf[0]);
+        break;
+    }
+    return true;
+}
+
+
+void KcpSocketPrivate::warnUnknownPacket(char packetType)
+{
+    // the peer may be newer than us, so the unknown packets are dropped, but only warned once per session.
+    if (unknownPacketWarned) {
+        return;
+    }
+    unknownPacketWarned = true;
+    qWarning() << "KcpSocket drops the packets of unknown type" << static_cast<int>(static_cast<quint8>(packetType))
+               << "from" << remoteAddress << remotePort;
+}
+
+
+// the data packet without connection id, which is a kcp segment after the packet type.
+void KcpSocketPrivate::inputPacket(const char *packet, int size)
+{
+    if (size < 5) {
+        return;
+    }
+    if (packet[0] == PACKET_TYPE_UNCOMPRESSED_DATA) {
+        inputSegment(packet + 1, size - 1);
+    } else if (packet[0] == PACKET_TYPE_COMPRESSED_DATA) {
+#ifdef QTNG_HAVE_ZLIB
+        int segmentSize;
+        const char *segment = scheduler->decompress(packet + 1, size - 1, &segmentSize);
+        if (segment) {
+            inputSegment(segment, segmentSize);
+        }
+#else
+        // the peer compresses without our agreement.
+        warnUnknownPacket(packet[0]);
+#endif
+    } else {
+        warnUnknownPacket(packet[0]);
+    }
+}
+
+
+void KcpSocketPrivate::inputSegment(const char *data, int size)
+{
+    int result;
+    {
+        ScopedLock<RLock> l(kcpLock); Q_UNUSED(l);
+        result = ikcp_input(kcp, data, size);
+    }
+    if (result < 0) {
+        // invalid datagram
+#ifdef DEBUG_PROTOCOL
+        qDebug() << "invalid datagram. kcp returns" << result;
+#endif
+    } else {
+        lastActiveTimestamp = kcpTimestamp();
+        // acks and retransmissions do not wake up the receiver.
+        if (ikcp_peeksize(kcp) > 0) {
+            receivingQueueNotEmpty->set();
+        }
+        updateKcp();
+    }
+}
+
+
+void KcpSocketPrivate::outputPacket(char packetType, const char *data, int size)
+{
+    if (fecEncoder.isEnabled()) {
+        sendFecData(packetType, data, size);
+        return;
+    }
+    char *packet = scheduler->reserve(this, size + 1);
+    packet[0] = packetType;
+    memcpy(packet + 1, data, static_cast<size_t>(size));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint32>(connectionId, packet + 1);
+#else
+    qToBigEndian<quint32>(connectionId, reinterpret_cast<uchar*>(packet + 1));
+#endif
+}
+
+
+void KcpSocketPrivate::countSegments(const char *buf, int len)
+{
+    // conv(4) + cmd(1) + frg(1) + wnd(2) + ts(4) + sn(4) + una(4) + len(4) + data
+    const int overhead = 24;
+    const char *end = buf + len;
+    while (end - buf >= overhead) {
+        const quint8 cmd = static_cast<quint8>(buf[4]);
+        quint32 sn, size;
+        memcpy(&sn, buf + 12, sizeof(sn));  // kcp encodes in little endian.
+        memcpy(&size, buf + 20, sizeof(size));
+        sn = qFromLittleEndian(sn);
+        size = qFromLittleEndian(size);
+        if (cmd == 81) {  // IKCP_CMD_PUSH
+            ++sentSegments;
+            if (static_cast<qint32>(sn - nextSegmentNumber) < 0) {
+                ++retransmittedSegments;
+            } else {
+                nextSegmentNumber = sn + 1;
+            }
+        }
+        if (size > static_cast<quint32>(end - buf - overhead)) {
+            break;
+        }
+        buf += overhead + static_cast<int>(size);
+    }
+}
+
+
+void KcpSocketPrivate::updateStats(quint64 now)
+{
+    const quint64 elapsed = now - lastStatsTimestamp;
+    if (elapsed < 1000) {
+        return;
+    }
+    const quint64 sent = sentSegments - lastSentSegments;
+    if (sent > 0) {
+        const float sample = static_cast<float>(retransmittedSegments - lastRetransmittedSegments) / sent;
+        lossRate = lossRate * 0.75f + qMin(sample, 1.0f) * 0.25f;
+    }
+    deliveryRate = static_cast<float>(kcp->snd_una - lastUna) / elapsed;
+    lastStatsTimestamp = now;
+    lastSentSegments = sentSegments;
+    lastRetransmittedSegments = retransmittedSegments;
+    lastUna = kcp->snd_una;
+    if (mode == KcpSocket::Adaptive) {
+        adapt();
+    }
+}
+
+
+void KcpSocketPrivate::adapt()
+{
+    const quint32 srtt = static_cast<quint32>(qMax(kcp->rx_srtt, 1));
+    const quint32 waitsnd = static_cast<quint32>(ikcp_waitsnd(kcp));
+
+    // keep about twice of the bandwidth-delay product in flight. if the window is the limit, the measured
+    // delivery rate follows it, so the window doubles until the loss stops it.
+    quint32 window = static_cast<quint32>(deliveryRate * srtt * 2);
+    if (waitsnd > kcp->snd_wnd && lossRate < 0.1f) {
+        window = qMax(window, kcp->snd_wnd * 2);
+    } else if (lossRate >= 0.1f) {
+        window = qMin(window, kcp->snd_wnd);
+    }
+    window = qBound<quint32>(32, window, 4096);
+
+    // flush more often on short paths. the congestion window of kcp backs off only if the loss is heavy.
+    const int interval = static_cast<int>(qBound<quint32>(10, srtt / 4, 40));
+    int resend = lossRate > 0.02f ? 2 : 3;
+    if (paths.size() > 1) {
+        ++resend;  // the paths reorder packets.
+    }
+    const int nocwnd = lossRate > 0.2f ? 0 : 1;
+    ikcp_nodelay(kcp, 1, interval, resend, nocwnd);
+    ikcp_wndsize(kcp, static_cast<int>(window), static_cast<int>(qMax(window, kcp->rcv_wnd)));
+
+    // the large datagrams are fragmented by ip, and lost more likely.
+    if (lossRate > 0.15f && kcp->mtu > 1200) {
+        ikcp_setmtu(kcp, 1200);
+    } else if (lossRate < 0.05f && kcp->mtu < 1400) {
+        ikcp_setmtu(kcp, 1400);
+    }
+}
+
+
+void KcpSocketPrivate::releasePacedPackets(quint64 now)
+{
+    if (!pacingEnabled) {  // disabled just now.
+        while (!pacedPackets.isEmpty()) {
+            const QByteArray packet = pacedPackets.takeFirst();
+            outputPacket(packet.at(0), packet.constData() + 1, packet.size() - 1);
+        }
+        return;
+    }
+    // the packets are spread over the round-trip time instead of bursting a whole window.
+    quint32 window = qMin(kcp->snd_wnd, kcp->rmt_wnd);
+    if (!kcp->nocwnd) {
+        window = qMin(window, kcp->cwnd);
+    }
+    const qint64 srtt = kcp->rx_srtt > 0 ? kcp->rx_srtt : 100;
+    const qint64 rate = qMax<qint64>(1, window * kcp->mtu * 5 / 4 / srtt);  // bytes per msec.
+    const qint64 burst = qMax<qint64>(rate, kcp->mtu * 4);
+    pacingTokens = qMin(pacingTokens + rate * static_cast<qint64>(now - lastPacedTimestamp), burst);
+    lastPacedTimestamp = now;
+    while (!pacedPackets.isEmpty() && pacingTokens > 0) {
+        const QByteArray packet = pacedPackets.takeFirst();
+        pacingTokens -= packet.size();
+        outputPacket(packet.at(0), packet.constData() + 1, packet.size() - 1);
+    }
+}
+
+
+void KcpSocketPrivate::writeFecHeader(char *packet, quint32 groupId, int index, int dataShards)
+{
+    packet[0] = PACKET_TYPE_FEC;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint32>(connectionId, packet + 1);
+    qToBigEndian<quint32>(groupId, packet + 5);
+#else
+    qToBigEndian<quint32>(connectionId, reinterpret_cast<uchar*>(packet + 1));
+    qToBigEndian<quint32>(groupId, reinterpret_cast<uchar*>(packet + 5));
+#endif
+    packet[9] = static_cast<char>(index);
+    packet[10] = static_cast<char>(dataShards);
+    packet[11] = static_cast<char>(fecEncoder.parityShards);
+}
+
+
+void KcpSocketPrivate::sendFecData(char packetType, const char *data, int size)
+{
+    // the data shard is sent at once, only the parity shards wait for the group.
+    const quint32 groupId = fecEncoder.groupId;
+    const int index = fecEncoder.addData(packetType, data, size, updatingTimestamp);
+    char *packet = scheduler->reserve(this, KcpFecHeaderSize + 1 + size);
+    writeFecHeader(packet, groupId, index, fecEncoder.dataShards);
+    packet[KcpFecHeaderSize] = packetType;
+    memcpy(packet + KcpFecHeaderSize + 1, data, static_cast<size_t>(size));
+    if (fecEncoder.isFull()) {
+        sendFecParity();
+    }
+}
+
+
+void KcpSocketPrivate::sendFecParity()
+{
+    const quint32 groupId = fecEncoder.groupId;
+    const int dataShards = fecEncoder.finish();
+    for (int i = 0; i < fecEncoder.parityShards; ++i) {
+        const QByteArray &parity = fecEncoder.parity.at(i);
+        char *packet = scheduler->reserve(this, KcpFecHeaderSize + parity.size());
+        writeFecHeader(packet, groupId, dataShards + i, dataShards);
+        memcpy(packet + KcpFecHeaderSize, parity.constData(), static_cast<size_t>(parity.size()));
+    }
+}
+
+
+bool KcpSocketPrivate::openPath(quint64 now)
+{
+    Q_UNUSED(now);
+    return false;
+}
+
+
+void KcpSocketPrivate::closePath(int path)
+{
+    paths.remove(path);
+    if (receivingPath >= paths.size()) {
+        receivingPath = 0;
+    }
+}
+
+
+int KcpSocketPrivate::choosePath()
+{
+    return chooseKcpPath(paths);
+}
+
+
+void KcpSocketPrivate::sendProbe(int path, char packetType, quint32 sequence)
+{
+    char *packet = scheduler->reserve(this, 9, path);
+    packet[0] = packetType;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint32>(connectionId, packet + 1);
+    qToBigEndian<quint32>(sequence, packet + 5);
+#else
+    qToBigEndian<quint32>(connectionId, reinterpret_cast<uchar*>(packet + 1));
+    qToBigEndian<quint32>(sequence, reinterpret_cast<uchar*>(packet + 5));
+#endif
+}
+
+
+void KcpSocketPrivate::sendSessionToken(int path)
+{
+    // both the request of client and the answer of server carry the public key of sender.
+    char *packet = scheduler->reserve(this, KcpTokenPacketSize, path);
+    packet[0] = PACKET_TYPE_SESSION_TOKEN;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint32>(connectionId, packet + 1);
+#else
+    qToBigEndian<quint32>(connectionId, reinterpret_cast<uchar*>(packet + 1));
+#endif
+    memcpy(packet + 5, tokenPublicKey.constData(), KcpTokenKeySize);
+}
+
+
+void KcpSocketPrivate::generateTokenKeys()
+{
+#ifndef QTNG_NO_CRYPTO
+    tokenPublicKey.resize(X25519_KEY_LENGTH);
+    tokenPrivateKey.resize(X25519_KEY_LENGTH);
+    X25519_keypair(reinterpret_cast<uint8_t*>(tokenPublicKey.data()),
+                   reinterpret_cast<uint8_t*>(tokenPrivateKey.data()));
+#endif
+}
+
+
+bool KcpSocketPrivate::deriveSessionToken()
+{
+#ifndef QTNG_NO_CRYPTO
+    if (tokenPublicKey.isEmpty()) {
+        generateTokenKeys();
+    }
+    if (tokenPrivateKey.size() != X25519_KEY_LENGTH || peerTokenKey.size() != X25519_KEY_LENGTH) {
+        return false;
+    }
+    char shared[X25519_KEY_LENGTH];
+    // fails for the keys of small order, which make a predictable secret.
+    if (!X25519(reinterpret_cast<uint8_t*>(shared), reinterpret_cast<const uint8_t*>(tokenPrivateKey.constData()),
+                reinterpret_cast<const uint8_t*>(peerTokenKey.constData()))) {
+        return false;
+    }
+    char id[4];
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint32>(connectionId, id);
+#else
+    qToBigEndian<quint32>(connectionId, reinterpret_cast<uchar*>(id));
+#endif
+    MessageDigest digest(MessageDigest::Sha256);
+    digest.addData(shared, sizeof(shared));
+    digest.addData(negotiable ? peerTokenKey : tokenPublicKey);
+    digest.addData(negotiable ? tokenPublicKey : peerTokenKey);
+    digest.addData(id, sizeof(id));
+    sessionToken = digest.result().left(KcpSessionTokenSize);
+    memset(shared, 0, sizeof(shared));
+    // the private key is not needed any more. the server side keeps the public key to answer again.
+    tokenPrivateKey.fill(0);
+    tokenPrivateKey.clear();
+    return sessionToken.size() == KcpSessionTokenSize;
+#else
+    return false;
+#endif
+}
+
+
+quint8 KcpSocketPrivate::wantedFeatures() const
+{
+    quint8 features = 0;
+    if (compressionEnabled) {
+        features |= KcpFeatureCompression;
+    }
+    if (fecDataShards > 0) {
+        features |= KcpFeatureFec;
+    }
+    return features;
+}
+
+
+void KcpSocketPrivate::sendFeatures(int path)
+{
+    // the client side sends the wanted features, and the server side answers with the agreed ones.
+    char *packet = scheduler->reserve(this, KcpFeaturesPacketSize, path);
+    packet[0] = PACKET_TYPE_FEATURES;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint32>(connectionId, packet + 1);
+#else
+    qToBigEndian<quint32>(connectionId, reinterpret_cast<uchar*>(packet + 1));
+#endif
+    packet[5] = static_cast<char>(negotiable ? peerFeatures : requestedFeatures);
+    packet[6] = static_cast<char>(negotiable ? fecEncoder.dataShards : fecDataShards);
+    packet[7] = static_cast<char>(negotiable ? fecEncoder.parityShards : fecParityShards);
+}
+
+
+QByteArray KcpSocketPrivate::makeResumeProof(quint64 nonce, bool migrate) const
+{
+#ifndef QTNG_NO_CRYPTO
+    char header[14];
+    header[0] = PACKET_TYPE_RESUME;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint32>(connectionId, header + 1);
+    qToBigEndian<quint64>(nonce, header + 5);
+#else
+    qToBigEndian<quint32>(connectionId, reinterpret_cast<uchar*>(header + 1));
+    qToBigEndian<quint64>(nonce, reinterpret_cast<uchar*>(header + 5));
+#endif
+    header[13] = migrate ? 1 : 0;
+    return hmac(sessionToken, QByteArray(header, sizeof(header)), MessageDigest::Sha256).left(KcpResumeProofSize);
+#else
+    Q_UNUSED(nonce);
+    Q_UNUSED(migrate);
+    return QByteArray();
+#endif
+}
+
+
+void KcpSocketPrivate::sendResume(int path)
+{
+    // the first path is the socket connected by user, whose address is changed. the others are new paths.
+    const bool migrate = (path == 0);
+    const quint64 nonce = paths.at(path).challengeNonce;
+    const QByteArray &proof = makeResumeProof(nonce, migrate);
+    if (proof.size() != KcpResumeProofSize) {
+        return;
+    }
+    char *packet = scheduler->reserve(this, KcpResumePacketSize, path);
+    packet[0] = PACKET_TYPE_RESUME;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint32>(connectionId, packet + 1);
+    qToBigEndian<quint64>(nonce, packet + 5);
+#else
+    qToBigEndian<quint32>(connectionId, reinterpret_cast<uchar*>(packet + 1));
+    qToBigEndian<quint64>(nonce, reinterpret_cast<uchar*>(packet + 5));
+#endif
+    packet[13] = migrate ? 1 : 0;
+    memcpy(packet + 14, proof.constData(), KcpResumeProofSize);
+}
+
+
+void KcpSocketPrivate::maintainPaths(quint64 now)
 {
-    if (len < 5) {
-        return true;
+    // the first path of client is the one connected by user, it is never dropped.
+    for (int i = paths.size() - 1; i >= 0 && paths.size() > 1; --i) {
+        if ((i > 0 || negotiable) && now - paths.at(i).lastReceivedTimestamp > 1000 * 10) {
+            closePath(i);
+        }
     }
-    int result;
-    switch(buf[0]) {
-    case PACKET_TYPE_UNCOMPRESSED_DATA:
-        {
-            ScopedLock<RLock> l(kcpLock); Q_UNUSED(l);
-            result = ikcp_input(kcp, buf + 1, len - 1);
+    for (int i = 0; i < paths.size(); ++i) {
+        KcpPath &path = paths[i];
+        if (path.ackPending) {
+            path.ackPending = false;
+            sendProbe(i, PACKET_TYPE_PATH_PROBE_ACK, path.ackSequence);
         }
-        if (result < 0) {
-            // invalid datagram
-#ifdef DEBUG_PROTOCOL
-            qDebug() << "invalid datagram. kcp returns" << result;
-#endif
-        } else {
-            lastActiveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
-            receivingQueueNotEmpty->set();
-            updateKcp();
+        if (path.resumePending) {
+            path.resumePending = false;
+            sendResume(i);
         }
-        break;
-    case PACKET_TYPE_CREATE_MULTIPATH:
-        break;
-    case PACKET_TYPE_CLOSE:
-        close(true);
-        return false;
-    case PACKET_TYPE_KEEPALIVE:
-        lastActiveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
-        break;
-    default:
-        break;
+        if (paths.size() <= 1 || now - path.lastProbeTimestamp < 1000) {
+            continue;
+        }
+        if (!path.probeAcked) {
+            path.probeLost();
+        }
+        path.lastProbeTimestamp = now;
+        path.probeAcked = false;
+        ++path.probeSequence;
+        sendProbe(i, PACKET_TYPE_PATH_PROBE, path.probeSequence);
     }
-    return true;
 }
 
 
-void KcpSocketPrivate::doUpdate()
+quint64 KcpSocketPrivate::updateStep(quint64 now)
 {
     Q_Q(KcpSocket);
     // in close(), state is set to Socket::UnconnectedState but error = NoError.
-    while (state == Socket::ConnectedState || error == Socket::NoError) {
-        quint64 now = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
-        if (now - lastActiveTimestamp > tearDownTime) {
+    if (state != Socket::ConnectedState && error != Socket::NoError) {
+        return 0;
+    }
+    if (now - lastActiveTimestamp > tearDownTime) {
 #ifdef DEBUG_PROTOCOL
-            qDebug() << "tearDown!";
+        qDebug() << "tearDown!";
 #endif
-            close(true);
-            return;
+        close(true);
+        return 0;
+    }
+    quint32 current = static_cast<quint32>(now - zeroTimestamp);  // impossible to overflow.
+    updatingTimestamp = now;
+    if (pacingEnabled || !pacedPackets.isEmpty()) {
+        releasePacedPackets(now);
+    }
+    {
+        ScopedLock<RLock> l(kcpLock); Q_UNUSED(l);
+        ikcp_update(kcp, current);   // ikcp_update() call ikcp_flush() and then kcp_callback()
+    }
+    quint32 ts = ikcp_check(kcp, current);
+    quint64 next = now + qMax<quint32>(ts - current, 1);
+    if (!pacedPackets.isEmpty()) {
+        next = now + 1;
+    }
+    updateStats(now);
+
+    if (fecEncoder.isExpired(now)) {
+        sendFecParity();
+    } else if (!fecEncoder.isEmpty()) {
+        next = qMax(qMin(next, fecEncoder.timestamp + fecEncoder.groupTimeout), now + 1);
+    }
+    if (now - lastFecExpiredTimestamp > 1000) {
+        fecDecoder.expire(now);
+        lastFecExpiredTimestamp = now;
+    }
+
+#ifndef QTNG_NO_CRYPTO
+    // the server side accepts a new path only if it proves the session token.
+    if (connectionId != 0 && !sessionToken.isEmpty() && paths.size() < multiPathCount
+            && now - lastPathOpenedTimestamp > 1000) {
+        lastPathOpenedTimestamp = now;
+        openPath(now);
+    }
+#endif
+    maintainPaths(now);
+#ifndef QTNG_NO_CRYPTO
+    if (negotiable) {
+        if (tokenRequested) {
+            tokenRequested = false;
+            sendSessionToken(-1);
         }
-        quint32 current = static_cast<quint32>(now - zeroTimestamp);  // impossible to overflow.
-        {
-            ScopedLock<RLock> l(kcpLock); Q_UNUSED(l);
-            ikcp_update(kcp, current);   // ikcp_update() call ikcp_flush() and then kcp_callback(), and maybe close(true)
+    } else if (connectionId != 0 && sessionToken.isEmpty() && now - lastTokenRequestTimestamp > 1000) {
+        lastTokenRequestTimestamp = now;
+        if (tokenPublicKey.isEmpty()) {
+            generateTokenKeys();
         }
-        if (state != Socket::ConnectedState && error != Socket::NoError) {
-            return;
+        sendSessionToken(0);
+    }
+#endif
+    if (negotiable) {
+        if (featuresRequested) {
+            featuresRequested = false;
+            sendFeatures(-1);
+        }
+    } else {
+        const quint8 wanted = wantedFeatures();
+        if (wanted != requestedFeatures) {
+            requestedFeatures = wanted;
+            featureRequests = 0;
+            featuresAnswered = false;
+            peerFeatures &= wanted;
+        }
+        // nothing to ask for if no feature is wanted nor agreed.
+        if (!featuresAnswered && (wanted != 0 || peerFeatures != 0) && featureRequests < KcpMaxFeatureRequests
+                && (featureRequests == 0 || now - lastFeatureRequestTimestamp > 1000)) {
+            ++featureRequests;
+            lastFeatureRequestTimestamp = now;
+            sendFeatures(0);
         }
+    }
+    if (paths.size() > 1) {
+        next = qMin(next, now + 1000);
+    }
 
-        quint32 ts = ikcp_check(kcp, current);
-        quint32 interval = ts - current;
+    if (now - lastKeepaliveTimestamp > 1000 * 5) {
+        const QByteArray &packet = makeKeepalivePacket();
+        memcpy(scheduler->reserve(this, packet.size()), packet.constData(), static_cast<size_t>(packet.size()));
+        lastKeepaliveTimestamp = now;
+    }
 
-        if (now - lastKeepaliveTimestamp > 1000 * 5) {
-            const QByteArray &packet = makeKeepalivePacket();
-            if (rawSend(packet.data(), packet.size()) != packet.size()) {
-#ifdef DEBUG_PROTOCOL
-                qDebug() << "can not send keep alive packet.";
-#endif
-                close(true);
-                return;
+    int sendingQueueSize = ikcp_waitsnd(kcp);
+    if (sendingQueueSize <= 0) {
+        sendingQueueNotFull->set();
+        sendingQueueEmpty->set();
+        q->busy.clear();
+        q->notBusy.set();
+    } else {
+        sendingQueueEmpty->clear();
+        if (static_cast<quint32>(sendingQueueSize) > waterLine) {
+            if (static_cast<quint32>(sendingQueueSize) > (waterLine * 1.2)) {
+                sendingQueueNotFull->clear();
             }
-        }
-
-        int sendingQueueSize = ikcp_waitsnd(kcp);
-        if (sendingQueueSize <= 0) {
+            q->busy.set();
+            q->notBusy.clear();
+        } else {
             sendingQueueNotFull->set();
-            sendingQueueEmpty->set();
             q->busy.clear();
             q->notBusy.set();
-        } else {
-            sendingQueueEmpty->clear();
-            if (static_cast<quint32>(sendingQueueSize) > waterLine) {
-                if (static_cast<quint32>(sendingQueueSize) > (waterLine * 1.2)) {
-                    sendingQueueNotFull->clear();
-                }
-                q->busy.set();
-                q->notBusy.clear();
-            } else {
-                sendingQueueNotFull->set();
-                q->busy.clear();
-                q->notBusy.set();
-            }
-        }
-
-        if (interval > 0) {
-            forceToUpdate->close();
-            try {
-                Timeout timeout(interval, 0); Q_UNUSED(timeout);
-                bool ok = forceToUpdate->wait();
-                if (!ok) {
-                    return;
-                }
-            } catch (TimeoutException &) {
-                // continue
-            }
         }
     }
+    return next;
 }
 
 
 void KcpSocketPrivate::updateKcp()
 {
-    QSharedPointer<Coroutine> t = operations->spawnWithName("update_kcp", [this] { doUpdate(); }, false);
-    forceToUpdate->open();
-}
-
-
-QByteArray KcpSocketPrivate::makeDataPacket(const char *data, qint32 size)
-{
-    QByteArray packet(size + 1, Qt::Uninitialized);
-    packet.data()[0] = PACKET_TYPE_UNCOMPRESSED_DATA;
-    memcpy(packet.data() + 1, data, static_cast<size_t>(size));
-#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-    qToBigEndian<quint32>(this->connectionId, packet.data() + 1);
-#else
-    qToBigEndian<quint32>(this->connectionId, reinterpret_cast<uchar*>(packet.data() + 1));
-#endif
-    return packet;
+    scheduler->updateNow(this);
 }
 
 
@@ -613,7 +1797,7 @@ Socket::NetworkLayerProtocol MasterKcpSocketPrivate::protocol() const
 
 bool MasterKcpSocketPrivate::close(bool force)
 {
-    // if `force` is true, must not block. see doUpdate()
+    // if `force` is true, must not block. see updateStep()
     if (state == Socket::UnconnectedState) {
         return true;
     } else if (state == Socket::ConnectedState) {
@@ -643,8 +1827,14 @@ bool MasterKcpSocketPrivate::close(bool force)
     }
 
     rawSocket->close();
+    for (const KcpPath &path: paths) {
+        if (path.socket != rawSocket) {
+            path.socket->close();
+        }
+    }
 
     //connected and listen state would do more cleaning work.
+    scheduler->remove(this);
     operations->killall();
     // await all pending recv()/send()
     receivingQueueNotEmpty->set();
@@ -682,13 +1872,23 @@ quint32 MasterKcpSocketPrivate::nextConnectionId()
 }
 
 
-void MasterKcpSocketPrivate::doReceive()
+void MasterKcpSocketPrivate::doReceive(QSharedPointer<Socket> socket)
 {
     QHostAddress addr;
     quint16 port;
     QByteArray buf(1024 * 64, Qt::Uninitialized);
     while (true) {
-        qint32 len = rawSocket->recvfrom(buf.data(), buf.size(), &addr, &port);
+        qint32 len = socket->recvfrom(buf.data(), buf.size(), &addr, &port);
+        if (Q_UNLIKELY(len < 0 || addr.isNull() || port == 0) && socket != rawSocket) {
+            // the extra path is broken, and would be opened again by updateStep().
+            for (int i = 1; i < paths.size(); ++i) {
+                if (paths.at(i).socket == socket) {
+                    closePath(i);
+                    break;
+                }
+            }
+            return;
+        }
         if (Q_UNLIKELY(len < 0 || addr.isNull() || port == 0)) {
             error = Socket::SocketResourceError;
             errorString = QStringLiteral("KcpSocket can not receive udp packet.");
@@ -735,6 +1935,17 @@ void MasterKcpSocketPrivate::doReceive()
             }
         }
         qToBigEndian<quint32>(0, reinterpret_cast<uchar*>(buf.data() + 1));
+        receivingPath = -1;
+        for (int i = 0; i < paths.size(); ++i) {
+            if (paths.at(i).socket == socket) {
+                receivingPath = i;
+                break;
+            }
+        }
+        if (receivingPath < 0) {
+            return;  // the path is closed.
+        }
+        paths[receivingPath].lastReceivedTimestamp = kcpTimestamp();
         if (!handleDatagram(buf.data(), static_cast<quint32>(len))) {
             return;
         }
@@ -773,17 +1984,43 @@ void MasterKcpSocketPrivate::doAccept()
         qToBigEndian<quint32>(0, reinterpret_cast<uchar*>(buf.data() + 1));
 #endif
 
-        const QString &key = concat(addr, port);
+        const KcpPeerKey key(addr, port);
         QPointer<SlaveKcpSocketPrivate> receiver;
         receiver = receiversByHostAndPort.value(key);
         if (receiver.isNull() && connectionId != 0) {
             receiver = receiversByConnectionId.value(connectionId);
+            if (!receiver.isNull() && !receiver->hasPath(key)) {
+                // a new address of the connection must prove the session token before it is used. without crypto,
+                // the connection id alone can not tell the client from the others, so the new address is dropped.
+#ifndef QTNG_NO_CRYPTO
+                const quint64 now = kcpTimestamp();
+                if (buf.at(0) == PACKET_TYPE_RESUME) {
+                    receiver->resume(buf.constData(), len, key, addr, port, now);
+                } else {
+                    receiver->challenge(addr, port, now);
+                }
+#endif
+                continue;
+            }
         }
         if (!receiver.isNull()) {
-            receiver->remoteAddress = addr;
-            receiver->remotePort = port;
+            const quint64 now = kcpTimestamp();
+            receiver->receivingPath = receiver->touchPath(key, now);
+            if (receiver->receivingPath < 0) {
+                // the original address of client was dropped for being silent, and it comes back.
+                receiver->receivingPath = receiver->addPath(key, addr, port, now);
+                if (receiver->receivingPath < 0) {
+                    continue;  // too many paths.
+                }
+            }
+            // the peer address follows the first path. sharing the address would make next recvfrom() allocate.
+            const KcpPath &first = receiver->paths.at(0);
+            if (receiver->remotePort != first.port || receiver->remoteAddress != first.address) {
+                receiver->remoteAddress = first.address;
+                receiver->remotePort = first.port;
+            }
             if (!receiver->handleDatagram(buf.data(), static_cast<quint32>(len))) {
-                receiversByHostAndPort.remove(receiver->originalHostAndPort);
+                receiversByHostAndPort.remove(receiver->originalPeer);
                 receiversByConnectionId.remove(receiver->connectionId);
             }
         } else {
@@ -791,7 +2028,7 @@ void MasterKcpSocketPrivate::doAccept()
             if (connectionId == 0 && pendingSlaves.size() < pendingSlaves.capacity()) {  // not full.
                 QSharedPointer<KcpSocket> slave(SlaveKcpSocketPrivate::create(this, addr, port, this->mode));
                 SlaveKcpSocketPrivate *d = SlaveKcpSocketPrivate::getPrivateHelper(slave);
-                d->originalHostAndPort = key;
+                d->originalPeer = key;
                 d->connectionId = nextConnectionId();
                 if (d->handleDatagram(buf.data(), static_cast<quint32>(len))) {
                     receiversByHostAndPort.insert(key, d);
@@ -825,7 +2062,7 @@ bool MasterKcpSocketPrivate::startReceivingCoroutine()
     case Socket::ClosingState:
         return false;
     case Socket::ConnectedState:
-        operations->spawnWithName("receiving", [this] { doReceive(); });
+        operations->spawnWithName("receiving", [this] { doReceive(rawSocket); });
         break;
     case Socket::ListeningState:
         operations->spawnWithName("receiving", [this] { doAccept(); });
@@ -851,6 +2088,11 @@ bool MasterKcpSocketPrivate::connect(const QHostAddress &addr, quint16 port)
     }
     remoteAddress = addr;
     remotePort = port;
+    KcpPath path;
+    path.socket = rawSocket;
+    path.address = addr;
+    path.port = port;
+    paths.append(path);
     state = Socket::ConnectedState;
     return true;
 }
@@ -864,6 +2106,11 @@ bool MasterKcpSocketPrivate::connect(const QString &hostName, quint16 port, Sock
     if (rawSocket->connect(hostName, port, protocol))  {
         remoteAddress = rawSocket->peerAddress();
         remotePort = port;
+        KcpPath path;
+        path.socket = rawSocket;
+        path.address = remoteAddress;
+        path.port = port;
+        paths.append(path);
         state = Socket::ConnectedState;
         return true;
     } else {
@@ -872,15 +2119,50 @@ bool MasterKcpSocketPrivate::connect(const QString &hostName, quint16 port, Sock
 }
 
 
-qint32 MasterKcpSocketPrivate::rawSend(const char *data, qint32 size)
+qint32 MasterKcpSocketPrivate::sendToPath(int path, const char *data, qint32 size)
 {
-    lastKeepaliveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+    if (path < 0 || path >= paths.size()) {
+        return -1;
+    }
+    lastKeepaliveTimestamp = kcpTimestamp();
     startReceivingCoroutine();
-    qint32 len = rawSocket->sendto(data, size, remoteAddress, remotePort);
+    const KcpPath &p = paths.at(path);
+    qint32 len = p.socket->sendto(data, size, p.address, p.port);
     return len;
 }
 
 
+bool MasterKcpSocketPrivate::openPath(quint64 now)
+{
+    // every path is another udp socket of client, so the server side sees a new 4-tuple of the same connection.
+    QSharedPointer<Socket> socket(new Socket(rawSocket->protocol(), Socket::UdpSocket));
+    if (!socket->bind(0)) {
+        return false;
+    }
+    KcpPath path;
+    path.socket = socket;
+    path.address = remoteAddress;
+    path.port = remotePort;
+    path.lastReceivedTimestamp = now;
+    paths.append(path);
+    const QByteArray &packet = makeMultiPathPacket(connectionId);
+    memcpy(scheduler->reserve(this, packet.size(), paths.size() - 1), packet.constData(),
+           static_cast<size_t>(packet.size()));
+    operations->spawn([this, socket] { doReceive(socket); });
+    return true;
+}
+
+
+void MasterKcpSocketPrivate::closePath(int path)
+{
+    QSharedPointer<Socket> socket = paths.at(path).socket;
+    KcpSocketPrivate::closePath(path);
+    if (socket != rawSocket) {
+        socket->close();
+    }
+}
+
+
 void MasterKcpSocketPrivate::setDnsCache(QSharedPointer<SocketDnsCache> dnsCache)
 {
     rawSocket->setDnsCache(dnsCache);
@@ -934,11 +2216,22 @@ QVariant MasterKcpSocketPrivate::option(Socket::SocketOption option) const
 
 
 SlaveKcpSocketPrivate::SlaveKcpSocketPrivate(MasterKcpSocketPrivate *parent, const QHostAddress &addr, quint16 port, KcpSocket *q)
-    :KcpSocketPrivate(q), parent(parent)
+    :KcpSocketPrivate(q), parent(parent), resumeNonce(0), resumeNonceTimestamp(0), lastChallengeTimestamp(0)
 {
     remoteAddress = addr;
     remotePort = port;
+    KcpPath path;
+    path.key = KcpPeerKey(addr, port);
+    path.address = addr;
+    path.port = port;
+    path.lastReceivedTimestamp = zeroTimestamp;
+    paths.append(path);
     state = Socket::ConnectedState;
+    // fec is enabled if the client asks for it.
+    fecDataShards = parent->fecDataShards;
+    fecParityShards = parent->fecParityShards;
+    fecEncoder.groupTimeout = parent->fecEncoder.groupTimeout;
+    negotiable = true;
 }
 
 
@@ -1011,7 +2304,7 @@ Socket::NetworkLayerProtocol SlaveKcpSocketPrivate::protocol() const
 
 bool SlaveKcpSocketPrivate::close(bool force)
 {
-    // if `force` is true, must not block. it is called by doUpdate()
+    // if `force` is true, must not block. it is called by updateStep()
     if (state == Socket::UnconnectedState) {
         return true;
     } else if (state == Socket::ConnectedState) {
@@ -1028,9 +2321,9 @@ bool SlaveKcpSocketPrivate::close(bool force)
     } else {  // there can be no other states.
         state = Socket::UnconnectedState;
     }
-    operations->kill("update_kcp");
+    scheduler->remove(this);
     if (!parent.isNull()) {
-        parent->removeSlave(originalHostAndPort);
+        parent->removeSlave(originalPeer);
         parent->removeSlave(connectionId);
         parent.clear();
     }
@@ -1070,18 +2363,144 @@ bool SlaveKcpSocketPrivate::connect(const QString &, quint16 , Socket::NetworkLa
     return false;
 }
 
-qint32 SlaveKcpSocketPrivate::rawSend(const char *data, qint32 size)
+qint32 SlaveKcpSocketPrivate::sendToPath(int path, const char *data, qint32 size)
 {
-    if (parent.isNull()) {
+    if (parent.isNull() || path < 0 || path >= paths.size()) {
         return -1;
     } else {
-        lastKeepaliveTimestamp = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
-        qint32 len = parent->rawSocket->sendto(data, size, remoteAddress, remotePort);
+        lastKeepaliveTimestamp = kcpTimestamp();
+        const KcpPath &p = paths.at(path);
+        qint32 len = parent->rawSocket->sendto(data, size, p.address, p.port);
         return len;
     }
 }
 
 
+bool SlaveKcpSocketPrivate::hasPath(const KcpPeerKey &key) const
+{
+    for (const KcpPath &path: paths) {
+        if (path.key == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void SlaveKcpSocketPrivate::challenge(const QHostAddress &addr, quint16 port, quint64 now)
+{
+    // nothing to prove before the key exchange is done.
+    if (parent.isNull() || sessionToken.isEmpty() || now - lastChallengeTimestamp < 100) {
+        return;
+    }
+    lastChallengeTimestamp = now;
+    // the nonce is kept for a while, so that the forged packets can not replace it before the client answers.
+    if (resumeNonce == 0 || now - resumeNonceTimestamp > 1000 * 5) {
+        do {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+            resumeNonce = qFromBigEndian<quint64>(randomBytes(8).constData());
+#else
+            resumeNonce = qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(randomBytes(8).constData()));
+#endif
+        } while (resumeNonce == 0);
+        resumeNonceTimestamp = now;
+    }
+    char packet[13];
+    packet[0] = PACKET_TYPE_RESUME_CHALLENGE;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint32>(connectionId, packet + 1);
+    qToBigEndian<quint64>(resumeNonce, packet + 5);
+#else
+    qToBigEndian<quint32>(connectionId, reinterpret_cast<uchar*>(packet + 1));
+    qToBigEndian<quint64>(resumeNonce, reinterpret_cast<uchar*>(packet + 5));
+#endif
+    parent->rawSocket->sendto(packet, sizeof(packet), addr, port);
+}
+
+
+bool SlaveKcpSocketPrivate::resume(const char *packet, int len, const KcpPeerKey &key, const QHostAddress &addr,
+                                   quint16 port, quint64 now)
+{
+    if (len < KcpResumePacketSize || sessionToken.isEmpty() || resumeNonce == 0
+            || now - resumeNonceTimestamp > 1000 * 5) {
+        return false;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    const quint64 nonce = qFromBigEndian<quint64>(packet + 5);
+#else
+    const quint64 nonce = qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(packet + 5));
+#endif
+    const bool migrate = packet[13] != 0;
+    const QByteArray &proof = makeResumeProof(nonce, migrate);
+    if (nonce != resumeNonce || proof.size() != KcpResumeProofSize) {
+        return false;
+    }
+    char diff = 0;  // compare in constant time.
+    for (int i = 0; i < KcpResumeProofSize; ++i) {
+        diff |= proof.at(i) ^ packet[14 + i];
+    }
+    if (diff != 0) {
+        return false;
+    }
+    resumeNonce = 0;
+    if (migrate) {
+        KcpPath path;
+        path.key = key;
+        path.address = addr;
+        path.port = port;
+        path.lastReceivedTimestamp = now;
+        paths[0] = path;
+        remoteAddress = addr;
+        remotePort = port;
+        if (!parent.isNull()) {
+            parent->removeSlave(originalPeer);
+            parent->receiversByHostAndPort.insert(key, this);
+        }
+        originalPeer = key;
+        // the segments in flight are lost with the old address, resend them by the new one at once.
+        ScopedLock<RLock> l(kcpLock); Q_UNUSED(l);
+        for (IQUEUEHEAD *p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
+            IKCPSEG *segment = iqueue_entry(p, IKCPSEG, node);
+            segment->resendts = kcp->current;
+        }
+        kcp->ts_flush = kcp->current;
+        updateKcp();
+    } else if (addPath(key, addr, port, now) < 0) {
+        return false;
+    }
+    lastActiveTimestamp = now;
+    return true;
+}
+
+
+int SlaveKcpSocketPrivate::touchPath(const KcpPeerKey &key, quint64 now)
+{
+    for (int i = 0; i < paths.size(); ++i) {
+        if (paths.at(i).key == key) {
+            paths[i].lastReceivedTimestamp = now;
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+int SlaveKcpSocketPrivate::addPath(const KcpPeerKey &key, const QHostAddress &addr, quint16 port, quint64 now)
+{
+    // a new path of the connection, which is proved by the session token.
+    if (paths.size() >= 8) {
+        return -1;
+    }
+    KcpPath path;
+    path.key = key;
+    path.address = addr;
+    path.port = port;
+    path.lastReceivedTimestamp = now;
+    paths.append(path);
+    return paths.size() - 1;
+}
+
+
 void SlaveKcpSocketPrivate::setDnsCache(QSharedPointer<SocketDnsCache> dnsCache)
 {
     if (!parent.isNull()) {
@@ -1195,6 +2614,135 @@ quint32 KcpSocket::sendQueueSize() const
 }
 
 
+bool KcpSocket::setFecShards(int dataShards, int parityShards)
+{
+    Q_D(KcpSocket);
+    KcpFecEncoder probe;
+    if (!probe.setShards(dataShards, parityShards)) {
+        return false;
+    }
+    d->fecDataShards = dataShards;
+    d->fecParityShards = parityShards;
+    // the parity of a pending group is dropped, kcp retransmits the lost packets of it.
+    if (!dataShards) {
+        d->fecEncoder.setShards(0, 0);
+    } else if (d->peerFeatures & KcpFeatureFec) {
+        d->fecEncoder.setShards(dataShards, parityShards);
+    }
+    return true;
+}
+
+
+int KcpSocket::fecDataShards() const
+{
+    Q_D(const KcpSocket);
+    return d->fecDataShards;
+}
+
+
+int KcpSocket::fecParityShards() const
+{
+    Q_D(const KcpSocket);
+    return d->fecParityShards;
+}
+
+
+void KcpSocket::setFecGroupTimeout(quint32 msecs)
+{
+    Q_D(KcpSocket);
+    d->fecEncoder.groupTimeout = msecs;
+}
+
+
+quint32 KcpSocket::fecGroupTimeout() const
+{
+    Q_D(const KcpSocket);
+    return d->fecEncoder.groupTimeout;
+}
+
+
+bool KcpSocket::setCompressionEnabled(bool enabled)
+{
+    Q_D(KcpSocket);
+#ifdef QTNG_HAVE_ZLIB
+    d->compressionEnabled = enabled;
+    return true;
+#else
+    return !enabled;
+#endif
+}
+
+
+bool KcpSocket::isCompressionEnabled() const
+{
+    Q_D(const KcpSocket);
+    return d->compressionEnabled;
+}
+
+
+void KcpSocket::setMultiPathCount(int count)
+{
+    Q_D(KcpSocket);
+    d->multiPathCount = qBound(1, count, 8);
+}
+
+
+int KcpSocket::multiPathCount() const
+{
+    Q_D(const KcpSocket);
+    return d->multiPathCount;
+}
+
+
+int KcpSocket::activePathCount() const
+{
+    Q_D(const KcpSocket);
+    return d->paths.size();
+}
+
+
+void KcpSocket::setPacingEnabled(bool enabled)
+{
+    Q_D(KcpSocket);
+    if (enabled && !d->pacingEnabled) {
+        d->pacingTokens = d->kcp->mtu * 4;
+        d->lastPacedTimestamp = kcpTimestamp();
+    }
+    d->pacingEnabled = enabled;
+    if (!enabled && !d->pacedPackets.isEmpty()) {
+        d->updateKcp();
+    }
+}
+
+
+bool KcpSocket::isPacingEnabled() const
+{
+    Q_D(const KcpSocket);
+    return d->pacingEnabled;
+}
+
+
+KcpStats KcpSocket::stats() const
+{
+    Q_D(const KcpSocket);
+    KcpStats stats;
+    stats.srtt = static_cast<quint32>(d->kcp->rx_srtt);
+    stats.rttVariance = static_cast<quint32>(d->kcp->rx_rttval);
+    stats.rto = static_cast<quint32>(d->kcp->rx_rto);
+    stats.congestionWindow = d->kcp->cwnd;
+    stats.sendWindow = d->kcp->snd_wnd;
+    stats.remoteWindow = d->kcp->rmt_wnd;
+    stats.mtu = d->kcp->mtu;
+    stats.interval = d->kcp->interval;
+    stats.waitSend = static_cast<quint32>(ikcp_waitsnd(d->kcp));
+    stats.sentSegments = d->sentSegments;
+    stats.retransmittedSegments = d->retransmittedSegments;
+    stats.lossRate = d->lossRate;
+    stats.paths = d->paths.size();
+    return stats;
+}
+
+
 quint32 KcpSocket::payloadSizeHint() const
 {
     Q_D(const KcpSocket);
@@ -1395,6 +2943,27 @@ QByteArray KcpSocket::recv(qint32 size)
 }
 
 
+QByteArray KcpSocket::recvPacket()
+{
+    Q_D(KcpSocket);
+    return d->recvPacket();
+}
+
+
+qint32 KcpSocket::sendPacket(const char *data, qint32 size)
+{
+    Q_D(KcpSocket);
+    return d->sendPacket(data, size);
+}
+
+
+qint32 KcpSocket::sendPacket(const QByteArray &packet)
+{
+    Q_D(KcpSocket);
+    return d->sendPacket(packet.constData(), packet.size());
+}
+
+
 QByteArray KcpSocket::recvall(qint32 size)
 {
     Q_D(KcpSocket);
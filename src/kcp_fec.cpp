@@ -0,0 +1,436 @@
+#include <QtCore/qendian.h>
+#include "../include/private/kcp_fec_p.h"
+// the ssse3 code is compiled for its own function, and chosen at runtime if the cpu supports it.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define QTNG_FEC_SSSE3
+#define QTNG_FEC_SSSE3_TARGET __attribute__((target("ssse3")))
+#include <tmmintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define QTNG_FEC_SSSE3
+#define QTNG_FEC_SSSE3_TARGET
+#include <intrin.h>
+#include <tmmintrin.h>
+#endif
+
+QTNETWORKNG_NAMESPACE_BEGIN
+
+namespace {
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1. the multiplication by a constant is split into
+// the low and high nibbles, which are looked up by pshufb sixteen bytes at a time.
+struct GaloisTables
+{
+    GaloisTables();
+    quint8 exp[512];
+    quint8 log[256];
+    quint8 mul[256][256];
+    quint8 low[256][16];
+    quint8 high[256][16];
+};
+
+
+GaloisTables::GaloisTables()
+{
+    int x = 1;
+    for (int i = 0; i < 255; ++i) {
+        exp[i] = static_cast<quint8>(x);
+        log[x] = static_cast<quint8>(i);
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= 0x11d;
+        }
+    }
+    for (int i = 255; i < 512; ++i) {
+        exp[i] = exp[i - 255];
+    }
+    log[0] = 0;
+    for (int a = 0; a < 256; ++a) {
+        for (int b = 0; b < 256; ++b) {
+            mul[a][b] = (a && b) ? exp[log[a] + log[b]] : 0;
+        }
+        for (int n = 0; n < 16; ++n) {
+            low[a][n] = mul[a][n];
+            high[a][n] = mul[a][n << 4];
+        }
+    }
+}
+
+
+const GaloisTables &galoisTables()
+{
+    static const GaloisTables tables;
+    return tables;
+}
+
+
+inline quint8 gfInverse(quint8 a)
+{
+    const GaloisTables &t = galoisTables();
+    return t.exp[255 - t.log[a]];
+}
+
+
+// invert a r x r matrix in place by gauss-jordan elimination.
+bool gfInvert(QVector<quint8> &matrix, int r)
+{
+    const GaloisTables &t = galoisTables();
+    QVector<quint8> inverse(r * r, 0);
+    for (int i = 0; i < r; ++i) {
+        inverse[i * r + i] = 1;
+    }
+    for (int c = 0; c < r; ++c) {
+        int pivot = c;
+        while (pivot < r && matrix.at(pivot * r + c) == 0) {
+            ++pivot;
+        }
+        if (pivot == r) {
+            return false;
+        }
+        if (pivot != c) {
+            for (int k = 0; k < r; ++k) {
+                qSwap(matrix[pivot * r + k], matrix[c * r + k]);
+                qSwap(inverse[pivot * r + k], inverse[c * r + k]);
+            }
+        }
+        const quint8 *scale = t.mul[gfInverse(matrix.at(c * r + c))];
+        for (int k = 0; k < r; ++k) {
+            matrix[c * r + k] = scale[matrix.at(c * r + k)];
+            inverse[c * r + k] = scale[inverse.at(c * r + k)];
+        }
+        for (int row = 0; row < r; ++row) {
+            const quint8 factor = matrix.at(row * r + c);
+            if (row == c || factor == 0) {
+                continue;
+            }
+            const quint8 *f = t.mul[factor];
+            for (int k = 0; k < r; ++k) {
+                matrix[row * r + k] ^= f[matrix.at(c * r + k)];
+                inverse[row * r + k] ^= f[inverse.at(c * r + k)];
+            }
+        }
+    }
+    matrix = inverse;
+    return true;
+}
+
+
+#ifdef QTNG_FEC_SSSE3
+bool hasSsse3()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+
+// returns the number of bytes processed, which is a multiple of 16.
+QTNG_FEC_SSSE3_TARGET int mulAddSsse3(const quint8 *lowTable, const quint8 *highTable, const char *src, char *dst, int size)
+{
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lowTable));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(highTable));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i l = _mm_shuffle_epi8(low, _mm_and_si128(in, mask));
+        __m128i h = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(in, 4), mask));
+        __m128i out = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(out, _mm_xor_si128(l, h)));
+    }
+    return i;
+}
+#endif
+
+}  // anonymous namespace
+
+
+void ReedSolomon::mulAdd(quint8 c, const char *src, char *dst, int size)
+{
+    if (c == 0 || size <= 0) {
+        return;
+    }
+    int i = 0;
+    if (c == 1) {
+        for (; i < size; ++i) {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+    const GaloisTables &t = galoisTables();
+#ifdef QTNG_FEC_SSSE3
+    static const bool ssse3 = hasSsse3();
+    if (ssse3) {
+        i = mulAddSsse3(t.low[c], t.high[c], src, dst, size);
+    }
+#endif
+    const quint8 *row = t.mul[c];
+    for (; i < size; ++i) {
+        dst[i] ^= static_cast<char>(row[static_cast<quint8>(src[i])]);
+    }
+}
+
+
+quint8 ReedSolomon::coefficient(int parityIndex, int dataIndex)
+{
+    // the cauchy matrix 1 / (x ^ y), with x = 255 - parityIndex and y = dataIndex.
+    return gfInverse(static_cast<quint8>((255 - parityIndex) ^ dataIndex));
+}
+
+
+void ReedSolomon::encode(const QVector<const char *> &dataShards, const QVector<char *> &parityShards, int shardSize)
+{
+    for (int i = 0; i < parityShards.size(); ++i) {
+        char *parity = parityShards.at(i);
+        memset(parity, 0, static_cast<size_t>(shardSize));
+        for (int j = 0; j < dataShards.size(); ++j) {
+            mulAdd(coefficient(i, j), dataShards.at(j), parity, shardSize);
+        }
+    }
+}
+
+
+bool ReedSolomon::reconstruct(QVector<QByteArray> &shards, int dataShards, int shardSize)
+{
+    const int parityShards = shards.size() - dataShards;
+    if (dataShards <= 0 || parityShards < 0 || shards.size() > 256) {
+        return false;
+    }
+    QVector<int> missing;
+    for (int j = 0; j < dataShards; ++j) {
+        QByteArray &shard = shards[j];
+        if (shard.isEmpty()) {
+            missing.append(j);
+        } else if (shard.size() > shardSize) {
+            return false;
+        } else if (shard.size() < shardSize) {
+            shard.append(QByteArray(shardSize - shard.size(), '\0'));
+        }
+    }
+    if (missing.isEmpty()) {
+        return true;
+    }
+    QVector<int> available;
+    for (int i = 0; i < parityShards && available.size() < missing.size(); ++i) {
+        if (shards.at(dataShards + i).size() == shardSize) {
+            available.append(i);
+        }
+    }
+    const int r = missing.size();
+    if (available.size() < r) {
+        return false;
+    }
+
+    // remove the known data shards from the parity shards, then solve the missing ones.
+    QVector<QByteArray> syndromes(r);
+    for (int a = 0; a < r; ++a) {
+        QByteArray syndrome = shards.at(dataShards + available.at(a));
+        char *s = syndrome.data();
+        for (int j = 0; j < dataShards; ++j) {
+            if (!missing.contains(j)) {
+                mulAdd(coefficient(available.at(a), j), shards.at(j).constData(), s, shardSize);
+            }
+        }
+        syndromes[a] = syndrome;
+    }
+    QVector<quint8> matrix(r * r);
+    for (int a = 0; a < r; ++a) {
+        for (int b = 0; b < r; ++b) {
+            matrix[a * r + b] = coefficient(available.at(a), missing.at(b));
+        }
+    }
+    if (!gfInvert(matrix, r)) {
+        return false;
+    }
+    for (int b = 0; b < r; ++b) {
+        QByteArray shard(shardSize, '\0');
+        for (int a = 0; a < r; ++a) {
+            mulAdd(matrix.at(b * r + a), syndromes.at(a).constData(), shard.data(), shardSize);
+        }
+        shards[missing.at(b)] = shard;
+    }
+    return true;
+}
+
+
+KcpFecEncoder::KcpFecEncoder()
+    : timestamp(0), groupId(0), groupTimeout(30), dataShards(0), parityShards(0), count(0), shardSize(0)
+{
+}
+
+
+bool KcpFecEncoder::setShards(int dataShards, int parityShards)
+{
+    if (dataShards == 0 && parityShards == 0) {
+        this->dataShards = 0;
+        this->parityShards = 0;
+    } else if (dataShards > 0 && parityShards > 0 && dataShards + parityShards <= 256) {
+        this->dataShards = dataShards;
+        this->parityShards = parityShards;
+    } else {
+        return false;
+    }
+    shards.resize(this->dataShards);
+    parity.resize(this->parityShards);
+    count = 0;
+    shardSize = 0;
+    return true;
+}
+
+
+int KcpFecEncoder::addData(char packetType, const char *data, int size, quint64 now)
+{
+    if (count == 0) {
+        timestamp = now;
+    }
+    QByteArray &shard = shards[count];
+    shard.resize(size + 3);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToBigEndian<quint16>(static_cast<quint16>(size + 1), shard.data());
+#else
+    qToBigEndian<quint16>(static_cast<quint16>(size + 1), reinterpret_cast<uchar*>(shard.data()));
+#endif
+    shard.data()[2] = packetType;
+    memcpy(shard.data() + 3, data, static_cast<size_t>(size));
+    shardSize = qMax(shardSize, size + 3);
+    return count++;
+}
+
+
+int KcpFecEncoder::finish()
+{
+    const int groupDataShards = count;
+    QVector<const char *> dataPointers(groupDataShards);
+    for (int j = 0; j < groupDataShards; ++j) {
+        QByteArray &shard = shards[j];
+        if (shard.size() < shardSize) {
+            int oldSize = shard.size();
+            shard.resize(shardSize);
+            memset(shard.data() + oldSize, 0, static_cast<size_t>(shardSize - oldSize));
+        }
+        dataPointers[j] = shard.constData();
+    }
+    QVector<char *> parityPointers(parityShards);
+    for (int i = 0; i < parityShards; ++i) {
+        parity[i].resize(shardSize);
+        parityPointers[i] = parity[i].data();
+    }
+    ReedSolomon::encode(dataPointers, parityPointers, shardSize);
+    count = 0;
+    shardSize = 0;
+    ++groupId;
+    return groupDataShards;
+}
+
+
+KcpFecDecoder::KcpFecDecoder()
+    : groupTimeout(1000 * 3)
+{
+}
+
+
+QList<QByteArray> KcpFecDecoder::addShard(const char *packet, int size, quint64 now)
+{
+    QList<QByteArray> recovered;
+    if (size <= KcpFecHeaderSize) {
+        return recovered;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    const quint32 groupId = qFromBigEndian<quint32>(packet + 5);
+#else
+    const quint32 groupId = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(packet + 5));
+#endif
+    const int index = static_cast<quint8>(packet[9]);
+    const int dataShards = static_cast<quint8>(packet[10]);
+    const int parityShards = static_cast<quint8>(packet[11]);
+    if (dataShards == 0 || parityShards == 0 || dataShards + parityShards > 256 || index >= dataShards + parityShards) {
+        return recovered;
+    }
+    const char *payload = packet + KcpFecHeaderSize;
+    const int payloadSize = size - KcpFecHeaderSize;
+
+    Group &group = groups[groupId];
+    if (group.finished) {
+        return recovered;
+    }
+    if (group.timestamp == 0) {
+        group.timestamp = now;
+    }
+    if (index < dataShards) {
+        // a data shard. dataShards is the configured number, the group may be smaller.
+        if (group.dataShards > 0 && index >= group.dataShards) {
+            return recovered;
+        }
+        if (group.shards.size() <= index) {
+            group.shards.resize(index + 1);
+        }
+        if (!group.shards.at(index).isEmpty()) {
+            return recovered;
+        }
+        QByteArray shard(payloadSize + 2, Qt::Uninitialized);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+        qToBigEndian<quint16>(static_cast<quint16>(payloadSize), shard.data());
+#else
+        qToBigEndian<quint16>(static_cast<quint16>(payloadSize), reinterpret_cast<uchar*>(shard.data()));
+#endif
+        memcpy(shard.data() + 2, payload, static_cast<size_t>(payloadSize));
+        group.shards[index] = shard;
+    } else {
+        if (group.dataShards == 0) {
+            group.dataShards = dataShards;
+            group.shardSize = payloadSize;
+            group.shards.resize(dataShards + parityShards);
+        } else if (group.dataShards != dataShards || group.shardSize != payloadSize
+                   || group.shards.size() != dataShards + parityShards) {
+            return recovered;
+        }
+        if (!group.shards.at(index).isEmpty()) {
+            return recovered;
+        }
+        group.shards[index] = QByteArray(payload, payloadSize);
+    }
+    ++group.received;
+    if (group.dataShards == 0 || group.received < group.dataShards) {
+        return recovered;
+    }
+
+    QVector<int> missing;
+    for (int j = 0; j < group.dataShards; ++j) {
+        if (group.shards.at(j).isEmpty()) {
+            missing.append(j);
+        }
+    }
+    if (!missing.isEmpty() && ReedSolomon::reconstruct(group.shards, group.dataShards, group.shardSize)) {
+        for (int j: missing) {
+            const QByteArray &shard = group.shards.at(j);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+            const int segmentSize = qFromBigEndian<quint16>(shard.constData());
+#else
+            const int segmentSize = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(shard.constData()));
+#endif
+            if (segmentSize > 0 && segmentSize + 2 <= shard.size()) {
+                recovered.append(shard.mid(2, segmentSize));
+            }
+        }
+    }
+    group.finished = true;
+    group.shards.clear();
+    return recovered;
+}
+
+
+void KcpFecDecoder::expire(quint64 now)
+{
+    for (QHash<quint32, Group>::iterator itor = groups.begin(); itor != groups.end();) {
+        if (now - itor->timestamp > groupTimeout) {
+            itor = groups.erase(itor);
+        } else {
+            ++itor;
+        }
+    }
+}
+
+QTNETWORKNG_NAMESPACE_END
@@ -1,4 +1,5 @@
 #include "../include/md.h"
+#include <openssl/hmac.h>
 #include "../include/private/crypto_p.h"
 
 QTNETWORKNG_NAMESPACE_BEGIN
@@ -48,6 +49,8 @@ public:
     ~MessageDigestPrivate();
     void addData(const char *buf, int len);
     QByteArray result();
+    int result(char *out);
+    void reset();
     EVP_MD_CTX *context;
     QByteArray finalData;
     MessageDigest::Algorithm algo;
@@ -116,6 +119,34 @@ QByteArray MessageDigestPrivate::result()
     return finalData;
 }
 
+int MessageDigestPrivate::result(char *out)
+{
+    if(hasError) {
+        return -1;
+    }
+    if(!finalData.isEmpty()) {
+        memcpy(out, finalData.constData(), static_cast<size_t>(finalData.size()));
+        return finalData.size();
+    }
+    unsigned int len;
+    int rvalue = EVP_DigestFinal_ex(context, reinterpret_cast<unsigned char*>(out), &len);
+    if(!rvalue) {
+        hasError = true;
+        return -1;
+    }
+    finalData = QByteArray(out, static_cast<int>(len));
+    return static_cast<int>(len);
+}
+
+void MessageDigestPrivate::reset()
+{
+    if(!context) {
+        return;
+    }
+    finalData.clear();
+    hasError = !EVP_DigestInit_ex(context, getOpenSSL_MD(algo), nullptr);
+}
+
 MessageDigest::MessageDigest(MessageDigest::Algorithm algo)
     :d_ptr(new MessageDigestPrivate(algo))
 {
@@ -141,6 +172,64 @@ QByteArray MessageDigest::result()
     return d->result();
 }
 
+
+int MessageDigest::result(char *out)
+{
+    Q_D(MessageDigest);
+    return d->result(out);
+}
+
+
+int MessageDigest::digestSize() const
+{
+    Q_D(const MessageDigest);
+    const EVP_MD *md = getOpenSSL_MD(d->algo);
+    return md ? EVP_MD_size(md) : 0;
+}
+
+
+void MessageDigest::reset()
+{
+    Q_D(MessageDigest);
+    d->reset();
+}
+
+
+QList<QByteArray> MessageDigest::digest(const QList<QByteArray> &messages, Algorithm algo)
+{
+    QList<QByteArray> results;
+    results.reserve(messages.size());
+    MessageDigestPrivate d(algo);
+    unsigned char buf[EVP_MAX_MD_SIZE];
+    for (const QByteArray &message: messages) {
+        d.reset();
+        unsigned int len = 0;
+        if (d.hasError || !EVP_DigestUpdate(d.context, message.constData(), static_cast<size_t>(message.size()))
+                || !EVP_DigestFinal_ex(d.context, buf, &len)) {
+            results.append(QByteArray());
+        } else {
+            results.append(QByteArray(reinterpret_cast<const char *>(buf), static_cast<int>(len)));
+        }
+    }
+    return results;
+}
+
+QByteArray hmac(const QByteArray &key, const QByteArray &data, const MessageDigest::Algorithm hashAlgo)
+{
+    initOpenSSL();
+    const EVP_MD *dgst = getOpenSSL_MD(hashAlgo);
+    if(!dgst) {
+        return QByteArray();
+    }
+    unsigned char result[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if(!HMAC(dgst, key.constData(), key.size(), reinterpret_cast<const unsigned char *>(data.constData()),
+             static_cast<size_t>(data.size()), result, &len)) {
+        return QByteArray();
+    }
+    return QByteArray(reinterpret_cast<const char *>(result), static_cast<int>(len));
+}
+
 QByteArray PBKDF2_HMAC(int keylen, const QByteArray &password, const QByteArray &salt,
                        const MessageDigest::Algorithm hashAlgo, int i)
 {
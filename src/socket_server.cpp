@@ -159,12 +159,25 @@ void BaseStreamServerPrivate::serveForever()
 void BaseStreamServerPrivate::handleRequest(QSharedPointer<SocketLike> request)
 {
     Q_Q(BaseStreamServer);
+    QSharedPointer<SocketLike> prepared;
     try {
-        q->processRequest(request); // close request.
+        prepared = q->prepareRequest(request);
+        if (prepared.isNull()) {
+            q->shutdownRequest(request);
+            q->closeRequest(request);
+            return;
+        }
+        q->processRequest(prepared); // close request.
     } catch (CoroutineExitException &) {
+        if (!prepared.isNull()) {
+            request = prepared;
+        }
         q->shutdownRequest(request);
         q->closeRequest(request);
     } catch (...) {
+        if (!prepared.isNull()) {
+            request = prepared;
+        }
         q->handleError(request);
         q->shutdownRequest(request);
         q->closeRequest(request);
@@ -277,6 +290,12 @@ bool BaseStreamServer::verifyRequest(QSharedPointer<SocketLike>)
 }
 
 
+QSharedPointer<SocketLike> BaseStreamServer::prepareRequest(QSharedPointer<SocketLike> request)
+{
+    return request;
+}
+
+
 void BaseStreamServer::processRequest(QSharedPointer<SocketLike>)
 {
 
@@ -312,14 +331,35 @@ class BaseSslServerPrivate: public BaseStreamServerPrivate
 {
 public:
     BaseSslServerPrivate(BaseSslServer *q, const QHostAddress &serverAddress, quint16 serverPort, const SslConfiguration &configuration)
-        :BaseStreamServerPrivate(q, serverAddress, serverPort), configuration(configuration) {}
+        : BaseStreamServerPrivate(q, serverAddress, serverPort)
+        , configuration(configuration)
+        , handshakeSemaphore(new Semaphore(64))
+        , handshakeTimeout(10.0f)
+        , maxConcurrentHandshakes(64)
+    {}
 public:
+    // all connections share the SSL_CTX of this configuration, which is built once.
     SslConfiguration configuration;
+    QSharedPointer<Semaphore> handshakeSemaphore;
+    float handshakeTimeout;
+    int maxConcurrentHandshakes;
 };
 
 
+// resume sessions unless the configuration brings its own cache.
+static SslConfiguration withSessionCache(const SslConfiguration &configuration)
+{
+    if (!configuration.serverSessionCache().isNull()) {
+        return configuration;
+    }
+    SslConfiguration c(configuration);
+    c.setServerSessionCache(QSharedPointer<SslServerSessionCache>::create());
+    return c;
+}
+
+
 BaseSslServer::BaseSslServer(const QHostAddress &serverAddress, quint16 serverPort, const SslConfiguration &configuration)
-    :BaseStreamServer (new BaseSslServerPrivate(this, serverAddress, serverPort, configuration))
+    :BaseStreamServer (new BaseSslServerPrivate(this, serverAddress, serverPort, withSessionCache(configuration)))
 {
 }
 
@@ -328,14 +368,49 @@ BaseSslServer::BaseSslServer(const QHostAddress &serverAddress, quint16 serverPo
     :BaseStreamServer (new BaseSslServerPrivate(this, serverAddress, serverPort, SslConfiguration()))
 {
     Q_D(BaseSslServer);
-    d->configuration = SslConfiguration::testPurpose("SslServer", "CN", "QtNetworkNg");
+    d->configuration = withSessionCache(SslConfiguration::testPurpose("SslServer", "CN", "QtNetworkNg"));
 }
 
 
 void BaseSslServer::setSslConfiguration(const SslConfiguration &configuration)
 {
     Q_D(BaseSslServer);
-    d->configuration = configuration;
+    d->configuration = withSessionCache(configuration);
+}
+
+
+QSharedPointer<SslServerSessionCache> BaseSslServer::sessionCache() const
+{
+    Q_D(const BaseSslServer);
+    return d->configuration.serverSessionCache();
+}
+
+
+QSharedPointer<SslCertificateStore> BaseSslServer::certificateStore() const
+{
+    Q_D(const BaseSslServer);
+    return d->configuration.certificateStore();
+}
+
+
+void BaseSslServer::setCertificateStore(QSharedPointer<SslCertificateStore> certificateStore)
+{
+    Q_D(BaseSslServer);
+    d->configuration.setCertificateStore(certificateStore);
+}
+
+
+QSharedPointer<SslCryptoWorkerPool> BaseSslServer::cryptoWorkerPool() const
+{
+    Q_D(const BaseSslServer);
+    return d->configuration.cryptoWorkerPool();
+}
+
+
+void BaseSslServer::setCryptoWorkerPool(QSharedPointer<SslCryptoWorkerPool> cryptoWorkerPool)
+{
+    Q_D(BaseSslServer);
+    d->configuration.setCryptoWorkerPool(cryptoWorkerPool);
 }
 
 
@@ -346,16 +421,68 @@ SslConfiguration BaseSslServer::sslConfiguratino() const
 }
 
 
+float BaseSslServer::handshakeTimeout() const
+{
+    Q_D(const BaseSslServer);
+    return d->handshakeTimeout;
+}
+
+
+void BaseSslServer::setHandshakeTimeout(float handshakeTimeout)
+{
+    Q_D(BaseSslServer);
+    d->handshakeTimeout = handshakeTimeout;
+}
+
+
+int BaseSslServer::maxConcurrentHandshakes() const
+{
+    Q_D(const BaseSslServer);
+    return d->maxConcurrentHandshakes;
+}
+
+
+void BaseSslServer::setMaxConcurrentHandshakes(int maxConcurrentHandshakes)
+{
+    Q_D(BaseSslServer);
+    // the handshakes in progress keep the old semaphore.
+    d->maxConcurrentHandshakes = qMax(1, maxConcurrentHandshakes);
+    d->handshakeSemaphore.reset(new Semaphore(d->maxConcurrentHandshakes));
+}
+
+
 bool BaseSslServer::isSecure() const
 {
     return true;
 }
 
 
+// accept plain tcp connections, so that slow handshakes never block the accepting coroutine.
 QSharedPointer<SocketLike> BaseSslServer::serverCreate()
+{
+    return asSocketLike(new Socket());
+}
+
+
+QSharedPointer<SocketLike> BaseSslServer::prepareRequest(QSharedPointer<SocketLike> request)
 {
     Q_D(BaseSslServer);
-    return asSocketLike(QSharedPointer<SslSocket>::create(d->configuration));
+    QSharedPointer<Semaphore> semaphore = d->handshakeSemaphore;
+    QSharedPointer<SslSocket> s(new SslSocket(request, d->configuration));
+    try {
+        // the time waiting for other handshakes counts too.
+        Timeout timeout(d->handshakeTimeout); Q_UNUSED(timeout);
+        ScopedLock<Semaphore> l(semaphore);
+        if (!l.isSuccess()) {
+            return QSharedPointer<SocketLike>();
+        }
+        if (!s->handshake(true)) {
+            return QSharedPointer<SocketLike>();
+        }
+    } catch (TimeoutException &) {
+        return QSharedPointer<SocketLike>();
+    }
+    return asSocketLike(s);
 }
 
 
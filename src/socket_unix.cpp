@@ -70,9 +70,9 @@ static inline void qt_socket_getPortAndAddress(const qt_sockaddr *s, quint16 *po
         Q_IPV6ADDR tmp;
         memcpy(&tmp, &s->a6.sin6_addr, sizeof(tmp));
         if (addr) {
-            QHostAddress tmpAddress;
-            tmpAddress.setAddress(tmp);
-            *addr = tmpAddress;
+            // set the address in place, which does not allocate unless it is shared.
+            addr->setAddress(tmp);
+            addr->setScopeId(QString());
             if (s->a6.sin6_scope_id) {
                 char scopeid[IFNAMSIZ];
                 if (::if_indextoname(s->a6.sin6_scope_id, scopeid)) {
@@ -86,9 +86,7 @@ static inline void qt_socket_getPortAndAddress(const qt_sockaddr *s, quint16 *po
             *port = ntohs(s->a6.sin6_port);
     } else if (s->a.sa_family == AF_INET) {
         if (addr) {
-            QHostAddress tmpAddress;
-            tmpAddress.setAddress(ntohl(s->a4.sin_addr.s_addr));
-            *addr = tmpAddress;
+            addr->setAddress(ntohl(s->a4.sin_addr.s_addr));
         }
         if (port)
             *port = ntohs(s->a4.sin_port);
@@ -1,7 +1,16 @@
 ﻿#include <QtCore/qfile.h>
+#include <QtCore/qfileinfo.h>
 #include <QtCore/qdatetime.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qvarlengtharray.h>
+#include <QtCore/qelapsedtimer.h>
 #include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
 #include "../include/locks.h"
+#include "../include/coroutine_utils.h"
 #include "../include/ssl.h"
 #include "../include/socket.h"
 #include "../include/socket_utils.h"
@@ -224,10 +233,16 @@ class SslConfigurationPrivate: public QSharedData
 {
 public:
     SslConfigurationPrivate();
-    SslConfigurationPrivate(const SslConfigurationPrivate &) = default;
+    SslConfigurationPrivate(const SslConfigurationPrivate &other);
     bool isNull() const;
     bool operator==(const SslConfigurationPrivate &other) const;
     static QSharedPointer<SSL_CTX> makeContext(const SslConfiguration &config, bool asServer);
+    // returns the SSL_CTX shared by all connections using this configuration.
+    static QSharedPointer<SSL_CTX> context(const SslConfiguration &config, bool asServer);
+    // returns the server context for a name of SslCertificateStore, which takes the certificate and private key
+    // from the configuration of name, and all other settings from the configuration of server.
+    static QSharedPointer<SSL_CTX> nameContext(const SslConfiguration &config, const SslConfiguration &named);
+    void clearContexts();
 
     QList<Certificate> caCertificates;
     Certificate localCertificate;
@@ -239,6 +254,17 @@ public:
     QList<SslCipher> ciphers;
     bool onlySecureProtocol;
     bool supportCompression;
+    QSharedPointer<SslServerSessionCache> serverSessionCache;
+    QSharedPointer<SslCertificateStore> certificateStore;
+    QSharedPointer<SslCryptoWorkerPool> cryptoWorkerPool;
+
+    // building a context parses certificates and keys, so it is done once per configuration.
+    mutable QMutex contextMutex;
+    mutable QSharedPointer<SSL_CTX> clientContext;
+    mutable QSharedPointer<SSL_CTX> serverContext;
+    mutable quint32 serverSessionCacheGeneration;
+    // keyed by the private of named configuration, which is kept alive by the value.
+    mutable QHash<const SslConfigurationPrivate *, QPair<SslConfiguration, QSharedPointer<SSL_CTX>>> nameContexts;
 };
 
 
@@ -253,7 +279,10 @@ bool SslConfigurationPrivate::operator==(const SslConfigurationPrivate &other) c
             peerVerifyName == other.peerVerifyName &&
             ciphers == other.ciphers &&
             onlySecureProtocol == other.onlySecureProtocol &&
-            supportCompression == other.supportCompression;
+            supportCompression == other.supportCompression &&
+            serverSessionCache == other.serverSessionCache &&
+            certificateStore == other.certificateStore &&
+            cryptoWorkerPool == other.cryptoWorkerPool;
 }
 
 
@@ -268,17 +297,80 @@ bool SslConfigurationPrivate::isNull() const
             peerVerifyName.isEmpty() &&
             ciphers.isEmpty() &&
             onlySecureProtocol == true &&
-            supportCompression == true;
+            supportCompression == true &&
+            serverSessionCache.isNull() &&
+            certificateStore.isNull() &&
+            cryptoWorkerPool.isNull();
 }
 
 
 SslConfigurationPrivate::SslConfigurationPrivate()
     :peerVerifyMode(Ssl::AutoVerifyPeer), peerVerifyDepth(4), onlySecureProtocol(true), supportCompression(true)
+    , serverSessionCacheGeneration(0)
 {
 
 }
 
 
+// the contexts are not copied, because the copy is going to be modified.
+SslConfigurationPrivate::SslConfigurationPrivate(const SslConfigurationPrivate &other)
+    : QSharedData(other)
+    , caCertificates(other.caCertificates)
+    , localCertificate(other.localCertificate)
+    , privateKey(other.privateKey)
+    , allowedNextProtocols(other.allowedNextProtocols)
+    , peerVerifyMode(other.peerVerifyMode)
+    , peerVerifyDepth(other.peerVerifyDepth)
+    , peerVerifyName(other.peerVerifyName)
+    , ciphers(other.ciphers)
+    , onlySecureProtocol(other.onlySecureProtocol)
+    , supportCompression(other.supportCompression)
+    , serverSessionCache(other.serverSessionCache)
+    , certificateStore(other.certificateStore)
+    , cryptoWorkerPool(other.cryptoWorkerPool)
+    , serverSessionCacheGeneration(0)
+{
+}
+
+
+void SslConfigurationPrivate::clearContexts()
+{
+    QMutexLocker locker(&contextMutex);
+    clientContext.clear();
+    serverContext.clear();
+    nameContexts.clear();
+}
+
+
+struct SslClientSession
+{
+    QSharedPointer<SslSessionCache> cache;
+    QString key;
+};
+
+
+static int sslClientSessionIndex()
+{
+    static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+
+static int onNewClientSession(SSL *ssl, SSL_SESSION *session);
+static void setupServerSessionCache(SSL_CTX *ctx, QSharedPointer<SslServerSessionCache> cache);
+static quint32 serverSessionCacheGeneration(QSharedPointer<SslServerSessionCache> cache);
+static void setupCertificateStore(SSL_CTX *ctx, QSharedPointer<SslCertificateStore> store);
+
+
+// SSL_CTX_free() flushes all sessions of the context, which calls the remove callback for every session. they are
+// not expired or invalid, so the callback is cleared to keep them in the external session store.
+static void freeContext(SSL_CTX *ctx)
+{
+    SSL_CTX_sess_set_remove_cb(ctx, nullptr);
+    SSL_CTX_free(ctx);
+}
+
+
 QSharedPointer<SSL_CTX> SslConfigurationPrivate::makeContext(const SslConfiguration &config, bool asServer)
 {
     QSharedPointer<SSL_CTX> ctx;
@@ -291,7 +383,7 @@ QSharedPointer<SSL_CTX> SslConfigurationPrivate::makeContext(const SslConfigurat
     if(!method) {
         return ctx;
     }
-    ctx.reset(SSL_CTX_new(method), SSL_CTX_free);
+    ctx.reset(SSL_CTX_new(method), freeContext);
     if(ctx.isNull()) {
         return ctx;
     }
@@ -318,12 +410,84 @@ QSharedPointer<SSL_CTX> SslConfigurationPrivate::makeContext(const SslConfigurat
             qDebug() << "can not set ssl certificate.";
         }
     }
+    X509_STORE *store = SSL_CTX_get_cert_store(ctx.data());
+    if (store) {
+        for (const Certificate &certificate: config.caCertificates()) {
+            if (certificate.isValid()) {
+                X509_STORE_add_cert(store, static_cast<X509 *>(certificate.handle()));
+            }
+        }
+    }
+    if (!asServer) {
+        // sessions are kept by SslSessionCache instead of the internal cache of SSL_CTX.
+        SSL_CTX_set_session_cache_mode(ctx.data(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx.data(), onNewClientSession);
+    } else {
+        setupServerSessionCache(ctx.data(), config.serverSessionCache());
+        setupCertificateStore(ctx.data(), config.certificateStore());
+    }
+    return ctx;
+}
+
+
+QSharedPointer<SSL_CTX> SslConfigurationPrivate::context(const SslConfiguration &config, bool asServer)
+{
+    const SslConfigurationPrivate *d = config.d.constData();
+    QMutexLocker locker(&d->contextMutex);
+    QSharedPointer<SSL_CTX> &ctx = asServer ? d->serverContext : d->clientContext;
+    if (asServer) {
+        // the settings of session cache are copied into SSL_CTX, so the context is built again if they are changed.
+        quint32 generation = serverSessionCacheGeneration(d->serverSessionCache);
+        if (ctx.isNull() || generation != d->serverSessionCacheGeneration) {
+            ctx = makeContext(config, asServer);
+            d->serverSessionCacheGeneration = generation;
+            d->nameContexts.clear();
+        }
+    } else if (ctx.isNull()) {
+        ctx = makeContext(config, asServer);
+    }
+    return ctx;
+}
+
+
+QSharedPointer<SSL_CTX> SslConfigurationPrivate::nameContext(const SslConfiguration &config, const SslConfiguration &named)
+{
+    const SslConfigurationPrivate *d = config.d.constData();
+    {
+        QMutexLocker locker(&d->contextMutex);
+        auto itor = d->nameContexts.constFind(named.d.constData());
+        if (itor != d->nameContexts.constEnd()) {
+            return itor.value().second;
+        }
+    }
+    SslConfiguration merged(config);
+    merged.setLocalCertificate(named.localCertificate());
+    merged.setPrivateKey(named.privateKey());
+    merged.setCertificateStore(QSharedPointer<SslCertificateStore>());
+    QSharedPointer<SSL_CTX> ctx = context(merged, true);
+    if (ctx.isNull()) {
+        return ctx;
+    }
+    QMutexLocker locker(&d->contextMutex);
+    // the reloaded certificates leave their old contexts here.
+    if (d->nameContexts.size() >= 1024) {
+        d->nameContexts.clear();
+    }
+    d->nameContexts.insert(named.d.constData(), qMakePair(named, ctx));
     return ctx;
 }
 
 
+static QSharedDataPointer<SslConfigurationPrivate> &defaultConfiguration()
+{
+    // default configurations share one private, so that they share the contexts as well.
+    static QSharedDataPointer<SslConfigurationPrivate> d(new SslConfigurationPrivate());
+    return d;
+}
+
+
 SslConfiguration::SslConfiguration()
-    :d(new SslConfigurationPrivate())
+    :d(defaultConfiguration())
 {
 }
 
@@ -431,102 +595,1118 @@ bool SslConfiguration::supportCompression() const
 }
 
 
+QSharedPointer<SslServerSessionCache> SslConfiguration::serverSessionCache() const
+{
+    return d->serverSessionCache;
+}
+
+
+QSharedPointer<SslCertificateStore> SslConfiguration::certificateStore() const
+{
+    return d->certificateStore;
+}
+
+
+QSharedPointer<SslCryptoWorkerPool> SslConfiguration::cryptoWorkerPool() const
+{
+    return d->cryptoWorkerPool;
+}
+
+
 void SslConfiguration::addCaCertificate(const Certificate &certificate)
 {
     d->caCertificates.append(certificate);
+    d->clearContexts();
 }
 
 
 void SslConfiguration::addCaCertificates(const QList<Certificate> &certificates)
 {
     d->caCertificates.append(certificates);
+    d->clearContexts();
 }
 
 
 void SslConfiguration::setAllowedNextProtocols(const QList<QByteArray> &protocols)
 {
     d->allowedNextProtocols = protocols;
+    d->clearContexts();
 }
 
 
 void SslConfiguration::setPeerVerifyDepth(int depth)
 {
     d->peerVerifyDepth = depth;
+    d->clearContexts();
 }
 
 
 void SslConfiguration::setPeerVerifyMode(Ssl::PeerVerifyMode mode)
 {
     d->peerVerifyMode = mode;
+    d->clearContexts();
 }
 
 
 void SslConfiguration::setPeerVerifyName(const QString &hostName)
 {
     d->peerVerifyName = hostName;
+    d->clearContexts();
 }
 
 
 void SslConfiguration::setLocalCertificate(const Certificate &certificate)
 {
-    d->localCertificate = certificate;
+    d->localCertificate = certificate;
+    d->clearContexts();
+}
+
+
+bool SslConfiguration::setLocalCertificate(const QString &path, Ssl::EncodingFormat format)
+{
+    QFile f(path);
+    if(!f.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray &data = f.readAll();
+    const Certificate &cert = Certificate::load(data, format);
+    if(cert.isNull() || cert.isBlacklisted()) {
+        return false;
+    }
+    setLocalCertificate(cert);
+    return true;
+}
+
+
+void SslConfiguration::setPrivateKey(const PrivateKey &key)
+{
+    d->privateKey = key;
+    d->clearContexts();
+}
+
+
+void SslConfiguration::setOnlySecureProtocol(bool onlySecureProtocol)
+{
+    d->onlySecureProtocol = onlySecureProtocol;
+    d->clearContexts();
+}
+
+
+void SslConfiguration::setSupportCompression(bool supportCompression)
+{
+    d->supportCompression = supportCompression;
+    d->clearContexts();
+}
+
+
+void SslConfiguration::setServerSessionCache(QSharedPointer<SslServerSessionCache> serverSessionCache)
+{
+    d->serverSessionCache = serverSessionCache;
+    d->clearContexts();
+}
+
+
+void SslConfiguration::setCertificateStore(QSharedPointer<SslCertificateStore> certificateStore)
+{
+    d->certificateStore = certificateStore;
+    d->clearContexts();
+}
+
+
+void SslConfiguration::setCryptoWorkerPool(QSharedPointer<SslCryptoWorkerPool> cryptoWorkerPool)
+{
+    // the pool does not change the context.
+    d->cryptoWorkerPool = cryptoWorkerPool;
+}
+
+
+QList<SslCipher> SslConfiguration::supportedCiphers()
+{
+    return QList<SslCipher>();
+}
+
+
+SslConfiguration SslConfiguration::testPurpose(const QString &commonName, const QString &countryCode, const QString &organization)
+{
+    PrivateKey key = PrivateKey::generate(qtng::PrivateKey::Rsa, 2048);
+    QMultiMap<Certificate::SubjectInfo, QString> info;
+    info.insert(Certificate::CommonName, commonName);
+    info.insert(Certificate::CountryName, countryCode);
+    info.insert(Certificate::Organization, organization);
+    const QDateTime &now = QDateTime::currentDateTime();
+    const Certificate &cert = Certificate::generate(key, MessageDigest::Sha256,
+                                                    293424, now, now.addYears(10), info);
+    SslConfiguration config;
+    config.setPrivateKey(key);
+    config.setLocalCertificate(cert);
+    return config;
+}
+
+
+class SslSessionCachePrivate
+{
+public:
+    SslSessionCachePrivate(int maxSessions)
+        : maxSessions(maxSessions), hits(0), misses(0) {}
+    QSharedPointer<SSL_SESSION> session(const QString &key);
+    void addSession(const QString &key, SSL_SESSION *session);
+    void removeSession(const QString &key);
+    static SslSessionCachePrivate *getPrivateHelper(SslSessionCache *cache) { return cache->d_ptr; }
+public:
+    QMap<QString, QSharedPointer<SSL_SESSION>> sessions;
+    QStringList recentlyUsed;  // the least recently used key comes first.
+    int maxSessions;
+    quint64 hits;
+    quint64 misses;
+};
+
+
+QSharedPointer<SSL_SESSION> SslSessionCachePrivate::session(const QString &key)
+{
+    QMap<QString, QSharedPointer<SSL_SESSION>>::const_iterator itor = sessions.constFind(key);
+    if (itor == sessions.constEnd()) {
+        return QSharedPointer<SSL_SESSION>();
+    }
+    recentlyUsed.removeOne(key);
+    recentlyUsed.append(key);
+    return itor.value();
+}
+
+
+// takes the reference of session.
+void SslSessionCachePrivate::addSession(const QString &key, SSL_SESSION *session)
+{
+    if (maxSessions <= 0) {
+        SSL_SESSION_free(session);
+        return;
+    }
+    if (sessions.contains(key)) {
+        recentlyUsed.removeOne(key);
+    }
+    sessions.insert(key, QSharedPointer<SSL_SESSION>(session, SSL_SESSION_free));
+    recentlyUsed.append(key);
+    while (sessions.size() > maxSessions && !recentlyUsed.isEmpty()) {
+        sessions.remove(recentlyUsed.takeFirst());
+    }
+}
+
+
+void SslSessionCachePrivate::removeSession(const QString &key)
+{
+    if (sessions.remove(key) > 0) {
+        recentlyUsed.removeOne(key);
+    }
+}
+
+
+static int onNewClientSession(SSL *ssl, SSL_SESSION *session)
+{
+    SslClientSession *clientSession = static_cast<SslClientSession *>(SSL_get_ex_data(ssl, sslClientSessionIndex()));
+    if (!clientSession || clientSession->cache.isNull() || clientSession->key.isEmpty()) {
+        return 0;
+    }
+    SslSessionCachePrivate::getPrivateHelper(clientSession->cache.data())->addSession(clientSession->key, session);
+    return 1;
+}
+
+
+SslSessionCache::SslSessionCache(int maxSessions)
+    : d_ptr(new SslSessionCachePrivate(maxSessions))
+{
+    initOpenSSL();
+}
+
+
+SslSessionCache::~SslSessionCache()
+{
+    delete d_ptr;
+}
+
+
+int SslSessionCache::maxSessions() const
+{
+    Q_D(const SslSessionCache);
+    return d->maxSessions;
+}
+
+
+void SslSessionCache::setMaxSessions(int maxSessions)
+{
+    Q_D(SslSessionCache);
+    d->maxSessions = maxSessions;
+    while (d->sessions.size() > qMax(maxSessions, 0) && !d->recentlyUsed.isEmpty()) {
+        d->sessions.remove(d->recentlyUsed.takeFirst());
+    }
+}
+
+
+int SslSessionCache::size() const
+{
+    Q_D(const SslSessionCache);
+    return d->sessions.size();
+}
+
+
+void SslSessionCache::remove(const QString &key)
+{
+    Q_D(SslSessionCache);
+    d->removeSession(key);
+}
+
+
+void SslSessionCache::clear()
+{
+    Q_D(SslSessionCache);
+    d->sessions.clear();
+    d->recentlyUsed.clear();
+}
+
+
+quint64 SslSessionCache::hits() const
+{
+    Q_D(const SslSessionCache);
+    return d->hits;
+}
+
+
+quint64 SslSessionCache::misses() const
+{
+    Q_D(const SslSessionCache);
+    return d->misses;
+}
+
+
+SslSessionStore::~SslSessionStore()
+{
+}
+
+
+struct SslTicketKey
+{
+    enum { NameSize = 16, HmacKeySize = 16, AesKeySize = 16, Size = NameSize + HmacKeySize + AesKeySize };
+    QByteArray name;
+    QByteArray hmacKey;
+    QByteArray aesKey;
+};
+
+
+class SslServerSessionCachePrivate
+{
+public:
+    SslServerSessionCachePrivate(int maxSessions)
+        : keyCreatedAt(0), maxSessions(maxSessions), sessionTimeout(300.0f), ticketKeyLifetime(3600.0f)
+        , hits(0), misses(0), generation(0), ticketsEnabled(true) {}
+    bool currentTicketKey(SslTicketKey *key);
+    bool findTicketKey(const unsigned char *name, SslTicketKey *key, bool *isCurrent);
+    void rotateTicketKey();
+    static SslServerSessionCachePrivate *getPrivateHelper(SslServerSessionCache *cache) { return cache->d_ptr; }
+public:
+    // servers in many threads may share the cache.
+    mutable QMutex mutex;
+    QList<SslTicketKey> ticketKeys;  // the current key comes first.
+    QSharedPointer<SslSessionStore> externalStore;
+    qint64 keyCreatedAt;
+    int maxSessions;
+    float sessionTimeout;
+    float ticketKeyLifetime;
+    quint64 hits;
+    quint64 misses;
+    quint32 generation;  // increased if the settings copied into SSL_CTX are changed.
+    bool ticketsEnabled;
+};
+
+
+void SslServerSessionCachePrivate::rotateTicketKey()
+{
+    SslTicketKey key;
+    key.name.resize(SslTicketKey::NameSize);
+    key.hmacKey.resize(SslTicketKey::HmacKeySize);
+    key.aesKey.resize(SslTicketKey::AesKeySize);
+    RAND_bytes(reinterpret_cast<unsigned char *>(key.name.data()), key.name.size());
+    RAND_bytes(reinterpret_cast<unsigned char *>(key.hmacKey.data()), key.hmacKey.size());
+    RAND_bytes(reinterpret_cast<unsigned char *>(key.aesKey.data()), key.aesKey.size());
+    ticketKeys.prepend(key);
+    // tickets encrypted by the previous key are accepted and renewed.
+    while (ticketKeys.size() > 2) {
+        ticketKeys.removeLast();
+    }
+    keyCreatedAt = QDateTime::currentMSecsSinceEpoch();
+}
+
+
+bool SslServerSessionCachePrivate::currentTicketKey(SslTicketKey *key)
+{
+    QMutexLocker locker(&mutex);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (ticketKeys.isEmpty() || (ticketKeyLifetime > 0 && now - keyCreatedAt > static_cast<qint64>(ticketKeyLifetime * 1000))) {
+        rotateTicketKey();
+    }
+    *key = ticketKeys.first();
+    return true;
+}
+
+
+bool SslServerSessionCachePrivate::findTicketKey(const unsigned char *name, SslTicketKey *key, bool *isCurrent)
+{
+    QMutexLocker locker(&mutex);
+    for (int i = 0; i < ticketKeys.size(); ++i) {
+        if (memcmp(ticketKeys.at(i).name.constData(), name, SslTicketKey::NameSize) == 0) {
+            *key = ticketKeys.at(i);
+            *isCurrent = (i == 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static int sslServerSessionCacheIndex()
+{
+    static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+
+static int sslServerSessionIndex()
+{
+    static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+
+static int sslServerConfigurationIndex()
+{
+    static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+
+// the SSL_CTX of connection may be switched by server name, so the cache is looked up from SSL first.
+static SslServerSessionCachePrivate *serverSessionCacheOf(SSL *ssl)
+{
+    void *d = SSL_get_ex_data(ssl, sslServerSessionIndex());
+    if (d) {
+        return static_cast<SslServerSessionCachePrivate *>(d);
+    }
+    return static_cast<SslServerSessionCachePrivate *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), sslServerSessionCacheIndex()));
+}
+
+
+static int onTicketKey(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cipherContext,
+                       HMAC_CTX *hmacContext, int enc)
+{
+    SslServerSessionCachePrivate *d = serverSessionCacheOf(ssl);
+    if (!d) {
+        return -1;
+    }
+    SslTicketKey key;
+    if (enc) {
+        d->currentTicketKey(&key);
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_128_cbc())) <= 0) {
+            return -1;
+        }
+        memcpy(name, key.name.constData(), SslTicketKey::NameSize);
+        EVP_EncryptInit_ex(cipherContext, EVP_aes_128_cbc(), nullptr,
+                           reinterpret_cast<const unsigned char *>(key.aesKey.constData()), iv);
+        HMAC_Init_ex(hmacContext, key.hmacKey.constData(), key.hmacKey.size(), EVP_sha256(), nullptr);
+        return 1;
+    } else {
+        bool isCurrent = false;
+        if (!d->findTicketKey(name, &key, &isCurrent)) {
+            return 0;  // unknown key, do a full handshake.
+        }
+        HMAC_Init_ex(hmacContext, key.hmacKey.constData(), key.hmacKey.size(), EVP_sha256(), nullptr);
+        EVP_DecryptInit_ex(cipherContext, EVP_aes_128_cbc(), nullptr,
+                           reinterpret_cast<const unsigned char *>(key.aesKey.constData()), iv);
+        return isCurrent ? 1 : 2;  // 2 asks to issue a new ticket with the current key.
+    }
+}
+
+
+static int onNewServerSession(SSL *ssl, SSL_SESSION *session)
+{
+    SslServerSessionCachePrivate *d = serverSessionCacheOf(ssl);
+    if (!d) {
+        return 0;
+    }
+    QSharedPointer<SslSessionStore> store;
+    {
+        QMutexLocker locker(&d->mutex);
+        store = d->externalStore;
+    }
+    if (store.isNull()) {
+        return 0;
+    }
+    unsigned int idLength = 0;
+    const unsigned char *id = SSL_SESSION_get_id(session, &idLength);
+    int size = i2d_SSL_SESSION(session, nullptr);
+    if (!id || idLength == 0 || size <= 0) {
+        return 0;
+    }
+    QByteArray data(size, Qt::Uninitialized);
+    unsigned char *p = reinterpret_cast<unsigned char *>(data.data());
+    i2d_SSL_SESSION(session, &p);
+    store->store(QByteArray(reinterpret_cast<const char *>(id), static_cast<int>(idLength)), data);
+    return 0;  // the reference of session is not kept.
+}
+
+
+static SSL_SESSION *onGetServerSession(SSL *ssl, const unsigned char *id, int idLength, int *copy)
+{
+    *copy = 0;
+    SslServerSessionCachePrivate *d = serverSessionCacheOf(ssl);
+    if (!d) {
+        return nullptr;
+    }
+    QSharedPointer<SslSessionStore> store;
+    {
+        QMutexLocker locker(&d->mutex);
+        store = d->externalStore;
+    }
+    if (store.isNull()) {
+        return nullptr;
+    }
+    const QByteArray &data = store->load(QByteArray(reinterpret_cast<const char *>(id), idLength));
+    if (data.isEmpty()) {
+        return nullptr;
+    }
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data.constData());
+    return d2i_SSL_SESSION(nullptr, &p, data.size());
+}
+
+
+static void onRemoveServerSession(SSL_CTX *ctx, SSL_SESSION *session)
+{
+    SslServerSessionCachePrivate *d = static_cast<SslServerSessionCachePrivate *>(
+                SSL_CTX_get_ex_data(ctx, sslServerSessionCacheIndex()));
+    if (!d) {
+        return;
+    }
+    QSharedPointer<SslSessionStore> store;
+    {
+        QMutexLocker locker(&d->mutex);
+        store = d->externalStore;
+    }
+    unsigned int idLength = 0;
+    const unsigned char *id = SSL_SESSION_get_id(session, &idLength);
+    if (!store.isNull() && id && idLength > 0) {
+        store->remove(QByteArray(reinterpret_cast<const char *>(id), static_cast<int>(idLength)));
+    }
+}
+
+
+static quint32 serverSessionCacheGeneration(QSharedPointer<SslServerSessionCache> cache)
+{
+    if (cache.isNull()) {
+        return 0;
+    }
+    SslServerSessionCachePrivate *d = SslServerSessionCachePrivate::getPrivateHelper(cache.data());
+    QMutexLocker locker(&d->mutex);
+    return d->generation;
+}
+
+
+static void setupServerSessionCache(SSL_CTX *ctx, QSharedPointer<SslServerSessionCache> cache)
+{
+    static const unsigned char sessionIdContext[] = "qtng";
+    SSL_CTX_set_session_id_context(ctx, sessionIdContext, sizeof(sessionIdContext) - 1);
+    if (cache.isNull()) {
+        return;
+    }
+    SslServerSessionCachePrivate *d = SslServerSessionCachePrivate::getPrivateHelper(cache.data());
+    QMutexLocker locker(&d->mutex);
+    SSL_CTX_set_ex_data(ctx, sslServerSessionCacheIndex(), d);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, qMax(d->maxSessions, 0));
+    SSL_CTX_set_timeout(ctx, static_cast<long>(d->sessionTimeout));
+    SSL_CTX_sess_set_new_cb(ctx, onNewServerSession);
+    SSL_CTX_sess_set_get_cb(ctx, onGetServerSession);
+    SSL_CTX_sess_set_remove_cb(ctx, onRemoveServerSession);
+    if (d->ticketsEnabled) {
+        SSL_CTX_set_tlsext_ticket_key_cb(ctx, onTicketKey);
+    } else {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+}
+
+
+SslServerSessionCache::SslServerSessionCache(int maxSessions)
+    : d_ptr(new SslServerSessionCachePrivate(maxSessions))
+{
+    initOpenSSL();
+}
+
+
+SslServerSessionCache::~SslServerSessionCache()
+{
+    delete d_ptr;
+}
+
+
+int SslServerSessionCache::maxSessions() const
+{
+    Q_D(const SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    return d->maxSessions;
+}
+
+
+void SslServerSessionCache::setMaxSessions(int maxSessions)
+{
+    Q_D(SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    if (d->maxSessions != maxSessions) {
+        d->maxSessions = maxSessions;
+        ++d->generation;
+    }
+}
+
+
+float SslServerSessionCache::sessionTimeout() const
+{
+    Q_D(const SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    return d->sessionTimeout;
+}
+
+
+void SslServerSessionCache::setSessionTimeout(float sessionTimeout)
+{
+    Q_D(SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    if (d->sessionTimeout != sessionTimeout) {
+        d->sessionTimeout = sessionTimeout;
+        ++d->generation;
+    }
+}
+
+
+bool SslServerSessionCache::ticketsEnabled() const
+{
+    Q_D(const SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    return d->ticketsEnabled;
+}
+
+
+void SslServerSessionCache::setTicketsEnabled(bool ticketsEnabled)
+{
+    Q_D(SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    if (d->ticketsEnabled != ticketsEnabled) {
+        d->ticketsEnabled = ticketsEnabled;
+        ++d->generation;
+    }
+}
+
+
+float SslServerSessionCache::ticketKeyLifetime() const
+{
+    Q_D(const SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    return d->ticketKeyLifetime;
+}
+
+
+void SslServerSessionCache::setTicketKeyLifetime(float ticketKeyLifetime)
+{
+    Q_D(SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    d->ticketKeyLifetime = ticketKeyLifetime;
+}
+
+
+void SslServerSessionCache::rotateTicketKey()
+{
+    Q_D(SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    d->rotateTicketKey();
+}
+
+
+QList<QByteArray> SslServerSessionCache::ticketKeys() const
+{
+    Q_D(const SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    QList<QByteArray> keys;
+    for (const SslTicketKey &key: d->ticketKeys) {
+        keys.append(key.name + key.hmacKey + key.aesKey);
+    }
+    return keys;
+}
+
+
+void SslServerSessionCache::setTicketKeys(const QList<QByteArray> &ticketKeys)
+{
+    Q_D(SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    QList<SslTicketKey> keys;
+    for (const QByteArray &data: ticketKeys) {
+        if (data.size() != SslTicketKey::Size) {
+            qDebug() << "invalid size of ticket key.";
+            continue;
+        }
+        SslTicketKey key;
+        key.name = data.left(SslTicketKey::NameSize);
+        key.hmacKey = data.mid(SslTicketKey::NameSize, SslTicketKey::HmacKeySize);
+        key.aesKey = data.right(SslTicketKey::AesKeySize);
+        keys.append(key);
+    }
+    d->ticketKeys = keys;
+    d->keyCreatedAt = QDateTime::currentMSecsSinceEpoch();
+}
+
+
+QSharedPointer<SslSessionStore> SslServerSessionCache::externalStore() const
+{
+    Q_D(const SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    return d->externalStore;
+}
+
+
+void SslServerSessionCache::setExternalStore(QSharedPointer<SslSessionStore> externalStore)
+{
+    Q_D(SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    d->externalStore = externalStore;
+}
+
+
+quint64 SslServerSessionCache::hits() const
+{
+    Q_D(const SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    return d->hits;
+}
+
+
+quint64 SslServerSessionCache::misses() const
+{
+    Q_D(const SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    return d->misses;
+}
+
+
+float SslServerSessionCache::hitRate() const
+{
+    Q_D(const SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    const quint64 total = d->hits + d->misses;
+    if (total == 0) {
+        return 0.0f;
+    }
+    return static_cast<float>(d->hits) / static_cast<float>(total);
+}
+
+
+void SslServerSessionCache::resetCounters()
+{
+    Q_D(SslServerSessionCache);
+    QMutexLocker locker(&d->mutex);
+    d->hits = 0;
+    d->misses = 0;
+}
+
+
+struct SslCertificateEntry
+{
+    SslConfiguration configuration;
+    QString certificatePath;
+    QString privateKeyPath;
+    QDateTime certificateModified;
+    QDateTime privateKeyModified;
+    Ssl::EncodingFormat format;
+};
+
+
+class SslCertificateStorePrivate
+{
+public:
+    SslConfiguration find(const QString &hostName, bool *found) const;
+    void add(QSharedPointer<SslCertificateEntry> entry, const QStringList &hostNames);
+    static QString normalize(const QString &hostName);
+    static QStringList namesOf(const Certificate &certificate);
+    static bool load(SslCertificateEntry *entry);
+    static SslCertificateStorePrivate *getPrivateHelper(SslCertificateStore *store) { return store->d_ptr; }
+public:
+    // the store is read by handshakes in any thread while being reloaded.
+    mutable QMutex mutex;
+    QHash<QString, QSharedPointer<SslCertificateEntry>> exactNames;
+    QHash<QString, QSharedPointer<SslCertificateEntry>> wildcardNames;  // keyed by the domain after "*."
+};
+
+
+QString SslCertificateStorePrivate::normalize(const QString &hostName)
+{
+    QString name = hostName.trimmed().toLower();
+    if (name.endsWith(QLatin1Char('.'))) {
+        name.chop(1);
+    }
+    return name;
+}
+
+
+QStringList SslCertificateStorePrivate::namesOf(const Certificate &certificate)
+{
+    QStringList names = certificate.subjectAlternativeNames().values(Certificate::DnsEntry);
+    if (names.isEmpty()) {
+        names = certificate.subjectInfo(Certificate::CommonName);
+    }
+    return names;
+}
+
+
+bool SslCertificateStorePrivate::load(SslCertificateEntry *entry)
+{
+    QFile certificateFile(entry->certificatePath);
+    QFile privateKeyFile(entry->privateKeyPath);
+    if (!certificateFile.open(QIODevice::ReadOnly) || !privateKeyFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const Certificate &certificate = Certificate::load(certificateFile.readAll(), entry->format);
+    const PrivateKey &privateKey = PrivateKey::load(privateKeyFile.readAll(), entry->format);
+    if (certificate.isNull() || !privateKey.isValid()) {
+        return false;
+    }
+    SslConfiguration configuration;
+    configuration.setLocalCertificate(certificate);
+    configuration.setPrivateKey(privateKey);
+    entry->configuration = configuration;
+    entry->certificateModified = QFileInfo(entry->certificatePath).lastModified();
+    entry->privateKeyModified = QFileInfo(entry->privateKeyPath).lastModified();
+    return true;
+}
+
+
+void SslCertificateStorePrivate::add(QSharedPointer<SslCertificateEntry> entry, const QStringList &hostNames)
+{
+    QMutexLocker locker(&mutex);
+    for (const QString &hostName: hostNames) {
+        const QString &name = normalize(hostName);
+        if (name.startsWith(QLatin1String("*."))) {
+            wildcardNames.insert(name.mid(2), entry);
+        } else if (!name.isEmpty()) {
+            exactNames.insert(name, entry);
+        }
+    }
+}
+
+
+SslConfiguration SslCertificateStorePrivate::find(const QString &hostName, bool *found) const
+{
+    const QString &name = normalize(hostName);
+    QMutexLocker locker(&mutex);
+    QSharedPointer<SslCertificateEntry> entry = exactNames.value(name);
+    if (entry.isNull()) {
+        // a wildcard matches exactly one label.
+        int dot = name.indexOf(QLatin1Char('.'));
+        if (dot > 0) {
+            entry = wildcardNames.value(name.mid(dot + 1));
+        }
+    }
+    if (found) {
+        *found = !entry.isNull();
+    }
+    if (entry.isNull()) {
+        return SslConfiguration();
+    }
+    return entry->configuration;
+}
+
+
+static int onServerName(SSL *ssl, int *, void *arg)
+{
+    SslCertificateStorePrivate *d = static_cast<SslCertificateStorePrivate *>(arg);
+    const SslConfiguration *config = static_cast<const SslConfiguration *>(SSL_get_ex_data(ssl, sslServerConfigurationIndex()));
+    const char *serverName = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!d || !config || !serverName) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    bool found = false;
+    const SslConfiguration &configuration = d->find(QString::fromUtf8(serverName), &found);
+    if (!found) {
+        return SSL_TLSEXT_ERR_NOACK;  // use the certificate of server.
+    }
+    QSharedPointer<SSL_CTX> ctx = SslConfigurationPrivate::nameContext(*config, configuration);
+    if (ctx.isNull()) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    SSL_set_SSL_CTX(ssl, ctx.data());  // the SSL holds a reference of ctx.
+    return SSL_TLSEXT_ERR_OK;
+}
+
+
+static void setupCertificateStore(SSL_CTX *ctx, QSharedPointer<SslCertificateStore> store)
+{
+    if (store.isNull()) {
+        return;
+    }
+    SSL_CTX_set_tlsext_servername_callback(ctx, onServerName);
+    SSL_CTX_set_tlsext_servername_arg(ctx, SslCertificateStorePrivate::getPrivateHelper(store.data()));
+}
+
+
+SslCertificateStore::SslCertificateStore()
+    : d_ptr(new SslCertificateStorePrivate())
+{
+    initOpenSSL();
+}
+
+
+SslCertificateStore::~SslCertificateStore()
+{
+    delete d_ptr;
+}
+
+
+void SslCertificateStore::addConfiguration(const SslConfiguration &configuration, const QStringList &hostNames)
+{
+    Q_D(SslCertificateStore);
+    QSharedPointer<SslCertificateEntry> entry(new SslCertificateEntry());
+    entry->configuration = configuration;
+    entry->format = Ssl::Pem;
+    d->add(entry, hostNames.isEmpty() ? SslCertificateStorePrivate::namesOf(configuration.localCertificate()) : hostNames);
+}
+
+
+bool SslCertificateStore::addCertificateFiles(const QString &certificatePath, const QString &privateKeyPath,
+                                              const QStringList &hostNames, Ssl::EncodingFormat format)
+{
+    Q_D(SslCertificateStore);
+    QSharedPointer<SslCertificateEntry> entry(new SslCertificateEntry());
+    entry->certificatePath = certificatePath;
+    entry->privateKeyPath = privateKeyPath;
+    entry->format = format;
+    if (!SslCertificateStorePrivate::load(entry.data())) {
+        return false;
+    }
+    d->add(entry, hostNames.isEmpty() ? SslCertificateStorePrivate::namesOf(entry->configuration.localCertificate()) : hostNames);
+    return true;
+}
+
+
+int SslCertificateStore::reload()
+{
+    Q_D(SslCertificateStore);
+    QList<QSharedPointer<SslCertificateEntry>> entries;
+    {
+        QMutexLocker locker(&d->mutex);
+        for (const QSharedPointer<SslCertificateEntry> &entry: d->exactNames) {
+            if (!entries.contains(entry)) {
+                entries.append(entry);
+            }
+        }
+        for (const QSharedPointer<SslCertificateEntry> &entry: d->wildcardNames) {
+            if (!entries.contains(entry)) {
+                entries.append(entry);
+            }
+        }
+    }
+    int count = 0;
+    for (const QSharedPointer<SslCertificateEntry> &entry: entries) {
+        SslCertificateEntry loaded;
+        {
+            QMutexLocker locker(&d->mutex);
+            if (entry->certificatePath.isEmpty()) {
+                continue;
+            }
+            if (QFileInfo(entry->certificatePath).lastModified() == entry->certificateModified
+                    && QFileInfo(entry->privateKeyPath).lastModified() == entry->privateKeyModified) {
+                continue;
+            }
+            loaded = *entry;
+        }
+        // keep serving the old certificate if the new one is broken.
+        if (SslCertificateStorePrivate::load(&loaded)) {
+            QMutexLocker locker(&d->mutex);
+            *entry = loaded;
+            ++count;
+        }
+    }
+    return count;
+}
+
+
+bool SslCertificateStore::removeHostName(const QString &hostName)
+{
+    Q_D(SslCertificateStore);
+    const QString &name = SslCertificateStorePrivate::normalize(hostName);
+    QMutexLocker locker(&d->mutex);
+    if (name.startsWith(QLatin1String("*."))) {
+        return d->wildcardNames.remove(name.mid(2)) > 0;
+    } else {
+        return d->exactNames.remove(name) > 0;
+    }
+}
+
+
+void SslCertificateStore::clear()
+{
+    Q_D(SslCertificateStore);
+    QMutexLocker locker(&d->mutex);
+    d->exactNames.clear();
+    d->wildcardNames.clear();
+}
+
+
+QStringList SslCertificateStore::hostNames() const
+{
+    Q_D(const SslCertificateStore);
+    QMutexLocker locker(&d->mutex);
+    QStringList names = d->exactNames.keys();
+    for (const QString &name: d->wildcardNames.keys()) {
+        names.append(QStringLiteral("*.") + name);
+    }
+    return names;
+}
+
+
+SslConfiguration SslCertificateStore::find(const QString &hostName, bool *found) const
+{
+    Q_D(const SslCertificateStore);
+    return d->find(hostName, found);
+}
+
+
+struct SslHandshakeStep
+{
+    SslHandshakeStep()
+        : result(-1), error(SSL_ERROR_SSL) {}
+    int result;
+    int error;
+};
+
+
+class SslCryptoWorkerPoolPrivate
+{
+public:
+    SslCryptoWorkerPoolPrivate(int threads)
+        : pool(new ThreadPool(threads)), threads(threads > 0 ? threads : QThread::idealThreadCount())
+        , queueDepth(0), maxQueueDepth(0), operations(0), totalLatency(0), maxLatency(0) {}
+    SslHandshakeStep handshake(QSharedPointer<SSL> ssl, const SslConfiguration &config, bool asServer);
+    static SslCryptoWorkerPoolPrivate *getPrivateHelper(SslCryptoWorkerPool *pool) { return pool->d_ptr; }
+public:
+    QSharedPointer<ThreadPool> pool;
+    int threads;
+    int queueDepth;
+    int maxQueueDepth;
+    quint64 operations;
+    qint64 totalLatency;  // in microseconds.
+    qint64 maxLatency;
+};
+
+
+SslHandshakeStep SslCryptoWorkerPoolPrivate::handshake(QSharedPointer<SSL> ssl, const SslConfiguration &config,
+                                                       bool asServer)
+{
+    QElapsedTimer timer;
+    timer.start();
+    ++queueDepth;
+    maxQueueDepth = qMax(maxQueueDepth, queueDepth);
+    // the worker keeps running if the waiting coroutine is killed or timed out, and the connection may be
+    // freed then. so the worker owns the SSL and the objects referred by its ex_data until it finishes.
+    QSharedPointer<SslServerSessionCache> serverCache = config.serverSessionCache();
+    std::function<SslHandshakeStep()> func = [ssl, config, serverCache, asServer] () mutable {
+        SslHandshakeStep step;
+        if (asServer) {
+            SSL_set_ex_data(ssl.data(), sslServerConfigurationIndex(), &config);
+            if (!serverCache.isNull()) {
+                SSL_set_ex_data(ssl.data(), sslServerSessionIndex(),
+                                SslServerSessionCachePrivate::getPrivateHelper(serverCache.data()));
+            }
+        }
+        // the error queue of openssl is thread local, so get the error in worker thread.
+        ERR_clear_error();
+        step.result = asServer ? SSL_accept(ssl.data()) : SSL_connect(ssl.data());
+        step.error = step.result > 0 ? SSL_ERROR_NONE : SSL_get_error(ssl.data(), step.result);
+        ERR_clear_error();
+        if (asServer) {
+            SSL_set_ex_data(ssl.data(), sslServerConfigurationIndex(), nullptr);
+        }
+        return step;
+    };
+    SslHandshakeStep step;
+    try {
+        step = pool->call<SslHandshakeStep>(func);
+    } catch (...) {
+        --queueDepth;
+        throw;
+    }
+    --queueDepth;
+    qint64 latency = timer.nsecsElapsed() / 1000;
+    ++operations;
+    totalLatency += latency;
+    maxLatency = qMax(maxLatency, latency);
+    return step;
+}
+
+
+SslCryptoWorkerPool::SslCryptoWorkerPool(int threads)
+    : d_ptr(new SslCryptoWorkerPoolPrivate(threads))
+{
+}
+
+
+SslCryptoWorkerPool::~SslCryptoWorkerPool()
+{
+    delete d_ptr;
+}
+
+
+int SslCryptoWorkerPool::threads() const
+{
+    Q_D(const SslCryptoWorkerPool);
+    return d->threads;
 }
 
 
-bool SslConfiguration::setLocalCertificate(const QString &path, Ssl::EncodingFormat format)
+int SslCryptoWorkerPool::queueDepth() const
 {
-    QFile f(path);
-    if(!f.open(QIODevice::ReadOnly)) {
-        return false;
-    }
-    const QByteArray &data = f.readAll();
-    const Certificate &cert = Certificate::load(data, format);
-    if(cert.isNull() || cert.isBlacklisted()) {
-        return false;
-    }
-    setLocalCertificate(cert);
-    return true;
+    Q_D(const SslCryptoWorkerPool);
+    return d->queueDepth;
 }
 
 
-void SslConfiguration::setPrivateKey(const PrivateKey &key)
+int SslCryptoWorkerPool::maxQueueDepth() const
 {
-    d->privateKey = key;
+    Q_D(const SslCryptoWorkerPool);
+    return d->maxQueueDepth;
 }
 
 
-void SslConfiguration::setOnlySecureProtocol(bool onlySecureProtocol)
+quint64 SslCryptoWorkerPool::operations() const
 {
-    d->onlySecureProtocol = onlySecureProtocol;
+    Q_D(const SslCryptoWorkerPool);
+    return d->operations;
 }
 
 
-void SslConfiguration::setSupportCompression(bool supportCompression)
+float SslCryptoWorkerPool::averageLatency() const
 {
-    d->supportCompression = supportCompression;
+    Q_D(const SslCryptoWorkerPool);
+    if (d->operations == 0) {
+        return 0.0;
+    }
+    return static_cast<float>(d->totalLatency / static_cast<double>(d->operations) / 1000000.0);
 }
 
 
-QList<SslCipher> SslConfiguration::supportedCiphers()
+float SslCryptoWorkerPool::maxLatency() const
 {
-    return QList<SslCipher>();
+    Q_D(const SslCryptoWorkerPool);
+    return static_cast<float>(d->maxLatency / 1000000.0);
 }
 
 
-SslConfiguration SslConfiguration::testPurpose(const QString &commonName, const QString &countryCode, const QString &organization)
+void SslCryptoWorkerPool::resetCounters()
 {
-    PrivateKey key = PrivateKey::generate(qtng::PrivateKey::Rsa, 2048);
-    QMultiMap<Certificate::SubjectInfo, QString> info;
-    info.insert(Certificate::CommonName, commonName);
-    info.insert(Certificate::CountryName, countryCode);
-    info.insert(Certificate::Organization, organization);
-    const QDateTime &now = QDateTime::currentDateTime();
-    const Certificate &cert = Certificate::generate(key, MessageDigest::Sha256,
-                                                    293424, now, now.addYears(10), info);
-    SslConfiguration config;
-    config.setPrivateKey(key);
-    config.setLocalCertificate(cert);
-    return config;
+    Q_D(SslCryptoWorkerPool);
+    d->maxQueueDepth = d->queueDepth;
+    d->operations = 0;
+    d->totalLatency = 0;
+    d->maxLatency = 0;
 }
 
 
@@ -764,6 +1944,169 @@ static SslError _q_OpenSSL_to_SslError(int errorCode, const Certificate &cert)
 */
 
 
+// a BIO reads and writes tls records straight from a plain socket, so that the
+// data is not copied into and out of memory BIOs. openssl never blocks in the
+// BIO: reads and full write buffers ask for a retry, and SslConnection does the
+// socket io in pumpIncoming() and pumpOutgoing() between openssl calls.
+struct SslSocketBio
+{
+    enum {
+        ReadAheadSize = 1024 * 32,
+        MaxPendingSize = 1024 * 64,
+    };
+    SslSocketBio(QSharedPointer<Socket> socket)
+        : socket(socket), readLock(new Lock()), readPos(0), readEnd(0) {}
+    bool fill();
+    bool flush();
+
+    QSharedPointer<Socket> socket;
+    QSharedPointer<Lock> readLock;
+    QVarLengthArray<char, ReadAheadSize> readBuffer;
+    QByteArray writeBuffer;
+    qint32 readPos;
+    qint32 readEnd;
+};
+
+
+bool SslSocketBio::fill()
+{
+    ScopedLock<Lock> l(readLock); Q_UNUSED(l);
+    if (readPos < readEnd) {
+        // another coroutine has received data while we were waiting.
+        return true;
+    }
+    qint32 n = socket->recv(readBuffer.data(), readBuffer.size());
+    if (n <= 0) {
+        return false;
+    }
+    readPos = 0;
+    readEnd = n;
+    return true;
+}
+
+
+bool SslSocketBio::flush()
+{
+    if (writeBuffer.isEmpty()) {
+        return true;
+    }
+    // sendall() blocks, and other coroutines may write records meanwhile. they are sent by
+    // their own flush(), which is queued after us by the write lock of socket.
+    QByteArray records;
+    records.swap(writeBuffer);
+    qint32 sent = socket->sendall(records.constData(), records.size());
+    return sent == records.size();
+}
+
+
+static int socketBioWrite(BIO *bio, const char *data, int size)
+{
+    BIO_clear_retry_flags(bio);
+    SslSocketBio *d = static_cast<SslSocketBio *>(BIO_get_data(bio));
+    if (!d || size < 0) {
+        return -1;
+    }
+    if (d->writeBuffer.size() >= SslSocketBio::MaxPendingSize) {
+        // SSL_write() returns SSL_ERROR_WANT_WRITE, and is called again after flush.
+        BIO_set_retry_write(bio);
+        return -1;
+    }
+    d->writeBuffer.append(data, size);
+    return size;
+}
+
+
+static int socketBioRead(BIO *bio, char *data, int size)
+{
+    BIO_clear_retry_flags(bio);
+    SslSocketBio *d = static_cast<SslSocketBio *>(BIO_get_data(bio));
+    if (!d || size <= 0) {
+        return -1;
+    }
+    if (d->readPos >= d->readEnd) {
+        // SSL_read() returns SSL_ERROR_WANT_READ, and is called again after fill.
+        BIO_set_retry_read(bio);
+        return -1;
+    }
+    qint32 n = qMin(size, d->readEnd - d->readPos);
+    memcpy(data, d->readBuffer.constData() + d->readPos, static_cast<size_t>(n));
+    d->readPos += n;
+    return n;
+}
+
+
+static long socketBioCtrl(BIO *bio, int cmd, long, void *)
+{
+    SslSocketBio *d = static_cast<SslSocketBio *>(BIO_get_data(bio));
+    if (!d) {
+        return 0;
+    }
+    switch (cmd) {
+    case BIO_CTRL_FLUSH:
+        // the records are sent by SslConnection::pumpOutgoing() after openssl returns.
+        return 1;
+    case BIO_CTRL_PENDING:
+        return d->readEnd - d->readPos;
+    case BIO_CTRL_WPENDING:
+        return d->writeBuffer.size();
+    case BIO_CTRL_DUP:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+
+static int socketBioCreate(BIO *bio)
+{
+    BIO_set_init(bio, 1);
+    return 1;
+}
+
+
+static int socketBioDestroy(BIO *bio)
+{
+    if (!bio) {
+        return 0;
+    }
+    delete static_cast<SslSocketBio *>(BIO_get_data(bio));
+    BIO_set_data(bio, nullptr);
+    return 1;
+}
+
+
+static BIO_METHOD *socketBioMethod()
+{
+    static BIO_METHOD *method = [] {
+        BIO_METHOD *m = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "qtng socket");
+        BIO_meth_set_write(m, socketBioWrite);
+        BIO_meth_set_read(m, socketBioRead);
+        BIO_meth_set_ctrl(m, socketBioCtrl);
+        BIO_meth_set_create(m, socketBioCreate);
+        BIO_meth_set_destroy(m, socketBioDestroy);
+        return m;
+    }();
+    return method;
+}
+
+
+// returns null if the socket is not a plain socket, such as KcpSocket.
+static BIO *newSocketBio(QSharedPointer<SocketLike> socketLike)
+{
+    QSharedPointer<Socket> socket = convertSocketLikeToSocket(socketLike);
+    if (socket.isNull()) {
+        return nullptr;
+    }
+    BIO *bio = BIO_new(socketBioMethod());
+    if (bio) {
+        SslSocketBio *d = new SslSocketBio(socket);
+        d->readBuffer.resize(SslSocketBio::ReadAheadSize);
+        BIO_set_data(bio, d);
+    }
+    return bio;
+}
+
+
 template<typename Socket>
 class SslConnection
 {
@@ -793,13 +2136,15 @@ public:
     QSharedPointer<SSL> ssl;
     QString verificationPeerName;
     QList<SslError> errors;
+    SslClientSession clientSession;
+    bool directIo;
     bool asServer;
 };
 
 
 template<typename Socket>
 SslConnection<Socket>::SslConnection(const SslConfiguration &config)
-    :config(config)
+    :config(config), directIo(false)
 {
     initOpenSSL();
 }
@@ -807,6 +2152,7 @@ SslConnection<Socket>::SslConnection(const SslConfiguration &config)
 
 template<typename Socket>
 SslConnection<Socket>::SslConnection()
+    :directIo(false)
 {
     initOpenSSL();
 }
@@ -829,16 +2175,23 @@ bool SslConnection<Socket>::handshake(bool asServer, const QString &verification
     this->verificationPeerName = verificationPeerName;
     // TODO set verify name.
 
-    BIO *incoming = BIO_new(BIO_s_mem());
-    if(!incoming) {
-        return false;
-    }
-    BIO *outgoing = BIO_new(BIO_s_mem());
-    if(!outgoing) {
-        return false;
+    // the handshakes running in worker threads must not touch the socket, so they use memory BIOs.
+    BIO *incoming = (asServer && !config.cryptoWorkerPool().isNull()) ? nullptr : newSocketBio(rawSocket);
+    BIO *outgoing = incoming;
+    directIo = incoming != nullptr;
+    if (!directIo) {
+        incoming = BIO_new(BIO_s_mem());
+        if(!incoming) {
+            return false;
+        }
+        outgoing = BIO_new(BIO_s_mem());
+        if(!outgoing) {
+            BIO_free(incoming);
+            return false;
+        }
     }
 
-    ctx = SslConfigurationPrivate::makeContext(config, asServer);
+    ctx = SslConfigurationPrivate::context(config, asServer);
     if(!ctx.isNull()) {
         ssl.reset(SSL_new(ctx.data()), SSL_free);
         if(!ssl.isNull()) {
@@ -856,14 +2209,69 @@ bool SslConnection<Socket>::handshake(bool asServer, const QString &verification
 //            }
 //                SSL_set_verify(ssl.data(), SSL_VERIFY_PEER, nullptr);
 //            }
-            return _handshake();
+            QSharedPointer<SSL_SESSION> session;
+            if (!asServer) {
+                if (!verificationPeerName.isEmpty() && QHostAddress(verificationPeerName).isNull()) {
+                    const QByteArray &hostName = verificationPeerName.toUtf8();
+                    SSL_set_tlsext_host_name(ssl.data(), hostName.constData());
+                }
+                if (!clientSession.cache.isNull()) {
+                    if (clientSession.key.isEmpty()) {
+                        const QString &host = verificationPeerName.isEmpty() ? rawSocket->peerAddress().toString()
+                                                                             : verificationPeerName;
+                        clientSession.key = host + QLatin1Char(':') + QString::number(rawSocket->peerPort());
+                    }
+                    SSL_set_ex_data(ssl.data(), sslClientSessionIndex(), &clientSession);
+                    session = SslSessionCachePrivate::getPrivateHelper(clientSession.cache.data())->session(clientSession.key);
+                    if (!session.isNull()) {
+                        SSL_set_session(ssl.data(), session.data());
+                    }
+                }
+            }
+            QSharedPointer<SslServerSessionCache> serverCache;
+            if (asServer) {
+                // the contexts selected by server name are based on this configuration.
+                SSL_set_ex_data(ssl.data(), sslServerConfigurationIndex(), &config);
+                serverCache = config.serverSessionCache();
+                if (!serverCache.isNull()) {
+                    SSL_set_ex_data(ssl.data(), sslServerSessionIndex(),
+                                    SslServerSessionCachePrivate::getPrivateHelper(serverCache.data()));
+                }
+            }
+            bool success = _handshake();
+            if (asServer && success) {
+                if (!serverCache.isNull()) {
+                    SslServerSessionCachePrivate *cache = SslServerSessionCachePrivate::getPrivateHelper(serverCache.data());
+                    QMutexLocker locker(&cache->mutex);
+                    if (SSL_session_reused(ssl.data())) {
+                        ++cache->hits;
+                    } else {
+                        ++cache->misses;
+                    }
+                }
+            }
+            if (!clientSession.cache.isNull() && !asServer) {
+                SslSessionCachePrivate *cache = SslSessionCachePrivate::getPrivateHelper(clientSession.cache.data());
+                if (success && SSL_session_reused(ssl.data())) {
+                    ++cache->hits;
+                } else {
+                    ++cache->misses;
+                    if (!success && !session.isNull()) {
+                        // the server refused the session, do not offer it again.
+                        cache->removeSession(clientSession.key);
+                    }
+                }
+            }
+            return success;
         } else {
             ctx.reset();
         }
     }
 
     BIO_free(incoming);
-    BIO_free(outgoing);
+    if (outgoing != incoming) {
+        BIO_free(outgoing);
+    }
     return false;
 }
 
@@ -931,10 +2339,23 @@ bool SslConnection<Socket>::close()
 template<typename Socket>
 bool SslConnection<Socket>::_handshake()
 {
+    // the callbacks of client sessions are not thread safe, so only servers use the worker pool.
+    QSharedPointer<SslCryptoWorkerPool> workerPool;
+    if (asServer && !directIo) {
+        workerPool = config.cryptoWorkerPool();
+    }
     while(true) {
-        int result = asServer ? SSL_accept(ssl.data()) : SSL_connect(ssl.data());
+        int result, err;
+        if (!workerPool.isNull()) {
+            SslCryptoWorkerPoolPrivate *pool = SslCryptoWorkerPoolPrivate::getPrivateHelper(workerPool.data());
+            const SslHandshakeStep &step = pool->handshake(ssl, config, asServer);
+            result = step.result;
+            err = step.error;
+        } else {
+            result = asServer ? SSL_accept(ssl.data()) : SSL_connect(ssl.data());
+            err = result > 0 ? SSL_ERROR_NONE : SSL_get_error(ssl.data(), result);
+        }
         if(result <= 0) {
-            int err = SSL_get_error(ssl.data(), result);
             switch(err) {
             case SSL_ERROR_WANT_READ:
                 if(!pumpOutgoing()) return false;
@@ -971,13 +2392,23 @@ bool SslConnection<Socket>::pumpOutgoing()
     if (ssl.isNull()) {
         return false;
     }
-    int pendingBytes;
-    QVarLengthArray<char, 4096> buf;
     BIO *outgoing = SSL_get_wbio(ssl.data());
+    if (directIo) {
+        // sends all records written since last flush at once.
+        SslSocketBio *d = outgoing ? static_cast<SslSocketBio *>(BIO_get_data(outgoing)) : nullptr;
+        if (!d || !d->flush()) {
+            qDebug() << "error sending data.";
+            return false;
+        }
+        return true;
+    }
+    // the buffers are local because the sending and receiving coroutines may pump at the same time.
+    int pendingBytes;
+    QVarLengthArray<char, 1024 * 16> buffer;
     while(outgoing && rawSocket->isValid() && (pendingBytes = BIO_pending(outgoing)) > 0) {
-        buf.resize(pendingBytes);
-        qint32 encryptedBytesRead = BIO_read(outgoing, buf.data(), pendingBytes);
-        qint32 actualWritten = rawSocket->sendall(buf.constData(), encryptedBytesRead);
+        buffer.resize(pendingBytes);
+        qint32 encryptedBytesRead = BIO_read(outgoing, buffer.data(), pendingBytes);
+        qint32 actualWritten = rawSocket->sendall(buffer.constData(), encryptedBytesRead);
         if (actualWritten < encryptedBytesRead) {
             qDebug() << "error sending data.";
             return false;
@@ -993,13 +2424,19 @@ bool SslConnection<Socket>::pumpIncoming()
     if (ssl.isNull()) {
         return false;
     }
-    const QByteArray &buf = rawSocket->recv(1024 * 8);
-    if(buf.isEmpty())
+    BIO *incoming = SSL_get_rbio(ssl.data());
+    if (directIo) {
+        SslSocketBio *d = incoming ? static_cast<SslSocketBio *>(BIO_get_data(incoming)) : nullptr;
+        return d && d->fill();
+    }
+    QVarLengthArray<char, 1024 * 16> buffer;
+    buffer.resize(buffer.capacity());
+    qint32 received = rawSocket->recv(buffer.data(), buffer.size());
+    if(received <= 0)
         return false;
     int totalWritten = 0;
-    BIO *incoming = SSL_get_rbio(ssl.data());
-    while(incoming && totalWritten < buf.size()) {
-        int writtenToBio = BIO_write(incoming, buf.constData() + totalWritten, buf.size() - totalWritten);
+    while(incoming && totalWritten < received) {
+        int writtenToBio = BIO_write(incoming, buffer.constData() + totalWritten, received - totalWritten);
         if(writtenToBio > 0) {
             totalWritten += writtenToBio;
         } else {
@@ -1424,6 +2861,31 @@ QList<SslError> SslSocket::sslErrors() const
 }
 
 
+void SslSocket::setSessionCache(QSharedPointer<SslSessionCache> cache, const QString &key)
+{
+    Q_D(SslSocket);
+    d->clientSession.cache = cache;
+    d->clientSession.key = key;
+}
+
+
+QSharedPointer<SslSessionCache> SslSocket::sessionCache() const
+{
+    Q_D(const SslSocket);
+    return d->clientSession.cache;
+}
+
+
+bool SslSocket::isSessionReused() const
+{
+    Q_D(const SslSocket);
+    if (d->ssl.isNull()) {
+        return false;
+    }
+    return SSL_session_reused(d->ssl.data());
+}
+
+
 void SslSocket::setSslConfiguration(const SslConfiguration &configuration)
 {
     Q_D(SslSocket);
@@ -1956,6 +3418,7 @@ class EncryptedSocketLike: public SocketLike
 {
 public:
     EncryptedSocketLike(QSharedPointer<Cipher> cipher, QSharedPointer<SocketLike> s);
+    explicit EncryptedSocketLike(QSharedPointer<SocketLike> s);  // for subclasses without stream cipher.
     virtual ~EncryptedSocketLike() override;
 public:
     virtual Socket::SocketError error() const override;
@@ -1983,8 +3446,8 @@ public:
     virtual bool setOption(Socket::SocketOption option, const QVariant &value) override;
     virtual QVariant option(Socket::SocketOption option) const override;
 
-    qint32 recv(char *data, qint32 size, bool all);
-    qint32 send(const char *data, qint32 size, bool all);
+    virtual qint32 recv(char *data, qint32 size, bool all);
+    virtual qint32 send(const char *data, qint32 size, bool all);
 
     virtual qint32 recv(char *data, qint32 size) override;
     virtual qint32 recvall(char *data, qint32 size) override;
@@ -2008,6 +3471,13 @@ EncryptedSocketLike::EncryptedSocketLike(QSharedPointer<Cipher> cipher, QSharedP
 }
 
 
+EncryptedSocketLike::EncryptedSocketLike(QSharedPointer<SocketLike> s)
+    : s(s)
+{
+
+}
+
+
 EncryptedSocketLike::~EncryptedSocketLike()
 {
     close();
@@ -2124,8 +3594,10 @@ bool EncryptedSocketLike::connect(const QString &hostName, quint16 port, Socket:
 
 void EncryptedSocketLike::close()
 {
-    QByteArray encrypted = outgoingCipher->finalData();
-    s->sendall(encrypted);
+    if (!outgoingCipher.isNull()) {
+        QByteArray encrypted = outgoingCipher->finalData();
+        s->sendall(encrypted);
+    }
     s->close();
 }
 
@@ -2267,6 +3739,253 @@ qint32 EncryptedSocketLike::sendall(const QByteArray &data)
     return send(data.constData(), data.size(), true);
 }
 
+
+// every record is a 2 bytes length of plain text, and the sealed text with 16 bytes tag. the length is
+// authenticated as additional data. the nonce is the number of records sealed by current key.
+class AeadSocketLike: public EncryptedSocketLike
+{
+public:
+    enum {
+        SaltSize = 32,
+        HeaderSize = 2,
+        TagSize = 16,
+        NonceSize = 12,
+        MaxRecordSize = 1024 * 16,
+        MaxPendingSize = 1024 * 64,
+    };
+    struct Direction
+    {
+        Direction() : counter(0), bytes(0), ready(false) { memset(&ctx, 0, sizeof(ctx)); }
+        ~Direction() { if (ready) EVP_AEAD_CTX_cleanup(&ctx); }
+        EVP_AEAD_CTX ctx;
+        QByteArray key;
+        quint64 counter;
+        qint64 bytes;
+        bool ready;
+    };
+    AeadSocketLike(const EVP_AEAD *aead, const QByteArray &key, QSharedPointer<SocketLike> s, qint64 rekeyBytes);
+public:
+    virtual qint32 recv(char *data, qint32 size, bool all) override;
+    virtual qint32 send(const char *data, qint32 size, bool all) override;
+private:
+    bool setKey(Direction *direction, const QByteArray &key);
+    bool rekey(Direction *direction);
+    void makeNonce(Direction *direction, uchar *nonce);
+    qint32 readRecord(char *data, qint32 size);
+public:
+    const EVP_AEAD *aead;
+    QByteArray masterKey;
+    qint64 rekeyBytes;
+    Direction incoming;
+    Direction outgoing;
+    QByteArray readBuffer;   // the plain text of last record is kept in readBuffer.
+    QByteArray writeBuffer;
+    qint32 readPos;
+    qint32 readEnd;
+    bool broken;
+};
+
+
+static QByteArray deriveAeadKey(const QByteArray &key, const QByteArray &info, int size)
+{
+    unsigned char result[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if (!HMAC(EVP_sha256(), key.constData(), key.size(), reinterpret_cast<const uchar *>(info.constData()),
+              static_cast<size_t>(info.size()), result, &len)) {
+        return QByteArray();
+    }
+    return QByteArray(reinterpret_cast<const char *>(result), qMin(static_cast<int>(len), size));
+}
+
+
+AeadSocketLike::AeadSocketLike(const EVP_AEAD *aead, const QByteArray &key, QSharedPointer<SocketLike> s, qint64 rekeyBytes)
+    : EncryptedSocketLike(s), aead(aead), masterKey(key), rekeyBytes(rekeyBytes), readPos(0), readEnd(0), broken(false)
+{
+    readBuffer.reserve(MaxRecordSize + TagSize);
+    writeBuffer.reserve(MaxPendingSize + HeaderSize + TagSize);
+}
+
+
+bool AeadSocketLike::setKey(Direction *direction, const QByteArray &key)
+{
+    if (direction->ready) {
+        EVP_AEAD_CTX_cleanup(&direction->ctx);
+        direction->ready = false;
+    }
+    if (key.size() != static_cast<int>(EVP_AEAD_key_length(aead))) {
+        return false;
+    }
+    if (!EVP_AEAD_CTX_init(&direction->ctx, aead, reinterpret_cast<const uchar *>(key.constData()),
+                           static_cast<size_t>(key.size()), TagSize, nullptr)) {
+        return false;
+    }
+    direction->key = key;
+    direction->counter = 0;
+    direction->bytes = 0;
+    direction->ready = true;
+    return true;
+}
+
+
+bool AeadSocketLike::rekey(Direction *direction)
+{
+    if (rekeyBytes <= 0 || direction->bytes < rekeyBytes) {
+        return true;
+    }
+    const QByteArray &key = deriveAeadKey(direction->key, "qtng rekey", direction->key.size());
+    return setKey(direction, key);
+}
+
+
+void AeadSocketLike::makeNonce(Direction *direction, uchar *nonce)
+{
+    memset(nonce, 0, NonceSize);
+    quint64 counter = direction->counter++;
+    for (int i = NonceSize - 1; i >= NonceSize - 8; --i) {
+        nonce[i] = static_cast<uchar>(counter & 0xff);
+        counter >>= 8;
+    }
+}
+
+
+qint32 AeadSocketLike::send(const char *data, qint32 size, bool)
+{
+    if (broken) {
+        return -1;
+    }
+    writeBuffer.resize(0);
+    if (!outgoing.ready) {
+        QByteArray salt(SaltSize, Qt::Uninitialized);
+        if (RAND_bytes(reinterpret_cast<uchar *>(salt.data()), salt.size()) != 1
+                || !setKey(&outgoing, deriveAeadKey(masterKey, salt, static_cast<int>(EVP_AEAD_key_length(aead))))) {
+            broken = true;
+            return -1;
+        }
+        writeBuffer.append(salt);
+    }
+    qint32 total = 0;
+    while (total < size) {
+        qint32 len = qMin<qint32>(size - total, MaxRecordSize);
+        int offset = writeBuffer.size();
+        writeBuffer.resize(offset + HeaderSize + len + TagSize);
+        uchar *header = reinterpret_cast<uchar *>(writeBuffer.data()) + offset;
+        header[0] = static_cast<uchar>(len >> 8);
+        header[1] = static_cast<uchar>(len & 0xff);
+        uchar nonce[NonceSize];
+        makeNonce(&outgoing, nonce);
+        size_t sealed = 0;
+        // seals straight into the buffer, without copying the plain text.
+        if (!EVP_AEAD_CTX_seal(&outgoing.ctx, header + HeaderSize, &sealed, static_cast<size_t>(len + TagSize),
+                               nonce, NonceSize, reinterpret_cast<const uchar *>(data + total), static_cast<size_t>(len),
+                               header, HeaderSize)) {
+            broken = true;
+            return -1;
+        }
+        total += len;
+        outgoing.bytes += len;
+        if (!rekey(&outgoing)) {
+            broken = true;
+            return -1;
+        }
+        if (writeBuffer.size() >= MaxPendingSize || total == size) {
+            qint32 sent = s->sendall(writeBuffer.constData(), writeBuffer.size());
+            if (sent < writeBuffer.size()) {
+                return -1;
+            }
+            writeBuffer.resize(0);
+        }
+    }
+    if (!writeBuffer.isEmpty()) {  // the salt without any data.
+        if (s->sendall(writeBuffer.constData(), writeBuffer.size()) < writeBuffer.size()) {
+            return -1;
+        }
+    }
+    return size;
+}
+
+
+qint32 AeadSocketLike::readRecord(char *data, qint32 size)
+{
+    if (!incoming.ready) {
+        char salt[SaltSize];
+        if (s->recvall(salt, SaltSize) != SaltSize) {
+            return -1;
+        }
+        if (!setKey(&incoming, deriveAeadKey(masterKey, QByteArray::fromRawData(salt, SaltSize),
+                                             static_cast<int>(EVP_AEAD_key_length(aead))))) {
+            broken = true;
+            return -1;
+        }
+    }
+    uchar header[HeaderSize];
+    if (s->recvall(reinterpret_cast<char *>(header), HeaderSize) != HeaderSize) {
+        return -1;
+    }
+    qint32 len = (header[0] << 8) | header[1];
+    if (len <= 0 || len > MaxRecordSize) {
+        broken = true;
+        return -1;
+    }
+    readBuffer.resize(len + TagSize);
+    if (s->recvall(readBuffer.data(), readBuffer.size()) != readBuffer.size()) {
+        return -1;
+    }
+    uchar nonce[NonceSize];
+    makeNonce(&incoming, nonce);
+    // opens straight into the buffer of caller if it is large enough, or keeps the plain text in readBuffer.
+    uchar *out = size >= len ? reinterpret_cast<uchar *>(data) : reinterpret_cast<uchar *>(readBuffer.data());
+    size_t opened = 0;
+    if (!EVP_AEAD_CTX_open(&incoming.ctx, out, &opened, static_cast<size_t>(len), nonce, NonceSize,
+                           reinterpret_cast<const uchar *>(readBuffer.constData()), static_cast<size_t>(readBuffer.size()),
+                           header, HeaderSize) || opened != static_cast<size_t>(len)) {
+        qDebug() << "the encrypted record is modified.";
+        broken = true;
+        return -1;
+    }
+    incoming.bytes += len;
+    if (!rekey(&incoming)) {
+        broken = true;
+        return -1;
+    }
+    if (size >= len) {
+        return len;
+    }
+    memcpy(data, readBuffer.constData(), static_cast<size_t>(size));
+    readPos = size;
+    readEnd = len;
+    return size;
+}
+
+
+qint32 AeadSocketLike::recv(char *data, qint32 size, bool all)
+{
+    if (broken) {
+        return -1;
+    }
+    qint32 total = 0;
+    while (total < size) {
+        if (readPos < readEnd) {
+            qint32 n = qMin(size - total, readEnd - readPos);
+            memcpy(data + total, readBuffer.constData() + readPos, static_cast<size_t>(n));
+            readPos += n;
+            total += n;
+        } else {
+            qint32 n = readRecord(data + total, size - total);
+            if (n <= 0) {
+                if (broken) {
+                    s->abort();
+                }
+                return total == 0 ? -1 : total;
+            }
+            total += n;
+        }
+        if (!all) {
+            break;
+        }
+    }
+    return total;
+}
+
 }
 
 
@@ -2279,4 +3998,28 @@ QSharedPointer<SocketLike> encrypted(QSharedPointer<Cipher> cipher, QSharedPoint
 }
 
 
+QSharedPointer<SocketLike> encrypted(Cipher::Algorithm algorithm, const QByteArray &key, QSharedPointer<SocketLike> socket,
+                                     qint64 rekeyBytes)
+{
+    const EVP_AEAD *aead;
+    switch (algorithm) {
+    case Cipher::AES128:
+        aead = EVP_aead_aes_128_gcm();
+        break;
+    case Cipher::AES256:
+        aead = EVP_aead_aes_256_gcm();
+        break;
+    case Cipher::ChaCha20Poly1305:
+        aead = EVP_aead_chacha20_poly1305();
+        break;
+    default:
+        return QSharedPointer<SocketLike>();
+    }
+    if (key.isEmpty() || socket.isNull()) {
+        return QSharedPointer<SocketLike>();
+    }
+    return QSharedPointer<SocketLike>(new AeadSocketLike(aead, key, socket, rekeyBytes));
+}
+
+
 QTNETWORKNG_NAMESPACE_END
@@ -1,5 +1,6 @@
 #include <QtTest>
 #include "qtcrypto.h"
+#include "include/hash_service.h"
 
 using namespace qtng;
 
@@ -21,6 +22,10 @@ private slots:
     void testAES256();
     void testBlowfish();
     void testDecrypt();
+    void testInPlaceCipher();
+    void testCipherBatch();
+    void testDigestBatch();
+    void testHashService();
     void testGenRSA();
     void testSignRSA();
     void testCryptoRSA();
@@ -225,6 +230,158 @@ QString first(const QStringList &l) {
     }
 }
 
+void TestCrypto::testInPlaceCipher()
+{
+    const QByteArray &key = randomBytes(32);
+    const QByteArray &iv = randomBytes(16);
+    const QByteArray &plain = randomBytes(1000);
+
+    Cipher expected(Cipher::AES256, Cipher::CBC, Cipher::Encrypt);
+    expected.setKey(key);
+    expected.setInitialVector(iv);
+    QByteArray encrypted = expected.addData(plain);
+    encrypted.append(expected.finalData());
+
+    Cipher c(Cipher::AES256, Cipher::CBC, Cipher::Encrypt);
+    c.setKey(key);
+    c.setInitialVector(iv);
+    QByteArray buf = plain;
+    buf.resize(plain.size() + c.blockSize());
+    int len = c.addData(buf.constData(), plain.size(), buf.data());
+    QVERIFY(len >= 0);
+    int finalLen = c.finalData(buf.data() + len);
+    QVERIFY(finalLen >= 0);
+    buf.resize(len + finalLen);
+    QCOMPARE(buf, encrypted);
+
+    // the context is reused for next message.
+    QVERIFY(c.reset());
+    QByteArray reencrypted = c.addData(plain);
+    reencrypted.append(c.finalData());
+    QCOMPARE(reencrypted, encrypted);
+    const QByteArray &iv2 = randomBytes(16);
+    QVERIFY(c.reset(iv2));
+    QByteArray encrypted2 = c.addData(plain);
+    encrypted2.append(c.finalData());
+    QVERIFY(encrypted2 != encrypted);
+
+    Cipher d(Cipher::AES256, Cipher::CBC, Cipher::Decrypt);
+    d.setKey(key);
+    d.setInitialVector(iv2);
+    QByteArray decrypted = d.addData(encrypted2);
+    decrypted.append(d.finalData());
+    QCOMPARE(decrypted, plain);
+
+    // decrypt in place by unaligned pieces, openssl holds back the last block and the partial blocks.
+    QVERIFY(d.reset(iv2));
+    buf = encrypted2;
+    buf.resize(encrypted2.size() + d.blockSize());
+    int written = 0;
+    for (int pos = 0; pos < encrypted2.size(); pos += 100) {
+        int pieceSize = qMin(100, encrypted2.size() - pos);
+        len = d.addData(buf.constData() + pos, pieceSize, buf.data() + written);
+        QVERIFY(len >= 0);
+        written += len;
+    }
+    finalLen = d.finalData(buf.data() + written);
+    QVERIFY(finalLen >= 0);
+    buf.resize(written + finalLen);
+    QCOMPARE(buf, plain);
+
+    // the same for encryption.
+    QVERIFY(c.reset(iv2));
+    buf = plain;
+    buf.resize(plain.size() + c.blockSize());
+    written = 0;
+    for (int pos = 0; pos < plain.size(); pos += 100) {
+        int pieceSize = qMin(100, plain.size() - pos);
+        len = c.addData(buf.constData() + pos, pieceSize, buf.data() + written);
+        QVERIFY(len >= 0);
+        written += len;
+    }
+    finalLen = c.finalData(buf.data() + written);
+    QVERIFY(finalLen >= 0);
+    buf.resize(written + finalLen);
+    QCOMPARE(buf, encrypted2);
+}
+
+
+void TestCrypto::testCipherBatch()
+{
+    const QByteArray &key = randomBytes(32);
+    const QByteArray &iv = randomBytes(16);
+    QList<QByteArray> messages;
+    QList<QByteArray> ivs;
+    for (int i = 0; i < 10; ++i) {
+        messages.append(randomBytes(i * 7));
+        ivs.append(randomBytes(16));
+    }
+    Cipher c(Cipher::AES128, Cipher::CFB, Cipher::Encrypt);
+    c.setKey(key.left(16));
+    c.setInitialVector(iv);
+    const QList<QByteArray> &encrypted = c.batch(messages, ivs);
+    QCOMPARE(encrypted.size(), messages.size());
+
+    Cipher d(Cipher::AES128, Cipher::CFB, Cipher::Decrypt);
+    d.setKey(key.left(16));
+    d.setInitialVector(iv);
+    QCOMPARE(d.batch(encrypted, ivs), messages);
+}
+
+
+void TestCrypto::testDigestBatch()
+{
+    QList<QByteArray> messages;
+    messages << "123456" << "" << "fish is here.";
+    const QList<QByteArray> &digests = MessageDigest::digest(messages, MessageDigest::Sha256);
+    QCOMPARE(digests.size(), messages.size());
+    for (int i = 0; i < messages.size(); ++i) {
+        QCOMPARE(digests.at(i), MessageDigest::digest(messages.at(i), MessageDigest::Sha256));
+    }
+
+    MessageDigest m(MessageDigest::Sha256);
+    QCOMPARE(m.digestSize(), 32);
+    char out[32];
+    m.addData("123456");
+    QCOMPARE(m.result(out), 32);
+    QCOMPARE(QByteArray(out, 32), digests.at(0));
+    m.reset();
+    m.addData("fish is here.");
+    QCOMPARE(m.result(), digests.at(2));
+}
+
+
+void TestCrypto::testHashService()
+{
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    const QByteArray &data = randomBytes(1024 * 1024 + 1234);
+    f.write(data);
+    f.flush();
+    const QByteArray &key = randomBytes(32);
+
+    HashService service;
+    service.setChunkSize(1024 * 64);
+    QCOMPARE(service.hash(f.fileName(), MessageDigest::Sha256), MessageDigest::digest(data, MessageDigest::Sha256));
+    QCOMPARE(service.hash(f.fileName(), MessageDigest::Sha256, key), hmac(key, data, MessageDigest::Sha256));
+    QCOMPARE(service.hash(FileLike::bytes(data), MessageDigest::Sha1), MessageDigest::digest(data, MessageDigest::Sha1));
+    QCOMPARE(service.hash(FileLike::bytes(data), MessageDigest::Sha1, key), hmac(key, data, MessageDigest::Sha1));
+
+    const QList<QByteArray> &results = service.hash(QStringList() << f.fileName() << f.fileName(), MessageDigest::Md5);
+    QCOMPARE(results.size(), 2);
+    QCOMPARE(results.at(1), MessageDigest::digest(data, MessageDigest::Md5));
+
+    const qint64 leafSize = 1024 * 100;
+    MessageDigest root(MessageDigest::Sha256);
+    root.addData("\x01", 1);
+    for (int offset = 0; offset < data.size(); offset += leafSize) {
+        root.addData(MessageDigest::digest(QByteArray(1, '\x00') + data.mid(offset, leafSize), MessageDigest::Sha256));
+    }
+    QCOMPARE(service.treeHash(f.fileName(), MessageDigest::Sha256, leafSize), root.result());
+    QVERIFY(service.hash(QStringLiteral("/not/exists"), MessageDigest::Sha256).isEmpty());
+}
+
+
 void TestCrypto::testCertificate()
 {
     PrivateKey pkey = PrivateKey::generate(PrivateKey::Rsa, 2048);
@@ -0,0 +1,384 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+class TestDataChannelFlow: public QObject
+{
+    Q_OBJECT
+private slots:
+    void testStalledChannel();
+    void testReceivingWindow();
+    void testCapacity();
+    void testCoalescing();
+    void testFlushDelay();
+    void testLegacyPeer();
+    void testNestedChannels();
+    void testStream();
+};
+
+
+static bool makeChannelPair(QSharedPointer<SocketChannel> *positive, QSharedPointer<SocketChannel> *negative)
+{
+    Socket server;
+    if (!server.bind(QHostAddress::LocalHost, 0) || !server.listen(10)) {
+        return false;
+    }
+    QSharedPointer<Socket> client(new Socket());
+    if (!client->connect(QHostAddress::LocalHost, server.localPort())) {
+        return false;
+    }
+    QSharedPointer<Socket> request(server.accept());
+    if (request.isNull()) {
+        return false;
+    }
+    positive->reset(new SocketChannel(client, PositivePole));
+    negative->reset(new SocketChannel(request, NegativePole));
+    return true;
+}
+
+
+// counts the writes to the socket.
+class CountingSocket: public SocketLike
+{
+public:
+    CountingSocket(QSharedPointer<SocketLike> backend)
+        : writes(0), backend(backend) {}
+    virtual Socket::SocketError error() const override { return backend->error(); }
+    virtual QString errorString() const override { return backend->errorString(); }
+    virtual bool isValid() const override { return backend->isValid(); }
+    virtual QHostAddress localAddress() const override { return backend->localAddress(); }
+    virtual quint16 localPort() const override { return backend->localPort(); }
+    virtual QHostAddress peerAddress() const override { return backend->peerAddress(); }
+    virtual QString peerName() const override { return backend->peerName(); }
+    virtual quint16 peerPort() const override { return backend->peerPort(); }
+    virtual qintptr fileno() const override { return backend->fileno(); }
+    virtual Socket::SocketType type() const override { return backend->type(); }
+    virtual Socket::SocketState state() const override { return backend->state(); }
+    virtual Socket::NetworkLayerProtocol protocol() const override { return backend->protocol(); }
+    virtual QSharedPointer<SocketLike> accept() override { return QSharedPointer<SocketLike>(); }
+    virtual Socket *acceptRaw() override { return nullptr; }
+    virtual bool bind(QHostAddress &, quint16, Socket::BindMode) override { return false; }
+    virtual bool bind(quint16, Socket::BindMode) override { return false; }
+    virtual bool connect(const QHostAddress &, quint16) override { return false; }
+    virtual bool connect(const QString &, quint16, Socket::NetworkLayerProtocol) override { return false; }
+    virtual void close() override { backend->close(); }
+    virtual void abort() override { backend->abort(); }
+    virtual bool listen(int) override { return false; }
+    virtual bool setOption(Socket::SocketOption option, const QVariant &value) override { return backend->setOption(option, value); }
+    virtual QVariant option(Socket::SocketOption option) const override { return backend->option(option); }
+    virtual qint32 recv(char *data, qint32 size) override { return backend->recv(data, size); }
+    virtual qint32 recvall(char *data, qint32 size) override { return backend->recvall(data, size); }
+    virtual qint32 send(const char *data, qint32 size) override { ++writes; return backend->send(data, size); }
+    virtual qint32 sendall(const char *data, qint32 size) override { ++writes; return backend->sendall(data, size); }
+    virtual QByteArray recv(qint32 size) override { return backend->recv(size); }
+    virtual QByteArray recvall(qint32 size) override { return backend->recvall(size); }
+    virtual qint32 send(const QByteArray &data) override { ++writes; return backend->send(data); }
+    virtual qint32 sendall(const QByteArray &data) override { ++writes; return backend->sendall(data); }
+public:
+    int writes;
+private:
+    QSharedPointer<SocketLike> backend;
+};
+
+
+static bool makeCountingPair(QSharedPointer<CountingSocket> *counting, QSharedPointer<SocketChannel> *positive,
+                             QSharedPointer<SocketChannel> *negative)
+{
+    Socket server;
+    if (!server.bind(QHostAddress::LocalHost, 0) || !server.listen(10)) {
+        return false;
+    }
+    QSharedPointer<Socket> client(new Socket());
+    if (!client->connect(QHostAddress::LocalHost, server.localPort())) {
+        return false;
+    }
+    QSharedPointer<Socket> request(server.accept());
+    if (request.isNull()) {
+        return false;
+    }
+    counting->reset(new CountingSocket(asSocketLike(client)));
+    positive->reset(new SocketChannel(counting->dynamicCast<SocketLike>(), PositivePole));
+    negative->reset(new SocketChannel(request, NegativePole));
+    // the hello packet is sent.
+    Coroutine::msleep(50);
+    return true;
+}
+
+
+// a bulk channel whose reader is stalled must not block the request/response of another channel.
+void TestDataChannelFlow::testStalledChannel()
+{
+    QSharedPointer<SocketChannel> positive, negative;
+    QVERIFY(makeChannelPair(&positive, &negative));
+    QSharedPointer<VirtualChannel> bulk = positive->makeChannel();
+    QSharedPointer<VirtualChannel> rpc = positive->makeChannel();
+    QVERIFY(!bulk.isNull() && !rpc.isNull());
+    QSharedPointer<VirtualChannel> bulkPeer = negative->takeChannel();
+    QSharedPointer<VirtualChannel> rpcPeer = negative->takeChannel();
+    QVERIFY(!bulkPeer.isNull() && !rpcPeer.isNull());
+    bulkPeer->setReceivingWindow(1024 * 64);
+    rpc->setPriority(8);
+
+    const QByteArray chunk(1024 * 16, 'x');
+    const int chunkCount = 256;
+    int sentChunks = 0;
+    CoroutineGroup operations;
+    QSharedPointer<Coroutine> sending = operations.spawn([bulk, chunk, chunkCount, &sentChunks] {
+        for (int i = 0; i < chunkCount; ++i) {
+            if (!bulk->sendPacket(chunk)) {
+                return;
+            }
+            ++sentChunks;
+        }
+    });
+    operations.spawn([rpcPeer] {
+        while (true) {
+            const QByteArray &request = rpcPeer->recvPacket();
+            if (request.isEmpty() || !rpcPeer->sendPacket(request)) {
+                return;
+            }
+        }
+    });
+
+    {
+        Timeout timeout(5.0);
+        for (int i = 0; i < 100; ++i) {
+            const QByteArray request = QByteArray::number(i);
+            QVERIFY(rpc->sendPacket(request));
+            QCOMPARE(rpc->recvPacket(), request);
+        }
+    }
+    // the sender is stopped by the window of peer, which is the default one before any update.
+    QVERIFY(sentChunks < chunkCount);
+    QVERIFY(sentChunks <= 1024 * 1024 / chunk.size() + 1);
+
+    // the credit is returned as the packets are read.
+    {
+        Timeout timeout(5.0);
+        for (int i = 0; i < chunkCount; ++i) {
+            QCOMPARE(bulkPeer->recvPacket().size(), chunk.size());
+        }
+        sending->join();
+    }
+    QCOMPARE(sentChunks, chunkCount);
+    operations.killall();
+}
+
+
+void TestDataChannelFlow::testReceivingWindow()
+{
+    QSharedPointer<SocketChannel> positive, negative;
+    QVERIFY(makeChannelPair(&positive, &negative));
+    QCOMPARE(negative->receivingWindow(), static_cast<quint32>(1024 * 1024));
+    negative->setReceivingWindow(1024 * 8);
+    negative->setReceivingWindow(1024 * 1024 * 4);
+    QCOMPARE(negative->receivingWindow(), static_cast<quint32>(1024 * 1024 * 4));
+    QCOMPARE(positive->priority(), 1);
+    positive->setPriority(100);
+    QCOMPARE(positive->priority(), 64);
+
+    const QByteArray packet(1024 * 60, 'y');
+    int sent = 0;
+    CoroutineGroup operations;
+    QSharedPointer<Coroutine> sending = operations.spawn([positive, packet, &sent] {
+        for (int i = 0; i < 100; ++i) {
+            if (!positive->sendPacket(packet)) {
+                return;
+            }
+            ++sent;
+        }
+    });
+    Timeout timeout(5.0);
+    for (int i = 0; i < 100; ++i) {
+        QCOMPARE(negative->recvPacket(), packet);
+    }
+    sending->join();
+    QCOMPARE(sent, 100);
+    operations.killall();
+}
+
+// the peer is asked to slow down if too many small packets are not read, which are far from the window.
+void TestDataChannelFlow::testCapacity()
+{
+    QSharedPointer<SocketChannel> positive, negative;
+    QVERIFY(makeChannelPair(&positive, &negative));
+    negative->setCapacity(16);
+    int sent = 0;
+    CoroutineGroup operations;
+    QSharedPointer<Coroutine> sending = operations.spawn([positive, &sent] {
+        for (int i = 0; i < 1000; ++i) {
+            if (!positive->sendPacket(QByteArray::number(i))) {
+                return;
+            }
+            ++sent;
+        }
+    });
+    Coroutine::msleep(200);
+    QVERIFY(sent < 1000);
+    Timeout timeout(5.0);
+    for (int i = 0; i < 1000; ++i) {
+        QCOMPARE(negative->recvPacket(), QByteArray::number(i));
+    }
+    sending->join();
+    QCOMPARE(sent, 1000);
+}
+
+
+// the packets queued together are framed into one write.
+void TestDataChannelFlow::testCoalescing()
+{
+    QSharedPointer<CountingSocket> counting;
+    QSharedPointer<SocketChannel> positive, negative;
+    QVERIFY(makeCountingPair(&counting, &positive, &negative));
+    const int writes = counting->writes;
+    for (int i = 0; i < 50; ++i) {
+        QVERIFY(positive->sendPacketAsync(QByteArray::number(i)));
+    }
+    Timeout timeout(5.0);
+    for (int i = 0; i < 50; ++i) {
+        QCOMPARE(negative->recvPacket(), QByteArray::number(i));
+    }
+    QCOMPARE(counting->writes - writes, 1);
+}
+
+
+// a small batch waits for the packets queued a little later.
+void TestDataChannelFlow::testFlushDelay()
+{
+    QSharedPointer<CountingSocket> counting;
+    QSharedPointer<SocketChannel> positive, negative;
+    QVERIFY(makeCountingPair(&counting, &positive, &negative));
+    QCOMPARE(positive->flushDelay(), 0);
+    positive->setFlushDelay(100);
+    QCOMPARE(positive->flushDelay(), 100);
+    const int writes = counting->writes;
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(positive->sendPacketAsync("first"));
+    Coroutine::msleep(20);
+    QVERIFY(positive->sendPacketAsync("second"));
+    Timeout timeout(5.0);
+    QCOMPARE(negative->recvPacket(), QByteArray("first"));
+    QVERIFY(timer.elapsed() >= 80);
+    QCOMPARE(negative->recvPacket(), QByteArray("second"));
+    QCOMPARE(counting->writes - writes, 1);
+}
+
+
+// the old versions neither send the hello packet nor return the credit.
+void TestDataChannelFlow::testLegacyPeer()
+{
+    Socket server;
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(10));
+    QSharedPointer<Socket> client(new Socket());
+    QVERIFY(client->connect(QHostAddress::LocalHost, server.localPort()));
+    QSharedPointer<Socket> peer(server.accept());
+    QVERIFY(!peer.isNull());
+    // a keepalive packet: size(4) + channel number(4) + KEEPALIVE_REQUEST(1)
+    QVERIFY(peer->sendall(QByteArray("\x00\x00\x00\x01\x00\x00\x00\x00\x06", 9)) == 9);
+    SocketChannel channel(client, PositivePole);
+
+    const QByteArray packet(1024 * 60, 'z');
+    const int packetCount = 64;  // larger than the default window.
+    int sent = 0;
+    CoroutineGroup operations;
+    QSharedPointer<Coroutine> sending = operations.spawn([&channel, packet, &sent] {
+        for (int i = 0; i < packetCount; ++i) {
+            if (!channel.sendPacket(packet)) {
+                return;
+            }
+            ++sent;
+        }
+    });
+    Timeout timeout(5.0);
+    qint64 received = 0;
+    const qint64 expected = (8 + packet.size()) * packetCount;
+    QByteArray buf(1024 * 64, Qt::Uninitialized);
+    while (received < expected) {
+        qint32 len = peer->recv(buf.data(), buf.size());
+        QVERIFY(len > 0);
+        received += len;
+    }
+    sending->join();
+    QCOMPARE(sent, packetCount);
+    QVERIFY(!channel.isBroken());
+}
+
+
+// the headers of every level are prepended into the headroom of packet, and skipped by the receiver.
+void TestDataChannelFlow::testNestedChannels()
+{
+    QSharedPointer<SocketChannel> positive, negative;
+    QVERIFY(makeChannelPair(&positive, &negative));
+    QSharedPointer<DataChannel> sender = positive;
+    QSharedPointer<DataChannel> receiver = negative;
+    for (int level = 0; level < 3; ++level) {
+        sender = sender->makeChannel();
+        QVERIFY(!sender.isNull());
+        receiver = receiver->takeChannel();
+        QVERIFY(!receiver.isNull());
+    }
+    QCOMPARE(sender->maxPacketSize(), static_cast<quint32>(positive->maxPacketSize() - 3 * sizeof(quint32)));
+
+    Timeout timeout(5.0);
+    for (int i = 0; i < 100; ++i) {
+        const QByteArray packet = randomBytes(1 + i * 97);
+        QVERIFY(sender->sendPacket(packet));
+        QCOMPARE(receiver->recvPacket(), packet);
+    }
+    QVERIFY(receiver->sendPacketAsync("pong"));
+    QCOMPARE(sender->recvPacket(), QByteArray("pong"));
+}
+
+// a large stream is read while it is being received, and does not block the small packets of the same channel.
+void TestDataChannelFlow::testStream()
+{
+    QSharedPointer<SocketChannel> positive, negative;
+    QVERIFY(makeChannelPair(&positive, &negative));
+    const QByteArray data = randomBytes(1024 * 1024 * 8 + 7);
+    bool sent = false;
+    CoroutineGroup operations;
+    operations.spawn([positive, data, &sent] {
+        sent = positive->sendStream(data);
+    });
+    operations.spawn([positive] {
+        for (int i = 0; i < 100; ++i) {
+            if (!positive->sendPacket(QByteArray::number(i))) {
+                return;
+            }
+        }
+    });
+
+    Timeout timeout(10.0);
+    QSharedPointer<FileLike> stream = negative->takeStream();
+    QVERIFY(!stream.isNull());
+    QCOMPARE(stream->size(), static_cast<qint64>(data.size()));
+    // the small packets go through while the stream is not read.
+    for (int i = 0; i < 100; ++i) {
+        QCOMPARE(negative->recvPacket(), QByteArray::number(i));
+    }
+    QVERIFY(!sent);
+    bool ok = false;
+    QCOMPARE(stream->readall(&ok), data);
+    QVERIFY(ok);
+    operations.joinall();
+    QVERIFY(sent);
+
+    // the sender fails if the receiver closes the stream.
+    operations.spawn([positive, data, &sent] {
+        sent = positive->sendStream(data);
+    });
+    stream = negative->takeStream();
+    QVERIFY(!stream.isNull());
+    char buf[1024];
+    QCOMPARE(stream->read(buf, sizeof(buf)), static_cast<qint32>(sizeof(buf)));
+    stream->close();
+    operations.joinall();
+    QVERIFY(!sent);
+    QVERIFY(!positive->isBroken());
+}
+
+QTEST_MAIN(TestDataChannelFlow)
+#include "test_data_channel_flow.moc"
@@ -0,0 +1,274 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+class TestHttpBody: public QObject
+{
+    Q_OBJECT
+private slots:
+    void testContentLength();
+    void testUntilClosed();
+    void testChunked();
+    void testChunkedSaveTo();
+    void testGzip();
+    void testTruncated();
+};
+
+
+// serves one connection with the canned response, and returns the url.
+static QString serve(CoroutineGroup *operations, const QByteArray &response)
+{
+    QSharedPointer<Socket> server(new Socket());
+    if (!server->bind(QHostAddress::LocalHost, 0) || !server->listen(10)) {
+        return QString();
+    }
+    operations->spawn([server, response] {
+        QSharedPointer<Socket> request(server->accept());
+        if (request.isNull()) {
+            return;
+        }
+        QByteArray header;
+        while (!header.contains("\r\n\r\n")) {
+            const QByteArray &t = request->recv(1024);
+            if (t.isEmpty()) {
+                return;
+            }
+            header.append(t);
+        }
+        request->sendall(response);
+        request->close();
+    });
+    return QStringLiteral("http://127.0.0.1:%1/").arg(server->localPort());
+}
+
+
+static HttpResponse get(const QString &url, bool streamResponse)
+{
+    HttpSession session;
+    HttpRequest request;
+    request.setUrl(url);
+    request.setStreamResponse(streamResponse);
+    return session.send(request);
+}
+
+
+static QByteArray chunked(const QByteArray &body, int chunkSize, const QByteArray &extension = QByteArray())
+{
+    QByteArray result;
+    for (int pos = 0; pos < body.size(); pos += chunkSize) {
+        const QByteArray &chunk = body.mid(pos, chunkSize);
+        result.append(QByteArray::number(chunk.size(), 16));
+        result.append(extension);
+        result.append("\r\n");
+        result.append(chunk);
+        result.append("\r\n");
+    }
+    result.append("0\r\n");
+    return result;
+}
+
+
+void TestHttpBody::testContentLength()
+{
+    CoroutineGroup operations;
+    const QString &url = serve(&operations, "HTTP/1.1 200 OK\r\nContent-Length: 13\r\nConnection: close\r\n\r\n"
+                                            "fish is here.");
+    QVERIFY(!url.isEmpty());
+    Timeout _(5.0);
+    HttpResponse response = get(url, true);
+    QVERIFY(response.isOk());
+    QCOMPARE(response.readChunk(4), QByteArray("fish"));
+    char buf[64];
+    QCOMPARE(response.readInto(buf, sizeof(buf)), 9);
+    QCOMPARE(QByteArray(buf, 9), QByteArray(" is here."));
+    QCOMPARE(response.readInto(buf, sizeof(buf)), 0);
+    QVERIFY(response.readChunk().isEmpty());
+    QVERIFY(response.isOk());
+}
+
+
+void TestHttpBody::testUntilClosed()
+{
+    CoroutineGroup operations;
+    const QByteArray &body = randomBytes(1024 * 100);
+    const QString &url = serve(&operations, "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n" + body);
+    QVERIFY(!url.isEmpty());
+    Timeout _(5.0);
+    HttpResponse response = get(url, false);
+    QVERIFY(response.isOk());
+    QCOMPARE(response.body(), body);
+}
+
+
+void TestHttpBody::testChunked()
+{
+    CoroutineGroup operations;
+    QByteArray raw = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+    raw.append("5;name=value\r\nhello\r\n");
+    raw.append("7; name=\"quoted\"\r\n, world\r\n");
+    raw.append("0\r\nX-Checksum: 1234\r\nX-Other: fish\r\n\r\n");
+    const QString &url = serve(&operations, raw);
+    QVERIFY(!url.isEmpty());
+    Timeout _(5.0);
+    HttpResponse response = get(url, false);
+    QVERIFY(response.isOk());
+    QCOMPARE(response.body(), QByteArray("hello, world"));
+}
+
+
+void TestHttpBody::testChunkedSaveTo()
+{
+    CoroutineGroup operations;
+    const QByteArray &body = randomBytes(1024 * 200 + 17);
+    QByteArray raw = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+    raw.append(chunked(body, 1000, ";ext"));
+    raw.append("\r\n");
+    const QString &url = serve(&operations, raw);
+    QVERIFY(!url.isEmpty());
+    Timeout _(5.0);
+    HttpResponse response = get(url, true);
+    QVERIFY(response.isOk());
+    QSharedPointer<BytesIO> file(new BytesIO());
+    QVERIFY(response.saveTo(file));
+    QCOMPARE(file->data(), body);
+    QVERIFY(response.isOk());
+}
+
+
+#ifdef QTNG_HAVE_ZLIB
+static quint32 crc32(const QByteArray &data)
+{
+    quint32 crc = 0xffffffff;
+    for (int i = 0; i < data.size(); ++i) {
+        crc ^= static_cast<uchar>(data.at(i));
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+
+// qCompress() makes a zlib stream after four bytes of length. wrap its deflate data as gzip.
+static QByteArray gzipped(const QByteArray &data)
+{
+    const QByteArray &zlib = qCompress(data).mid(4);
+    QByteArray result("\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\x03", 10);
+    result.append(zlib.mid(2, zlib.size() - 6));
+    QByteArray trailer(8, Qt::Uninitialized);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    qToLittleEndian<quint32>(crc32(data), trailer.data());
+    qToLittleEndian<quint32>(static_cast<quint32>(data.size()), trailer.data() + 4);
+#else
+    qToLittleEndian<quint32>(crc32(data), reinterpret_cast<uchar*>(trailer.data()));
+    qToLittleEndian<quint32>(static_cast<quint32>(data.size()), reinterpret_cast<uchar*>(trailer.data() + 4));
+#endif
+    result.append(trailer);
+    return result;
+}
+#endif
+
+
+void TestHttpBody::testGzip()
+{
+#ifdef QTNG_HAVE_ZLIB
+    const QByteArray &body = QByteArray("fish is here. ").repeated(1024 * 10);
+    const QByteArray &compressed = gzipped(body);
+    QVERIFY(compressed.size() < body.size());
+    Timeout _(5.0);
+    {
+        CoroutineGroup operations;
+        QByteArray raw = "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nConnection: close\r\nContent-Length: ";
+        raw.append(QByteArray::number(compressed.size()));
+        raw.append("\r\n\r\n");
+        raw.append(compressed);
+        const QString &url = serve(&operations, raw);
+        QVERIFY(!url.isEmpty());
+        HttpResponse response = get(url, false);
+        QVERIFY(response.isOk());
+        QCOMPARE(response.body(), body);
+    }
+    {
+        CoroutineGroup operations;
+        QByteArray raw = "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+        raw.append(chunked(compressed, 100));
+        raw.append("\r\n");
+        const QString &url = serve(&operations, raw);
+        QVERIFY(!url.isEmpty());
+        HttpResponse response = get(url, true);
+        QVERIFY(response.isOk());
+        QByteArray decoded;
+        while (true) {
+            const QByteArray &chunk = response.readChunk(1000);
+            if (chunk.isEmpty()) {
+                break;
+            }
+            decoded.append(chunk);
+        }
+        QVERIFY(response.isOk());
+        QCOMPARE(decoded, body);
+    }
+    {
+        // the compressed stream is cut, but the content length is right.
+        CoroutineGroup operations;
+        const QByteArray &cut = compressed.left(compressed.size() / 2);
+        QByteArray raw = "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nConnection: close\r\nContent-Length: ";
+        raw.append(QByteArray::number(cut.size()));
+        raw.append("\r\n\r\n");
+        raw.append(cut);
+        const QString &url = serve(&operations, raw);
+        QVERIFY(!url.isEmpty());
+        HttpResponse response = get(url, false);
+        QVERIFY(!response.isOk());
+    }
+#else
+    QSKIP("built without zlib.");
+#endif
+}
+
+
+void TestHttpBody::testTruncated()
+{
+    Timeout _(5.0);
+    {
+        CoroutineGroup operations;
+        const QString &url = serve(&operations, "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\nfish is here.");
+        QVERIFY(!url.isEmpty());
+        HttpResponse response = get(url, false);
+        QVERIFY(!response.isOk());
+        QVERIFY(response.hasNetworkError());
+    }
+    {
+        CoroutineGroup operations;
+        const QString &url = serve(&operations, "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\nfish is here.");
+        QVERIFY(!url.isEmpty());
+        HttpResponse response = get(url, true);
+        QVERIFY(response.isOk());
+        QSharedPointer<BytesIO> file(new BytesIO());
+        QVERIFY(!response.saveTo(file));
+        QCOMPARE(file->data(), QByteArray("fish is here."));
+        QVERIFY(response.hasNetworkError());
+    }
+    {
+        // the last chunk is missing.
+        CoroutineGroup operations;
+        const QString &url = serve(&operations, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                                "5\r\nhello\r\n7\r\n, wo");
+        QVERIFY(!url.isEmpty());
+        HttpResponse response = get(url, false);
+        QVERIFY(!response.isOk());
+    }
+    {
+        CoroutineGroup operations;
+        const QString &url = serve(&operations, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                                "zz\r\nhello\r\n0\r\n\r\n");
+        QVERIFY(!url.isEmpty());
+        HttpResponse response = get(url, false);
+        QVERIFY(!response.isOk());
+    }
+}
+
+
+QTEST_MAIN(TestHttpBody)
+#include "test_http_body.moc"
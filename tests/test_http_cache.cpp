@@ -0,0 +1,319 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+class TestHttpCache: public QObject
+{
+    Q_OBJECT
+private slots:
+    void testDiskStoreAndLoad();
+    void testDiskRestart();
+    void testDiskEviction();
+    void testDiskConcurrentWriters();
+    void testMemoryLruBound();
+    void testMemoryVary();
+    void testFreshness();
+    void testRevalidation();
+};
+
+
+static HttpResponse makeResponse(const QString &url, const QByteArray &body)
+{
+    HttpRequest request;
+    request.setUrl(url);
+    HttpResponse response;
+    response.setUrl(url);
+    response.setRequest(request);
+    response.setStatusCode(200);
+    response.setStatusText(QStringLiteral("OK"));
+    response.addHeader(QStringLiteral("Cache-Control"), "max-age=3600");
+    response.setBody(body);
+    return response;
+}
+
+
+static bool loadResponse(HttpCacheManager *cache, const QString &url, QByteArray *body)
+{
+    HttpRequest request;
+    request.setUrl(url);
+    HttpResponse response;
+    response.setUrl(url);
+    response.setRequest(request);
+    if (!cache->getResponse(&response)) {
+        return false;
+    }
+    *body = response.body();
+    return true;
+}
+
+
+void TestHttpCache::testDiskStoreAndLoad()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    HttpDiskCacheManager cache(dir.path());
+    const QByteArray &small = randomBytes(1024);
+    const QByteArray &large = randomBytes(1024 * 1024);  // streamed from disk.
+    QVERIFY(cache.addResponse(makeResponse("http://example.com/small", small)));
+    QVERIFY(cache.addResponse(makeResponse("http://example.com/large", large)));
+    QVERIFY(cache.cacheSize() >= small.size() + large.size());
+
+    QByteArray body;
+    QVERIFY(loadResponse(&cache, "http://example.com/small", &body));
+    QCOMPARE(body, small);
+    QVERIFY(loadResponse(&cache, "http://example.com/large", &body));
+    QCOMPARE(body, large);
+    QVERIFY(!loadResponse(&cache, "http://example.com/missing", &body));
+
+    cache.clear();
+    QCOMPARE(cache.cacheSize(), static_cast<qint64>(0));
+    QVERIFY(!loadResponse(&cache, "http://example.com/small", &body));
+}
+
+
+void TestHttpCache::testDiskRestart()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QByteArray &body = randomBytes(1024);
+    {
+        HttpDiskCacheManager cache(dir.path());
+        QVERIFY(cache.addResponse(makeResponse("http://example.com/", body)));
+    }
+
+    // the files not named by the cache are kept, and so are the temporary files of other writers.
+    const QString &foreign = dir.path() + QStringLiteral("/notes.txt");
+    const QString &foreignShard = dir.path() + QStringLiteral("/ab/notes.txt");
+    const QString &temporary = dir.path() + QStringLiteral("/ab/cd/abcd") + QString(60, QLatin1Char('0'))
+            + QStringLiteral(".body.a1b2c3");
+    QVERIFY(QDir().mkpath(dir.path() + QStringLiteral("/ab/cd")));
+    for (const QString &path: QStringList() << foreign << foreignShard << temporary) {
+        QFile f(path);
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write("fish");
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    const QString &stale = dir.path() + QStringLiteral("/ab/cd/abcd") + QString(60, QLatin1Char('1'))
+            + QStringLiteral(".meta.d4e5f6");
+    {
+        QFile f(stale);
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write("fish");
+        QVERIFY(f.setFileTime(QDateTime::currentDateTime().addDays(-1), QFileDevice::FileModificationTime));
+    }
+#endif
+
+    HttpDiskCacheManager cache(dir.path());
+    QByteArray loaded;
+    QVERIFY(loadResponse(&cache, "http://example.com/", &loaded));
+    QCOMPARE(loaded, body);
+    QVERIFY(cache.cacheSize() >= body.size());
+    QVERIFY(QFile::exists(foreign));
+    QVERIFY(QFile::exists(foreignShard));
+    QVERIFY(QFile::exists(temporary));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    QVERIFY(!QFile::exists(stale));
+#endif
+}
+
+
+void TestHttpCache::testDiskEviction()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    HttpDiskCacheManager cache(dir.path());
+    cache.setMaxCacheSize(1024 * 20);
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(cache.addResponse(makeResponse(QStringLiteral("http://example.com/%1").arg(i), randomBytes(1024 * 4))));
+        Coroutine::msleep(5);  // make the entries used at different times.
+    }
+    QVERIFY(cache.cacheSize() <= cache.maxCacheSize());
+    QByteArray body;
+    QVERIFY(!loadResponse(&cache, "http://example.com/0", &body));
+    QVERIFY(loadResponse(&cache, "http://example.com/9", &body));
+
+    // the index is rebuilt from the files left.
+    HttpDiskCacheManager restarted(dir.path());
+    QVERIFY(!loadResponse(&restarted, "http://example.com/0", &body));
+    QVERIFY(loadResponse(&restarted, "http://example.com/9", &body));
+    QVERIFY(restarted.cacheSize() <= cache.maxCacheSize());
+}
+
+
+// two managers share the directory, the readers see one of the responses but never a mixed one.
+void TestHttpCache::testDiskConcurrentWriters()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    HttpDiskCacheManager first(dir.path());
+    HttpDiskCacheManager second(dir.path());
+    const QByteArray &alpha = QByteArray(1024 * 300, 'a');
+    const QByteArray &beta = QByteArray(1024 * 300, 'b');
+    CoroutineGroup operations;
+    QSharedPointer<int> failures(new int(0));
+    for (int i = 0; i < 10; ++i) {
+        operations.spawn([&first, alpha, failures] {
+            if (!first.addResponse(makeResponse("http://example.com/", alpha))) {
+                ++(*failures);
+            }
+        });
+        operations.spawn([&second, beta, failures] {
+            if (!second.addResponse(makeResponse("http://example.com/", beta))) {
+                ++(*failures);
+            }
+        });
+    }
+    operations.joinall();
+    QCOMPARE(*failures, 0);
+
+    HttpDiskCacheManager reader(dir.path());
+    QByteArray body;
+    QVERIFY(loadResponse(&reader, "http://example.com/", &body));
+    QVERIFY(body == alpha || body == beta);
+}
+
+
+void TestHttpCache::testMemoryLruBound()
+{
+    HttpMemoryCacheManager cache;
+    cache.setMaxCacheSize(1024 * 10);
+    QVERIFY(cache.addResponse(makeResponse("http://example.com/0", randomBytes(1024 * 3))));
+    QVERIFY(cache.addResponse(makeResponse("http://example.com/1", randomBytes(1024 * 3))));
+    QVERIFY(cache.addResponse(makeResponse("http://example.com/2", randomBytes(1024 * 3))));
+    QByteArray body;
+    QVERIFY(loadResponse(&cache, "http://example.com/0", &body));  // the first one is used recently now.
+    QVERIFY(cache.addResponse(makeResponse("http://example.com/3", randomBytes(1024 * 3))));
+    QVERIFY(cache.cacheSize() <= cache.maxCacheSize());
+    QVERIFY(loadResponse(&cache, "http://example.com/0", &body));
+    QVERIFY(!loadResponse(&cache, "http://example.com/1", &body));
+    QVERIFY(loadResponse(&cache, "http://example.com/3", &body));
+
+    // a response larger than the limit is not cached.
+    QVERIFY(!cache.addResponse(makeResponse("http://example.com/large", randomBytes(1024 * 20))));
+    cache.clear();
+    QCOMPARE(cache.cacheSize(), 0);
+}
+
+
+void TestHttpCache::testMemoryVary()
+{
+    HttpRequest english;
+    english.setUrl(QStringLiteral("http://example.com/"));
+    english.addHeader(QStringLiteral("Accept-Language"), "en");
+    HttpResponse response = makeResponse("http://example.com/", "hello");
+    response.addHeader(QStringLiteral("Vary"), "Accept-Language");
+    response.setRequest(english);
+
+    HttpMemoryCacheManager cache;
+    QVERIFY(cache.addResponse(response));
+
+    HttpResponse cached;
+    cached.setUrl(QStringLiteral("http://example.com/"));
+    cached.setRequest(english);
+    QVERIFY(cache.getResponse(&cached));
+    QCOMPARE(cached.body(), QByteArray("hello"));
+
+    HttpRequest french;
+    french.setUrl(QStringLiteral("http://example.com/"));
+    french.addHeader(QStringLiteral("Accept-Language"), "fr");
+    HttpResponse missed;
+    missed.setUrl(QStringLiteral("http://example.com/"));
+    missed.setRequest(french);
+    QVERIFY(!cache.getResponse(&missed));
+}
+
+
+void TestHttpCache::testFreshness()
+{
+    const QDateTime &now = QDateTime::currentDateTimeUtc();
+    HttpResponse response = makeResponse("http://example.com/", "hello");
+    response.setHeader(QStringLiteral("Date"), HttpResponse::toHttpDate(now));
+    QVERIFY(HttpCacheManager::isFresh(response));
+
+    response.setHeader(QStringLiteral("Age"), "7200");
+    QVERIFY(!HttpCacheManager::isFresh(response));
+
+    HttpResponse expires = makeResponse("http://example.com/", "hello");
+    expires.removeHeader(QStringLiteral("Cache-Control"));
+    expires.setHeader(QStringLiteral("Date"), HttpResponse::toHttpDate(now));
+    expires.setHeader(QStringLiteral("Expires"), HttpResponse::toHttpDate(now.addSecs(60)));
+    QCOMPARE(HttpCacheManager::freshnessLifetime(expires), static_cast<qint64>(60));
+    QVERIFY(HttpCacheManager::isFresh(expires));
+    expires.setHeader(QStringLiteral("Expires"), HttpResponse::toHttpDate(now.addSecs(-60)));
+    QVERIFY(!HttpCacheManager::isFresh(expires));
+
+    HttpResponse noCache = makeResponse("http://example.com/", "hello");
+    noCache.setHeader(QStringLiteral("Cache-Control"), "no-cache, max-age=3600");
+    noCache.setHeader(QStringLiteral("Date"), HttpResponse::toHttpDate(now));
+    QVERIFY(!HttpCacheManager::isFresh(noCache));
+}
+
+
+// serves the canned responses one per connection, and keeps the request headers.
+static QString serve(CoroutineGroup *operations, const QList<QByteArray> &responses, QSharedPointer<QList<QByteArray>> requests)
+{
+    QSharedPointer<Socket> server(new Socket());
+    if (!server->bind(QHostAddress::LocalHost, 0) || !server->listen(10)) {
+        return QString();
+    }
+    operations->spawn([server, responses, requests] {
+        for (const QByteArray &response: responses) {
+            QSharedPointer<Socket> request(server->accept());
+            if (request.isNull()) {
+                return;
+            }
+            QByteArray header;
+            while (!header.contains("\r\n\r\n")) {
+                const QByteArray &t = request->recv(1024);
+                if (t.isEmpty()) {
+                    return;
+                }
+                header.append(t);
+            }
+            requests->append(header);
+            request->sendall(response);
+            request->close();
+        }
+    });
+    return QStringLiteral("http://127.0.0.1:%1/").arg(server->localPort());
+}
+
+
+void TestHttpCache::testRevalidation()
+{
+    QList<QByteArray> responses;
+    responses.append("HTTP/1.1 200 OK\r\nCache-Control: max-age=0\r\nETag: \"v1\"\r\n"
+                     "Content-Length: 5\r\nConnection: close\r\n\r\nhello");
+    responses.append("HTTP/1.1 304 Not Modified\r\nCache-Control: max-age=3600\r\nETag: \"v1\"\r\n"
+                     "Connection: close\r\n\r\n");
+    QSharedPointer<QList<QByteArray>> requests(new QList<QByteArray>());
+    CoroutineGroup operations;
+    const QString &url = serve(&operations, responses, requests);
+    QVERIFY(!url.isEmpty());
+
+    Timeout _(5.0);
+    HttpSession session;
+    session.setCacheManager(QSharedPointer<HttpMemoryCacheManager>::create());
+    HttpResponse first = session.get(url);
+    QVERIFY(first.isOk());
+    QCOMPARE(first.body(), QByteArray("hello"));
+
+    // the stale response is revalidated, and the 304 answer turns into the cached response.
+    HttpResponse second = session.get(url);
+    QVERIFY(second.isOk());
+    QCOMPARE(second.statusCode(), 200);
+    QCOMPARE(second.body(), QByteArray("hello"));
+    QCOMPARE(requests->size(), 2);
+    QVERIFY(requests->at(1).contains("If-None-Match: \"v1\""));
+
+    // it is fresh now, so the server is not asked again.
+    HttpResponse third = session.get(url);
+    QVERIFY(third.isOk());
+    QCOMPARE(third.body(), QByteArray("hello"));
+    QCOMPARE(requests->size(), 2);
+}
+
+
+QTEST_MAIN(TestHttpCache)
+#include "test_http_cache.moc"
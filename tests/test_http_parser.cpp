@@ -0,0 +1,173 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+
+using namespace qtng;
+
+class TestHttpParser: public QObject
+{
+    Q_OBJECT
+private slots:
+    void testResponse();
+    void testRequest();
+    void testIncremental();
+    void testInvalidHeader();
+    void testTooManyHeaders();
+    void testKnownHeaders();
+    void benchmarkHeaderSplitter();
+    void benchmarkHttpHeaderParser();
+};
+
+
+static const QByteArray sampleResponse =
+        "HTTP/1.1 200 OK\r\n"
+        "Server: nginx/1.18.0\r\n"
+        "Date: Mon, 19 Oct 2020 08:00:00 GMT\r\n"
+        "Content-Type: text/html; charset=utf-8\r\n"
+        "Content-Length: 5\r\n"
+        "Connection: keep-alive\r\n"
+        "Cache-Control: max-age=3600\r\n"
+        "ETag: \"5f8d3c40-5\"\r\n"
+        "Vary: Accept-Encoding\r\n"
+        "X-Request-Id: 6a1c0d0e-3c1f-4b7a-9f0e-4a1b2c3d4e5f\r\n"
+        "\r\n"
+        "hello";
+
+
+void TestHttpParser::testResponse()
+{
+    HttpHeaderParser parser;
+    QCOMPARE(parser.parse(sampleResponse), HttpHeaderParser::Finished);
+    QCOMPARE(sampleResponse.mid(parser.headerSize()), QByteArray("hello"));
+
+    HttpVersion version;
+    int statusCode;
+    QByteArray statusText;
+    QVERIFY(HttpHeaderParser::parseStatusLine(sampleResponse.constData() + parser.firstLineOffset(),
+                                              parser.firstLineLength(), &version, &statusCode, &statusText));
+    QCOMPARE(version, Http1_1);
+    QCOMPARE(statusCode, 200);
+    QCOMPARE(statusText, QByteArray("OK"));
+
+    const QList<HttpHeader> &headers = parser.headers(sampleResponse.constData());
+    QCOMPARE(headers.size(), 9);
+    QCOMPARE(headers.at(2).name, QStringLiteral("Content-Type"));
+    QCOMPARE(headers.at(2).value, QByteArray("text/html; charset=utf-8"));
+    QCOMPARE(headers.at(8).name, QStringLiteral("X-Request-Id"));
+}
+
+
+void TestHttpParser::testRequest()
+{
+    const QByteArray request = "\r\nGET /index.html?a=b HTTP/1.0\r\nhost:  example.com \r\n\r\n";
+    HttpHeaderParser parser;
+    QCOMPARE(parser.parse(request), HttpHeaderParser::Finished);
+    QCOMPARE(parser.headerSize(), request.size());
+
+    QByteArray method, path;
+    HttpVersion version;
+    QVERIFY(HttpHeaderParser::parseRequestLine(request.constData() + parser.firstLineOffset(),
+                                               parser.firstLineLength(), &method, &path, &version));
+    QCOMPARE(method, QByteArray("GET"));
+    QCOMPARE(path, QByteArray("/index.html?a=b"));
+    QCOMPARE(version, Http1_0);
+
+    const QList<HttpHeader> &headers = parser.headers(request.constData());
+    QCOMPARE(headers.size(), 1);
+    QCOMPARE(headers.at(0).name, QStringLiteral("Host"));
+    QCOMPARE(headers.at(0).value, QByteArray("example.com"));
+
+    const QByteArray badVersion = "GET / HTTP/3.7";
+    QVERIFY(HttpHeaderParser::parseRequestLine(badVersion.constData(), badVersion.size(), &method, &path, &version));
+    QCOMPARE(version, Unknown);
+    const QByteArray badSyntax = "GET / HTTP/1.1 extra";
+    QVERIFY(!HttpHeaderParser::parseRequestLine(badSyntax.constData(), badSyntax.size(), &method, &path, &version));
+}
+
+
+void TestHttpParser::testIncremental()
+{
+    HttpHeaderParser parser;
+    QByteArray buf;
+    for (int i = 0; i < sampleResponse.size(); ++i) {
+        buf.append(sampleResponse.at(i));
+        HttpHeaderParser::Result result = parser.parse(buf);
+        if (result == HttpHeaderParser::Finished) {
+            break;
+        }
+        QCOMPARE(result, HttpHeaderParser::NeedMoreData);
+    }
+    QVERIFY(parser.isFinished());
+    QCOMPARE(parser.headerCount(), 9);
+    QCOMPARE(parser.headerSize(), sampleResponse.size() - 5);
+}
+
+
+void TestHttpParser::testInvalidHeader()
+{
+    HttpHeaderParser parser;
+    QCOMPARE(parser.parse(QByteArray("HTTP/1.1 200 OK\r\nno colon here\r\n\r\n")), HttpHeaderParser::InvalidHeader);
+    parser.reset();
+    QCOMPARE(parser.parse(QByteArray("HTTP/1.1 200 OK\r\nA: b\r\n folded\r\n\r\n")), HttpHeaderParser::InvalidHeader);
+    parser.reset();
+    QCOMPARE(parser.parse(QByteArray("HTTP/1.1 200 OK\r\n: empty\r\n\r\n")), HttpHeaderParser::InvalidHeader);
+
+    HttpHeaderParser smallParser(64, 32);
+    QCOMPARE(smallParser.parse(QByteArray(64, 'a')), HttpHeaderParser::HeadersTooLarge);
+}
+
+
+void TestHttpParser::testTooManyHeaders()
+{
+    QByteArray buf = "HTTP/1.1 200 OK\r\n";
+    for (int i = 0; i < 5; ++i) {
+        buf.append("X-Header: value\r\n");
+    }
+    buf.append("\r\n");
+    HttpHeaderParser parser(4);
+    QCOMPARE(parser.parse(buf), HttpHeaderParser::TooManyHeaders);
+    HttpHeaderParser parser2(5);
+    QCOMPARE(parser2.parse(buf), HttpHeaderParser::Finished);
+}
+
+
+void TestHttpParser::testKnownHeaders()
+{
+    HeaderOperationMixin::KnownHeader knownHeader;
+    QVERIFY(HeaderOperationMixin::lookupKnownHeader("content-length", 14, &knownHeader));
+    QCOMPARE(knownHeader, HeaderOperationMixin::ContentLengthHeader);
+    QVERIFY(!HeaderOperationMixin::lookupKnownHeader("Content-Lengthx", 15, &knownHeader));
+    QCOMPARE(HeaderOperationMixin::toString(HeaderOperationMixin::IfNoneMatchHeader), QStringLiteral("If-None-Match"));
+
+    HttpResponse response;
+    HttpHeaderParser parser;
+    QCOMPARE(parser.parse(sampleResponse), HttpHeaderParser::Finished);
+    response.setHeaders(parser.headers(sampleResponse.constData()));
+    QCOMPARE(response.header(QStringLiteral("content-length")), QByteArray("5"));
+    QCOMPARE(response.header(HeaderOperationMixin::ETagHeader), QByteArray("\"5f8d3c40-5\""));
+}
+
+
+void TestHttpParser::benchmarkHeaderSplitter()
+{
+    QBENCHMARK {
+        HeaderSplitter splitter(QSharedPointer<SocketLike>(), sampleResponse);
+        HeaderSplitter::Error error;
+        splitter.nextLine(&error);
+        const QList<HttpHeader> &headers = splitter.headers(64, &error);
+        QCOMPARE(headers.size(), 9);
+    }
+}
+
+
+void TestHttpParser::benchmarkHttpHeaderParser()
+{
+    QBENCHMARK {
+        HttpHeaderParser parser;
+        parser.parse(sampleResponse);
+        const QList<HttpHeader> &headers = parser.headers(sampleResponse.constData());
+        QCOMPARE(headers.size(), 9);
+    }
+}
+
+QTEST_MAIN(TestHttpParser)
+#include "test_http_parser.moc"
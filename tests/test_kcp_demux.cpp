@@ -0,0 +1,98 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+#include "include/private/kcp_p.h"
+
+using namespace qtng;
+
+class TestKcpDemux: public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void testPeerKey();
+    void benchmarkStringKey();
+    void benchmarkPeerKey();
+private:
+    QList<QPair<QHostAddress, quint16>> peers;
+};
+
+
+// the number of simulated peers, and datagrams of every round.
+static const int PeerCount = 4096;
+static const int DatagramCount = 1024 * 64;
+
+
+void TestKcpDemux::initTestCase()
+{
+    for (int i = 0; i < PeerCount; ++i) {
+        if (i % 4 == 0) {
+            Q_IPV6ADDR ipv6;
+            memset(&ipv6, 0, sizeof(ipv6));
+            ipv6[0] = 0x20;
+            ipv6[1] = 0x01;
+            ipv6[14] = static_cast<quint8>(i >> 8);
+            ipv6[15] = static_cast<quint8>(i & 0xff);
+            peers.append(qMakePair(QHostAddress(ipv6), static_cast<quint16>(10000 + i)));
+        } else {
+            peers.append(qMakePair(QHostAddress(static_cast<quint32>(0x0a000000 + i)), static_cast<quint16>(10000 + i % 7)));
+        }
+    }
+}
+
+
+void TestKcpDemux::testPeerKey()
+{
+    QHostAddress ipv4(QStringLiteral("192.168.1.1"));
+    QHostAddress mapped(QStringLiteral("::ffff:192.168.1.1"));
+    QCOMPARE(KcpPeerKey(ipv4, 80), KcpPeerKey(mapped, 80));
+    QCOMPARE(qHash(KcpPeerKey(ipv4, 80)), qHash(KcpPeerKey(mapped, 80)));
+    QVERIFY(!(KcpPeerKey(ipv4, 80) == KcpPeerKey(ipv4, 81)));
+    QVERIFY(!(KcpPeerKey(ipv4, 80) == KcpPeerKey(QHostAddress(QStringLiteral("192.168.1.2")), 80)));
+
+    QHash<KcpPeerKey, int> receivers;
+    for (int i = 0; i < peers.size(); ++i) {
+        receivers.insert(KcpPeerKey(peers.at(i).first, peers.at(i).second), i);
+    }
+    QCOMPARE(receivers.size(), peers.size());
+    for (int i = 0; i < peers.size(); ++i) {
+        QCOMPARE(receivers.value(KcpPeerKey(peers.at(i).first, peers.at(i).second), -1), i);
+    }
+}
+
+
+// the old way, which formats the address of every datagram.
+void TestKcpDemux::benchmarkStringKey()
+{
+    QMap<QString, int> receivers;
+    for (int i = 0; i < peers.size(); ++i) {
+        receivers.insert(peers.at(i).first.toString() + QString::number(peers.at(i).second), i);
+    }
+    qint64 found = 0;
+    QBENCHMARK {
+        for (int i = 0; i < DatagramCount; ++i) {
+            const QPair<QHostAddress, quint16> &peer = peers.at(i % PeerCount);
+            found += receivers.value(peer.first.toString() + QString::number(peer.second), -1);
+        }
+    }
+    QVERIFY(found > 0);
+}
+
+
+void TestKcpDemux::benchmarkPeerKey()
+{
+    QHash<KcpPeerKey, int> receivers;
+    for (int i = 0; i < peers.size(); ++i) {
+        receivers.insert(KcpPeerKey(peers.at(i).first, peers.at(i).second), i);
+    }
+    qint64 found = 0;
+    QBENCHMARK {
+        for (int i = 0; i < DatagramCount; ++i) {
+            const QPair<QHostAddress, quint16> &peer = peers.at(i % PeerCount);
+            found += receivers.value(KcpPeerKey(peer.first, peer.second), -1);
+        }
+    }
+    QVERIFY(found > 0);
+}
+
+QTEST_MAIN(TestKcpDemux)
+#include "test_kcp_demux.moc"
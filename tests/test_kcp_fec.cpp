@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <QtTest>
+#include "qtnetworkng.h"
+#include "include/private/kcp_fec_p.h"
+
+using namespace qtng;
+
+class TestKcpFec: public QObject
+{
+    Q_OBJECT
+private slots:
+    void testReedSolomon();
+    void testDecoder();
+    void benchmarkEncode();
+    void testPackets();
+    void benchmarkLossyLoopback_data();
+    void benchmarkLossyLoopback();
+};
+
+
+void TestKcpFec::testReedSolomon()
+{
+    const int dataShards = 10;
+    const int parityShards = 3;
+    const int shardSize = 1400;
+    QVector<QByteArray> data;
+    QVector<const char *> dataPointers;
+    for (int j = 0; j < dataShards; ++j) {
+        data.append(randomBytes(shardSize));
+        dataPointers.append(data.last().constData());
+    }
+    QVector<QByteArray> parity(parityShards, QByteArray(shardSize, Qt::Uninitialized));
+    QVector<char *> parityPointers;
+    for (int i = 0; i < parityShards; ++i) {
+        parityPointers.append(parity[i].data());
+    }
+    ReedSolomon::encode(dataPointers, parityPointers, shardSize);
+
+    for (int round = 0; round < 100; ++round) {
+        QVector<QByteArray> shards = data + parity;
+        // lose up to `parityShards` shards of any kind.
+        for (int k = 0; k < parityShards; ++k) {
+            shards[qrand() % shards.size()].clear();
+        }
+        QVERIFY(ReedSolomon::reconstruct(shards, dataShards, shardSize));
+        QCOMPARE(shards.mid(0, dataShards), data);
+    }
+
+    QVector<QByteArray> shards = data + parity;
+    for (int k = 0; k <= parityShards; ++k) {
+        shards[k].clear();
+    }
+    QVERIFY(!ReedSolomon::reconstruct(shards, dataShards, shardSize));
+}
+
+
+void TestKcpFec::testDecoder()
+{
+    KcpFecEncoder encoder;
+    QVERIFY(!encoder.setShards(0, 3));
+    QVERIFY(encoder.setShards(4, 2));
+    QList<QByteArray> segments;
+    QList<QByteArray> packets;
+    for (int i = 0; i < 3; ++i) {  // a partial group.
+        const QByteArray &segment = randomBytes(100 + i * 10);
+        encoder.addData('\x01', segment.constData(), segment.size(), 0);
+        segments.append('\x01' + segment);
+        QByteArray packet(KcpFecHeaderSize, '\0');
+        packet[9] = static_cast<char>(i);
+        packet[10] = 4;
+        packet[11] = 2;
+        packets.append(packet + segments.last());
+    }
+    QCOMPARE(encoder.finish(), 3);
+    for (int i = 0; i < 2; ++i) {
+        QByteArray packet(KcpFecHeaderSize, '\0');
+        packet[9] = static_cast<char>(3 + i);
+        packet[10] = 3;
+        packet[11] = 2;
+        packets.append(packet + encoder.parity.at(i));
+    }
+
+    // lose the first and the third segments.
+    KcpFecDecoder decoder;
+    QVERIFY(decoder.addShard(packets.at(1).constData(), packets.at(1).size(), 1).isEmpty());
+    QVERIFY(decoder.addShard(packets.at(3).constData(), packets.at(3).size(), 1).isEmpty());
+    const QList<QByteArray> &recovered = decoder.addShard(packets.at(4).constData(), packets.at(4).size(), 1);
+    QCOMPARE(recovered.size(), 2);
+    QCOMPARE(recovered.at(0), segments.at(0));
+    QCOMPARE(recovered.at(1), segments.at(2));
+    QVERIFY(decoder.addShard(packets.at(0).constData(), packets.at(0).size(), 1).isEmpty());
+}
+
+
+void TestKcpFec::benchmarkEncode()
+{
+    const int dataShards = 10;
+    const int parityShards = 3;
+    const int shardSize = 1400;
+    QVector<QByteArray> data;
+    QVector<const char *> dataPointers;
+    for (int j = 0; j < dataShards; ++j) {
+        data.append(randomBytes(shardSize));
+        dataPointers.append(data.last().constData());
+    }
+    QVector<QByteArray> parity(parityShards, QByteArray(shardSize, Qt::Uninitialized));
+    QVector<char *> parityPointers;
+    for (int i = 0; i < parityShards; ++i) {
+        parityPointers.append(parity[i].data());
+    }
+    QBENCHMARK {
+        ReedSolomon::encode(dataPointers, parityPointers, shardSize);
+    }
+}
+
+
+void TestKcpFec::testPackets()
+{
+    KcpSocket server(Socket::IPv4Protocol);
+    server.setMode(KcpSocket::Loopback);
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(10));
+    KcpSocket client(Socket::IPv4Protocol);
+    client.setMode(KcpSocket::Loopback);
+    QVERIFY(client.connect(QHostAddress::LocalHost, server.localPort()));
+
+    const QByteArray small = randomBytes(100);
+    const QByteArray large = randomBytes(static_cast<int>(client.payloadSizeHint()) * 3 + 7);
+    QCOMPARE(client.sendPacket(small), small.size());
+    QCOMPARE(client.sendPacket(large), large.size());
+    QCOMPARE(client.sendPacket(large), large.size());
+    QCOMPARE(client.sendPacket(QByteArray(static_cast<int>(client.payloadSizeHint()) * 200, 'x')), -1);
+
+    QSharedPointer<KcpSocket> request = server.accept();
+    QVERIFY(!request.isNull());
+    QCOMPARE(request->recvPacket(), small);
+    QCOMPARE(request->recvPacket(), large);
+    // a partial read keeps the rest of message.
+    QCOMPARE(request->recv(10), large.left(10));
+    QCOMPARE(request->recvPacket(), large.mid(10));
+
+    QCOMPARE(client.sendall(large), large.size());
+    QCOMPARE(request->recvall(large.size()), large);
+    client.close();
+}
+
+
+// forwards the datagrams between one kcp client and the server, and drops some of them.
+class LossyRelay
+{
+public:
+    LossyRelay(quint16 serverPort, int lossPercent);
+    ~LossyRelay();
+    quint16 port() const { return socket.localPort(); }
+    qint64 forwardedBytes;
+private:
+    void run();
+    Socket socket;
+    CoroutineGroup operations;
+    QHostAddress clientAddress;
+    quint16 clientPort;
+    quint16 serverPort;
+    int lossPercent;
+};
+
+
+LossyRelay::LossyRelay(quint16 serverPort, int lossPercent)
+    : forwardedBytes(0), socket(Socket::IPv4Protocol, Socket::UdpSocket), clientPort(0), serverPort(serverPort), lossPercent(lossPercent)
+{
+    socket.bind(QHostAddress::LocalHost, 0);
+    operations.spawn([this] { run(); });
+}
+
+
+LossyRelay::~LossyRelay()
+{
+    operations.killall();
+    socket.close();
+}
+
+
+void LossyRelay::run()
+{
+    QByteArray buf(1024 * 64, Qt::Uninitialized);
+    QHostAddress addr;
+    quint16 port;
+    while (true) {
+        qint32 len = socket.recvfrom(buf.data(), buf.size(), &addr, &port);
+        if (len < 0) {
+            return;
+        }
+        if (qrand() % 100 < lossPercent) {
+            continue;
+        }
+        forwardedBytes += len;
+        if (port == serverPort) {
+            if (clientPort != 0) {
+                socket.sendto(buf.constData(), len, clientAddress, clientPort);
+            }
+        } else {
+            clientAddress = addr;
+            clientPort = port;
+            socket.sendto(buf.constData(), len, QHostAddress::LocalHost, serverPort);
+        }
+    }
+}
+
+
+void TestKcpFec::benchmarkLossyLoopback_data()
+{
+    QTest::addColumn<int>("lossPercent");
+    QTest::addColumn<int>("dataShards");
+    QTest::addColumn<int>("parityShards");
+    QTest::addColumn<bool>("compression");
+    QTest::addColumn<bool>("adaptive");
+    QTest::newRow("plain, 0% loss") << 0 << 0 << 0 << false << false;
+    QTest::newRow("compressed, 0% loss") << 0 << 0 << 0 << true << false;
+    QTest::newRow("plain, 5% loss") << 5 << 0 << 0 << false << false;
+    QTest::newRow("fec 10/3, 5% loss") << 5 << 10 << 3 << false << false;
+    QTest::newRow("plain, 15% loss") << 15 << 0 << 0 << false << false;
+    QTest::newRow("fec 10/3, 15% loss") << 15 << 10 << 3 << false << false;
+    QTest::newRow("fec 4/2, 15% loss") << 15 << 4 << 2 << false << false;
+    QTest::newRow("fec 10/3 compressed, 15% loss") << 15 << 10 << 3 << true << false;
+    QTest::newRow("adaptive paced, 5% loss") << 5 << 0 << 0 << false << true;
+    QTest::newRow("adaptive paced, 15% loss") << 15 << 0 << 0 << false << true;
+}
+
+
+// the client sends timestamped messages at a constant rate, the server echoes them. reports the goodput and
+// the 99th percentile of round-trip time.
+void TestKcpFec::benchmarkLossyLoopback()
+{
+    QFETCH(int, lossPercent);
+    QFETCH(int, dataShards);
+    QFETCH(int, parityShards);
+    QFETCH(bool, compression);
+    QFETCH(bool, adaptive);
+    const int messageSize = 1024;
+    const int messageCount = 2000;
+
+    KcpSocket server(Socket::IPv4Protocol);
+    server.setMode(adaptive ? KcpSocket::Adaptive : KcpSocket::FastInternet);
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(10));
+    LossyRelay relay(server.localPort(), lossPercent);
+    QSharedPointer<KcpSocket> client(new KcpSocket(Socket::IPv4Protocol));
+    client->setMode(adaptive ? KcpSocket::Adaptive : KcpSocket::FastInternet);
+    client->setPacingEnabled(adaptive);
+    QVERIFY(client->setFecShards(dataShards, parityShards));
+    if (compression && !client->setCompressionEnabled(true)) {
+        QSKIP("zlib is not available.");
+    }
+    QVERIFY(client->connect(QHostAddress::LocalHost, relay.port()));
+
+    CoroutineGroup operations;
+    operations.spawn([&server, messageSize] {
+        QSharedPointer<KcpSocket> request = server.accept();
+        if (request.isNull()) {
+            return;
+        }
+        QByteArray buf(messageSize, Qt::Uninitialized);
+        while (request->recvall(buf.data(), buf.size()) == buf.size()) {
+            if (request->sendall(buf.constData(), buf.size()) != buf.size()) {
+                return;
+            }
+        }
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    operations.spawn([client, &timer, messageSize, messageCount] {
+        // a text-heavy payload.
+        QByteArray message;
+        while (message.size() < messageSize) {
+            message.append("{\"id\":" + QByteArray::number(message.size()) + ",\"status\":\"ok\",\"items\":[]},");
+        }
+        message.resize(messageSize);
+        for (int i = 0; i < messageCount; ++i) {
+            const qint64 sent = timer.nsecsElapsed();
+            memcpy(message.data(), &sent, sizeof(sent));
+            if (client->sendall(message) != message.size()) {
+                return;
+            }
+            Coroutine::msleep(1);
+        }
+    });
+
+    QVector<qint64> latencies;
+    QByteArray buf(messageSize, Qt::Uninitialized);
+    while (latencies.size() < messageCount) {
+        if (client->recvall(buf.data(), buf.size()) != buf.size()) {
+            break;
+        }
+        qint64 sent;
+        memcpy(&sent, buf.constData(), sizeof(sent));
+        latencies.append(timer.nsecsElapsed() - sent);
+    }
+    const qint64 elapsed = timer.nsecsElapsed();
+    QCOMPARE(latencies.size(), messageCount);
+    std::sort(latencies.begin(), latencies.end());
+    const double goodput = static_cast<double>(messageSize) * messageCount / (elapsed / 1e9);
+    qDebug() << QTest::currentDataTag() << "goodput:" << qRound(goodput / 1024) << "KiB/s"
+             << "p50:" << latencies.at(messageCount / 2) / 1000 << "us"
+             << "p99:" << latencies.at(messageCount * 99 / 100) / 1000 << "us"
+             << "udp bytes:" << relay.forwardedBytes;
+    const KcpStats &stats = client->stats();
+    qDebug() << "srtt:" << stats.srtt << "rto:" << stats.rto << "window:" << stats.sendWindow
+             << "retransmitted:" << stats.retransmittedSegments << "/" << stats.sentSegments;
+    QTest::setBenchmarkResult(goodput, QTest::BytesPerSecond);
+    client->close();
+    operations.killall();
+}
+
+QTEST_MAIN(TestKcpFec)
+#include "test_kcp_fec.moc"
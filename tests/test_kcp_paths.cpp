@@ -0,0 +1,443 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+#include "include/private/kcp_p.h"
+
+using namespace qtng;
+
+class TestKcpPaths: public QObject
+{
+    Q_OBJECT
+private slots:
+    void testWeight();
+    void testChoosePath();
+    void testBrokenPath();
+    void testMultiPath();
+    void testFailover();
+    void testForgedPath();
+    void testResume();
+    void testForgedProof();
+};
+
+
+// forwards the datagrams of every client socket by an upstream socket of its own, so that the server sees one
+// 4-tuple for every path of client. the paths can be broken, or rebound to a new upstream socket as a nat does.
+class PathRelay
+{
+public:
+    explicit PathRelay(quint16 serverPort);
+    ~PathRelay();
+    quint16 port() const { return socket.localPort(); }
+    int pathCount() const { return upstreams.size(); }
+    void breakPath(int path) { upstreams.at(path)->broken = true; }
+    void rebindPath(int path);
+    quint32 connectionId;
+private:
+    struct Upstream
+    {
+        QHostAddress clientAddress;
+        quint16 clientPort;
+        QSharedPointer<Socket> socket;
+        bool broken;
+    };
+    void run();
+    void receive(QSharedPointer<Upstream> upstream, QSharedPointer<Socket> upstreamSocket);
+    Socket socket;
+    CoroutineGroup operations;
+    QList<QSharedPointer<Upstream>> upstreams;
+    quint16 serverPort;
+};
+
+
+PathRelay::PathRelay(quint16 serverPort)
+    : connectionId(0), socket(Socket::IPv4Protocol, Socket::UdpSocket), serverPort(serverPort)
+{
+    socket.bind(QHostAddress::LocalHost, 0);
+    operations.spawn([this] { run(); });
+}
+
+
+PathRelay::~PathRelay()
+{
+    operations.killall();
+    for (QSharedPointer<Upstream> upstream: upstreams) {
+        upstream->socket->close();
+    }
+    socket.close();
+}
+
+
+void PathRelay::run()
+{
+    QByteArray buf(1024 * 64, Qt::Uninitialized);
+    QHostAddress addr;
+    quint16 port;
+    while (true) {
+        qint32 len = socket.recvfrom(buf.data(), buf.size(), &addr, &port);
+        if (len < 0) {
+            return;
+        }
+        QSharedPointer<Upstream> upstream;
+        for (QSharedPointer<Upstream> u: upstreams) {
+            if (u->clientPort == port && u->clientAddress == addr) {
+                upstream = u;
+                break;
+            }
+        }
+        if (upstream.isNull()) {
+            upstream.reset(new Upstream);
+            upstream->clientAddress = addr;
+            upstream->clientPort = port;
+            upstream->socket.reset(new Socket(Socket::IPv4Protocol, Socket::UdpSocket));
+            upstream->socket->bind(QHostAddress::LocalHost, 0);
+            upstream->broken = false;
+            upstreams.append(upstream);
+            QSharedPointer<Socket> upstreamSocket = upstream->socket;
+            operations.spawn([this, upstream, upstreamSocket] { receive(upstream, upstreamSocket); });
+        }
+        if (!upstream->broken) {
+            upstream->socket->sendto(buf.constData(), len, QHostAddress::LocalHost, serverPort);
+        }
+    }
+}
+
+
+void PathRelay::rebindPath(int path)
+{
+    QSharedPointer<Upstream> upstream = upstreams.at(path);
+    QSharedPointer<Socket> old = upstream->socket;
+    QSharedPointer<Socket> upstreamSocket(new Socket(Socket::IPv4Protocol, Socket::UdpSocket));
+    upstreamSocket->bind(QHostAddress::LocalHost, 0);
+    upstream->socket = upstreamSocket;
+    operations.spawn([this, upstream, upstreamSocket] { receive(upstream, upstreamSocket); });
+    old->close();
+}
+
+
+void PathRelay::receive(QSharedPointer<Upstream> upstream, QSharedPointer<Socket> upstreamSocket)
+{
+    QByteArray buf(1024 * 64, Qt::Uninitialized);
+    QHostAddress addr;
+    quint16 port;
+    while (true) {
+        qint32 len = upstreamSocket->recvfrom(buf.data(), buf.size(), &addr, &port);
+        if (len < 0) {
+            return;
+        }
+        if (len >= 5 && connectionId == 0) {
+            connectionId = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(buf.constData() + 1));
+        }
+        if (!upstream->broken) {
+            socket.sendto(buf.constData(), len, upstream->clientAddress, upstream->clientPort);
+        }
+    }
+}
+
+
+// connects the client to server by the relay.
+static bool connectRelay(KcpSocket &server, PathRelay &relay, KcpSocket &client, QSharedPointer<KcpSocket> *request)
+{
+    if (!client.connect(QHostAddress::LocalHost, relay.port()) || client.sendall(QByteArray("hello")) != 5) {
+        return false;
+    }
+    *request = server.accept();
+    return !request->isNull() && (*request)->recvall(5) == "hello" && relay.connectionId != 0;
+}
+
+
+#ifndef QTNG_NO_CRYPTO
+// asks the server for a challenge from an unknown address. it is answered once the key exchange is done.
+static QByteArray askChallenge(Socket &attacker, quint16 serverPort, quint32 connectionId)
+{
+    char packet[16];
+    memset(packet, 0, sizeof(packet));
+    packet[0] = 0x04;  // keepalive
+    qToBigEndian<quint32>(connectionId, reinterpret_cast<uchar*>(packet + 1));
+    CoroutineGroup operations;
+    operations.spawn([&attacker, &packet, serverPort] {
+        while (attacker.sendto(packet, sizeof(packet), QHostAddress::LocalHost, serverPort) > 0) {
+            Coroutine::msleep(100);
+        }
+    });
+    Timeout timeout(5.0);
+    char reply[64];
+    QHostAddress addr;
+    quint16 port;
+    const qint32 len = attacker.recvfrom(reply, sizeof(reply), &addr, &port);
+    operations.killall();
+    return len > 0 ? QByteArray(reply, len) : QByteArray();
+}
+
+
+// waits until the client proves the session token for the new address, and the server moves the session to it.
+static bool waitForPeerPort(QSharedPointer<KcpSocket> request, quint16 oldPort)
+{
+    for (int i = 0; i < 100; ++i) {
+        if (request->peerPort() != oldPort) {
+            return true;
+        }
+        Coroutine::msleep(50);
+    }
+    return false;
+}
+#endif
+
+
+// connects the client to server by the relay, and waits until both sides have two paths.
+static bool connectPaths(KcpSocket &server, PathRelay &relay, KcpSocket &client, QSharedPointer<KcpSocket> *request)
+{
+    client.setMultiPathCount(2);
+    if (!connectRelay(server, relay, client, request)) {
+        return false;
+    }
+    for (int i = 0; i < 100; ++i) {
+        if (client.activePathCount() == 2 && (*request)->activePathCount() == 2) {
+            return true;
+        }
+        Coroutine::msleep(50);
+    }
+    return false;
+}
+
+
+void TestKcpPaths::testWeight()
+{
+    KcpPath fast, slow, lossy;
+    for (int i = 0; i < 10; ++i) {
+        fast.probeAnswered(10);
+        slow.probeAnswered(100);
+        lossy.probeAnswered(10);
+        lossy.probeLost();
+    }
+    QCOMPARE(fast.srtt, static_cast<quint32>(10));
+    QCOMPARE(slow.srtt, static_cast<quint32>(100));
+    QVERIFY(fast.weight > slow.weight);
+    QVERIFY(fast.weight > lossy.weight);
+    QVERIFY(lossy.loss > 0.1f);
+    QVERIFY(slow.weight >= 1);
+
+    // the loss fades once the probes are answered again.
+    const int weight = lossy.weight;
+    for (int i = 0; i < 10; ++i) {
+        lossy.probeAnswered(10);
+    }
+    QVERIFY(lossy.weight > weight);
+}
+
+
+// smooth weighted round-robin sends every path its share in every round, and does not send bursts.
+void TestKcpPaths::testChoosePath()
+{
+    QVector<KcpPath> paths(3);
+    paths[0].weight = 5;
+    paths[1].weight = 3;
+    paths[2].weight = 2;
+    int counts[3] = {0, 0, 0};
+    int last = -1;
+    int run = 0;
+    int longestRun = 0;
+    for (int i = 0; i < 100; ++i) {
+        const int path = chooseKcpPath(paths);
+        QVERIFY(path >= 0 && path < 3);
+        ++counts[path];
+        run = path == last ? run + 1 : 1;
+        longestRun = qMax(longestRun, run);
+        last = path;
+    }
+    QCOMPARE(counts[0], 50);
+    QCOMPARE(counts[1], 30);
+    QCOMPARE(counts[2], 20);
+    QVERIFY(longestRun <= 2);
+
+    QVector<KcpPath> single(1);
+    QCOMPARE(chooseKcpPath(single), 0);
+}
+
+
+void TestKcpPaths::testBrokenPath()
+{
+    QVector<KcpPath> paths(2);
+    paths[0].probeLost();
+    QVERIFY(!paths.at(0).isBroken());
+    paths[0].probeLost();
+    QVERIFY(paths.at(0).isBroken());
+    for (int i = 0; i < 10; ++i) {
+        QCOMPARE(chooseKcpPath(paths), 1);
+    }
+
+    // the packets still go out if all paths are broken.
+    paths[1].probeLost();
+    paths[1].probeLost();
+    int counts[2] = {0, 0};
+    for (int i = 0; i < 10; ++i) {
+        ++counts[chooseKcpPath(paths)];
+    }
+    QVERIFY(counts[0] > 0 && counts[1] > 0);
+
+    // and the path is chosen again once it answers.
+    paths[0].probeAnswered(10);
+    QVERIFY(!paths.at(0).isBroken());
+    for (int i = 0; i < 10; ++i) {
+        QCOMPARE(chooseKcpPath(paths), 0);
+    }
+}
+
+
+void TestKcpPaths::testMultiPath()
+{
+#ifdef QTNG_NO_CRYPTO
+    QSKIP("multipath needs the crypto support.");
+#else
+    KcpSocket server(Socket::IPv4Protocol);
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(10));
+    PathRelay relay(server.localPort());
+    KcpSocket client(Socket::IPv4Protocol);
+    QSharedPointer<KcpSocket> request;
+    QVERIFY(connectPaths(server, relay, client, &request));
+    QCOMPARE(relay.pathCount(), 2);
+
+    Timeout timeout(10.0);
+    const QByteArray data(1024 * 256, 'x');
+    CoroutineGroup operations;
+    operations.spawn([&client, data] { client.sendall(data); });
+    QCOMPARE(request->recvall(data.size()), data);
+    QCOMPARE(request->sendall(data), data.size());
+    QCOMPARE(client.recvall(data.size()), data);
+#endif
+}
+
+
+// the transfer goes on if the first path is broken, and the client keeps the path for it may come back.
+void TestKcpPaths::testFailover()
+{
+#ifdef QTNG_NO_CRYPTO
+    QSKIP("multipath needs the crypto support.");
+#else
+    KcpSocket server(Socket::IPv4Protocol);
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(10));
+    PathRelay relay(server.localPort());
+    KcpSocket client(Socket::IPv4Protocol);
+    QSharedPointer<KcpSocket> request;
+    QVERIFY(connectPaths(server, relay, client, &request));
+
+    relay.breakPath(0);
+    Timeout timeout(20.0);
+    const QByteArray data(1024 * 256, 'y');
+    CoroutineGroup operations;
+    operations.spawn([&client, data] { client.sendall(data); });
+    QCOMPARE(request->recvall(data.size()), data);
+    QCOMPARE(request->sendall(data), data.size());
+    QCOMPARE(client.recvall(data.size()), data);
+    QCOMPARE(client.activePathCount(), 2);
+#endif
+}
+
+
+// a datagram carrying the connection id from an unknown address is not taken as a new path.
+void TestKcpPaths::testForgedPath()
+{
+    KcpSocket server(Socket::IPv4Protocol);
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(10));
+    PathRelay relay(server.localPort());
+    KcpSocket client(Socket::IPv4Protocol);
+    QSharedPointer<KcpSocket> request;
+    QVERIFY(connectRelay(server, relay, client, &request));
+
+    Socket attacker(Socket::IPv4Protocol, Socket::UdpSocket);
+    QVERIFY(attacker.bind(QHostAddress::LocalHost, 0));
+#ifndef QTNG_NO_CRYPTO
+    // the server asks the new address for the proof of session token.
+    const QByteArray &challenge = askChallenge(attacker, server.localPort(), relay.connectionId);
+    QCOMPARE(challenge.size(), 13);
+    QCOMPARE(challenge.at(0), static_cast<char>(0x0a));
+#else
+    char packet[16];
+    memset(packet, 0, sizeof(packet));
+    packet[0] = 0x04;  // keepalive
+    qToBigEndian<quint32>(relay.connectionId, reinterpret_cast<uchar*>(packet + 1));
+    QCOMPARE(attacker.sendto(packet, sizeof(packet), QHostAddress::LocalHost, server.localPort()),
+             static_cast<qint32>(sizeof(packet)));
+    Coroutine::msleep(100);
+#endif
+    QCOMPARE(request->activePathCount(), 1);
+    QCOMPARE(client.sendall(QByteArray("world")), 5);
+    QCOMPARE(request->recvall(5), QByteArray("world"));
+}
+
+
+// the nat of client is rebound, and the session moves to the new address after the client proves the token.
+void TestKcpPaths::testResume()
+{
+#ifdef QTNG_NO_CRYPTO
+    QSKIP("resuming needs the crypto support.");
+#else
+    KcpSocket server(Socket::IPv4Protocol);
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(10));
+    PathRelay relay(server.localPort());
+    KcpSocket client(Socket::IPv4Protocol);
+    QSharedPointer<KcpSocket> request;
+    QVERIFY(connectRelay(server, relay, client, &request));
+    // the key exchange is done in a round trip.
+    Coroutine::msleep(200);
+
+    const quint16 oldPort = request->peerPort();
+    relay.rebindPath(0);
+    Timeout timeout(10.0);
+    const QByteArray data(1024 * 64, 'z');
+    QCOMPARE(client.sendall(data), data.size());
+    QCOMPARE(request->recvall(data.size()), data);
+    QVERIFY(waitForPeerPort(request, oldPort));
+    QCOMPARE(request->activePathCount(), 1);
+    QCOMPARE(request->sendall(data), data.size());
+    QCOMPARE(client.recvall(data.size()), data);
+#endif
+}
+
+
+// the proof made without the session token is rejected, and the session stays at the address of client.
+void TestKcpPaths::testForgedProof()
+{
+#ifdef QTNG_NO_CRYPTO
+    QSKIP("resuming needs the crypto support.");
+#else
+    KcpSocket server(Socket::IPv4Protocol);
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(10));
+    PathRelay relay(server.localPort());
+    KcpSocket client(Socket::IPv4Protocol);
+    QSharedPointer<KcpSocket> request;
+    QVERIFY(connectRelay(server, relay, client, &request));
+    const quint16 oldPort = request->peerPort();
+
+    Socket attacker(Socket::IPv4Protocol, Socket::UdpSocket);
+    QVERIFY(attacker.bind(QHostAddress::LocalHost, 0));
+    const QByteArray &challenge = askChallenge(attacker, server.localPort(), relay.connectionId);
+    QCOMPARE(challenge.size(), 13);
+
+    // type(1) + connection id(4) + nonce(8) + migrate flag(1) + proof(16)
+    QByteArray resume = challenge;
+    resume[0] = 0x0b;
+    resume.append(static_cast<char>(1));
+    resume.append(randomBytes(16));
+    QCOMPARE(attacker.sendto(resume, QHostAddress::LocalHost, server.localPort()), resume.size());
+    // neither is a new path added by it.
+    resume[13] = 0;
+    resume.replace(14, 16, randomBytes(16));
+    QCOMPARE(attacker.sendto(resume, QHostAddress::LocalHost, server.localPort()), resume.size());
+    Coroutine::msleep(200);
+
+    QCOMPARE(request->peerPort(), oldPort);
+    QCOMPARE(request->activePathCount(), 1);
+    Timeout timeout(5.0);
+    QCOMPARE(client.sendall(QByteArray("world")), 5);
+    QCOMPARE(request->recvall(5), QByteArray("world"));
+    QCOMPARE(request->sendall(QByteArray("again")), 5);
+    QCOMPARE(client.recvall(5), QByteArray("again"));
+#endif
+}
+
+QTEST_MAIN(TestKcpPaths)
+#include "test_kcp_paths.moc"
@@ -0,0 +1,123 @@
+#include <QtTest>
+#include "qtnetworkng.h"
+#include "include/private/kcp_p.h"
+
+using namespace qtng;
+
+struct TimerItem
+{
+    TimerItem()
+        : wheelPrev(nullptr), wheelNext(nullptr), wheelDue(0), wheelSlot(KcpTimerWheel<TimerItem>::NoSlot) {}
+    TimerItem *wheelPrev;
+    TimerItem *wheelNext;
+    quint64 wheelDue;
+    int wheelSlot;
+};
+typedef KcpTimerWheel<TimerItem> Wheel;
+
+
+class TestKcpScheduler: public QObject
+{
+    Q_OBJECT
+private slots:
+    void testNear();
+    void testCascade();
+    void testReschedule();
+    void testBlocked();
+};
+
+
+// advances the wheel one tick after another, and returns the tick which the item is due at.
+static quint64 dueTick(Wheel *wheel, TimerItem *item, quint64 until)
+{
+    while (wheel->currentTick < until) {
+        wheel->advance(wheel->currentTick + 1);
+        if (wheel->due.contains(item)) {
+            wheel->due.clear();
+            return wheel->currentTick;
+        }
+        wheel->due.clear();
+    }
+    return 0;
+}
+
+
+void TestKcpScheduler::testNear()
+{
+    Wheel wheel(1000);
+    TimerItem a, b;
+    wheel.schedule(&a, 1010);
+    wheel.schedule(&b, 1010);
+    QCOMPARE(wheel.nextTick(), static_cast<quint64>(1010));
+    wheel.advance(1009);
+    QVERIFY(wheel.due.isEmpty());
+    wheel.advance(1010);
+    QCOMPARE(wheel.due.size(), 2);
+    QCOMPARE(a.wheelSlot, static_cast<int>(Wheel::DueSlot));
+    QCOMPARE(b.wheelSlot, static_cast<int>(Wheel::DueSlot));
+
+    // an item due in the past is ready at once.
+    wheel.due.clear();
+    wheel.schedule(&a, 900);
+    QCOMPARE(wheel.nextTick(), wheel.currentTick);
+    wheel.advance(wheel.currentTick);
+    QCOMPARE(wheel.due.size(), 1);
+}
+
+
+void TestKcpScheduler::testCascade()
+{
+    // the items beyond the near slots are kept in the far slots, and cascaded into the near slots in time.
+    const quint64 start = 1000;
+    const quint64 delays[] = {Wheel::NearSlots - 1, Wheel::NearSlots, Wheel::NearSlots + 1, Wheel::NearSlots * 3 + 17,
+                              Wheel::NearSlots * Wheel::FarSlots - 1, Wheel::NearSlots * Wheel::FarSlots * 2};
+    for (quint64 delay: delays) {
+        Wheel wheel(start);
+        TimerItem item;
+        wheel.schedule(&item, start + delay);
+        QCOMPARE(dueTick(&wheel, &item, start + delay + Wheel::NearSlots * 2), start + delay);
+    }
+}
+
+
+void TestKcpScheduler::testReschedule()
+{
+    Wheel wheel(5000);
+    TimerItem a, b;
+    wheel.schedule(&a, 5000 + Wheel::NearSlots * 4);
+    wheel.schedule(&b, 5100);
+
+    // moves a from a far slot to a near one, and b from a near slot to a far one.
+    wheel.unlink(&a);
+    QCOMPARE(a.wheelSlot, static_cast<int>(Wheel::NoSlot));
+    wheel.schedule(&a, 5050);
+    wheel.unlink(&b);
+    wheel.schedule(&b, 5000 + Wheel::NearSlots * 2 + 3);
+    QCOMPARE(wheel.nextTick(), static_cast<quint64>(5050));
+    QCOMPARE(dueTick(&wheel, &a, 6000), static_cast<quint64>(5050));
+    QCOMPARE(dueTick(&wheel, &b, 6000), static_cast<quint64>(5000 + Wheel::NearSlots * 2 + 3));
+
+    // an unlinked item is never due.
+    TimerItem c;
+    wheel.schedule(&c, wheel.currentTick + 10);
+    wheel.unlink(&c);
+    QCOMPARE(dueTick(&wheel, &c, wheel.currentTick + Wheel::NearSlots), static_cast<quint64>(0));
+}
+
+
+void TestKcpScheduler::testBlocked()
+{
+    // all items are due if the thread was blocked for longer than the wheel.
+    Wheel wheel(0);
+    TimerItem a, b;
+    wheel.schedule(&a, 10);
+    wheel.schedule(&b, Wheel::NearSlots * 10);
+    wheel.advance(Wheel::NearSlots * Wheel::FarSlots * 4);
+    QCOMPARE(wheel.due.size(), 2);
+    QCOMPARE(wheel.currentTick, static_cast<quint64>(Wheel::NearSlots * Wheel::FarSlots * 4));
+}
+
+
+QTEST_MAIN(TestKcpScheduler)
+
+#include "test_kcp_scheduler.moc"
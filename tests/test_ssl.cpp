@@ -12,6 +12,17 @@ private slots:
 //    void testSocks5Proxy();
     void testVersion10();
     void testServer();
+    void testSessionResumption();
+    void testServerName();
+    void testCryptoWorkerPool();
+    void testCryptoWorkerPoolTimeout();
+    void testServerHandshakeTimeout();
+    void testServerHandshakeSemaphore();
+    void testDirectRecords();
+    void testDirectPartialWrite();
+    void testAeadEncrypted();
+    void benchmarkEncrypted_data();
+    void benchmarkEncrypted();
 };
 
 
@@ -95,6 +106,494 @@ void TestSsl::testServer()
     }
     clientCoroutine->join();
 }
+
+
+// connects to the server, and reads the greeting so that the tickets sent after handshake are received.
+static bool resumeSession(quint16 port, QSharedPointer<SslSessionCache> cache, bool *reused)
+{
+    SslSocket client;
+    client.setSessionCache(cache, QStringLiteral("goldfish"));
+    if (!client.connect(QHostAddress::LocalHost, port)) {
+        return false;
+    }
+    if (client.recvall(5) != "hello") {
+        return false;
+    }
+    *reused = client.isSessionReused();
+    return true;
+}
+
+
+void TestSsl::testSessionResumption()
+{
+    QSharedPointer<SslServerSessionCache> serverCache(new SslServerSessionCache());
+    SslConfiguration config = SslConfiguration::testPurpose("Goldfish", "CN", "Example");
+    config.setServerSessionCache(serverCache);
+    SslSocket server(Socket::AnyIPProtocol, config);
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(100));
+    quint16 port = server.localPort();
+    QSharedPointer<Coroutine> serving(Coroutine::spawn([&server] {
+        while (true) {
+            QSharedPointer<SslSocket> request = server.accept();
+            if (request.isNull()) {
+                return;
+            }
+            request->sendall("hello");
+            request->recv(1);  // wait for the client closing.
+        }
+    }));
+
+    Timeout _(5.0);
+    QSharedPointer<SslSessionCache> clientCache(new SslSessionCache());
+    bool reused = true;
+    QVERIFY(resumeSession(port, clientCache, &reused));
+    QVERIFY(!reused);
+    QVERIFY(resumeSession(port, clientCache, &reused));
+    QVERIFY(reused);
+    QCOMPARE(serverCache->hits(), static_cast<quint64>(1));
+    QCOMPARE(serverCache->misses(), static_cast<quint64>(1));
+
+    // the settings take effect for new connections.
+    serverCache->setTicketsEnabled(false);
+    QVERIFY(resumeSession(port, clientCache, &reused));
+    QVERIFY(!reused);
+    serving->kill();
+    serving->join();
+}
+
+
+static QByteArray peerCertificateDigest(quint16 port, const QString &serverName)
+{
+    QSharedPointer<Socket> rawSocket(new Socket());
+    if (!rawSocket->connect(QHostAddress::LocalHost, port)) {
+        return QByteArray();
+    }
+    SslSocket client(rawSocket);
+    if (!client.handshake(false, serverName)) {
+        return QByteArray();
+    }
+    return client.peerCertificate().digest(MessageDigest::Sha256);
+}
+
+
+void TestSsl::testServerName()
+{
+    const SslConfiguration &alpha = SslConfiguration::testPurpose("alpha.example.com", "CN", "Example");
+    const SslConfiguration &beta = SslConfiguration::testPurpose("beta.example.com", "CN", "Example");
+    QSharedPointer<SslCertificateStore> store(new SslCertificateStore());
+    store->addConfiguration(alpha, QStringList() << "alpha.example.com");
+    store->addConfiguration(beta, QStringList() << "*.beta.example.com");
+    SslConfiguration config = SslConfiguration::testPurpose("Goldfish", "CN", "Example");
+    config.setCertificateStore(store);
+    SslSocket server(Socket::AnyIPProtocol, config);
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(100));
+    quint16 port = server.localPort();
+    QSharedPointer<Coroutine> serving(Coroutine::spawn([&server] {
+        while (true) {
+            QSharedPointer<SslSocket> request = server.accept();
+            if (request.isNull()) {
+                return;
+            }
+        }
+    }));
+
+    Timeout _(5.0);
+    QCOMPARE(peerCertificateDigest(port, "alpha.example.com"), alpha.localCertificate().digest(MessageDigest::Sha256));
+    QCOMPARE(peerCertificateDigest(port, "www.beta.example.com"), beta.localCertificate().digest(MessageDigest::Sha256));
+    QCOMPARE(peerCertificateDigest(port, "gamma.example.com"), config.localCertificate().digest(MessageDigest::Sha256));
+    serving->kill();
+    serving->join();
+}
+
+
+void TestSsl::testCryptoWorkerPool()
+{
+    QSharedPointer<SslCryptoWorkerPool> pool(new SslCryptoWorkerPool(2));
+    SslConfiguration config = SslConfiguration::testPurpose("Goldfish", "CN", "Example");
+    config.setCryptoWorkerPool(pool);
+    SslSocket server(Socket::AnyIPProtocol, config);
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(100));
+    quint16 port = server.localPort();
+    CoroutineGroup operations;
+    operations.spawn([&server, &operations] {
+        while (true) {
+            QSharedPointer<SslSocket> request = server.accept();
+            if (request.isNull()) {
+                return;
+            }
+            operations.spawn([request] {
+                const QByteArray &data = request->recv(1024);
+                request->sendall(data);
+            });
+        }
+    });
+
+    Timeout _(5.0);
+    QList<QSharedPointer<Coroutine>> clients;
+    QSharedPointer<int> echoed(new int(0));
+    for (int i = 0; i < 8; ++i) {
+        clients.append(Coroutine::spawn([port, echoed] {
+            SslSocket client;
+            if (!client.connect(QHostAddress::LocalHost, port)) {
+                return;
+            }
+            client.sendall("fish is here.");
+            if (client.recvall(13) == "fish is here.") {
+                ++(*echoed);
+            }
+        }));
+    }
+    for (QSharedPointer<Coroutine> client: clients) {
+        client->join();
+    }
+    QCOMPARE(*echoed, 8);
+    QVERIFY(pool->operations() >= 8);
+    QCOMPARE(pool->queueDepth(), 0);
+    operations.killall();
+}
+
+
+// the server handshakes are interrupted while their steps may be running in the workers.
+void TestSsl::testCryptoWorkerPoolTimeout()
+{
+    QSharedPointer<SslCryptoWorkerPool> pool(new SslCryptoWorkerPool(1));
+    SslConfiguration config = SslConfiguration::testPurpose("Goldfish", "CN", "Example");
+    config.setCryptoWorkerPool(pool);
+    Socket server;
+    QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+    QVERIFY(server.listen(100));
+    quint16 port = server.localPort();
+
+    for (int i = 0; i < 20; ++i) {
+        QSharedPointer<Coroutine> client(Coroutine::spawn([port] {
+            QSharedPointer<Socket> rawSocket(new Socket());
+            if (!rawSocket->connect(QHostAddress::LocalHost, port)) {
+                return;
+            }
+            SslSocket s(rawSocket);
+            s.handshake(false);
+        }));
+        QSharedPointer<Socket> request(server.accept());
+        QVERIFY(!request.isNull());
+        try {
+            Timeout _(0.001f * (i % 5 + 1));
+            SslSocket s(request, config);
+            s.handshake(true);
+        } catch (TimeoutException &) {
+        }
+        request->abort();
+        client->join();
+    }
+
+    // a stalled client times out, and the pool is usable after all.
+    QSharedPointer<Socket> stalled(new Socket());
+    QVERIFY(stalled->connect(QHostAddress::LocalHost, port));
+    QSharedPointer<Socket> request(server.accept());
+    QVERIFY(!request.isNull());
+    bool timedOut = false;
+    try {
+        Timeout _(0.2);
+        SslSocket s(request, config);
+        s.handshake(true);
+    } catch (TimeoutException &) {
+        timedOut = true;
+    }
+    QVERIFY(timedOut);
+
+    QSharedPointer<Coroutine> client(Coroutine::spawn([port] {
+        SslSocket s;
+        if (s.connect(QHostAddress::LocalHost, port)) {
+            s.sendall("fish is here.");
+        }
+    }));
+    {
+        Timeout _(5.0);
+        QSharedPointer<Socket> request(server.accept());
+        QVERIFY(!request.isNull());
+        SslSocket s(request, config);
+        QVERIFY(s.handshake(true));
+        QCOMPARE(s.recvall(13), QByteArray("fish is here."));
+    }
+    client->join();
+    QCOMPARE(pool->queueDepth(), 0);
+}
+
+
+class EchoHandler: public BaseRequestHandler
+{
+protected:
+    virtual void handle() override
+    {
+        const QByteArray &data = request->recv(1024);
+        request->sendall(data);
+    }
+};
+
+
+static bool echo(quint16 port)
+{
+    SslSocket client;
+    if (!client.connect(QHostAddress::LocalHost, port)) {
+        return false;
+    }
+    client.sendall("fish is here.");
+    return client.recvall(13) == "fish is here.";
+}
+
+
+void TestSsl::testServerHandshakeTimeout()
+{
+    SslServer<EchoHandler> server(QHostAddress::LocalHost, 0, SslConfiguration::testPurpose("Goldfish", "CN", "Example"));
+    server.setHandshakeTimeout(0.2f);
+    QVERIFY(server.start());
+    quint16 port = server.serverPort();
+    QVERIFY(port != 0);
+
+    Timeout _(5.0);
+    // the client never sends the hello, so the server drops it after the timeout.
+    Socket stalled;
+    QVERIFY(stalled.connect(QHostAddress::LocalHost, port));
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(stalled.recv(1024).isEmpty());
+    QVERIFY(timer.elapsed() >= 150);
+
+    QVERIFY(echo(port));
+    server.stop();
+}
+
+
+// the handshakes over the limit wait until the stalled one is dropped.
+void TestSsl::testServerHandshakeSemaphore()
+{
+    SslServer<EchoHandler> server(QHostAddress::LocalHost, 0, SslConfiguration::testPurpose("Goldfish", "CN", "Example"));
+    server.setHandshakeTimeout(1.0f);
+    server.setMaxConcurrentHandshakes(1);
+    QVERIFY(server.start());
+    quint16 port = server.serverPort();
+    QVERIFY(port != 0);
+
+    Timeout _(5.0);
+    QElapsedTimer timer;
+    {
+        Socket stalled;
+        QVERIFY(stalled.connect(QHostAddress::LocalHost, port));
+        Coroutine::msleep(100);  // the stalled one takes the only slot.
+        timer.start();
+        QVERIFY(echo(port));
+        QVERIFY(timer.elapsed() >= 500);
+    }
+
+    server.setMaxConcurrentHandshakes(2);
+    {
+        Socket stalled;
+        QVERIFY(stalled.connect(QHostAddress::LocalHost, port));
+        Coroutine::msleep(100);
+        timer.start();
+        QVERIFY(echo(port));
+        QVERIFY(timer.elapsed() < 500);
+    }
+    server.stop();
+}
+
+
+// the ssl sockets over plain sockets read and write tls records on the socket directly.
+static bool sslPair(QSharedPointer<SslSocket> *server, QSharedPointer<SslSocket> *client)
+{
+    Socket listener;
+    if (!listener.bind(QHostAddress::LocalHost, 0) || !listener.listen(1)) {
+        return false;
+    }
+    QSharedPointer<Socket> rawClient(new Socket());
+    if (!rawClient->connect(QHostAddress::LocalHost, listener.localPort())) {
+        return false;
+    }
+    QSharedPointer<Socket> rawServer(listener.accept());
+    if (rawServer.isNull()) {
+        return false;
+    }
+    QSharedPointer<SslSocket> s(new SslSocket(rawServer, SslConfiguration::testPurpose("Goldfish", "CN", "Example")));
+    QSharedPointer<SslSocket> c(new SslSocket(rawClient));
+    QSharedPointer<bool> serverOk(new bool(false));
+    QSharedPointer<Coroutine> handshaking(Coroutine::spawn([s, serverOk] {
+        *serverOk = s->handshake(true);
+    }));
+    bool clientOk = c->handshake(false);
+    handshaking->join();
+    if (!clientOk || !*serverOk) {
+        return false;
+    }
+    *server = s;
+    *client = c;
+    return true;
+}
+
+
+// many records in both directions at the same time.
+void TestSsl::testDirectRecords()
+{
+    Timeout _(10.0);
+    QSharedPointer<SslSocket> server, client;
+    QVERIFY(sslPair(&server, &client));
+    const QByteArray &up = randomBytes(1024 * 1024 + 7);
+    const QByteArray &down = randomBytes(1024 * 1024 + 13);
+    CoroutineGroup operations;
+    operations.spawn([client, up] {
+        client->sendall(up);
+    });
+    operations.spawn([server, down] {
+        server->sendall(down);
+    });
+    QSharedPointer<QByteArray> received(new QByteArray());
+    operations.spawn([server, up, received] {
+        *received = server->recvall(up.size());
+    });
+    QCOMPARE(client->recvall(down.size()), down);
+    operations.joinall();
+    QCOMPARE(*received, up);
+
+    // small records still work after the large ones.
+    QCOMPARE(client->sendall("fish is here."), 13);
+    QCOMPARE(server->recvall(13), QByteArray("fish is here."));
+}
+
+
+void TestSsl::testDirectPartialWrite()
+{
+    Timeout _(10.0);
+    QSharedPointer<SslSocket> server, client;
+    QVERIFY(sslPair(&server, &client));
+
+    // the receiver is slow, so the pending records fill up the socket buffer and are sent in many flushes.
+    const QByteArray &data = randomBytes(1024 * 1024 * 4);
+    QSharedPointer<QByteArray> received(new QByteArray());
+    QSharedPointer<Coroutine> receiving(Coroutine::spawn([server, received, data] {
+        Coroutine::msleep(200);
+        *received = server->recvall(data.size());
+    }));
+    qint32 total = 0;
+    while (total < data.size()) {
+        qint32 sent = client->send(data.constData() + total, data.size() - total);
+        QVERIFY(sent > 0);
+        QVERIFY(sent <= data.size() - total);
+        total += sent;
+    }
+    receiving->join();
+    QCOMPARE(*received, data);
+
+    // the peer closes in the middle, so only a part is sent.
+    QSharedPointer<Coroutine> closing(Coroutine::spawn([server] {
+        server->recvall(1024 * 64);
+        server->close();
+    }));
+    const QByteArray &large = QByteArray(1024 * 1024 * 32, 'x');  // larger than the socket buffers.
+    qint32 sent = client->sendall(large);
+    QVERIFY(sent < large.size());
+    closing->join();
+}
+
+
+static bool connectedPair(QSharedPointer<SocketLike> *left, QSharedPointer<SocketLike> *right)
+{
+    Socket server;
+    if (!server.bind(QHostAddress::LocalHost, 0) || !server.listen(1)) {
+        return false;
+    }
+    QSharedPointer<Socket> client(new Socket());
+    if (!client->connect(QHostAddress::LocalHost, server.localPort())) {
+        return false;
+    }
+    QSharedPointer<Socket> request(server.accept());
+    if (request.isNull()) {
+        return false;
+    }
+    *left = asSocketLike(client);
+    *right = asSocketLike(request);
+    return true;
+}
+
+
+void TestSsl::testAeadEncrypted()
+{
+    QSharedPointer<SocketLike> left, right;
+    QVERIFY(connectedPair(&left, &right));
+    const QByteArray &key = randomBytes(32);
+    // rekey after every 1000 bytes to test the key renewal.
+    QSharedPointer<SocketLike> sender = encrypted(Cipher::ChaCha20Poly1305, key, left, 1000);
+    QSharedPointer<SocketLike> receiver = encrypted(Cipher::ChaCha20Poly1305, key, right, 1000);
+    QVERIFY(!sender.isNull() && !receiver.isNull());
+    QVERIFY(encrypted(Cipher::Blowfish, key, left).isNull());
+
+    const QByteArray &data = randomBytes(1024 * 100);
+    QSharedPointer<Coroutine> sending(Coroutine::spawn([sender, data] {
+        sender->sendall(data);
+        sender->sendall("fish is here.");
+    }));
+    QCOMPARE(receiver->recvall(data.size()), data);
+    QCOMPARE(receiver->recv(3), QByteArray("fis"));
+    QCOMPARE(receiver->recvall(10), QByteArray("h is here."));
+    sending->join();
+
+    // a modified record closes the connection.
+    QSharedPointer<SocketLike> left2, right2;
+    QVERIFY(connectedPair(&left2, &right2));
+    QSharedPointer<SocketLike> receiver2 = encrypted(Cipher::AES256, key, right2);
+    QByteArray forged = randomBytes(32);
+    forged.append("\x00\x05", 2);
+    forged.append(randomBytes(5 + 16));
+    left2->sendall(forged);
+    QVERIFY(receiver2->recv(1024).isEmpty());
+}
+
+
+void TestSsl::benchmarkEncrypted_data()
+{
+    QTest::addColumn<int>("algorithm");
+    QTest::addColumn<bool>("aead");
+    QTest::newRow("AES256-CFB") << static_cast<int>(Cipher::AES256) << false;
+    QTest::newRow("AES128-GCM") << static_cast<int>(Cipher::AES128) << true;
+    QTest::newRow("AES256-GCM") << static_cast<int>(Cipher::AES256) << true;
+    QTest::newRow("ChaCha20-Poly1305") << static_cast<int>(Cipher::ChaCha20Poly1305) << true;
+}
+
+
+void TestSsl::benchmarkEncrypted()
+{
+    QFETCH(int, algorithm);
+    QFETCH(bool, aead);
+    QSharedPointer<SocketLike> left, right;
+    QVERIFY(connectedPair(&left, &right));
+    const QByteArray &key = randomBytes(32);
+    QSharedPointer<SocketLike> sender, receiver;
+    if (aead) {
+        sender = encrypted(static_cast<Cipher::Algorithm>(algorithm), key, left);
+        receiver = encrypted(static_cast<Cipher::Algorithm>(algorithm), key, right);
+    } else {
+        QSharedPointer<Cipher> cipher(new Cipher(static_cast<Cipher::Algorithm>(algorithm), Cipher::CFB, Cipher::Encrypt));
+        cipher->setPassword(key, "3.1415926535", MessageDigest::Sha256, 1000);
+        sender = encrypted(cipher, left);
+        receiver = encrypted(cipher, right);
+    }
+    const QByteArray &block = randomBytes(1024 * 64);
+    const int blocks = 256;  // 16M bytes.
+    QByteArray buf(block.size(), Qt::Uninitialized);
+    QBENCHMARK {
+        QSharedPointer<Coroutine> sending(Coroutine::spawn([sender, block] {
+            for (int i = 0; i < blocks; ++i) {
+                sender->sendall(block);
+            }
+        }));
+        for (int i = 0; i < blocks; ++i) {
+            QCOMPARE(receiver->recvall(buf.data(), buf.size()), buf.size());
+        }
+        sending->join();
+    }
+}
+
+
 QTEST_MAIN(TestSsl)
 
 #include "test_ssl.moc"